@@ -72,6 +72,13 @@ class ElfReader {
    * 3. Try read gnu_debugdata(lZMA compressed ELF) from ELF, then linear lookup symtab
    */
   void *LookupSymbol(const char *symbol, ElfW(Addr) load_base, bool only_dynsym = false);
+  /**
+   * LookupSymbol for several symbols at once: symtab is scanned once for all symbols missing
+   * from dynsym and gnu_debugdata is decompressed at most once. addresses[i] is nullptr if
+   * symbols[i] was not found, returns the number found.
+   */
+  size_t LookupSymbols(const char *const *symbols, size_t count, ElfW(Addr) load_base,
+                       void **addresses, bool only_dynsym = false);
   ~ElfReader() = default;
 
  private:
@@ -30,6 +30,7 @@
 #include <unistd.h>
 
 #include <string>
+#include <vector>
 
 namespace kwai {
 namespace linker {
@@ -132,40 +133,78 @@ void *ElfReader::LookupSymbol(const char *symbol, ElfW(Addr) load_base,
   if (!symbol) {
     return nullptr;
   }
+  void *address = nullptr;
+  LookupSymbols(&symbol, 1, load_base, &address, only_dynsym);
+  return address;
+}
 
-  // First lookup from dynsym using hash
-  ElfW(Addr) sym_vaddr =
-      has_gnu_hash_ ? LookupByGnuHash(symbol) : LookupByElfHash(symbol);
-  if (sym_vaddr != 0) {
-    return reinterpret_cast<void *>(load_base + sym_vaddr);
+size_t ElfReader::LookupSymbols(const char *const *symbols, size_t count,
+                                ElfW(Addr) load_base, void **addresses,
+                                bool only_dynsym) {
+  size_t found = 0;
+  for (size_t i = 0; i < count; i++) {
+    addresses[i] = nullptr;
+    if (!symbols[i]) {
+      continue;
+    }
+    // First lookup from dynsym using hash
+    ElfW(Addr) sym_vaddr = has_gnu_hash_ ? LookupByGnuHash(symbols[i])
+                                         : LookupByElfHash(symbols[i]);
+    if (sym_vaddr != 0) {
+      addresses[i] = reinterpret_cast<void *>(load_base + sym_vaddr);
+      found++;
+    }
   }
 
-  if (only_dynsym) {
-    return nullptr;
+  if (only_dynsym || found == count) {
+    return found;
   }
 
-  // Try lookup from symtab
-  for (int index = 0; index < symtab_ent_count_; index++) {
+  // Try lookup from symtab, one pass for all missing symbols
+  for (int index = 0; index < symtab_ent_count_ && found < count; index++) {
     // Only care functions and objects
     if (ELF_ST_TYPE(symtab_[index].st_info) != STT_FUNC &&
         ELF_ST_TYPE(symtab_[index].st_info) != STT_OBJECT) {
       continue;
     }
 
-    if (!strcmp(strtab_ + symtab_[index].st_name, symbol)) {
-      return reinterpret_cast<void *>(load_base + symtab_[index].st_value);
+    const char *name = strtab_ + symtab_[index].st_name;
+    for (size_t i = 0; i < count; i++) {
+      if (!addresses[i] && symbols[i] && !strcmp(name, symbols[i])) {
+        addresses[i] =
+            reinterpret_cast<void *>(load_base + symtab_[index].st_value);
+        found++;
+        break;
+      }
     }
   }
 
-  // Try lookup from compressed gnu_debugdata
+  if (found == count) {
+    return found;
+  }
+
+  // Try lookup from compressed gnu_debugdata, decompressed once
   std::string decompressed_data;
   if (DecGnuDebugdata(decompressed_data)) {
     ElfReader elf_reader(std::make_shared<MemoryElfWrapper>(decompressed_data));
     if (elf_reader.Init()) {
-      return elf_reader.LookupSymbol(symbol, load_base);
+      std::vector<size_t> missing;
+      std::vector<const char *> missing_symbols;
+      for (size_t i = 0; i < count; i++) {
+        if (!addresses[i] && symbols[i]) {
+          missing.push_back(i);
+          missing_symbols.push_back(symbols[i]);
+        }
+      }
+      std::vector<void *> missing_addresses(missing.size());
+      found += elf_reader.LookupSymbols(missing_symbols.data(), missing.size(),
+                                        load_base, missing_addresses.data());
+      for (size_t i = 0; i < missing.size(); i++) {
+        addresses[missing[i]] = missing_addresses[i];
+      }
     }
   }
-  return nullptr;
+  return found;
 }
 
 template <class T>
@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2025. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by wangzefeng <wangzefeng@kuaishou.com> on 2025.
+ *
+ */
+
+#include "dump_scheduler.h"
+
+#include <android/log.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#undef LOG_TAG
+#define LOG_TAG "DumpScheduler"
+
+namespace kwai {
+namespace leak_monitor {
+
+static const char *const kDecisionNames[] = {
+    "started",    "queued",    "superseded", "session budget", "day budget",
+    "no growth",  "low disk",  "low ram",    "succeeded",      "failed"};
+
+static uint64_t RealtimeMs() {
+  struct timespec ts {};
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Available bytes of the file system holding path, UINT64_MAX if unknown
+static uint64_t FreeDiskBytes(const std::string &path) {
+  size_t slash = path.rfind('/');
+  std::string dir = slash == std::string::npos ? "."
+                    : slash == 0                ? "/"
+                                                : path.substr(0, slash);
+  struct statfs fs {};
+  if (statfs(dir.c_str(), &fs) != 0) {
+    __android_log_print(ANDROID_LOG_WARN, LOG_TAG, "statfs %s: %s",
+                        dir.c_str(), strerror(errno));
+    return UINT64_MAX;
+  }
+  return static_cast<uint64_t>(fs.f_bavail) * fs.f_bsize;
+}
+
+// MemAvailable, UINT64_MAX if unknown. One read() of the first lines, no
+// stdio, it sits near the top of the file.
+static uint64_t FreeRamBytes() {
+  int fd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return UINT64_MAX;
+  }
+  char buf[512];
+  ssize_t len = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (len <= 0) {
+    return UINT64_MAX;
+  }
+  buf[len] = '\0';
+  const char *line = strstr(buf, "MemAvailable:");
+  unsigned long long kb;
+  if (line == nullptr || sscanf(line, "MemAvailable: %llu kB", &kb) != 1) {
+    return UINT64_MAX;
+  }
+  return static_cast<uint64_t>(kb) * 1024;
+}
+
+DumpScheduler::DumpScheduler()
+    : policy_(),
+      runner_(nullptr),
+      runner_arg_(nullptr),
+      has_thread_(false),
+      running_(false),
+      has_pending_(false),
+      session_dumps_(0),
+      day_(0),
+      day_dumps_(0),
+      last_heap_bytes_(0),
+      ring_(),
+      ring_next_(0),
+      ring_count_(0) {
+  pthread_mutex_init(&mutex_, nullptr);
+  pthread_cond_init(&cond_, nullptr);
+}
+
+void DumpScheduler::Configure(const DumpSchedulerPolicy &policy) {
+  pthread_mutex_lock(&mutex_);
+  policy_ = policy;
+  pthread_mutex_unlock(&mutex_);
+}
+
+void DumpScheduler::SetStateFile(const char *path) {
+  pthread_mutex_lock(&mutex_);
+  if (state_file_ != path) {
+    state_file_ = path;
+    // Reloaded by the next Admit()
+    day_ = 0;
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+void DumpScheduler::SetRunner(DumpRunner runner, void *arg) {
+  pthread_mutex_lock(&mutex_);
+  runner_ = runner;
+  runner_arg_ = arg;
+  pthread_mutex_unlock(&mutex_);
+}
+
+// Count of day in the state file, false if it holds none for that day
+static bool ReadDayCount(int fd, uint32_t day, uint32_t *dumps) {
+  char buf[32];
+  ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+  if (len <= 0) {
+    return false;
+  }
+  buf[len] = '\0';
+  unsigned stored_day, stored_dumps;
+  if (sscanf(buf, "%u %u", &stored_day, &stored_dumps) != 2 ||
+      stored_day != day) {
+    return false;
+  }
+  *dumps = stored_dumps;
+  return true;
+}
+
+// Refreshes the count of the day from the state file, other processes of the
+// app may have dumped since
+void DumpScheduler::LoadDayCount(uint32_t day) {
+  if (day != day_) {
+    day_ = day;
+    day_dumps_ = 0;
+  }
+  if (state_file_.empty()) {
+    return;
+  }
+  int fd = open(state_file_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  // Shared lock, a writer truncates before it writes
+  flock(fd, LOCK_SH);
+  ReadDayCount(fd, day, &day_dumps_);
+  flock(fd, LOCK_UN);
+  close(fd);
+}
+
+// Read, check and increment under one exclusive lock, so that processes
+// starting at the same time cannot both take the last dump of the day
+bool DumpScheduler::CountDayDump() {
+  int fd = state_file_.empty()
+               ? -1
+               : open(state_file_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    if (!state_file_.empty()) {
+      __android_log_print(ANDROID_LOG_WARN, LOG_TAG, "open %s: %s",
+                          state_file_.c_str(), strerror(errno));
+    }
+    if (policy_.day_budget != 0 && day_dumps_ >= policy_.day_budget) {
+      return false;
+    }
+    day_dumps_++;
+    return true;
+  }
+  while (flock(fd, LOCK_EX) != 0 && errno == EINTR) {
+  }
+  uint32_t dumps = 0;
+  bool counted = false;
+  if (ReadDayCount(fd, day_, &dumps)) {
+    day_dumps_ = dumps;
+  }
+  if (policy_.day_budget == 0 || day_dumps_ < policy_.day_budget) {
+    day_dumps_++;
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%u %u\n", day_, day_dumps_);
+    if (ftruncate(fd, 0) != 0 || pwrite(fd, buf, len, 0) != len) {
+      __android_log_print(ANDROID_LOG_WARN, LOG_TAG, "write %s: %s",
+                          state_file_.c_str(), strerror(errno));
+    }
+    counted = true;
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+  return counted;
+}
+
+DumpDecision DumpScheduler::Admit(const Request &request) {
+  LoadDayCount(static_cast<uint32_t>(time(nullptr) / (24 * 60 * 60)));
+  if (policy_.session_budget != 0 &&
+      session_dumps_ >= policy_.session_budget) {
+    return kDumpRefusedSessionBudget;
+  }
+  if (policy_.day_budget != 0 && day_dumps_ >= policy_.day_budget) {
+    return kDumpRefusedDayBudget;
+  }
+  if (session_dumps_ != 0 &&
+      request.heap_bytes < last_heap_bytes_ + policy_.min_growth_bytes) {
+    return kDumpRefusedNoGrowth;
+  }
+  if (policy_.min_free_disk_bytes != 0 &&
+      FreeDiskBytes(request.path) < policy_.min_free_disk_bytes) {
+    return kDumpRefusedLowDisk;
+  }
+  if (policy_.min_free_ram_bytes != 0 &&
+      FreeRamBytes() < policy_.min_free_ram_bytes) {
+    return kDumpRefusedLowRam;
+  }
+  return kDumpStarted;
+}
+
+bool DumpScheduler::Start(const Request &request) {
+  if (!CountDayDump()) {
+    Record(request, kDumpRefusedDayBudget);
+    return false;
+  }
+  session_dumps_++;
+  last_heap_bytes_ = request.heap_bytes;
+  Record(request, kDumpStarted);
+  return true;
+}
+
+void DumpScheduler::Record(const Request &request, DumpDecision decision) {
+  ring_[ring_next_] = {RealtimeMs(), request.trigger, decision,
+                       request.heap_bytes};
+  ring_next_ = (ring_next_ + 1) % kDecisionRingSize;
+  if (ring_count_ < kDecisionRingSize) {
+    ring_count_++;
+  }
+  __android_log_print(ANDROID_LOG_INFO, LOG_TAG,
+                      "trigger %d heap %" PRIu64 " KB: %s, %u this session, "
+                      "%u today",
+                      request.trigger, request.heap_bytes / 1024,
+                      kDecisionNames[decision], session_dumps_, day_dumps_);
+}
+
+DumpDecision DumpScheduler::Submit(int32_t trigger, uint64_t heap_bytes,
+                                   const char *path) {
+  Request request{trigger, heap_bytes, path, false};
+  pthread_mutex_lock(&mutex_);
+  DumpDecision decision = runner_ != nullptr ? Admit(request) : kDumpFailed;
+  if (decision != kDumpStarted) {
+    Record(request, decision);
+  } else if (running_) {
+    if (has_pending_) {
+      Record(pending_, kDumpSuperseded);
+    }
+    pending_ = request;
+    has_pending_ = true;
+    decision = kDumpQueued;
+    Record(request, decision);
+  } else {
+    if (!has_thread_) {
+      pthread_t thread;
+      has_thread_ = pthread_create(&thread, nullptr, Loop, this) == 0;
+      if (has_thread_) {
+        pthread_detach(thread);
+      }
+    }
+    if (!has_thread_) {
+      decision = kDumpFailed;
+      Record(request, decision);
+    } else if (!Start(request)) {
+      decision = kDumpRefusedDayBudget;
+    } else {
+      request.admitted = true;
+      pending_ = request;
+      has_pending_ = true;
+      running_ = true;
+      pthread_cond_signal(&cond_);
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+  return decision;
+}
+
+void *DumpScheduler::Loop(void *arg) {
+  auto scheduler = static_cast<DumpScheduler *>(arg);
+  pthread_setname_np(pthread_self(), "koom-dump-sched");
+  pthread_mutex_lock(&scheduler->mutex_);
+  for (;;) {
+    while (!scheduler->has_pending_) {
+      scheduler->running_ = false;
+      pthread_cond_wait(&scheduler->cond_, &scheduler->mutex_);
+    }
+    Request request = scheduler->pending_;
+    scheduler->has_pending_ = false;
+    if (!request.admitted) {
+      // Queued behind a dump that may have used up the budget or the disk
+      DumpDecision decision = scheduler->Admit(request);
+      if (decision != kDumpStarted) {
+        scheduler->Record(request, decision);
+        continue;
+      }
+      if (!scheduler->Start(request)) {
+        continue;
+      }
+    }
+    DumpRunner runner = scheduler->runner_;
+    void *runner_arg = scheduler->runner_arg_;
+    pthread_mutex_unlock(&scheduler->mutex_);
+    bool success = runner(runner_arg, request.path.c_str());
+    pthread_mutex_lock(&scheduler->mutex_);
+    scheduler->Record(request, success ? kDumpSucceeded : kDumpFailed);
+  }
+  return nullptr;
+}
+
+size_t DumpScheduler::Decisions(DumpDecisionRecord *out, size_t max) const {
+  pthread_mutex_lock(&mutex_);
+  size_t count = ring_count_ < max ? ring_count_ : max;
+  // The newest count records, oldest first
+  size_t first = (ring_next_ + kDecisionRingSize - count) % kDecisionRingSize;
+  for (size_t i = 0; i < count; i++) {
+    out[i] = ring_[(first + i) % kDecisionRingSize];
+  }
+  pthread_mutex_unlock(&mutex_);
+  return count;
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2025. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by wangzefeng <wangzefeng@kuaishou.com> on 2025.
+ *
+ */
+
+#include "dump_stats.h"
+
+#include <android/log.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#undef LOG_TAG
+#define LOG_TAG "DumpStats"
+
+namespace kwai {
+namespace leak_monitor {
+
+static constexpr useconds_t kSampleIntervalUs = 100 * 1000;
+
+// State of the sampler, only exists in the child
+static pthread_t sampler_thread;
+static clockid_t dump_cpu_clock;
+static std::atomic<bool> sampler_stop;
+static uint64_t base_write_chars;
+static pid_t parent_pid;
+
+uint64_t DumpClockNs() {
+  struct timespec ts {};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+DumpProgress *CreateDumpProgress() {
+  void *page = mmap(nullptr, sizeof(DumpProgress), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (page == MAP_FAILED) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "mmap failed: %s",
+                        strerror(errno));
+    return nullptr;
+  }
+  return new (page) DumpProgress{};
+}
+
+static uint64_t ReadWriteChars() {
+  FILE *io = fopen("/proc/self/io", "re");
+  if (io == nullptr) {
+    return 0;
+  }
+  unsigned long long wchar = 0;
+  char line[64];
+  while (fgets(line, sizeof(line), io) != nullptr) {
+    if (sscanf(line, "wchar: %llu", &wchar) == 1) {
+      break;
+    }
+  }
+  fclose(io);
+  return wchar;
+}
+
+static void Sample(DumpProgress *progress) {
+  struct timespec ts {};
+  clock_gettime(dump_cpu_clock, &ts);
+  uint64_t cpu_ns = static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL +
+                    ts.tv_nsec;
+  uint64_t bytes = ReadWriteChars() - base_write_chars;
+  if (bytes != progress->bytes_written.load(std::memory_order_relaxed) ||
+      cpu_ns != progress->cpu_ns.load(std::memory_order_relaxed)) {
+    progress->last_progress_ns.store(DumpClockNs(), std::memory_order_relaxed);
+  }
+  progress->bytes_written.store(bytes, std::memory_order_relaxed);
+  progress->cpu_ns.store(cpu_ns, std::memory_order_relaxed);
+}
+
+static void *SamplerLoop(void *arg) {
+  auto *progress = static_cast<DumpProgress *>(arg);
+  while (!sampler_stop.load(std::memory_order_relaxed)) {
+    usleep(kSampleIntervalUs);
+    Sample(progress);
+    // Nobody is left to watch or reap us
+    if (getppid() != parent_pid) {
+      _exit(1);
+    }
+  }
+  return nullptr;
+}
+
+void BeginChildDump(DumpProgress *progress, pid_t parent) {
+  if (progress == nullptr) {
+    return;
+  }
+  uint64_t now = DumpClockNs();
+  progress->pid.store(getpid(), std::memory_order_relaxed);
+  progress->dump_start_ns.store(now, std::memory_order_relaxed);
+  progress->dump_end_ns.store(0, std::memory_order_relaxed);
+  base_write_chars = ReadWriteChars();
+  progress->bytes_written.store(0, std::memory_order_relaxed);
+  progress->cpu_ns.store(0, std::memory_order_relaxed);
+  progress->last_progress_ns.store(now, std::memory_order_relaxed);
+  progress->phase.store(kDumpPhaseDumping, std::memory_order_release);
+
+  // Taken before the fork, the parent may already be gone
+  parent_pid = parent;
+  // The forked child only has this thread, the sampler is the second one
+  sampler_stop.store(false);
+  if (pthread_getcpuclockid(pthread_self(), &dump_cpu_clock) != 0) {
+    dump_cpu_clock = CLOCK_PROCESS_CPUTIME_ID;
+  }
+  if (pthread_create(&sampler_thread, nullptr, SamplerLoop, progress) != 0) {
+    sampler_thread = 0;
+  }
+}
+
+void EndChildDump(DumpProgress *progress) {
+  if (progress == nullptr) {
+    return;
+  }
+  if (sampler_thread != 0) {
+    sampler_stop.store(true);
+    pthread_join(sampler_thread, nullptr);
+    sampler_thread = 0;
+  }
+  Sample(progress);
+  progress->dump_end_ns.store(DumpClockNs(), std::memory_order_relaxed);
+  progress->phase.store(kDumpPhaseDone, std::memory_order_release);
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2025. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by wangzefeng <wangzefeng@kuaishou.com> on 2025.
+ *
+ */
+
+#include "dump_throttle.h"
+
+#include <android/log.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "dump_stats.h"
+
+#undef LOG_TAG
+#define LOG_TAG "DumpThrottle"
+
+namespace kwai {
+namespace leak_monitor {
+
+// From linux/ioprio.h, not exported by every NDK
+static constexpr int kIoprioClassShift = 13;
+static constexpr int kIoprioClassIdle = 3;
+static constexpr int kIoprioWhoProcess = 1;
+
+static long ReadCpuValue(int cpu, const char *name) {
+  char path[96];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, name);
+  FILE *file = fopen(path, "re");
+  if (file == nullptr) {
+    return -1;
+  }
+  long value = -1;
+  if (fscanf(file, "%ld", &value) != 1) {
+    value = -1;
+  }
+  fclose(file);
+  return value;
+}
+
+bool LittleCoreMask(cpu_set_t *mask) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return false;
+  }
+  // cpu_capacity is what the scheduler itself uses, not every kernel has it
+  const char *const kSources[] = {"cpu_capacity", "cpufreq/cpuinfo_max_freq"};
+  for (const char *source : kSources) {
+    long lowest = -1;
+    long highest = -1;
+    long values[CPU_SETSIZE];
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      values[cpu] = CPU_ISSET(cpu, &allowed) ? ReadCpuValue(cpu, source) : -1;
+      if (values[cpu] < 0) {
+        continue;
+      }
+      lowest = lowest < 0 ? values[cpu] : std::min(lowest, values[cpu]);
+      highest = std::max(highest, values[cpu]);
+    }
+    if (lowest < 0) {
+      continue;
+    }
+    if (lowest == highest) {
+      return false;
+    }
+    CPU_ZERO(mask);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (values[cpu] == lowest) {
+        CPU_SET(cpu, mask);
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+void ApplyDumpChildPolicy(const DumpChildPolicy &policy) {
+  cpu_set_t little;
+  if (policy.little_cores && LittleCoreMask(&little) &&
+      sched_setaffinity(0, sizeof(little), &little) != 0) {
+    __android_log_print(ANDROID_LOG_WARN, LOG_TAG, "affinity failed: %s",
+                        strerror(errno));
+  }
+  if (policy.nice != 0 && setpriority(PRIO_PROCESS, 0, policy.nice) != 0) {
+    __android_log_print(ANDROID_LOG_WARN, LOG_TAG, "nice %d failed: %s",
+                        policy.nice, strerror(errno));
+  }
+  struct sched_param param = {};
+  if (policy.idle_cpu && sched_setscheduler(0, SCHED_IDLE, &param) != 0) {
+    __android_log_print(ANDROID_LOG_WARN, LOG_TAG, "SCHED_IDLE failed: %s",
+                        strerror(errno));
+  }
+  if (policy.idle_io &&
+      syscall(SYS_ioprio_set, kIoprioWhoProcess, 0,
+              kIoprioClassIdle << kIoprioClassShift) != 0) {
+    __android_log_print(ANDROID_LOG_WARN, LOG_TAG, "ioprio failed: %s",
+                        strerror(errno));
+  }
+}
+
+TokenBucket::TokenBucket(uint64_t bytes_per_second, uint64_t burst_bytes)
+    : rate_(static_cast<double>(bytes_per_second)),
+      burst_(static_cast<double>(burst_bytes)),
+      tokens_(static_cast<double>(burst_bytes)),
+      last_ns_(DumpClockNs()),
+      throttled_ns_(0) {}
+
+void TokenBucket::Acquire(size_t bytes) {
+  uint64_t now = DumpClockNs();
+  tokens_ = std::min(burst_, tokens_ + (now - last_ns_) * rate_ / 1e9);
+  last_ns_ = now;
+  tokens_ -= static_cast<double>(bytes);
+  if (tokens_ >= 0) {
+    return;
+  }
+  // The debt is paid by the refill of the next call, which includes the
+  // time slept here
+  auto sleep_ns = static_cast<uint64_t>(-tokens_ / rate_ * 1e9);
+  struct timespec ts = {static_cast<time_t>(sleep_ns / 1000000000ULL),
+                        static_cast<long>(sleep_ns % 1000000000ULL)};
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+  }
+  throttled_ns_ += sleep_ns;
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2025. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by wangzefeng <wangzefeng@kuaishou.com> on 2025.
+ *
+ */
+
+#include "dump_watchdog.h"
+
+#include <android/log.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef __ANDROID__
+#include <android/api-level.h>
+#endif
+
+#undef LOG_TAG
+#define LOG_TAG "DumpWatchdog"
+
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+
+namespace kwai {
+namespace leak_monitor {
+
+// How often limits are checked, exits are seen at once with a pidfd
+static constexpr int kPidfdTickMs = 200;
+static constexpr int kPollTickMs = 50;
+
+// Unknown syscalls are fatal under the app seccomp filter, pidfd_open is only
+// allowed from Android 12 on
+static int OpenPidfd(pid_t pid) {
+#ifdef __ANDROID__
+  if (android_get_device_api_level() < __ANDROID_API_S__) {
+    return -1;
+  }
+#endif
+  return static_cast<int>(syscall(__NR_pidfd_open, pid, 0));
+}
+
+static const char *const kEndNames[] = {"exited", "idle", "timeout",
+                                        "cancelled", "lost"};
+
+DumpWatchdog::DumpWatchdog()
+    : idle_timeout_ms_(30 * 1000),
+      max_duration_ms_(0),
+      pid_(0),
+      cancelled_(false),
+      wake_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+      progress_(nullptr),
+      callback_(nullptr),
+      callback_arg_(nullptr),
+      thread_(),
+      has_thread_(false),
+      status_(-1),
+      end_(kDumpEndLost) {}
+
+void DumpWatchdog::Configure(uint32_t idle_timeout_ms,
+                             uint32_t max_duration_ms) {
+  idle_timeout_ms_ = idle_timeout_ms;
+  max_duration_ms_ = max_duration_ms;
+}
+
+bool DumpWatchdog::Start(pid_t pid, const DumpProgress *progress,
+                         Callback callback, void *arg) {
+  pid_t expected = 0;
+  if (!pid_.compare_exchange_strong(expected, pid)) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "already watching %d",
+                        expected);
+    return false;
+  }
+  cancelled_.store(false);
+  uint64_t drained;
+  while (read(wake_fd_, &drained, sizeof(drained)) > 0) {
+  }
+  progress_ = progress;
+  callback_ = callback;
+  callback_arg_ = arg;
+  status_ = -1;
+  end_ = kDumpEndLost;
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (callback != nullptr) {
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  }
+  has_thread_ = pthread_create(&thread_, &attr, Run, this) == 0;
+  pthread_attr_destroy(&attr);
+  if (!has_thread_ && callback != nullptr) {
+    // No thread, no asynchronous completion: reap here
+    int status = -1;
+    DumpEnd end = Watch(&status);
+    callback(arg, status, end);
+    pid_.store(0);
+  }
+  return true;
+}
+
+DumpEnd DumpWatchdog::Join(int *status) {
+  if (has_thread_) {
+    pthread_join(thread_, nullptr);
+    has_thread_ = false;
+  } else if (pid_.load() != 0) {
+    end_ = Watch(&status_);
+  }
+  pid_.store(0);
+  *status = status_;
+  return end_;
+}
+
+void DumpWatchdog::Cancel() {
+  if (pid_.load() == 0) {
+    return;
+  }
+  cancelled_.store(true);
+  uint64_t one = 1;
+  write(wake_fd_, &one, sizeof(one));
+}
+
+void *DumpWatchdog::Run(void *arg) {
+  auto watchdog = static_cast<DumpWatchdog *>(arg);
+  pthread_setname_np(pthread_self(), "koom-dump-watch");
+  Callback callback = watchdog->callback_;
+  void *callback_arg = watchdog->callback_arg_;
+  int status = -1;
+  DumpEnd end = watchdog->Watch(&status);
+  if (callback != nullptr) {
+    callback(callback_arg, status, end);
+    watchdog->pid_.store(0);
+  } else {
+    watchdog->status_ = status;
+    watchdog->end_ = end;
+  }
+  return nullptr;
+}
+
+bool DumpWatchdog::Expired(uint64_t start_ns, DumpEnd *end) const {
+  if (cancelled_.load()) {
+    *end = kDumpEndCancelled;
+    return true;
+  }
+  uint64_t now = DumpClockNs();
+  if (max_duration_ms_ != 0 &&
+      now - start_ns > max_duration_ms_ * 1000000ULL) {
+    *end = kDumpEndTimeout;
+    return true;
+  }
+  if (idle_timeout_ms_ != 0) {
+    // Until the child reached DumpHeap the fork itself is the last progress
+    uint64_t last = start_ns;
+    if (progress_ != nullptr &&
+        progress_->phase.load(std::memory_order_acquire) != kDumpPhaseIdle) {
+      uint64_t progressed = progress_->last_progress_ns.load();
+      last = progressed > last ? progressed : last;
+    }
+    if (now > last && now - last > idle_timeout_ms_ * 1000000ULL) {
+      *end = kDumpEndIdle;
+      return true;
+    }
+  }
+  return false;
+}
+
+DumpEnd DumpWatchdog::Watch(int *status) {
+  pid_t pid = pid_.load();
+  uint64_t start_ns = DumpClockNs();
+  int pidfd = OpenPidfd(pid);
+  DumpEnd end = kDumpEndExited;
+  bool exited = false;
+
+  for (;;) {
+    if (pidfd < 0) {
+      pid_t reaped = waitpid(pid, status, WNOHANG);
+      if (reaped == pid) {
+        exited = true;
+        break;
+      }
+      if (reaped < 0 && errno != EINTR) {
+        end = kDumpEndLost;
+        break;
+      }
+    }
+    if (Expired(start_ns, &end)) {
+      __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "kill dump child %d: %s",
+                          pid, kEndNames[end]);
+      kill(pid, SIGKILL);
+      break;
+    }
+    struct pollfd fds[2] = {{wake_fd_, POLLIN, 0}, {pidfd, POLLIN, 0}};
+    int ready = poll(fds, pidfd < 0 ? 1 : 2,
+                     pidfd < 0 ? kPollTickMs : kPidfdTickMs);
+    if (ready > 0 && pidfd >= 0 && (fds[1].revents & POLLIN)) {
+      break;
+    }
+  }
+  if (pidfd >= 0) {
+    close(pidfd);
+  }
+
+  if (!exited && end != kDumpEndLost) {
+    while (waitpid(pid, status, 0) == -1) {
+      if (errno != EINTR) {
+        end = kDumpEndLost;
+        break;
+      }
+    }
+  }
+  if (end == kDumpEndLost) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "waitpid %d failed: %s",
+                        pid, strerror(errno));
+  }
+  return end;
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2025. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by wangzefeng <wangzefeng@kuaishou.com> on 2025.
+ *
+ */
+
+#include "fork_footprint.h"
+
+#include <android/log.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#undef LOG_TAG
+#define LOG_TAG "ForkFootprint"
+
+namespace kwai {
+namespace leak_monitor {
+
+// Mappings the heap dump reads, never excluded
+static const char *const kKeepPrefixes[] = {
+    "[anon:dalvik-", "/dev/ashmem/dalvik-", "/memfd:dalvik-", "[anon:jit-",
+    "/memfd:jit-", "/dev/ashmem/jit-", "[anon:libc_malloc", "[anon:scudo:",
+    "[anon:GWP-ASan", "[heap]", "[stack", "[anon:stack_and_tls",
+    "[anon:thread", "[anon:bionic", "[anon:linker", "[anon:.bss",
+    "[anon:System property", "[vdso]", "[vvar]", "[vectors]",
+};
+
+static const char *const kGraphicsPrefixes[] = {
+    "/dev/kgsl", "/dev/mali", "/dev/dri/", "/dev/ion", "/dev/pvr",
+    "/dev/nvmap", "/dmabuf", "anon_inode:dmabuf", "[anon:gralloc",
+};
+
+template <size_t N>
+static bool StartsWithAny(const char *path, const char *const (&prefixes)[N]) {
+  for (const char *prefix : prefixes) {
+    if (strncmp(path, prefix, strlen(prefix)) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether the VmFlags of a /proc/self/smaps mapping include flag, e.g. "dc"
+// for MADV_DONTFORK
+static bool HasVmFlag(const char *flags, const char *flag) {
+  for (const char *p = strstr(flags, flag); p != nullptr;
+       p = strstr(p + 2, flag)) {
+    if (p[-1] == ' ' && (p[2] == ' ' || p[2] == '\n' || p[2] == '\0')) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool Overlaps(uintptr_t start, uintptr_t end, uintptr_t other_start,
+                     uintptr_t other_end) {
+  return start < other_end && other_start < end;
+}
+
+ForkFootprint::ForkFootprint() : classes_(0), min_anonymous_bytes_(0) {}
+
+void ForkFootprint::Configure(uint32_t classes, size_t min_anonymous_bytes) {
+  classes_ = classes;
+  min_anonymous_bytes_ = min_anonymous_bytes;
+}
+
+void ForkFootprint::RegisterBuffer(const void *addr, size_t size) {
+  // madvise needs whole pages, only the pages inside the buffer are excluded
+  auto page = static_cast<uintptr_t>(getpagesize());
+  auto start = (reinterpret_cast<uintptr_t>(addr) + page - 1) & ~(page - 1);
+  auto end = (reinterpret_cast<uintptr_t>(addr) + size) & ~(page - 1);
+  if (start < end) {
+    own_buffers_.push_back({start, end});
+  }
+}
+
+void ForkFootprint::UnregisterBuffer(const void *addr) {
+  auto page = static_cast<uintptr_t>(getpagesize());
+  auto start = (reinterpret_cast<uintptr_t>(addr) + page - 1) & ~(page - 1);
+  for (auto it = own_buffers_.begin(); it != own_buffers_.end(); ++it) {
+    if (it->start == start) {
+      own_buffers_.erase(it);
+      return;
+    }
+  }
+}
+
+uint32_t ForkFootprint::Classify(uintptr_t start, uintptr_t end,
+                                 const char *perms, uint64_t inode,
+                                 const char *path) const {
+  // Guard pages have no page tables to copy
+  if (perms[0] != 'r' || StartsWithAny(path, kKeepPrefixes)) {
+    return 0;
+  }
+  if (StartsWithAny(path, kGraphicsPrefixes)) {
+    return classes_ & kGraphics;
+  }
+  if (strncmp(path, "/dev/ashmem/", 12) == 0 ||
+      strncmp(path, "/memfd:", 7) == 0) {
+    return classes_ & kAshmem;
+  }
+  // Shared anonymous memory like the DumpProgress page ("/dev/zero") is how
+  // the child talks to the parent
+  bool anonymous = inode == 0 && (path[0] == '\0' ||
+                                  strncmp(path, "[anon:", 6) == 0);
+  if (anonymous && perms[3] == 'p' && end - start >= min_anonymous_bytes_) {
+    return classes_ & kLargeAnonymous;
+  }
+  return 0;
+}
+
+size_t ForkFootprint::Exclude() {
+  excluded_.clear();
+  if (classes_ == 0) {
+    return 0;
+  }
+
+  std::vector<Range> candidates;
+  if (classes_ & kOwnBuffers) {
+    candidates = own_buffers_;
+  }
+  // Mappings the app itself marked MADV_DONTFORK, Restore() must not hand
+  // them to its later forks
+  std::vector<Range> dont_fork;
+  // smaps rather than maps for the VmFlags, which follow the other fields of
+  // each mapping
+  FILE *smaps = fopen("/proc/self/smaps", "re");
+  if (smaps == nullptr) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "open smaps failed: %s",
+                        strerror(errno));
+  } else {
+    char line[512];
+    Range mapping = {0, 0};
+    bool candidate = false;
+    while (fgets(line, sizeof(line), smaps) != nullptr) {
+      if (strncmp(line, "VmFlags:", 8) == 0) {
+        if (HasVmFlag(line + 8, "dc")) {
+          dont_fork.push_back(mapping);
+          candidate = false;
+        }
+        continue;
+      }
+      uintptr_t start, end;
+      char perms[5];
+      uint64_t inode;
+      int path_offset = 0;
+      if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR " %4s %*x %*s %" SCNu64 " %n",
+                 &start, &end, perms, &inode, &path_offset) != 4) {
+        continue;
+      }
+      // 上一个映射的 VmFlags 已经读完（老内核没有这一行）
+      if (candidate) candidates.push_back(mapping);
+      char *path = line + path_offset;
+      path[strcspn(path, "\n")] = '\0';
+      mapping = {start, end};
+      candidate = (classes_ & ~kOwnBuffers) != 0 &&
+                  Classify(start, end, perms, inode, path) != 0;
+    }
+    if (candidate) candidates.push_back(mapping);
+    fclose(smaps);
+  }
+
+  size_t bytes = 0;
+  for (const Range &range : candidates) {
+    bool marked = false;
+    for (const Range &mapping : dont_fork) {
+      marked |= Overlaps(range.start, range.end, mapping.start, mapping.end);
+    }
+    if (marked) {
+      continue;
+    }
+    if (madvise(reinterpret_cast<void *>(range.start), range.end - range.start,
+                MADV_DONTFORK) == 0) {
+      excluded_.push_back(range);
+      bytes += range.end - range.start;
+    }
+  }
+  return bytes;
+}
+
+void ForkFootprint::Restore() {
+  for (const Range &range : excluded_) {
+    // EINVAL for VM_IO device mappings, nothing to do about it
+    madvise(reinterpret_cast<void *>(range.start), range.end - range.start,
+            MADV_DOFORK);
+  }
+  excluded_.clear();
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
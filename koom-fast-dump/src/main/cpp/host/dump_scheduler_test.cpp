@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2025. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by wangzefeng <wangzefeng@kuaishou.com> on 2025.
+ *
+ */
+
+// Checks that the day budget of DumpScheduler is shared through its state
+// file: a process that already loaded the count sees the dumps of another
+// one, and processes starting at the same time never take more than the
+// budget together:
+//
+//   dump-scheduler-test
+
+#include <android/log.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "dump_scheduler.h"
+
+using kwai::leak_monitor::DumpDecision;
+using kwai::leak_monitor::DumpDecisionRecord;
+using kwai::leak_monitor::DumpScheduler;
+using kwai::leak_monitor::DumpSchedulerPolicy;
+
+namespace {
+
+constexpr uint32_t kDayBudget = 3;
+constexpr int kRacers = 8;
+
+bool RunDump(void *, const char *) { return true; }
+
+void Setup(DumpScheduler *scheduler, const std::string &state_file) {
+  DumpSchedulerPolicy policy = {};
+  policy.day_budget = kDayBudget;
+  scheduler->Configure(policy);
+  scheduler->SetStateFile(state_file.c_str());
+  scheduler->SetRunner(RunDump, nullptr);
+}
+
+// Submits and waits for the dump thread to finish a started dump, so that
+// the next Submit() is not queued behind it
+DumpDecision SubmitAndWait(DumpScheduler *scheduler) {
+  DumpDecision decision = scheduler->Submit(0, 0, "/tmp/dump.hprof");
+  if (decision != kwai::leak_monitor::kDumpStarted) {
+    return decision;
+  }
+  for (;;) {
+    DumpDecisionRecord last;
+    size_t count = scheduler->Decisions(&last, 1);
+    if (count == 1 && last.decision == kwai::leak_monitor::kDumpSucceeded) {
+      return decision;
+    }
+    usleep(1000);
+  }
+}
+
+// Child processes exit with the number of dumps they started
+int StartedInChild(const std::string &state_file, int dumps, int start_fd) {
+  DumpScheduler scheduler;
+  Setup(&scheduler, state_file);
+  char go;
+  if (start_fd >= 0 && read(start_fd, &go, 1) < 0) {
+    _exit(255);
+  }
+  int started = 0;
+  for (int i = 0; i < dumps; i++) {
+    started += SubmitAndWait(&scheduler) == kwai::leak_monitor::kDumpStarted;
+  }
+  _exit(started);
+}
+
+int Reap(pid_t pid) {
+  int status = 0;
+  if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+    return -1;
+  }
+  return WEXITSTATUS(status);
+}
+
+bool TestStaleCount(const std::string &state_file) {
+  unlink(state_file.c_str());
+  DumpScheduler scheduler;
+  Setup(&scheduler, state_file);
+  // 本进程先读到 1，另一个进程再用掉剩下的预算
+  bool ok = SubmitAndWait(&scheduler) == kwai::leak_monitor::kDumpStarted;
+  pid_t pid = fork();
+  if (pid == 0) StartedInChild(state_file, kDayBudget, -1);
+  ok &= Reap(pid) == (int)kDayBudget - 1;
+  const DumpDecision decision = SubmitAndWait(&scheduler);
+  if (decision != kwai::leak_monitor::kDumpRefusedDayBudget) {
+    fprintf(stderr, "stale count: decision %d after the other process\n",
+            decision);
+    ok = false;
+  }
+  if (ok) printf("stale count: refused after the other process OK\n");
+  return ok;
+}
+
+bool TestRace(const std::string &state_file) {
+  unlink(state_file.c_str());
+  int fds[2];
+  if (pipe(fds) != 0) return false;
+  pid_t pids[kRacers];
+  for (pid_t &pid : pids) {
+    pid = fork();
+    if (pid == 0) {
+      close(fds[1]);
+      StartedInChild(state_file, 2, fds[0]);
+    }
+  }
+  close(fds[0]);
+  // 关掉写端，所有子进程同时从 read 返回
+  close(fds[1]);
+  int started = 0;
+  bool ok = true;
+  for (pid_t pid : pids) {
+    int n = Reap(pid);
+    ok &= n >= 0;
+    started += n;
+  }
+  if (!ok || started != (int)kDayBudget) {
+    fprintf(stderr, "race: %d processes started %d dumps, budget %u\n",
+            kRacers, started, kDayBudget);
+    return false;
+  }
+  printf("race: %d processes started %d dumps OK\n", kRacers, started);
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  koom_host_log_set_min_priority(ANDROID_LOG_WARN);
+  char dir[] = "/tmp/dump-scheduler-XXXXXX";
+  if (mkdtemp(dir) == nullptr) return 1;
+  const std::string state_file = std::string(dir) + "/state";
+  bool ok = TestStaleCount(state_file);
+  ok &= TestRace(state_file);
+  unlink(state_file.c_str());
+  rmdir(dir);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2025. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by wangzefeng <wangzefeng@kuaishou.com> on 2025.
+ *
+ */
+
+// Checks which /proc/self/maps lines ForkFootprint::Classify() lets the dump
+// child keep, and that Exclude() really keeps real mappings out of a fork
+// and Restore() brings them back with their contents, except those the app
+// marked MADV_DONTFORK itself:
+//
+//   fork-footprint-test
+
+#include <android/log.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "fork_footprint.h"
+
+using kwai::leak_monitor::ForkFootprint;
+
+namespace {
+
+constexpr uint32_t kAllClasses =
+    ForkFootprint::kLargeAnonymous | ForkFootprint::kAshmem |
+    ForkFootprint::kGraphics | ForkFootprint::kOwnBuffers;
+constexpr uintptr_t kMapStart = 0x70000000;
+constexpr size_t kMinAnonymous = 1u << 20u;
+
+struct Line {
+  const char *perms;
+  uint64_t inode;
+  const char *path;
+  size_t size;
+  uint32_t expected;
+};
+
+// Mappings the dump needs, all large enough to be excluded otherwise
+const Line kKeptLines[] = {
+    {"rw-p", 0, "[anon:dalvik-main space (region space)]", 256u << 20u, 0},
+    {"rw-p", 0, "[anon:dalvik-LinearAlloc]", 8u << 20u, 0},
+    {"rw-s", 42, "/dev/ashmem/dalvik-zygote space (deleted)", 8u << 20u, 0},
+    {"rw-s", 42, "/memfd:dalvik-data-code-cache (deleted)", 8u << 20u, 0},
+    {"r--p", 0, "[anon:jit-cache]", 8u << 20u, 0},
+    {"rw-s", 42, "/memfd:jit-cache (deleted)", 8u << 20u, 0},
+    {"rw-s", 42, "/dev/ashmem/jit-zygote-cache (deleted)", 8u << 20u, 0},
+    {"rw-p", 0, "[anon:libc_malloc]", 64u << 20u, 0},
+    {"rw-p", 0, "[anon:scudo:primary]", 64u << 20u, 0},
+    {"rw-p", 0, "[anon:GWP-ASan Alive Slot]", 2u << 20u, 0},
+    {"rw-p", 0, "[heap]", 16u << 20u, 0},
+    {"rw-p", 0, "[stack]", 8u << 20u, 0},
+    {"rw-p", 0, "[anon:stack_and_tls:1234]", 2u << 20u, 0},
+    {"rw-p", 0, "[anon:thread signal stack]", 2u << 20u, 0},
+    {"rw-p", 0, "[anon:bionic TLS]", 2u << 20u, 0},
+    {"rw-p", 0, "[anon:linker_alloc]", 2u << 20u, 0},
+    {"rw-p", 0, "[anon:.bss]", 2u << 20u, 0},
+    {"r--p", 0, "[anon:System property context nodes]", 2u << 20u, 0},
+    {"r--p", 0, "[vvar]", 2u << 20u, 0},
+    {"r-xp", 0, "[vdso]", 2u << 20u, 0},
+    {"r-xp", 0, "[vectors]", 2u << 20u, 0},
+    // File backed, the boot image and oat files among them
+    {"r--p", 1234, "/system/framework/arm64/boot.art", 8u << 20u, 0},
+    {"r-xp", 1234, "/data/app/base.odex", 8u << 20u, 0},
+    {"r--p", 1234, "/system/lib64/libc.so", 2u << 20u, 0},
+    // Guard pages, too small or shared anonymous memory
+    {"---p", 0, "", 64u << 20u, 0},
+    {"rw-p", 0, "", kMinAnonymous - 4096, 0},
+    {"rw-s", 7, "/dev/zero (deleted)", 8u << 20u, 0},
+    {"rw-s", 0, "", 8u << 20u, 0},
+};
+
+const Line kExcludedLines[] = {
+    {"rw-p", 0, "", kMinAnonymous, ForkFootprint::kLargeAnonymous},
+    {"rw-p", 0, "[anon:codec buffer]", 32u << 20u,
+     ForkFootprint::kLargeAnonymous},
+    {"r--p", 0, "[anon:Mem_0x10000001]", 4u << 20u,
+     ForkFootprint::kLargeAnonymous},
+    {"rw-s", 42, "/dev/ashmem/CursorWindow (deleted)", 2u << 20u,
+     ForkFootprint::kAshmem},
+    {"rw-s", 42, "/memfd:SurfaceView (deleted)", 4096,
+     ForkFootprint::kAshmem},
+    {"rw-s", 42, "/dev/kgsl-3d0", 4096, ForkFootprint::kGraphics},
+    {"rw-s", 42, "/dev/mali0", 4096, ForkFootprint::kGraphics},
+    {"rw-s", 42, "/dev/dri/renderD128", 4096, ForkFootprint::kGraphics},
+    {"rw-s", 42, "/dmabuf:", 4096, ForkFootprint::kGraphics},
+    {"rw-s", 42, "anon_inode:dmabuf", 4096, ForkFootprint::kGraphics},
+    {"rw-p", 0, "[anon:gralloc-buffer]", 4096, ForkFootprint::kGraphics},
+};
+
+bool CheckLines(const ForkFootprint &footprint, const Line *lines,
+                size_t count, uint32_t classes) {
+  bool ok = true;
+  for (size_t i = 0; i < count; i++) {
+    const Line &line = lines[i];
+    const uint32_t actual =
+        footprint.Classify(kMapStart, kMapStart + line.size, line.perms,
+                           line.inode, line.path);
+    if (actual != (line.expected & classes)) {
+      fprintf(stderr, "classes 0x%x: \"%s\" %s %zu bytes is 0x%x, not 0x%x\n",
+              classes, line.path, line.perms, line.size, actual,
+              line.expected & classes);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool TestClassify() {
+  ForkFootprint footprint;
+  bool ok = true;
+  // 每个类单独打开时只排除它自己的那些
+  for (uint32_t classes : {0u, (uint32_t)ForkFootprint::kLargeAnonymous,
+                           (uint32_t)ForkFootprint::kAshmem,
+                           (uint32_t)ForkFootprint::kGraphics, kAllClasses}) {
+    footprint.Configure(classes, kMinAnonymous);
+    ok &= CheckLines(footprint, kKeptLines,
+                     sizeof(kKeptLines) / sizeof(kKeptLines[0]), classes);
+    ok &= CheckLines(footprint, kExcludedLines,
+                     sizeof(kExcludedLines) / sizeof(kExcludedLines[0]),
+                     classes);
+  }
+  if (ok) {
+    printf("classify: %zu kept, %zu excluded OK\n",
+           sizeof(kKeptLines) / sizeof(kKeptLines[0]),
+           sizeof(kExcludedLines) / sizeof(kExcludedLines[0]));
+  }
+  return ok;
+}
+
+uint8_t Pattern(size_t offset) { return (uint8_t)(offset * 31 + 7); }
+
+// Forks a child that reports whether each page of [addr, addr + size) is
+// mapped in it and, if so, still holds the pattern. Returns a bit per
+// outcome: 1 some page mapped, 2 some page missing, 4 contents differ.
+int ProbeInChild(const uint8_t *addr, size_t size) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    // 子进程只做系统调用和读内存，不碰 malloc
+    const size_t page = (size_t)getpagesize();
+    unsigned char resident;
+    int outcome = 0;
+    for (size_t offset = 0; offset < size; offset += page) {
+      if (mincore(const_cast<uint8_t *>(addr) + offset, page, &resident) !=
+          0) {
+        outcome |= 2;
+        continue;
+      }
+      outcome |= 1;
+      for (size_t i = offset; i < offset + page; i++) {
+        if (addr[i] != Pattern(i)) outcome |= 4;
+      }
+    }
+    _exit(outcome);
+  }
+  int status = 0;
+  if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+    return -1;
+  }
+  return WEXITSTATUS(status);
+}
+
+uint8_t *MapWithPattern(size_t size) {
+  void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) return nullptr;
+  auto *bytes = static_cast<uint8_t *>(map);
+  for (size_t i = 0; i < size; i++) bytes[i] = Pattern(i);
+  return bytes;
+}
+
+bool Expect(const char *name, int outcome, int expected) {
+  if (outcome == expected) return true;
+  fprintf(stderr, "%s: child saw %d, expected %d\n", name, outcome, expected);
+  return false;
+}
+
+bool TestOwnBuffers() {
+  const size_t page = (size_t)getpagesize();
+  const size_t size = 64 * page;
+  uint8_t *map = MapWithPattern(size);
+  if (map == nullptr) return false;
+  // 不按页对齐的 buffer 只排除里面的整页
+  ForkFootprint footprint;
+  footprint.Configure(ForkFootprint::kOwnBuffers, 0);
+  footprint.RegisterBuffer(map + page / 2, size - page);
+  bool ok = Expect("own buffers before", ProbeInChild(map, size), 1);
+  const size_t excluded = footprint.Exclude();
+  ok &= excluded == size - 2 * page;
+  ok &= Expect("own buffers first page", ProbeInChild(map, page), 1);
+  ok &= Expect("own buffers excluded",
+               ProbeInChild(map + page, size - 2 * page), 2);
+  ok &= Expect("own buffers last page",
+               ProbeInChild(map + size - page, page), 1);
+  footprint.Restore();
+  ok &= Expect("own buffers restored", ProbeInChild(map, size), 1);
+
+  footprint.UnregisterBuffer(map + page / 2);
+  ok &= footprint.Exclude() == 0;
+  ok &= Expect("own buffers unregistered", ProbeInChild(map, size), 1);
+  footprint.Restore();
+  munmap(map, size);
+  if (ok) printf("own buffers: %zu bytes excluded and restored OK\n", excluded);
+  return ok;
+}
+
+bool TestLargeAnonymous() {
+  // 比这个进程里其他匿名映射都大，只会排除它
+  const size_t size = 256u << 20u;
+  uint8_t *map = MapWithPattern(size);
+  if (map == nullptr) return false;
+  ForkFootprint footprint;
+  footprint.Configure(ForkFootprint::kLargeAnonymous, size);
+  const size_t excluded = footprint.Exclude();
+  bool ok = excluded >= size;
+  ok &= Expect("large anonymous excluded", ProbeInChild(map, size), 2);
+  footprint.Restore();
+  ok &= Expect("large anonymous restored", ProbeInChild(map, size), 1);
+  // 不配置任何类时什么都不动
+  footprint.Configure(0, size);
+  ok &= footprint.Exclude() == 0;
+  ok &= Expect("disabled", ProbeInChild(map, size), 1);
+  for (size_t i = 0; ok && i < size; i++) ok = map[i] == Pattern(i);
+  munmap(map, size);
+  if (ok) {
+    printf("large anonymous: %zu bytes excluded and restored OK\n", excluded);
+  }
+  return ok;
+}
+
+bool TestAppDontFork() {
+  const size_t size = 256u << 20u;
+  uint8_t *map = MapWithPattern(size);
+  if (map == nullptr) return false;
+  // app 自己标了 DONTFORK 的映射，哪个类都不该再动它
+  bool ok = madvise(map, size, MADV_DONTFORK) == 0;
+  ForkFootprint footprint;
+  footprint.Configure(
+      ForkFootprint::kLargeAnonymous | ForkFootprint::kOwnBuffers, size);
+  footprint.RegisterBuffer(map, size);
+  ok &= footprint.Exclude() == 0;
+  ok &= Expect("app dontfork excluded", ProbeInChild(map, size), 2);
+  footprint.Restore();
+  ok &= Expect("app dontfork after restore", ProbeInChild(map, size), 2);
+  footprint.UnregisterBuffer(map);
+  munmap(map, size);
+  if (ok) printf("app dontfork: left alone OK\n");
+  return ok;
+}
+
+}  // namespace
+
+int main() {
+  koom_host_log_set_min_priority(ANDROID_LOG_WARN);
+  bool ok = TestClassify();
+  ok &= TestOwnBuffers();
+  ok &= TestLargeAnonymous();
+  ok &= TestAppDontFork();
+  return ok ? 0 : 1;
+}
@@ -19,8 +19,17 @@
 
 #include "hprof_dump.h"
 
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <log/log.h>
+
 #include "hprof_dump_impl.h"
 
+#undef LOG_TAG
+#define LOG_TAG "HprofDump"
+
 namespace kwai {
 namespace leak_monitor {
 
@@ -29,10 +38,12 @@ HprofDump &HprofDump::GetInstance() {
   return hprof_dump;
 }
 
-HprofDump::HprofDump() : impl_(HprofDumpImpl::GetInstance(android_get_device_api_level())) {}
+HprofDump::HprofDump() : impl_(HprofDumpImpl::GetInstance(android_get_device_api_level())), init_ns_(0) {}
 
 void HprofDump::Initialize() {
+  uint64_t start = DumpClockNs();
   impl_.Initialize();
+  init_ns_ = DumpClockNs() - start;
 }
 
 pid_t HprofDump::SuspendAndFork() {
@@ -40,15 +51,105 @@ pid_t HprofDump::SuspendAndFork() {
 }
 
 bool HprofDump::Resume() {
-  return impl_.Resume();
+  bool resumed = impl_.ResumeParent();
+  // The caller reaps the child itself
+  impl_.ReleaseFork();
+  return resumed;
 }
 
 bool HprofDump::ResumeAndWait(pid_t pid) {
   return impl_.ResumeAndWait(pid);
 }
 
-void HprofDump::DumpHeap(const char* filename) {
-  return impl_.DumpHeap(filename);
+bool HprofDump::ResumeAndWatch(pid_t pid, DumpCallback callback, void *arg) {
+  impl_.ResumeParent();
+  return impl_.Watch(pid, callback, arg);
+}
+
+void HprofDump::CancelDump() {
+  impl_.Watchdog().Cancel();
+}
+
+DumpWatchdog &HprofDump::Watchdog() {
+  return impl_.Watchdog();
+}
+
+void HprofDump::DumpHeap(const char* filename, int fd) {
+  return impl_.DumpHeapInChild(filename, fd);
+}
+
+DumpStats HprofDump::LastStats() const {
+  DumpStats stats = impl_.LastStats();
+  stats.init_ns = init_ns_;
+  return stats;
+}
+
+const DumpProgress *HprofDump::Progress() const {
+  return impl_.Progress();
+}
+
+ForkFootprint &HprofDump::Footprint() {
+  return impl_.Footprint();
+}
+
+DumpChildPolicy &HprofDump::ChildPolicy() {
+  return impl_.ChildPolicy();
+}
+
+DumpScheduler &HprofDump::Scheduler() {
+  return scheduler_;
+}
+
+bool HprofDump::ForkDumpToStream(const char* path,
+                                 const HprofStreamProcessor* processor,
+                                 int pipe_size) {
+  int file_fd = -1;
+  HprofStreamProcessor file_processor = FileStreamProcessor(&file_fd);
+  if (processor == nullptr) {
+    processor = &file_processor;
+  }
+
+  if (!processor->begin(processor->arg, path)) {
+    return false;
+  }
+  int fds[2];
+  if (!CreateHprofPipe(fds, pipe_size)) {
+    return processor->end(processor->arg, false);
+  }
+
+  pid_t pid = impl_.SuspendAndFork();
+  if (pid == 0) {
+    close(fds[0]);
+    impl_.DumpHeapInChild(path, fds[1]);
+    FastExit(0);
+  }
+  close(fds[1]);
+  if (pid < 0) {
+    close(fds[0]);
+    return processor->end(processor->arg, false);
+  }
+
+  bool resumed = impl_.ResumeParent();
+  // Watched while pumping, a killed child closes the pipe and ends the pump
+  bool watched = impl_.Watch(pid, nullptr, nullptr);
+  HprofStreamStats stats{};
+  uint64_t rate = impl_.ChildPolicy().write_bytes_per_second;
+  // A tenth of a second ahead at most, but at least one full read
+  TokenBucket limiter(rate, std::max<uint64_t>(rate / 10, 1 << 20));
+  bool pumped = PumpHprofStream(fds[0], processor,
+                                rate != 0 ? &limiter : nullptr,
+                                impl_.Progress(), &stats);
+  // Before waiting: if the processor gave up the child must see EPIPE rather
+  // than block on a full pipe
+  close(fds[0]);
+  bool exited = watched && impl_.Wait(pid);
+  ALOGI("stream %llu bytes in %llu reads, processing %llu ms, throttled "
+        "%llu ms",
+        static_cast<unsigned long long>(stats.bytes),
+        static_cast<unsigned long long>(stats.reads),
+        static_cast<unsigned long long>(stats.process_ns / 1000000),
+        static_cast<unsigned long long>(stats.throttled_ns / 1000000));
+  return processor->end(processor->arg, resumed && pumped && exited);
 }
 
 }  // namespace leak_monitor
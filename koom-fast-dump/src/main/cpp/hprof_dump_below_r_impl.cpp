@@ -79,14 +79,14 @@ bool HprofDumpBelowRImpl::Resume() {
   return true;
 }
 
-void HprofDumpBelowRImpl::DumpHeap(const char* filename) {
+void HprofDumpBelowRImpl::DumpHeap(const char* filename, int fd) {
   KCHECKV(init_done_)
   // If "direct_to_ddms" is true, the other arguments are ignored, and data is
   // sent directly to DDMS.
   // If "fd" is >= 0, the output will be written to that file descriptor.
   // Otherwise, "filename" is used to create an output file.
   // DumpHeap(const char* filename, int fd, bool direct_to_ddms)
-  dump_heap_func_(filename, -1, false);
+  dump_heap_func_(filename, fd, false);
 }
 
 } // namespace leak_monitor
@@ -106,6 +106,7 @@ bool HprofDumpBelowVImpl::Suspend() {
 
   void *self = __get_tls()[TLS_SLOT_ART_THREAD_SELF];
   sgc_constructor_fnc_((void *)sgc_instance_.get(), self, kGcCauseHprof, kCollectorTypeHprof);
+  MarkGcCriticalSectionEntered();
   ssa_constructor_fnc_((void *)ssa_instance_.get(), LOG_TAG, true);
   // avoid deadlock with child process
   exclusive_unlock_fnc_(*mutator_lock_ptr_, self);
@@ -124,14 +125,14 @@ bool HprofDumpBelowVImpl::Resume() {
   return true;
 }
 
-void HprofDumpBelowVImpl::DumpHeap(const char* filename) {
+void HprofDumpBelowVImpl::DumpHeap(const char* filename, int fd) {
   KCHECKV(init_done_)
   // If "direct_to_ddms" is true, the other arguments are ignored, and data is
   // sent directly to DDMS.
   // If "fd" is >= 0, the output will be written to that file descriptor.
   // Otherwise, "filename" is used to create an output file.
   // DumpHeap(const char* filename, int fd, bool direct_to_ddms)
-  dump_heap_func_(filename, -1, false);
+  dump_heap_func_(filename, fd, false);
 }
 
 } // namespace leak_monitor
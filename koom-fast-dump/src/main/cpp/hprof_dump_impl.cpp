@@ -23,6 +23,7 @@
 #include <sys/prctl.h>
 #include <sys/wait.h>
 #include <cerrno>
+#include <cstring>
 
 #include <log/kcheck.h>
 
@@ -55,40 +56,145 @@ pid_t HprofDumpImpl::Fork() {
 }
 
 pid_t HprofDumpImpl::SuspendAndFork() {
+  // The stats and the progress page belong to the running dump
+  bool idle = false;
+  if (!forking_.compare_exchange_strong(idle, true)) {
+    ALOGE("Another dump is being started");
+    return -1;
+  }
+  if (watchdog_.Watching()) {
+    ALOGE("A dump child is still running");
+    forking_.store(false);
+    return -1;
+  }
+  if (progress_ == nullptr) {
+    progress_ = CreateDumpProgress();
+  }
+  if (progress_ != nullptr) {
+    progress_->phase.store(kDumpPhaseIdle);
+  }
+  stats_ = {};
+  stats_.exit_status = -1;
+  stats_.end_reason = kDumpEndLost;
+  gc_critical_section_ns_ = 0;
+  resume_end_ns_ = 0;
+
+  // Walking the maps is slow, it must happen before the app is suspended
+  uint64_t exclude_start_ns = DumpClockNs();
+  stats_.excluded_bytes = fork_footprint_.Exclude();
+  suspend_start_ns_ = DumpClockNs();
+  stats_.exclude_ns = suspend_start_ns_ - exclude_start_ns;
   if (!Suspend()) {
+    fork_footprint_.Restore();
+    forking_.store(false);
     return -1;
   }
+  uint64_t suspended_ns = DumpClockNs();
 
+  parent_pid_ = getpid();
   pid_t pid = Fork();
   if (pid == 0) {
-    // Set timeout for child process
-    alarm(60);
+    // No alarm, the parent's DumpWatchdog decides how long the child may take
     prctl(PR_SET_NAME, "forked-dump-process");
+    ApplyDumpChildPolicy(child_policy_);
+    return pid;
+  }
+  fork_footprint_.Restore();
+  if (pid < 0) {
+    // Callers only resume after a successful fork
+    ALOGE("fork failed: %s", strerror(errno));
+    ResumeParent();
+    forking_.store(false);
+    return pid;
+  }
+  stats_.fork_ns = DumpClockNs() - suspended_ns;
+  if (gc_critical_section_ns_ != 0) {
+    stats_.gc_critical_section_ns = gc_critical_section_ns_ - suspend_start_ns_;
+    stats_.suspend_ns = suspended_ns - gc_critical_section_ns_;
+  } else {
+    stats_.suspend_ns = suspended_ns - suspend_start_ns_;
   }
   return pid;
 }
 
+bool HprofDumpImpl::ResumeParent() {
+  uint64_t start = DumpClockNs();
+  bool resumed = Resume();
+  resume_end_ns_ = DumpClockNs();
+  stats_.resume_ns = resume_end_ns_ - start;
+  stats_.pause_ns = resume_end_ns_ - suspend_start_ns_;
+  ALOGI("app paused %llu us: gc critical section %llu us, suspend %llu us, "
+        "fork %llu us (%zu KB excluded), resume %llu us",
+        (unsigned long long)stats_.pause_ns / 1000,
+        (unsigned long long)stats_.gc_critical_section_ns / 1000,
+        (unsigned long long)stats_.suspend_ns / 1000,
+        (unsigned long long)stats_.fork_ns / 1000,
+        (size_t)(stats_.excluded_bytes / 1024),
+        (unsigned long long)stats_.resume_ns / 1000);
+  return resumed;
+}
+
 bool HprofDumpImpl::ResumeAndWait(pid_t pid) {
-  if (!Resume()) {
+  if (!ResumeParent()) {
+    ReleaseFork();
     return false;
   }
+  return Watch(pid, nullptr, nullptr) && Wait(pid);
+}
 
+void HprofDumpImpl::DumpHeapInChild(const char* filename, int fd) {
+  BeginChildDump(progress_, parent_pid_);
+  DumpHeap(filename, fd);
+  EndChildDump(progress_);
+}
+
+bool HprofDumpImpl::Watch(pid_t pid, DumpCallback callback, void *arg) {
+  watched_pid_ = pid;
+  callback_ = callback;
+  callback_arg_ = arg;
+  bool watched = watchdog_.Start(
+      pid, progress_, callback != nullptr ? OnWatchEnd : nullptr, this);
+  forking_.store(false);
+  return watched;
+}
+
+void HprofDumpImpl::OnWatchEnd(void *arg, int status, DumpEnd end) {
+  auto impl = static_cast<HprofDumpImpl *>(arg);
+  bool success = impl->Finish(impl->watched_pid_, status, end);
+  impl->callback_(impl->callback_arg_, success);
+}
+
+bool HprofDumpImpl::Wait(pid_t pid) {
   int status;
-  for (;;) {
-    if (waitpid(pid, &status, 0) != -1) {
-      if (!WIFEXITED(status)) {
-        ALOGE("Child process %d exited with status %d, terminated by signal %d",
-              pid, WEXITSTATUS(status), WTERMSIG(status));
-        return false;
-      }
-      return true;
-    }
-    // 被信号中断调用的话，再发起一次waitpid调用即可
-    if (errno == EINTR){
-      continue;
-    }
+  DumpEnd end = watchdog_.Join(&status);
+  return Finish(pid, status, end);
+}
+
+bool HprofDumpImpl::Finish(pid_t pid, int status, DumpEnd end) {
+  stats_.exit_status = status;
+  stats_.end_reason = end;
+  if (resume_end_ns_ != 0) {
+    stats_.wait_ns = DumpClockNs() - resume_end_ns_;
+  }
+  if (progress_ != nullptr &&
+      progress_->phase.load(std::memory_order_acquire) != kDumpPhaseIdle) {
+    uint64_t dump_end = progress_->dump_end_ns.load();
+    stats_.child_dump_ns = (dump_end != 0 ? dump_end : DumpClockNs()) -
+                           progress_->dump_start_ns.load();
+    stats_.bytes_written = progress_->bytes_written.load();
+  }
+  ALOGI("child %d status %d end %d, dump %llu ms, %llu bytes", pid, status, end,
+        (unsigned long long)stats_.child_dump_ns / 1000000,
+        (unsigned long long)stats_.bytes_written);
+  if (end == kDumpEndLost) {
+    return false;
+  }
+  if (!WIFEXITED(status)) {
+    ALOGE("Child process %d exited with status %d, terminated by signal %d",
+          pid, WEXITSTATUS(status), WTERMSIG(status));
     return false;
   }
+  return end == kDumpEndExited;
 }
 
 } // namespace leak_monitor
@@ -19,15 +19,13 @@
 
 #include "hprof_dump_v_impl.h"
 
-#include <dlfcn.h>
-
-#include <kwai_linker/kwai_dlfcn.h>
 #include <bionic/tls.h>
 #include <log/kcheck.h>
 
 #include <memory>
 
 #include "defines.h"
+#include "symbol_cache.h"
 
 #undef LOG_TAG
 #define LOG_TAG "HprofDumpVImpl"
@@ -35,8 +33,6 @@
 namespace kwai {
 namespace leak_monitor {
 
-using namespace kwai::linker;
-
 HprofDumpVImpl &HprofDumpVImpl::GetInstance() {
   static HprofDumpVImpl instance;
   return instance;
@@ -56,38 +52,38 @@ bool HprofDumpVImpl::Initialize() {
     return true;
   }
 
-  std::unique_ptr<void, decltype(&DlFcn::dlclose_elf)>
-      handle(DlFcn::dlopen_elf("libart.so", RTLD_NOW), DlFcn::dlclose_elf);
-  KCHECKB(handle)
-
-  ssa_constructor_fnc_ = (void (*)(void *, const char *, bool))DlFcn::dlsym_elf(
-      handle.get(), "_ZN3art16ScopedSuspendAllC1EPKcb");
-  KCHECKB(ssa_constructor_fnc_)
-  ssa_destructor_fnc_ = (void (*)(void *))DlFcn::dlsym_elf(
-      handle.get(), "_ZN3art16ScopedSuspendAllD1Ev");
-  KCHECKB(ssa_destructor_fnc_)
-
-  sgc_constructor_fnc_ = (void (*)(void *, void *, GcCause, CollectorType))DlFcn::dlsym_elf(
-      handle.get(),
-      "_ZN3art2gc23ScopedGCCriticalSectionC1EPNS_6ThreadENS0_7GcCauseENS0_13CollectorTypeE");
-  KCHECKB(sgc_constructor_fnc_)
-  sgc_destructor_fnc_ =
-      (void (*)(void *))DlFcn::dlsym_elf(handle.get(), "_ZN3art2gc23ScopedGCCriticalSectionD1Ev");
-  KCHECKB(sgc_destructor_fnc_)
-
-  thread_list_lock_ptr_ =
-      (void **)DlFcn::dlsym_elf(handle.get(), "_ZN3art5Locks17thread_list_lock_E");
-  KCHECKB(thread_list_lock_ptr_)
-  exclusive_lock_fnc_ = (void (*)(void *, void *))DlFcn::dlsym_elf(
-      handle.get(), "_ZN3art5Mutex13ExclusiveLockEPNS_6ThreadE");
-  KCHECKB(exclusive_lock_fnc_)
-  exclusive_unlock_fnc_ = (void (*)(void *, void *))DlFcn::dlsym_elf(
-      handle.get(), "_ZN3art5Mutex15ExclusiveUnlockEPNS_6ThreadE");
-  KCHECKB(exclusive_unlock_fnc_)
-
-  dump_heap_func_ =
-      (void (*)(const char *, int, bool))DlFcn::dlsym_elf(handle.get(), "_ZN3art5hprof8DumpHeapEPKcib");
-  KCHECKB(dump_heap_func_)
+  // Resolved from libart once per build-id, or from the cache of an earlier
+  // launch
+  static const char *const kSymbols[] = {
+      "_ZN3art16ScopedSuspendAllC1EPKcb",
+      "_ZN3art16ScopedSuspendAllD1Ev",
+      "_ZN3art2gc23ScopedGCCriticalSectionC1EPNS_6ThreadENS0_7GcCauseENS0_13CollectorTypeE",
+      "_ZN3art2gc23ScopedGCCriticalSectionD1Ev",
+      "_ZN3art5Locks17thread_list_lock_E",
+      "_ZN3art5Mutex13ExclusiveLockEPNS_6ThreadE",
+      "_ZN3art5Mutex15ExclusiveUnlockEPNS_6ThreadE",
+      "_ZN3art5hprof8DumpHeapEPKcib",
+  };
+  constexpr size_t kSymbolCount = sizeof(kSymbols) / sizeof(kSymbols[0]);
+  void *symbols[kSymbolCount];
+  if (!SymbolCache::GetInstance().Resolve("libart.so", kSymbols, kSymbolCount,
+                                          symbols)) {
+    for (size_t i = 0; i < kSymbolCount; i++) {
+      if (symbols[i] == nullptr) {
+        ALOGE("%s not found", kSymbols[i]);
+      }
+    }
+    return false;
+  }
+
+  ssa_constructor_fnc_ = (void (*)(void *, const char *, bool))symbols[0];
+  ssa_destructor_fnc_ = (void (*)(void *))symbols[1];
+  sgc_constructor_fnc_ = (void (*)(void *, void *, GcCause, CollectorType))symbols[2];
+  sgc_destructor_fnc_ = (void (*)(void *))symbols[3];
+  thread_list_lock_ptr_ = (void **)symbols[4];
+  exclusive_lock_fnc_ = (void (*)(void *, void *))symbols[5];
+  exclusive_unlock_fnc_ = (void (*)(void *, void *))symbols[6];
+  dump_heap_func_ = (void (*)(const char *, int, bool))symbols[7];
 
   init_done_ = true;
   return true;
@@ -162,6 +158,7 @@ bool HprofDumpVImpl::Suspend() {
   // hprof DumpHeap: https://cs.android.com/android/platform/superproject/main/+/main:art/runtime/hprof/hprof.cc;l=1616
   void *self = __get_tls()[TLS_SLOT_ART_THREAD_SELF];
   sgc_instance_ = std::make_unique<ScopedGCCriticalSection>(self, kGcCauseHprof, kCollectorTypeHprof);
+  MarkGcCriticalSectionEntered();
   ssa_instance_ = std::make_unique<ScopedSuspendAll>(LOG_TAG, true);
 
   return true;
@@ -185,7 +182,7 @@ bool HprofDumpVImpl::Resume() {
   return true;
 }
 
-void HprofDumpVImpl::DumpHeap(const char* filename) {
+void HprofDumpVImpl::DumpHeap(const char* filename, int fd) {
   KCHECKV(init_done_)
 
   Resume();
@@ -194,7 +191,7 @@ void HprofDumpVImpl::DumpHeap(const char* filename) {
   // If "fd" is >= 0, the output will be written to that file descriptor.
   // Otherwise, "filename" is used to create an output file.
   // DumpHeap(const char* filename, int fd, bool direct_to_ddms)
-  dump_heap_func_(filename, -1, false);
+  dump_heap_func_(filename, fd, false);
 }
 
 } // namespace leak_monitor
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2025. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by wangzefeng <wangzefeng@kuaishou.com> on 2025.
+ *
+ */
+
+#include "hprof_stream.h"
+
+#include <android/log.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#undef LOG_TAG
+#define LOG_TAG "HprofStream"
+
+namespace kwai {
+namespace leak_monitor {
+
+// Larger than the default pipe (64 KB) so that a full pipe is drained in one
+// read
+static constexpr size_t kReadSize = 1 << 20;
+
+static uint64_t NowNs() {
+  struct timespec ts {};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+bool CreateHprofPipe(int fds[2], int pipe_size) {
+  if (pipe2(fds, O_CLOEXEC) == -1) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "pipe2 failed: %s",
+                        strerror(errno));
+    return false;
+  }
+  // Not fatal, the dump only gets more context switches
+  if (pipe_size > 0 && fcntl(fds[1], F_SETPIPE_SZ, pipe_size) == -1) {
+    __android_log_print(ANDROID_LOG_WARN, LOG_TAG,
+                        "F_SETPIPE_SZ %d failed: %s", pipe_size,
+                        strerror(errno));
+  }
+  return true;
+}
+
+bool PumpHprofStream(int fd, const HprofStreamProcessor *processor,
+                     TokenBucket *limiter, DumpProgress *progress,
+                     HprofStreamStats *stats) {
+  auto *buffer = static_cast<uint8_t *>(malloc(kReadSize));
+  if (buffer == nullptr) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "no read buffer");
+    return false;
+  }
+  bool success = false;
+  for (;;) {
+    ssize_t n = read(fd, buffer, kReadSize);
+    if (n > 0 && limiter != nullptr) {
+      limiter->Acquire(n);
+    }
+    if (n == 0) {
+      success = true;
+      break;
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "read failed: %s",
+                          strerror(errno));
+      break;
+    }
+    uint64_t start = NowNs();
+    bool written = processor->write(processor->arg, buffer, n);
+    stats->process_ns += NowNs() - start;
+    stats->bytes += n;
+    stats->reads++;
+    if (progress != nullptr) {
+      // 子进程的采样线程只看得到自己的 wchar，管道满时它停在 write 上
+      progress->last_progress_ns.store(DumpClockNs(),
+                                       std::memory_order_relaxed);
+    }
+    if (!written) {
+      __android_log_print(ANDROID_LOG_ERROR, LOG_TAG,
+                          "processor failed after %llu bytes",
+                          static_cast<unsigned long long>(stats->bytes));
+      break;
+    }
+  }
+  free(buffer);
+  if (limiter != nullptr) {
+    stats->throttled_ns = limiter->ThrottledNs();
+  }
+  return success;
+}
+
+static bool FileBegin(void *arg, const char *path) {
+  auto *fd = static_cast<int *>(arg);
+  *fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (*fd == -1) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "open %s failed: %s",
+                        path, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+static bool FileWrite(void *arg, const uint8_t *data, size_t size) {
+  int fd = *static_cast<int *>(arg);
+  while (size > 0) {
+    ssize_t n = write(fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "write failed: %s",
+                          strerror(errno));
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool FileEnd(void *arg, bool complete) {
+  auto *fd = static_cast<int *>(arg);
+  if (*fd == -1) {
+    return false;
+  }
+  bool closed = close(*fd) == 0;
+  *fd = -1;
+  return complete && closed;
+}
+
+HprofStreamProcessor FileStreamProcessor(int *fd) {
+  return HprofStreamProcessor{fd, FileBegin, FileWrite, FileEnd};
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
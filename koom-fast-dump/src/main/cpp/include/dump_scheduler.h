@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2025. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by wangzefeng <wangzefeng@kuaishou.com> on 2025.
+ *
+ */
+
+#ifndef KOOM_DUMP_SCHEDULER_H
+#define KOOM_DUMP_SCHEDULER_H
+
+#include <pthread.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace kwai {
+namespace leak_monitor {
+
+// Outcome of a DumpScheduler::Submit(), and the later fate of accepted
+// requests in the decision ring
+enum DumpDecision : int32_t {
+  // Handed to the dump thread, which was idle
+  kDumpStarted = 0,
+  // Waits for the running dump in the single pending slot
+  kDumpQueued = 1,
+  // A newer request took over the pending slot
+  kDumpSuperseded = 2,
+  kDumpRefusedSessionBudget = 3,
+  kDumpRefusedDayBudget = 4,
+  // The heap did not grow by min_growth_bytes since the last dump
+  kDumpRefusedNoGrowth = 5,
+  kDumpRefusedLowDisk = 6,
+  kDumpRefusedLowRam = 7,
+  // Results of a started dump
+  kDumpSucceeded = 8,
+  kDumpFailed = 9,
+};
+
+/**
+ * Limits of the scheduler, 0 disables each.
+ */
+struct DumpSchedulerPolicy {
+  // Dumps started by this process
+  uint32_t session_budget;
+  // Dumps started per UTC day, counted across processes with a state file
+  uint32_t day_budget;
+  // Growth of the triggering heap size over the one of the last dump
+  uint64_t min_growth_bytes;
+  // Available space of the file system the dump is written to
+  uint64_t min_free_disk_bytes;
+  // MemAvailable, the forked process dirties pages the app then shares
+  uint64_t min_free_ram_bytes;
+};
+
+// One entry of the decision ring
+struct DumpDecisionRecord {
+  // CLOCK_REALTIME
+  uint64_t time_ms;
+  int32_t trigger;
+  DumpDecision decision;
+  uint64_t heap_bytes;
+};
+
+// Runs one dump to path on the scheduler thread and returns once it
+// finished, true on success
+typedef bool (*DumpRunner)(void *arg, const char *path);
+
+/**
+ * Admission control in front of HprofDump for repeated triggers of the
+ * same growth: budgets per session and per day, a minimum heap growth
+ * between dumps and floors of free disk and RAM, read from statfs and
+ * /proc/meminfo on every request. Accepted dumps run one at a time on a
+ * dedicated thread, a request arriving meanwhile waits in a single slot
+ * and replaces the one already waiting there. Every decision lands in a
+ * small ring for telemetry.
+ */
+class DumpScheduler {
+ public:
+  static constexpr size_t kDecisionRingSize = 32;
+
+  DumpScheduler();
+
+  void Configure(const DumpSchedulerPolicy &policy);
+  // File keeping the count of the current day, shared by all processes of
+  // the app and updated under flock(). Without one the day budget only
+  // counts this process.
+  void SetStateFile(const char *path);
+  // Must be set before the first Submit(). The dump thread is created by
+  // the first accepted request, runner attaches it to whatever the dump
+  // needs.
+  void SetRunner(DumpRunner runner, void *arg);
+
+  // trigger is the caller's reason code, only recorded
+  DumpDecision Submit(int32_t trigger, uint64_t heap_bytes, const char *path);
+  // Oldest first, returns the number copied
+  size_t Decisions(DumpDecisionRecord *out, size_t max) const;
+
+ private:
+  struct Request {
+    int32_t trigger;
+    uint64_t heap_bytes;
+    std::string path;
+    // Counted against the budgets already
+    bool admitted;
+  };
+
+  static void *Loop(void *arg);
+  DumpDecision Admit(const Request &request);
+  // Counts the dump, false and recorded as refused if other processes used
+  // up the day budget since Admit()
+  bool Start(const Request &request);
+  void Record(const Request &request, DumpDecision decision);
+  void LoadDayCount(uint32_t day);
+  bool CountDayDump();
+
+  mutable pthread_mutex_t mutex_;
+  pthread_cond_t cond_;
+  DumpSchedulerPolicy policy_;
+  std::string state_file_;
+  DumpRunner runner_;
+  void *runner_arg_;
+  bool has_thread_;
+  bool running_;
+  bool has_pending_;
+  Request pending_;
+  uint32_t session_dumps_;
+  uint32_t day_;
+  uint32_t day_dumps_;
+  uint64_t last_heap_bytes_;
+  DumpDecisionRecord ring_[kDecisionRingSize];
+  size_t ring_next_;
+  size_t ring_count_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_DUMP_SCHEDULER_H
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2025. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by wangzefeng <wangzefeng@kuaishou.com> on 2025.
+ *
+ */
+
+#ifndef KOOM_DUMP_STATS_H
+#define KOOM_DUMP_STATS_H
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+
+namespace kwai {
+namespace leak_monitor {
+
+enum DumpPhase : uint32_t {
+  kDumpPhaseIdle = 0,
+  kDumpPhaseDumping = 1,
+  kDumpPhaseDone = 2,
+};
+
+/**
+ * Lives in a MAP_SHARED page so that the parent sees what the forked child
+ * is doing while it dumps. Written by the child, read by the parent at any
+ * time. In stream mode the parent's pump also refreshes last_progress_ns,
+ * see PumpHprofStream: a child blocked on a pipe the parent drains slowly is
+ * not idle. bytes_written then counts what the child wrote into the pipe.
+ */
+struct DumpProgress {
+  std::atomic<uint32_t> phase;
+  std::atomic<int32_t> pid;
+  // CLOCK_MONOTONIC, shared by both processes
+  std::atomic<uint64_t> dump_start_ns;
+  std::atomic<uint64_t> dump_end_ns;
+  // Bytes the child passed to write(), wchar of /proc/self/io
+  std::atomic<uint64_t> bytes_written;
+  // CPU time of the dumping thread
+  std::atomic<uint64_t> cpu_ns;
+  // Last time bytes_written or cpu_ns moved or, in stream mode, the parent
+  // consumed a chunk. A wedged child stops here and is killed after the
+  // watchdog's idle_timeout_ms, see dump_watchdog.h.
+  std::atomic<uint64_t> last_progress_ns;
+};
+
+/**
+ * Durations in ns of the last fork dump, 0 if a phase did not happen. The
+ * app is frozen for pause_ns: gc_critical_section_ns + suspend_ns + fork_ns +
+ * resume_ns plus bookkeeping.
+ */
+struct DumpStats {
+  // Symbol lookup in Initialize, once per process
+  uint64_t init_ns;
+  // Marking mappings MADV_DONTFORK before suspending, see fork_footprint.h
+  uint64_t exclude_ns;
+  uint64_t excluded_bytes;
+  // Entering the GC critical section, i.e. waiting for a running GC
+  uint64_t gc_critical_section_ns;
+  // Suspending all threads, including the GC critical section below R
+  uint64_t suspend_ns;
+  // Includes undoing the exclusions
+  uint64_t fork_ns;
+  uint64_t resume_ns;
+  uint64_t pause_ns;
+  // DumpHeap in the child, from the progress block
+  uint64_t child_dump_ns;
+  // From resume until the child was reaped
+  uint64_t wait_ns;
+  uint64_t bytes_written;
+  // Raw waitpid status, -1 if the child was not reaped
+  int32_t exit_status;
+  // DumpEnd, why the child is gone
+  int32_t end_reason;
+};
+
+uint64_t DumpClockNs();
+
+// Anonymous shared page inherited by the forked child, nullptr on failure
+DumpProgress *CreateDumpProgress();
+
+// Called by the child around DumpHeap. A sampler thread refreshes
+// bytes_written and cpu_ns every 100 ms in between, and ends the child once
+// parent, getpid() before the fork, is gone.
+void BeginChildDump(DumpProgress *progress, pid_t parent);
+void EndChildDump(DumpProgress *progress);
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_DUMP_STATS_H
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2025. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by wangzefeng <wangzefeng@kuaishou.com> on 2025.
+ *
+ */
+
+#ifndef KOOM_DUMP_THROTTLE_H
+#define KOOM_DUMP_THROTTLE_H
+
+#include <sched.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * How the forked dump process gets out of the way of the resumed app, all
+ * off by default. Only ever lowers priorities, which needs no permission.
+ */
+struct DumpChildPolicy {
+  // Run on the cores with the lowest max frequency among those the app's
+  // cpuset allows, no effect on devices with a single cluster
+  bool little_cores;
+  // setpriority() value, 0 keeps the app's
+  int nice;
+  // SCHED_IDLE: only runs when no other thread of the cpu wants to
+  bool idle_cpu;
+  // IOPRIO_CLASS_IDLE: storage is only used when nobody else needs it
+  bool idle_io;
+  // Pace of the dump in stream mode, 0 unlimited. The parent reads the pipe
+  // no faster than this, so the child blocks on the full pipe. Dumps to a
+  // file are written by ART directly and are not paced.
+  uint64_t write_bytes_per_second;
+};
+
+// Called in the child right after fork, failures are logged and ignored
+void ApplyDumpChildPolicy(const DumpChildPolicy &policy);
+
+// The cpus of the slowest cluster among those allowed for this thread,
+// false if they cannot be told apart
+bool LittleCoreMask(cpu_set_t *mask);
+
+/**
+ * Token bucket that sleeps in Acquire() once more than burst bytes are
+ * ahead of rate.
+ */
+class TokenBucket {
+ public:
+  TokenBucket(uint64_t bytes_per_second, uint64_t burst_bytes);
+
+  void Acquire(size_t bytes);
+  uint64_t ThrottledNs() const { return throttled_ns_; }
+
+ private:
+  double rate_;
+  double burst_;
+  double tokens_;
+  uint64_t last_ns_;
+  uint64_t throttled_ns_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_DUMP_THROTTLE_H
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2025. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by wangzefeng <wangzefeng@kuaishou.com> on 2025.
+ *
+ */
+
+#ifndef KOOM_DUMP_WATCHDOG_H
+#define KOOM_DUMP_WATCHDOG_H
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+
+#include "dump_stats.h"
+
+namespace kwai {
+namespace leak_monitor {
+
+enum DumpEnd : int32_t {
+  // The child exited by itself, successfully or not
+  kDumpEndExited = 0,
+  // Killed: no progress for idle_timeout_ms
+  kDumpEndIdle = 1,
+  // Killed: ran longer than max_duration_ms
+  kDumpEndTimeout = 2,
+  // Killed: Cancel() was called
+  kDumpEndCancelled = 3,
+  // waitpid failed, the child may still run
+  kDumpEndLost = 4,
+};
+
+// Completion of a watched dump, success: the child exited by itself with
+// status 0
+typedef void (*DumpCallback)(void *arg, bool success);
+
+/**
+ * Watches the dump child from the parent instead of the alarm the child used
+ * to set: a healthy dump of a huge heap may take as long as it needs, a child
+ * that stopped writing and computing is killed after idle_timeout_ms, see
+ * DumpProgress::last_progress_ns. Waits on a pidfd where the kernel has it
+ * (5.3+), otherwise polls waitpid. One child at a time.
+ */
+class DumpWatchdog {
+ public:
+  typedef void (*Callback)(void *arg, int status, DumpEnd end);
+
+  DumpWatchdog();
+
+  // 0 disables either limit. Applies to the next Start().
+  void Configure(uint32_t idle_timeout_ms, uint32_t max_duration_ms);
+
+  // Watches pid on a thread from now on. With a callback the child is reaped
+  // there and the callback runs on that thread, Join() must not be used, and
+  // the callback cannot Start() the next dump itself. Without one Join()
+  // returns the result.
+  bool Start(pid_t pid, const DumpProgress *progress, Callback callback,
+             void *arg);
+  DumpEnd Join(int *status);
+  // Kills the watched child, any thread, no effect if none is watched
+  void Cancel();
+  // Until the result was delivered
+  bool Watching() const { return pid_.load() != 0; }
+
+ private:
+  static void *Run(void *arg);
+  DumpEnd Watch(int *status);
+  bool Expired(uint64_t start_ns, DumpEnd *end) const;
+
+  uint32_t idle_timeout_ms_;
+  uint32_t max_duration_ms_;
+
+  std::atomic<pid_t> pid_;
+  std::atomic<bool> cancelled_;
+  // Wakes the watching thread up for Cancel()
+  int wake_fd_;
+  const DumpProgress *progress_;
+  Callback callback_;
+  void *callback_arg_;
+  pthread_t thread_;
+  bool has_thread_;
+  int status_;
+  DumpEnd end_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_DUMP_WATCHDOG_H
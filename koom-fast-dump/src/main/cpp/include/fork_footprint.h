@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2025. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by wangzefeng <wangzefeng@kuaishou.com> on 2025.
+ *
+ */
+
+#ifndef KOOM_FORK_FOOTPRINT_H
+#define KOOM_FORK_FOOTPRINT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * Makes the dump child cheaper to fork: before fork() mappings the child
+ * never reads are marked MADV_DONTFORK, so fork() does not copy their page
+ * tables while the app is suspended, and the parent gets them back with
+ * MADV_DOFORK afterwards. If the child touches an excluded range anyway it
+ * dies of SIGSEGV, the dump fails but the app is not affected. Mappings the
+ * app already marked MADV_DONTFORK ("dc" in the VmFlags of
+ * /proc/self/smaps) are left alone, Restore() does not make them forkable.
+ *
+ * Whatever the classes say, mappings the heap dump needs are never excluded:
+ * the Java heap and other ART maps (dalvik-*, jit-cache, images, oat), the
+ * malloc heap, stacks, the linker and everything file backed except device
+ * nodes.
+ */
+class ForkFootprint {
+ public:
+  enum RegionClass : uint32_t {
+    // Anonymous private mappings of at least min_anonymous_bytes, e.g. codec
+    // or bitmap buffers mapped by native code. Unnamed neighbours with the
+    // same protection are merged by the kernel and judged as one mapping.
+    kLargeAnonymous = 1u << 0u,
+    // ashmem and memfd regions, except ART's
+    kAshmem = 1u << 1u,
+    // GPU, gralloc and dma-buf mappings. The kernel refuses MADV_DOFORK on
+    // VM_IO mappings, those stay excluded from later forks of the app too.
+    kGraphics = 1u << 2u,
+    // Ranges passed to RegisterBuffer
+    kOwnBuffers = 1u << 3u,
+  };
+
+  ForkFootprint();
+
+  // classes 0 (the default) disables the step
+  void Configure(uint32_t classes, size_t min_anonymous_bytes);
+  // KOOM memory the dump child does not need
+  void RegisterBuffer(const void *addr, size_t size);
+  void UnregisterBuffer(const void *addr);
+
+  // Before fork and before the app is suspended, reading smaps is slow.
+  // Returns the bytes of address space excluded.
+  size_t Exclude();
+  // After fork in the parent, undoes Exclude for the ranges it marked
+  void Restore();
+
+  // Which classes a line of /proc/self/maps belongs to, 0 if it must stay
+  // in the child. Exposed for testing.
+  uint32_t Classify(uintptr_t start, uintptr_t end, const char *perms,
+                    uint64_t inode, const char *path) const;
+
+ private:
+  struct Range {
+    uintptr_t start;
+    uintptr_t end;
+  };
+
+  uint32_t classes_;
+  size_t min_anonymous_bytes_;
+  std::vector<Range> own_buffers_;
+  std::vector<Range> excluded_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_FORK_FOOTPRINT_H
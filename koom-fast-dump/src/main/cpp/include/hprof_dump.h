@@ -21,6 +21,12 @@
 #define KOOM_HPROF_DUMP_H
 
 #include <android-base/macros.h>
+#include <dump_stats.h>
+#include <dump_scheduler.h>
+#include <dump_throttle.h>
+#include <dump_watchdog.h>
+#include <fork_footprint.h>
+#include <hprof_stream.h>
 
 #include <memory>
 #include <string>
@@ -44,8 +50,37 @@ class HprofDump {
   pid_t SuspendAndFork();
   bool Resume();
   bool ResumeAndWait(pid_t pid);
+  // Returns at once, the child is reaped in the background and callback runs
+  // on the watchdog thread with the result. false if the watchdog did not
+  // take the child, callback is not called then.
+  bool ResumeAndWatch(pid_t pid, DumpCallback callback, void *arg);
+  // Kills the running dump child, any thread
+  void CancelDump();
+  // Timeouts of the dump child, see DumpWatchdog
+  DumpWatchdog &Watchdog();
 
-  void DumpHeap(const char* filename);
+  // Only in the forked process
+  void DumpHeap(const char* filename, int fd = -1);
+
+  // The child dumps into a pipe instead of a file and processor consumes it
+  // in this process while the child is still running, so the raw hprof never
+  // touches the disk. A null processor writes the raw stream to path.
+  // pipe_size bounds how far the child runs ahead, see CreateHprofPipe.
+  // Blocks until the child exited, the watchdog kills it if the processor is
+  // so slow that the child makes no progress for its idle timeout.
+  bool ForkDumpToStream(const char* path,
+                        const HprofStreamProcessor* processor, int pipe_size);
+
+  // Phase timing of the last dump, complete once the child was reaped
+  DumpStats LastStats() const;
+  // Live view of the running dump child, nullptr if it is not available
+  const DumpProgress *Progress() const;
+  // What SuspendAndFork keeps out of the child, nothing by default
+  ForkFootprint &Footprint();
+  // Applied to the child right after fork, nothing by default
+  DumpChildPolicy &ChildPolicy();
+  // Admission of triggered dumps, runs them on its own thread
+  DumpScheduler &Scheduler();
 
  private:
   HprofDump();
@@ -54,6 +89,8 @@ class HprofDump {
 
  private:
   HprofDumpImpl &impl_;
+  uint64_t init_ns_;
+  DumpScheduler scheduler_;
 };
 
 }  // namespace leak_monitor
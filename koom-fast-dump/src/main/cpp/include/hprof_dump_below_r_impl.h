@@ -47,7 +47,7 @@ class HprofDumpBelowRImpl : public HprofDumpImpl {
   bool Suspend() override;
   bool Resume() override;
 
-  void DumpHeap(const char* filename) override;
+  void DumpHeap(const char* filename, int fd) override;
 
  private:
   bool init_done_;
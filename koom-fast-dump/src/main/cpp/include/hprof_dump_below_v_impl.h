@@ -50,7 +50,7 @@ class HprofDumpBelowVImpl : public HprofDumpImpl {
   bool Suspend() override;
   bool Resume() override;
 
-  void DumpHeap(const char* filename) override;
+  void DumpHeap(const char* filename, int fd) override;
 
  private:
   bool init_done_;
@@ -22,6 +22,13 @@
 
 #include <sys/types.h>
 
+#include <atomic>
+
+#include "dump_stats.h"
+#include "dump_throttle.h"
+#include "dump_watchdog.h"
+#include "fork_footprint.h"
+
 namespace kwai {
 namespace leak_monitor {
 
@@ -40,12 +47,59 @@ class HprofDumpImpl {
   virtual pid_t Fork();
   virtual bool Resume() = 0;
 
-  virtual void DumpHeap(const char* filename) = 0;
+  // Writes to fd if it is >= 0, otherwise creates filename
+  virtual void DumpHeap(const char* filename, int fd) = 0;
 
  public:
   // Avoid Any Not Necessary actions on the forked process
   pid_t SuspendAndFork();
+  // Resume() of the parent after SuspendAndFork, timed into LastStats()
+  bool ResumeParent();
+  // Ends SuspendAndFork's claim on the dump for a child that is not watched,
+  // Watch() does so itself
+  void ReleaseFork() { forking_.store(false); }
   bool ResumeAndWait(pid_t pid);
+  // Hands the forked process to the watchdog, with a callback it is reaped
+  // in the background and the callback runs on the watchdog thread, without
+  // one Wait() must follow
+  bool Watch(pid_t pid, DumpCallback callback, void *arg);
+  // Waits for the watched process, false if it failed or was killed
+  bool Wait(pid_t pid);
+  // DumpHeap in the forked process, reporting to the progress block
+  void DumpHeapInChild(const char* filename, int fd);
+
+  const DumpStats &LastStats() const { return stats_; }
+  ForkFootprint &Footprint() { return fork_footprint_; }
+  DumpChildPolicy &ChildPolicy() { return child_policy_; }
+  DumpWatchdog &Watchdog() { return watchdog_; }
+  // nullptr if the shared page could not be mapped
+  const DumpProgress *Progress() const { return progress_; }
+  DumpProgress *Progress() { return progress_; }
+
+ protected:
+  // Suspend() implementations that enter a GC critical section before
+  // suspending all threads call this in between
+  void MarkGcCriticalSectionEntered() { gc_critical_section_ns_ = DumpClockNs(); }
+
+ private:
+  static void OnWatchEnd(void *arg, int status, DumpEnd end);
+  bool Finish(pid_t pid, int status, DumpEnd end);
+
+  DumpStats stats_ = {};
+  DumpProgress *progress_ = nullptr;
+  ForkFootprint fork_footprint_;
+  DumpChildPolicy child_policy_ = {};
+  DumpWatchdog watchdog_;
+  pid_t watched_pid_ = 0;
+  pid_t parent_pid_ = 0;
+  // From SuspendAndFork until the child is watched, one dump at a time
+  // whichever thread starts it
+  std::atomic<bool> forking_{false};
+  DumpCallback callback_ = nullptr;
+  void *callback_arg_ = nullptr;
+  uint64_t suspend_start_ns_ = 0;
+  uint64_t gc_critical_section_ns_ = 0;
+  uint64_t resume_end_ns_ = 0;
 };
 
 } // namespace leak_monitor
@@ -55,7 +55,7 @@ class HprofDumpVImpl : public HprofDumpImpl {
   pid_t Fork() override;
   bool Resume() override;
 
-  void DumpHeap(const char* filename) override;
+  void DumpHeap(const char* filename, int fd) override;
 
  private:
   bool init_done_;
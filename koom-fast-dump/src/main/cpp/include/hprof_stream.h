@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2025. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by wangzefeng <wangzefeng@kuaishou.com> on 2025.
+ *
+ */
+
+#ifndef KOOM_HPROF_STREAM_H
+#define KOOM_HPROF_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "dump_stats.h"
+#include "dump_throttle.h"
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * Consumer of a heap dump that the forked child writes into a pipe, see
+ * HprofDump::ForkDumpToStream. Only plain function pointers so that another
+ * library (koom-strip-dump) can hand one over as a jlong. All calls happen on
+ * the dumping thread of the parent, in the order begin, write..., end.
+ */
+struct HprofStreamProcessor {
+  void *arg;
+  // Called before the child starts, false cancels the dump
+  bool (*begin)(void *arg, const char *path);
+  // Called with every chunk read from the pipe, false stops reading and the
+  // child is killed by SIGPIPE on its next write
+  bool (*write)(void *arg, const uint8_t *data, size_t size);
+  // complete is false if reading or the child failed, returns the result of
+  // the dump
+  bool (*end)(void *arg, bool complete);
+};
+
+struct HprofStreamStats {
+  uint64_t bytes;
+  uint64_t reads;
+  // Time the parent spent in processor->write, the rest of the dump time the
+  // child was producing or the pipe was empty
+  uint64_t process_ns;
+  // Time spent waiting for the limiter
+  uint64_t throttled_ns;
+};
+
+// Pipe with O_CLOEXEC ends, pipe_size > 0 sets the capacity (F_SETPIPE_SZ,
+// rounded up by the kernel and capped by /proc/sys/fs/pipe-max-size). It is
+// how far the child may run ahead of the processor before its write blocks.
+bool CreateHprofPipe(int fds[2], int pipe_size);
+
+// Feeds everything read from fd until EOF to processor->write, returns false
+// if reading or the processor failed. Does not call begin or end. With a
+// limiter the pipe is read no faster than its rate. With progress every
+// chunk handed on refreshes last_progress_ns: while the limiter or the
+// processor hold the pump the child blocks on the full pipe, which must not
+// count as idle.
+bool PumpHprofStream(int fd, const HprofStreamProcessor *processor,
+                     TokenBucket *limiter, DumpProgress *progress,
+                     HprofStreamStats *stats);
+
+// Processor writing the stream unchanged to path, *fd must start as -1
+HprofStreamProcessor FileStreamProcessor(int *fd);
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_HPROF_STREAM_H
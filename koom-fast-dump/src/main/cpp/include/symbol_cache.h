@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2025. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by wangzefeng <wangzefeng@kuaishou.com> on 2025.
+ *
+ */
+
+#ifndef KOOM_SYMBOL_CACHE_H
+#define KOOM_SYMBOL_CACHE_H
+
+#include <link.h>
+#include <pthread.h>
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * Resolves symbols of a loaded library, also those only in .symtab or
+ * .gnu_debugdata, and remembers their offsets keyed by the library's path
+ * and build-id. The first resolution in a process looks every name up in
+ * the ELF file, later ones and, with a cache file, those of later launches
+ * only read the build-id note from the mapped library. A library updated in
+ * place has another build-id, stale offsets are never used.
+ */
+class SymbolCache {
+ public:
+  static SymbolCache &GetInstance();
+
+  // File keeping the offsets across launches, none by default. Set it before
+  // the first Resolve().
+  void SetCacheFile(const char *path);
+
+  // addresses[i] of names[i] in lib_name, for example "libart.so". false
+  // unless every name was found.
+  bool Resolve(const char *lib_name, const char *const *names, size_t count,
+               void **addresses);
+
+ private:
+  struct Library {
+    std::string path;
+    std::string build_id;
+    ElfW(Addr) load_base;
+  };
+  typedef std::map<std::string, ElfW(Addr)> Offsets;
+
+  SymbolCache();
+
+  static bool FindLoaded(const char *lib_name, Library *library);
+  bool LoadCacheFile(const Library &library, Offsets *offsets);
+  void StoreCacheFile(const Library &library, const Offsets &offsets);
+  bool ResolveElf(const char *lib_name, Library *library,
+                  const char *const *names, size_t count, Offsets *offsets);
+
+  pthread_mutex_t mutex_;
+  std::string cache_file_;
+  // Keyed by path and build-id
+  std::map<std::string, Offsets> libraries_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_SYMBOL_CACHE_H
@@ -25,9 +25,11 @@
 #include <kwai_linker/kwai_dlfcn.h>
 #include <log/log.h>
 #include <pthread.h>
+#include <symbol_cache.h>
 #include <unistd.h>
 #include <wait.h>
 
+#include <algorithm>
 #include <string>
 
 #undef LOG_TAG
@@ -47,6 +49,14 @@ JNIEXPORT void JNICALL Java_com_kwai_koom_fastdump_ForkJvmHeapDumper_nativeInit(
   HprofDump::GetInstance().Initialize();
 }
 
+JNIEXPORT void JNICALL
+Java_com_kwai_koom_fastdump_ForkJvmHeapDumper_nativeSetSymbolCache(
+    JNIEnv *env, jobject jobject ATTRIBUTE_UNUSED, jstring j_file) {
+  auto c_file = env->GetStringUTFChars(j_file, nullptr);
+  SymbolCache::GetInstance().SetCacheFile(c_file);
+  env->ReleaseStringUTFChars(j_file, c_file);
+}
+
 JNIEXPORT jboolean JNICALL
 Java_com_kwai_koom_fastdump_ForkJvmHeapDumper_forkDump(
     JNIEnv *env, jobject,
@@ -62,15 +72,272 @@ Java_com_kwai_koom_fastdump_ForkJvmHeapDumper_forkDump(
     HprofDump::GetInstance().DumpHeap(file_name.c_str());
     FastExit(0);
   } else if (pid > 0) {
+    // Without waiting the child is still reaped, in the background
     dump_success =
         JNI_TRUE == wait_pid
             ? HprofDump::GetInstance().ResumeAndWait(pid)
-            : HprofDump::GetInstance().Resume();
+            : HprofDump::GetInstance().ResumeAndWatch(
+                  pid, [](void *, bool) {}, nullptr);
   }
 
   return dump_success;
 }
 
+struct AsyncDump {
+  JavaVM *vm;
+  jobject listener;
+};
+
+static void OnAsyncDumpEnd(void *arg, bool success) {
+  auto dump = static_cast<AsyncDump *>(arg);
+  JNIEnv *env = nullptr;
+  JavaVMAttachArgs attach_args = {JNI_VERSION_1_6, "koom-dump-watch", nullptr};
+  if (dump->vm->AttachCurrentThread(&env, &attach_args) == JNI_OK) {
+    jclass clazz = env->GetObjectClass(dump->listener);
+    jmethodID method = env->GetMethodID(clazz, "onDumpFinished", "(Z)V");
+    if (method != nullptr) {
+      env->CallVoidMethod(dump->listener, method, (jboolean)success);
+    }
+    if (env->ExceptionCheck()) {
+      env->ExceptionDescribe();
+      env->ExceptionClear();
+    }
+    env->DeleteLocalRef(clazz);
+    env->DeleteGlobalRef(dump->listener);
+    dump->vm->DetachCurrentThread();
+  }
+  delete dump;
+}
+
+/**
+ * Returns once the app is resumed, j_listener.onDumpFinished(boolean) is
+ * called on the watchdog thread when the child is gone. false if the dump
+ * could not start, the listener is not called then.
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_kwai_koom_fastdump_ForkJvmHeapDumper_forkDumpAsync(
+    JNIEnv *env, jobject,
+    jstring j_path, jobject j_listener
+) {
+  auto c_path = env->GetStringUTFChars(j_path, nullptr);
+  std::string file_name(c_path);
+  env->ReleaseStringUTFChars(j_path, c_path);
+
+  auto dump = new AsyncDump{nullptr, nullptr};
+  if (env->GetJavaVM(&dump->vm) != JNI_OK) {
+    delete dump;
+    return JNI_FALSE;
+  }
+  dump->listener = env->NewGlobalRef(j_listener);
+
+  auto pid = HprofDump::GetInstance().SuspendAndFork();
+  if (pid == 0) {
+    HprofDump::GetInstance().DumpHeap(file_name.c_str());
+    FastExit(0);
+  }
+  // The watchdog owns dump once it watches the child
+  if (pid < 0 ||
+      !HprofDump::GetInstance().ResumeAndWatch(pid, OnAsyncDumpEnd, dump)) {
+    env->DeleteGlobalRef(dump->listener);
+    delete dump;
+    return JNI_FALSE;
+  }
+  return JNI_TRUE;
+}
+
+JNIEXPORT void JNICALL
+Java_com_kwai_koom_fastdump_ForkJvmHeapDumper_cancelDump(
+    JNIEnv *env ATTRIBUTE_UNUSED, jobject jobject ATTRIBUTE_UNUSED) {
+  HprofDump::GetInstance().CancelDump();
+}
+
+JNIEXPORT void JNICALL
+Java_com_kwai_koom_fastdump_ForkJvmHeapDumper_nativeSetWatchdog(
+    JNIEnv *env ATTRIBUTE_UNUSED, jobject jobject ATTRIBUTE_UNUSED,
+    jint idle_timeout_ms, jint max_duration_ms) {
+  HprofDump::GetInstance().Watchdog().Configure(
+      static_cast<uint32_t>(std::max(idle_timeout_ms, 0)),
+      static_cast<uint32_t>(std::max(max_duration_ms, 0)));
+}
+
+// DumpRunner of the scheduler thread, arg is the JavaVM. Suspending the app
+// needs a thread ART knows, the scheduler thread stays attached for good.
+static bool RunScheduledDump(void *arg, const char *path) {
+  auto vm = static_cast<JavaVM *>(arg);
+  JNIEnv *env = nullptr;
+  if (vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6) != JNI_OK) {
+    JavaVMAttachArgs attach_args = {JNI_VERSION_1_6, "koom-dump-sched",
+                                    nullptr};
+    if (vm->AttachCurrentThreadAsDaemon(&env, &attach_args) != JNI_OK) {
+      return false;
+    }
+  }
+  auto pid = HprofDump::GetInstance().SuspendAndFork();
+  if (pid == 0) {
+    HprofDump::GetInstance().DumpHeap(path);
+    FastExit(0);
+  }
+  return pid > 0 && HprofDump::GetInstance().ResumeAndWait(pid);
+}
+
+JNIEXPORT void JNICALL
+Java_com_kwai_koom_fastdump_ForkJvmHeapDumper_nativeSetScheduler(
+    JNIEnv *env, jobject jobject ATTRIBUTE_UNUSED,
+    jint session_budget, jint day_budget, jlong min_growth_bytes,
+    jlong min_free_disk_bytes, jlong min_free_ram_bytes, jstring j_state_file) {
+  DumpSchedulerPolicy policy = {
+      static_cast<uint32_t>(std::max(session_budget, 0)),
+      static_cast<uint32_t>(std::max(day_budget, 0)),
+      static_cast<uint64_t>(std::max<jlong>(min_growth_bytes, 0)),
+      static_cast<uint64_t>(std::max<jlong>(min_free_disk_bytes, 0)),
+      static_cast<uint64_t>(std::max<jlong>(min_free_ram_bytes, 0)),
+  };
+  DumpScheduler &scheduler = HprofDump::GetInstance().Scheduler();
+  scheduler.Configure(policy);
+  if (j_state_file != nullptr) {
+    auto c_state_file = env->GetStringUTFChars(j_state_file, nullptr);
+    scheduler.SetStateFile(c_state_file);
+    env->ReleaseStringUTFChars(j_state_file, c_state_file);
+  } else {
+    scheduler.SetStateFile("");
+  }
+}
+
+/**
+ * Returns a DumpDecision, the dump itself runs on the scheduler thread.
+ */
+JNIEXPORT jint JNICALL
+Java_com_kwai_koom_fastdump_ForkJvmHeapDumper_nativeRequestDump(
+    JNIEnv *env, jobject jobject ATTRIBUTE_UNUSED,
+    jstring j_path, jint trigger, jlong heap_bytes) {
+  DumpScheduler &scheduler = HprofDump::GetInstance().Scheduler();
+  JavaVM *vm = nullptr;
+  if (env->GetJavaVM(&vm) != JNI_OK) {
+    return kDumpFailed;
+  }
+  scheduler.SetRunner(RunScheduledDump, vm);
+
+  auto c_path = env->GetStringUTFChars(j_path, nullptr);
+  std::string file_name(c_path);
+  env->ReleaseStringUTFChars(j_path, c_path);
+  return scheduler.Submit(trigger,
+                          static_cast<uint64_t>(std::max<jlong>(heap_bytes, 0)),
+                          file_name.c_str());
+}
+
+/**
+ * j_processor is a HprofStreamProcessor* owned by another native library, 0
+ * streams the raw hprof into j_path.
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_kwai_koom_fastdump_ForkJvmHeapDumper_forkDumpToStream(
+    JNIEnv *env, jobject,
+    jstring j_path, jlong j_processor, jint pipe_size
+) {
+  auto c_path = env->GetStringUTFChars(j_path, nullptr);
+  std::string file_name(c_path);
+  env->ReleaseStringUTFChars(j_path, c_path);
+
+  auto processor = reinterpret_cast<const HprofStreamProcessor *>(j_processor);
+  return HprofDump::GetInstance().ForkDumpToStream(file_name.c_str(),
+                                                   processor, pipe_size);
+}
+
+JNIEXPORT void JNICALL
+Java_com_kwai_koom_fastdump_ForkJvmHeapDumper_nativeSetForkExclusions(
+    JNIEnv *env ATTRIBUTE_UNUSED, jobject jobject ATTRIBUTE_UNUSED,
+    jint region_classes, jlong min_anonymous_bytes) {
+  HprofDump::GetInstance().Footprint().Configure(
+      static_cast<uint32_t>(region_classes),
+      static_cast<size_t>(min_anonymous_bytes));
+}
+
+JNIEXPORT void JNICALL
+Java_com_kwai_koom_fastdump_ForkJvmHeapDumper_nativeSetChildPolicy(
+    JNIEnv *env ATTRIBUTE_UNUSED, jobject jobject ATTRIBUTE_UNUSED,
+    jboolean little_cores, jint nice, jboolean idle_cpu, jboolean idle_io,
+    jlong write_bytes_per_second) {
+  DumpChildPolicy &policy = HprofDump::GetInstance().ChildPolicy();
+  policy.little_cores = little_cores == JNI_TRUE;
+  policy.nice = nice;
+  policy.idle_cpu = idle_cpu == JNI_TRUE;
+  policy.idle_io = idle_io == JNI_TRUE;
+  policy.write_bytes_per_second =
+      static_cast<uint64_t>(std::max<jlong>(write_bytes_per_second, 0));
+}
+
+static jlongArray ToJava(JNIEnv *env, const jlong *values, jsize count) {
+  jlongArray array = env->NewLongArray(count);
+  if (array != nullptr) {
+    env->SetLongArrayRegion(array, 0, count, values);
+  }
+  return array;
+}
+
+/**
+ * Layout must match DumpStats.java
+ */
+JNIEXPORT jlongArray JNICALL
+Java_com_kwai_koom_fastdump_ForkJvmHeapDumper_lastDumpStats(
+    JNIEnv *env, jobject jobject ATTRIBUTE_UNUSED) {
+  DumpStats stats = HprofDump::GetInstance().LastStats();
+  const jlong values[] = {
+      (jlong)stats.init_ns, (jlong)stats.exclude_ns,
+      (jlong)stats.excluded_bytes, (jlong)stats.gc_critical_section_ns,
+      (jlong)stats.suspend_ns, (jlong)stats.fork_ns,
+      (jlong)stats.resume_ns, (jlong)stats.pause_ns,
+      (jlong)stats.child_dump_ns, (jlong)stats.wait_ns,
+      (jlong)stats.bytes_written, (jlong)stats.exit_status,
+      (jlong)stats.end_reason,
+  };
+  return ToJava(env, values, sizeof(values) / sizeof(values[0]));
+}
+
+/**
+ * Layout must match DumpProgress.java, null if there is no progress block
+ */
+JNIEXPORT jlongArray JNICALL
+Java_com_kwai_koom_fastdump_ForkJvmHeapDumper_dumpProgress(
+    JNIEnv *env, jobject jobject ATTRIBUTE_UNUSED) {
+  const DumpProgress *progress = HprofDump::GetInstance().Progress();
+  if (progress == nullptr) {
+    return nullptr;
+  }
+  uint64_t now = DumpClockNs();
+  uint64_t start = progress->dump_start_ns.load();
+  uint64_t end = progress->dump_end_ns.load();
+  uint32_t phase = progress->phase.load(std::memory_order_acquire);
+  const jlong values[] = {
+      (jlong)phase,
+      (jlong)progress->pid.load(),
+      (jlong)(phase == kDumpPhaseIdle ? 0 : (end != 0 ? end : now) - start),
+      (jlong)progress->bytes_written.load(),
+      (jlong)progress->cpu_ns.load(),
+      (jlong)(phase == kDumpPhaseIdle
+                  ? 0 : now - progress->last_progress_ns.load()),
+  };
+  return ToJava(env, values, sizeof(values) / sizeof(values[0]));
+}
+
+/**
+ * Layout must match DumpDecision.java, four values per record, oldest first
+ */
+JNIEXPORT jlongArray JNICALL
+Java_com_kwai_koom_fastdump_ForkJvmHeapDumper_dumpDecisions(
+    JNIEnv *env, jobject jobject ATTRIBUTE_UNUSED) {
+  DumpDecisionRecord records[DumpScheduler::kDecisionRingSize];
+  size_t count = HprofDump::GetInstance().Scheduler().Decisions(
+      records, DumpScheduler::kDecisionRingSize);
+  jlong values[DumpScheduler::kDecisionRingSize * 4];
+  for (size_t i = 0; i < count; i++) {
+    values[i * 4] = (jlong)records[i].time_ms;
+    values[i * 4 + 1] = (jlong)records[i].trigger;
+    values[i * 4 + 2] = (jlong)records[i].decision;
+    values[i * 4 + 3] = (jlong)records[i].heap_bytes;
+  }
+  return ToJava(env, values, static_cast<jsize>(count * 4));
+}
+
 #ifdef __cplusplus
 }
 #endif
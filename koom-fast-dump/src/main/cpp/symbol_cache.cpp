@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2025. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by wangzefeng <wangzefeng@kuaishou.com> on 2025.
+ *
+ */
+
+#include "symbol_cache.h"
+
+#include <android/log.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <kwai_linker/kwai_dlfcn.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include "dump_stats.h"
+
+#undef LOG_TAG
+#define LOG_TAG "SymbolCache"
+
+namespace kwai {
+namespace leak_monitor {
+
+using namespace kwai::linker;
+
+static const char kCacheMagic[] = "koom-symbols 1";
+
+SymbolCache &SymbolCache::GetInstance() {
+  static SymbolCache instance;
+  return instance;
+}
+
+SymbolCache::SymbolCache() { pthread_mutex_init(&mutex_, nullptr); }
+
+void SymbolCache::SetCacheFile(const char *path) {
+  pthread_mutex_lock(&mutex_);
+  cache_file_ = path;
+  pthread_mutex_unlock(&mutex_);
+}
+
+static std::string ReadBuildId(const dl_phdr_info *info) {
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+    if (phdr.p_type != PT_NOTE) {
+      continue;
+    }
+    auto note =
+        reinterpret_cast<const uint8_t *>(info->dlpi_addr + phdr.p_vaddr);
+    const uint8_t *end = note + phdr.p_memsz;
+    while (note + sizeof(ElfW(Nhdr)) <= end) {
+      auto nhdr = reinterpret_cast<const ElfW(Nhdr) *>(note);
+      const uint8_t *name = note + sizeof(ElfW(Nhdr));
+      const uint8_t *desc = name + ((nhdr->n_namesz + 3) & ~3u);
+      const uint8_t *next = desc + ((nhdr->n_descsz + 3) & ~3u);
+      if (next > end) {
+        break;
+      }
+      if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+          memcmp(name, "GNU", 4) == 0) {
+        static const char kHex[] = "0123456789abcdef";
+        std::string build_id;
+        for (uint32_t j = 0; j < nhdr->n_descsz; j++) {
+          build_id += kHex[desc[j] >> 4];
+          build_id += kHex[desc[j] & 0xf];
+        }
+        return build_id;
+      }
+      note = next;
+    }
+  }
+  return "";
+}
+
+struct FindData {
+  const char *lib_name;
+  size_t lib_name_len;
+  void *library;
+};
+
+bool SymbolCache::FindLoaded(const char *lib_name, Library *library) {
+  FindData data = {lib_name, strlen(lib_name), library};
+  auto callback = [](dl_phdr_info *info, size_t, void *arg) -> int {
+    auto data = static_cast<FindData *>(arg);
+    size_t len = info->dlpi_name != nullptr ? strlen(info->dlpi_name) : 0;
+    // The full path on Android, match its last component
+    if (len < data->lib_name_len + 1 || info->dlpi_name[0] != '/' ||
+        strcmp(info->dlpi_name + len - data->lib_name_len,
+               data->lib_name) != 0 ||
+        info->dlpi_name[len - data->lib_name_len - 1] != '/') {
+      return 0;
+    }
+    auto library = static_cast<Library *>(data->library);
+    library->path = info->dlpi_name;
+    library->build_id = ReadBuildId(info);
+    library->load_base = info->dlpi_addr;
+    return 1;
+  };
+  return dl_iterate_phdr(callback, &data) != 0;
+}
+
+bool SymbolCache::LoadCacheFile(const Library &library, Offsets *offsets) {
+  FILE *file = fopen(cache_file_.c_str(), "re");
+  if (file == nullptr) {
+    return false;
+  }
+  char line[512];
+  bool valid = false;
+  // Magic, path and build-id must match before any offset is taken
+  if (fgets(line, sizeof(line), file) != nullptr &&
+      strncmp(line, kCacheMagic, strlen(kCacheMagic)) == 0 &&
+      fgets(line, sizeof(line), file) != nullptr &&
+      library.path + "\n" == line &&
+      fgets(line, sizeof(line), file) != nullptr &&
+      library.build_id + "\n" == line) {
+    valid = true;
+    while (fgets(line, sizeof(line), file) != nullptr) {
+      uint64_t offset;
+      char name[sizeof(line)];
+      if (sscanf(line, "%" SCNx64 " %511s", &offset, name) == 2) {
+        (*offsets)[name] = static_cast<ElfW(Addr)>(offset);
+      }
+    }
+  }
+  fclose(file);
+  if (!valid) {
+    __android_log_print(ANDROID_LOG_INFO, LOG_TAG,
+                        "%s is for another build of %s", cache_file_.c_str(),
+                        library.path.c_str());
+  }
+  return valid;
+}
+
+void SymbolCache::StoreCacheFile(const Library &library,
+                                 const Offsets &offsets) {
+  // Written aside and renamed, a crash never leaves half a file behind
+  std::string temp = cache_file_ + ".tmp";
+  FILE *file = fopen(temp.c_str(), "we");
+  if (file == nullptr) {
+    __android_log_print(ANDROID_LOG_WARN, LOG_TAG, "open %s: %s",
+                        temp.c_str(), strerror(errno));
+    return;
+  }
+  fprintf(file, "%s\n%s\n%s\n", kCacheMagic, library.path.c_str(),
+          library.build_id.c_str());
+  for (const auto &offset : offsets) {
+    fprintf(file, "%" PRIx64 " %s\n", static_cast<uint64_t>(offset.second),
+            offset.first.c_str());
+  }
+  bool written = fflush(file) == 0;
+  written = fclose(file) == 0 && written;
+  if (!written || rename(temp.c_str(), cache_file_.c_str()) != 0) {
+    __android_log_print(ANDROID_LOG_WARN, LOG_TAG, "write %s: %s",
+                        cache_file_.c_str(), strerror(errno));
+    unlink(temp.c_str());
+  }
+}
+
+bool SymbolCache::ResolveElf(const char *lib_name, Library *library,
+                             const char *const *names, size_t count,
+                             Offsets *offsets) {
+  std::unique_ptr<void, decltype(&DlFcn::dlclose_elf)> handle(
+      DlFcn::dlopen_elf(lib_name, RTLD_NOW), DlFcn::dlclose_elf);
+  if (!handle) {
+    return false;
+  }
+  ElfW(Addr) load_base =
+      reinterpret_cast<DlFcn::SoDlInfo *>(handle.get())->load_base;
+  if (library->load_base == 0) {
+    library->load_base = load_base;
+  } else if (library->load_base != load_base) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG,
+                        "%s: load base %p in maps, %p loaded", lib_name,
+                        reinterpret_cast<void *>(load_base),
+                        reinterpret_cast<void *>(library->load_base));
+    return false;
+  }
+  // 只用预编译 libkwai-android-base.so 导出的 dlsym_elf，每个名字解析一次
+  for (size_t i = 0; i < count; i++) {
+    void *address = DlFcn::dlsym_elf(handle.get(), names[i]);
+    if (address != nullptr) {
+      (*offsets)[names[i]] = reinterpret_cast<ElfW(Addr)>(address) - load_base;
+    }
+  }
+  return true;
+}
+
+static bool Complete(const std::map<std::string, ElfW(Addr)> &offsets,
+                     const char *const *names, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (offsets.find(names[i]) == offsets.end()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SymbolCache::Resolve(const char *lib_name, const char *const *names,
+                          size_t count, void **addresses) {
+  uint64_t start = DumpClockNs();
+  pthread_mutex_lock(&mutex_);
+  Library library{};
+  // Without a build-id nothing tells a stale offset apart, nothing is kept
+  bool cacheable =
+      FindLoaded(lib_name, &library) && !library.build_id.empty();
+  Offsets uncached;
+  Offsets *offsets = cacheable
+                         ? &libraries_[library.path + "\n" + library.build_id]
+                         : &uncached;
+  const char *source = "memory";
+  if (!Complete(*offsets, names, count) && offsets->empty() &&
+      cacheable && !cache_file_.empty() &&
+      LoadCacheFile(library, offsets)) {
+    source = "file";
+  }
+  if (!Complete(*offsets, names, count)) {
+    source = "elf";
+    size_t known = offsets->size();
+    if (ResolveElf(lib_name, &library, names, count, offsets) && cacheable &&
+        !cache_file_.empty() && offsets->size() != known) {
+      StoreCacheFile(library, *offsets);
+    }
+  }
+
+  size_t found = 0;
+  for (size_t i = 0; i < count; i++) {
+    auto offset = offsets->find(names[i]);
+    addresses[i] = offset != offsets->end()
+                       ? reinterpret_cast<void *>(library.load_base +
+                                                  offset->second)
+                       : nullptr;
+    found += addresses[i] != nullptr;
+  }
+  pthread_mutex_unlock(&mutex_);
+  __android_log_print(ANDROID_LOG_INFO, LOG_TAG,
+                      "%zu/%zu symbols of %s from %s in %" PRIu64 " us", found,
+                      count, lib_name, source, (DumpClockNs() - start) / 1000);
+  return found == count;
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
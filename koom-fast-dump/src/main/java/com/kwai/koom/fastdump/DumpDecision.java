@@ -0,0 +1,57 @@
+/*
+ * Copyright 2020 Kwai, Inc. All rights reserved.
+ * <p>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * <p>
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * <p>
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.kwai.koom.fastdump;
+
+import androidx.annotation.NonNull;
+
+/**
+ * One entry of the dump scheduler's decision ring, see dump_scheduler.h. A request that was
+ * started shows up again with its result.
+ */
+public final class DumpDecision {
+  public static final int STARTED = 0;
+  public static final int QUEUED = 1;
+  public static final int SUPERSEDED = 2;
+  public static final int REFUSED_SESSION_BUDGET = 3;
+  public static final int REFUSED_DAY_BUDGET = 4;
+  public static final int REFUSED_NO_GROWTH = 5;
+  public static final int REFUSED_LOW_DISK = 6;
+  public static final int REFUSED_LOW_RAM = 7;
+  public static final int SUCCEEDED = 8;
+  public static final int FAILED = 9;
+
+  /** Wall clock. */
+  public final long timeMs;
+  /** The caller's code passed to {@link ForkJvmHeapDumper#requestDump}. */
+  public final int trigger;
+  public final int decision;
+  public final long heapBytes;
+
+  DumpDecision(long[] values, int offset) {
+    timeMs = values[offset];
+    trigger = (int) values[offset + 1];
+    decision = (int) values[offset + 2];
+    heapBytes = values[offset + 3];
+  }
+
+  @NonNull
+  @Override
+  public String toString() {
+    return "DumpDecision{time=" + timeMs + ", trigger=" + trigger + ", decision=" + decision
+        + ", heap=" + heapBytes / 1024 + "KB}";
+  }
+}
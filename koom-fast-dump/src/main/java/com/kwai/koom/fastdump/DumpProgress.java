@@ -0,0 +1,55 @@
+/*
+ * Copyright 2020 Kwai, Inc. All rights reserved.
+ * <p>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * <p>
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * <p>
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.kwai.koom.fastdump;
+
+import androidx.annotation.NonNull;
+
+/**
+ * Snapshot of what the forked dump process is doing, read from memory it shares with this
+ * process, see dump_stats.h. Safe to poll from any thread while a dump is running.
+ */
+public final class DumpProgress {
+  public static final int PHASE_IDLE = 0;
+  public static final int PHASE_DUMPING = 1;
+  public static final int PHASE_DONE = 2;
+
+  public final int phase;
+  public final int pid;
+  public final long elapsedNs;
+  public final long bytesWritten;
+  /** CPU time the dumping thread used. */
+  public final long cpuNs;
+  /** Time since bytesWritten or cpuNs last moved, a growing value means a stuck dump. */
+  public final long idleNs;
+
+  DumpProgress(long[] values) {
+    phase = (int) values[0];
+    pid = (int) values[1];
+    elapsedNs = values[2];
+    bytesWritten = values[3];
+    cpuNs = values[4];
+    idleNs = values[5];
+  }
+
+  @NonNull
+  @Override
+  public String toString() {
+    return "DumpProgress{phase=" + phase + ", pid=" + pid + ", elapsed=" + elapsedNs / 1000000
+        + "ms, bytes=" + bytesWritten + ", cpu=" + cpuNs / 1000000 + "ms, idle="
+        + idleNs / 1000000 + "ms}";
+  }
+}
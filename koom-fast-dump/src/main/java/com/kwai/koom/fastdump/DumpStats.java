@@ -0,0 +1,81 @@
+/*
+ * Copyright 2020 Kwai, Inc. All rights reserved.
+ * <p>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * <p>
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * <p>
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.kwai.koom.fastdump;
+
+import androidx.annotation.NonNull;
+
+/**
+ * Phase timing of the last {@link ForkJvmHeapDumper} dump, see dump_stats.h. Times are in
+ * nanoseconds, 0 if the phase did not happen. The app is frozen for {@link #pauseNs}.
+ */
+public final class DumpStats {
+  /** Values of {@link #endReason}, see dump_watchdog.h. */
+  public static final int END_EXITED = 0;
+  public static final int END_IDLE = 1;
+  public static final int END_TIMEOUT = 2;
+  public static final int END_CANCELLED = 3;
+  public static final int END_LOST = 4;
+
+  /** Symbol lookup, once per process. */
+  public final long initNs;
+  /** Marking mappings for {@link ForkJvmHeapDumper#setForkExclusions}, before the pause. */
+  public final long excludeNs;
+  public final long excludedBytes;
+  /** Waiting for a running GC before suspending, 0 below Android R. */
+  public final long gcCriticalSectionNs;
+  public final long suspendNs;
+  public final long forkNs;
+  public final long resumeNs;
+  public final long pauseNs;
+  /** DumpHeap in the forked process. */
+  public final long childDumpNs;
+  /** From resume until the forked process exited. */
+  public final long waitNs;
+  /** Bytes the forked process wrote, the stripped size when stripping in it. */
+  public final long bytesWritten;
+  /** Raw waitpid status, -1 if the forked process was not waited for. */
+  public final int exitStatus;
+  /** Whether the forked process exited by itself or why the watchdog killed it. */
+  public final int endReason;
+
+  DumpStats(long[] values) {
+    initNs = values[0];
+    excludeNs = values[1];
+    excludedBytes = values[2];
+    gcCriticalSectionNs = values[3];
+    suspendNs = values[4];
+    forkNs = values[5];
+    resumeNs = values[6];
+    pauseNs = values[7];
+    childDumpNs = values[8];
+    waitNs = values[9];
+    bytesWritten = values[10];
+    exitStatus = (int) values[11];
+    endReason = (int) values[12];
+  }
+
+  @NonNull
+  @Override
+  public String toString() {
+    return "DumpStats{pause=" + pauseNs / 1000 + "us, gcCriticalSection="
+        + gcCriticalSectionNs / 1000 + "us, suspend=" + suspendNs / 1000 + "us, fork="
+        + forkNs / 1000 + "us, excluded=" + excludedBytes / 1024 + "KB in " + excludeNs / 1000
+        + "us, resume=" + resumeNs / 1000 + "us, childDump=" + childDumpNs / 1000000
+        + "ms, wait=" + waitNs / 1000000 + "ms, bytes=" + bytesWritten + ", exitStatus="
+        + exitStatus + ", endReason=" + endReason + ", init=" + initNs / 1000 + "us}";
+  }
+}
@@ -23,15 +23,54 @@ package com.kwai.koom.fastdump;
 import static com.kwai.koom.base.Monitor_ApplicationKt.sdkVersionMatch;
 import static com.kwai.koom.base.Monitor_SoKt.loadSoQuietly;
 
+import java.util.ArrayList;
+import java.util.List;
+
 import android.text.TextUtils;
 
 import androidx.annotation.NonNull;
+import androidx.annotation.Nullable;
 
 import com.kwai.koom.base.MonitorLog;
 
 public class ForkJvmHeapDumper implements HeapDumper {
   private static final String TAG = "OOMMonitor_ForkJvmHeapDumper";
-  private boolean mLoadSuccess;
+
+  /**
+   * Region classes of {@link #setForkExclusions(int, long)}, see fork_footprint.h.
+   */
+  public static final int EXCLUDE_LARGE_ANONYMOUS = 1;
+  public static final int EXCLUDE_ASHMEM = 1 << 1;
+  public static final int EXCLUDE_GRAPHICS = 1 << 2;
+  public static final int EXCLUDE_OWN_BUFFERS = 1 << 3;
+  private volatile boolean mLoadSuccess;
+  private int mForkExclusions;
+  private long mMinAnonymousBytes;
+  private boolean mLittleCores;
+  private int mChildNice;
+  private boolean mIdleCpu;
+  private boolean mIdleIo;
+  private long mWriteBytesPerSecond;
+  private int mIdleTimeoutMs = 30 * 1000;
+  private int mMaxDurationMs;
+  private int mSessionBudget = 2;
+  private int mDayBudget = 5;
+  private long mMinGrowthBytes = 32L * 1024 * 1024;
+  private long mMinFreeDiskBytes = 1024L * 1024 * 1024;
+  private long mMinFreeRamBytes = 256L * 1024 * 1024;
+  private String mSchedulerStateFile;
+  private String mSymbolCacheFile;
+
+  /**
+   * Result of {@link #dumpAsync(String, DumpListener)}.
+   */
+  public interface DumpListener {
+    /**
+     * Called on a native thread once the forked process is gone, must not start the next
+     * dump itself.
+     */
+    void onDumpFinished(boolean success);
+  }
 
   private static class Holder {
     private static final ForkJvmHeapDumper INSTANCE = new ForkJvmHeapDumper();
@@ -49,10 +88,169 @@ public class ForkJvmHeapDumper implements HeapDumper {
     }
     if (loadSoQuietly("koom-fast-dump")) {
       mLoadSuccess = true;
+      if (mSymbolCacheFile != null) {
+        nativeSetSymbolCache(mSymbolCacheFile);
+      }
       nativeInit();
     }
   }
 
+  /**
+   * Keeps the offsets of the ART symbols the dump needs in file, for example under
+   * Context#getCacheDir(). The next launch then skips parsing libart.so, an update of it is
+   * detected by its build-id. Only takes effect before the first dump or {@link #prepare()}.
+   */
+  public synchronized void setSymbolCacheFile(@Nullable String file) {
+    mSymbolCacheFile = file;
+  }
+
+  /**
+   * Loads the library and resolves the ART symbols ahead of the first dump, which otherwise
+   * does it right before suspending the app. Blocks, call it off the main thread.
+   */
+  public synchronized void prepare() {
+    if (sdkVersionMatch()) {
+      init();
+    }
+  }
+
+  /**
+   * Keeps mappings of the given classes out of the forked process so that fork() copies
+   * fewer page tables while the app is suspended. Mappings the dump reads (Java heap, ART,
+   * malloc, stacks, code) are never excluded, if the forked process touches an excluded
+   * one anyway only the dump fails. 0 disables it, the default.
+   *
+   * @param regionClasses      EXCLUDE_* flags
+   * @param minAnonymousBytes  smallest mapping of {@link #EXCLUDE_LARGE_ANONYMOUS}
+   */
+  public synchronized void setForkExclusions(int regionClasses, long minAnonymousBytes) {
+    mForkExclusions = regionClasses;
+    mMinAnonymousBytes = minAnonymousBytes;
+  }
+
+  /**
+   * Lowers the priority of the forked process so that the resumed app keeps its frame rate,
+   * the dump takes longer in exchange. All off by default, see dump_throttle.h.
+   *
+   * @param littleCores         run on the slowest cluster
+   * @param nice                setpriority() value, 0 keeps the app's
+   * @param idleCpu             SCHED_IDLE, only run when the cpu is otherwise idle
+   * @param idleIo              idle io priority class
+   * @param writeBytesPerSecond pace of {@link #dumpToStream}, 0 unlimited. File dumps are
+   *                            written by ART directly and are not paced.
+   */
+  public synchronized void setChildThrottle(boolean littleCores, int nice, boolean idleCpu,
+      boolean idleIo, long writeBytesPerSecond) {
+    mLittleCores = littleCores;
+    mChildNice = nice;
+    mIdleCpu = idleCpu;
+    mIdleIo = idleIo;
+    mWriteBytesPerSecond = writeBytesPerSecond;
+  }
+
+  /**
+   * Limits of the forked process, see dump_watchdog.h. It is killed once it made no
+   * progress (neither wrote nor computed) for idleTimeoutMs, or ran longer than
+   * maxDurationMs. 0 disables a limit, the defaults are 30 s idle and no maximum.
+   */
+  public synchronized void setWatchdog(int idleTimeoutMs, int maxDurationMs) {
+    mIdleTimeoutMs = idleTimeoutMs;
+    mMaxDurationMs = maxDurationMs;
+  }
+
+  /**
+   * Limits of {@link #requestDump(String, int, long)}, 0 disables each. Defaults: 2 dumps per
+   * process, 5 per day, 32 MB of heap growth between dumps, 1 GB of free disk and 256 MB of
+   * available RAM.
+   *
+   * @param stateFile keeps the count of the day across processes, without one the day budget
+   *                  only counts this process
+   */
+  public synchronized void setScheduler(int sessionBudget, int dayBudget, long minGrowthBytes,
+      long minFreeDiskBytes, long minFreeRamBytes, @Nullable String stateFile) {
+    mSessionBudget = sessionBudget;
+    mDayBudget = dayBudget;
+    mMinGrowthBytes = minGrowthBytes;
+    mMinFreeDiskBytes = minFreeDiskBytes;
+    mMinFreeRamBytes = minFreeRamBytes;
+    mSchedulerStateFile = stateFile;
+  }
+
+  /**
+   * Dump for a trigger that may fire repeatedly, for example a heap threshold. Returns at once
+   * with a {@link DumpDecision} code: STARTED and QUEUED dumps run one after the other on a
+   * native thread, the others were refused. The outcome is in {@link #getDumpDecisions()}.
+   *
+   * @param trigger   caller defined reason, only recorded
+   * @param heapBytes heap size that fired the trigger, compared against the last dump
+   */
+  public synchronized int requestDump(String path, int trigger, long heapBytes) {
+    MonitorLog.i(TAG, "requestDump " + path + " trigger " + trigger);
+    if (!sdkVersionMatch()) {
+      throw new UnsupportedOperationException("dump failed caused by sdk version not supported!");
+    }
+    init();
+    if (!mLoadSuccess || TextUtils.isEmpty(path)) {
+      MonitorLog.e(TAG, "dump failed caused by so not loaded or empty path!");
+      return DumpDecision.FAILED;
+    }
+
+    applySettings();
+    return nativeRequestDump(path, trigger, heapBytes);
+  }
+
+  /**
+   * The scheduler's latest decisions, oldest first.
+   */
+  @NonNull
+  public List<DumpDecision> getDumpDecisions() {
+    List<DumpDecision> decisions = new ArrayList<>();
+    if (!mLoadSuccess) {
+      return decisions;
+    }
+    long[] values = dumpDecisions();
+    for (int offset = 0; values != null && offset + 4 <= values.length; offset += 4) {
+      decisions.add(new DumpDecision(values, offset));
+    }
+    return decisions;
+  }
+
+  /**
+   * Kills the running dump, the dump then reports failure. Callable from any thread.
+   */
+  public void cancel() {
+    if (mLoadSuccess) {
+      cancelDump();
+    }
+  }
+
+  /**
+   * Like {@link #dump(String)} but returns once the app is resumed, the result is delivered
+   * to listener. Returns false if the dump could not start, listener is not called then.
+   * {@link #getLastDumpStats()} is complete once listener was called.
+   */
+  public synchronized boolean dumpAsync(String path, @NonNull DumpListener listener) {
+    MonitorLog.i(TAG, "dumpAsync " + path);
+    if (!sdkVersionMatch()) {
+      throw new UnsupportedOperationException("dump failed caused by sdk version not supported!");
+    }
+    init();
+    if (!mLoadSuccess) {
+      MonitorLog.e(TAG, "dump failed caused by so not loaded!");
+      return false;
+    }
+
+    if (TextUtils.isEmpty(path)) {
+      MonitorLog.e(TAG, "dump failed caused by empty path!");
+      return false;
+    }
+
+    applySettings();
+    boolean started = forkDumpAsync(path, listener);
+    MonitorLog.i(TAG, String.format("dump to %s %s", path, started ? "started" : "failure"));
+    return started;
+  }
+
   @Override
   public synchronized boolean dump(String path) {
     MonitorLog.i(TAG, "dump " + path);
@@ -70,15 +268,110 @@ public class ForkJvmHeapDumper implements HeapDumper {
       return false;
     }
 
+    applySettings();
     boolean dumpRes = forkDump(path, true);
     MonitorLog.i(TAG, String.format("dump to %s %s %s", path, "and wait", dumpRes ? "success" : "failure"));
+    MonitorLog.i(TAG, String.valueOf(getLastDumpStats()));
     return dumpRes;
   }
 
+  /**
+   * Like {@link #dump(String)} but the forked process writes the hprof into a pipe, and
+   * {@code processor} consumes it in this process while it is dumped, so the raw hprof
+   * is never written to disk.
+   *
+   * @param processor      address of a native HprofStreamProcessor (see hprof_stream.h),
+   *                       0 writes the raw hprof to path
+   * @param pipeBufferSize bytes the forked process may write ahead of the processor
+   *                       before it blocks, 0 keeps the system default (64 KB)
+   */
+  public synchronized boolean dumpToStream(String path, long processor, int pipeBufferSize) {
+    MonitorLog.i(TAG, "dumpToStream " + path);
+    if (!sdkVersionMatch()) {
+      throw new UnsupportedOperationException("dump failed caused by sdk version not supported!");
+    }
+    init();
+    if (!mLoadSuccess) {
+      MonitorLog.e(TAG, "dump failed caused by so not loaded!");
+      return false;
+    }
+
+    if (TextUtils.isEmpty(path)) {
+      MonitorLog.e(TAG, "dump failed caused by empty path!");
+      return false;
+    }
+
+    applySettings();
+    boolean dumpRes = forkDumpToStream(path, processor, pipeBufferSize);
+    MonitorLog.i(TAG, String.format("stream dump to %s %s", path, dumpRes ? "success" : "failure"));
+    MonitorLog.i(TAG, String.valueOf(getLastDumpStats()));
+    return dumpRes;
+  }
+
+  /**
+   * Phase timing of the last dump, null if the native library is not loaded.
+   */
+  @Nullable
+  public synchronized DumpStats getLastDumpStats() {
+    if (!mLoadSuccess) {
+      return null;
+    }
+    long[] values = lastDumpStats();
+    return values != null ? new DumpStats(values) : null;
+  }
+
+  /**
+   * Progress of the running or last dump, not synchronized so that it can be polled while
+   * {@link #dump(String)} blocks another thread. Null if not available.
+   */
+  @Nullable
+  public DumpProgress getDumpProgress() {
+    if (!mLoadSuccess) {
+      return null;
+    }
+    long[] values = dumpProgress();
+    return values != null ? new DumpProgress(values) : null;
+  }
+
+  private void applySettings() {
+    nativeSetForkExclusions(mForkExclusions, mMinAnonymousBytes);
+    nativeSetChildPolicy(mLittleCores, mChildNice, mIdleCpu, mIdleIo, mWriteBytesPerSecond);
+    nativeSetWatchdog(mIdleTimeoutMs, mMaxDurationMs);
+    nativeSetScheduler(mSessionBudget, mDayBudget, mMinGrowthBytes, mMinFreeDiskBytes,
+        mMinFreeRamBytes, mSchedulerStateFile);
+  }
+
   /**
    * Init before do dump.
    */
   private native void nativeInit();
 
+  private native void nativeSetSymbolCache(@NonNull String file);
+
   private native boolean forkDump(@NonNull String path, boolean waitPid);
+
+  private native boolean forkDumpToStream(@NonNull String path, long processor,
+      int pipeBufferSize);
+
+  private native void nativeSetForkExclusions(int regionClasses, long minAnonymousBytes);
+
+  private native void nativeSetChildPolicy(boolean littleCores, int nice, boolean idleCpu,
+      boolean idleIo, long writeBytesPerSecond);
+
+  private native void nativeSetWatchdog(int idleTimeoutMs, int maxDurationMs);
+
+  private native boolean forkDumpAsync(@NonNull String path, @NonNull DumpListener listener);
+
+  private native void cancelDump();
+
+  private native void nativeSetScheduler(int sessionBudget, int dayBudget, long minGrowthBytes,
+      long minFreeDiskBytes, long minFreeRamBytes, @Nullable String stateFile);
+
+  private native int nativeRequestDump(@NonNull String path, int trigger, long heapBytes);
+
+  private native long[] dumpDecisions();
+
+  private native long[] lastDumpStats();
+
+  private native long[] dumpProgress();
 }
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <android/log.h>
+#include <async_writer.h>
+#include <sys/prctl.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#define LOG_TAG "HprofCrop"
+
+namespace kwai {
+namespace leak_monitor {
+
+static constexpr size_t kPageSize = 4096;
+
+static uint64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void SemWait(sem_t *sem) {
+  while (sem_wait(sem) != 0 && errno == EINTR) {
+  }
+}
+
+AsyncWriter::AsyncWriter()
+    : fill_index_(0),
+      filling_(nullptr),
+      drain_index_(0),
+      worker_(),
+      running_(false),
+      failed_(false),
+      error_(0),
+      consumer_(nullptr),
+      arg_(nullptr),
+      max_stall_ns_(0) {
+  memset(buffers_, 0, sizeof(buffers_));
+}
+
+AsyncWriter::~AsyncWriter() {
+  if (running_) Finish();
+  FreeBuffers();
+}
+
+void AsyncWriter::FreeBuffers() {
+  for (auto &buffer : buffers_) {
+    free(buffer.data);
+    buffer = {nullptr, 0};
+  }
+}
+
+bool AsyncWriter::Start(Consumer consumer, void *arg) {
+  if (running_) return false;
+  for (auto &buffer : buffers_) {
+    if (buffer.data == nullptr &&
+        posix_memalign(reinterpret_cast<void **>(&buffer.data), kPageSize,
+                       kBufferSize) != 0) {
+      buffer.data = nullptr;
+      FreeBuffers();
+      return false;
+    }
+    buffer.size = 0;
+  }
+  sem_init(&free_, 0, kBufferCount);
+  sem_init(&filled_, 0, 0);
+  fill_index_ = 0;
+  filling_ = nullptr;
+  drain_index_ = 0;
+  failed_ = false;
+  error_ = 0;
+  consumer_ = consumer;
+  arg_ = arg;
+  max_stall_ns_ = 0;
+  int error = pthread_create(&worker_, nullptr, Trampoline, this);
+  if (error != 0) {
+    // fork 出的子进程里创建线程可能失败，调用方退回同步写
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG,
+                        "create writer thread failed %d", error);
+    sem_destroy(&free_);
+    sem_destroy(&filled_);
+    return false;
+  }
+  running_ = true;
+  return true;
+}
+
+void *AsyncWriter::Trampoline(void *arg) {
+  prctl(PR_SET_NAME, "koom-hprof-writer");
+  static_cast<AsyncWriter *>(arg)->Loop();
+  return nullptr;
+}
+
+void AsyncWriter::Loop() {
+  while (true) {
+    SemWait(&filled_);
+    Buffer &buffer = buffers_[drain_index_];
+    drain_index_ = (drain_index_ + 1) % kBufferCount;
+    if (buffer.size == 0) return;
+    if (!failed_) {
+      errno = 0;
+      if (!consumer_(arg_, buffer.data, buffer.size)) {
+        // 先存 errno 再置 failed_，写线程看到失败时一定能拿到它
+        error_ = errno != 0 ? errno : EIO;
+        failed_ = true;
+      }
+    }
+    buffer.size = 0;
+    sem_post(&free_);
+  }
+}
+
+AsyncWriter::Buffer *AsyncWriter::AcquireBuffer() {
+  if (filling_ == nullptr) {
+    uint64_t start = NowNs();
+    SemWait(&free_);
+    uint64_t stall = NowNs() - start;
+    if (stall > max_stall_ns_) max_stall_ns_ = stall;
+    filling_ = &buffers_[fill_index_];
+    fill_index_ = (fill_index_ + 1) % kBufferCount;
+  }
+  return filling_;
+}
+
+void AsyncWriter::Submit() {
+  filling_ = nullptr;
+  sem_post(&filled_);
+}
+
+bool AsyncWriter::Write(const uint8_t *data, size_t size) {
+  while (size > 0 && !failed_) {
+    Buffer *buffer = AcquireBuffer();
+    size_t n = kBufferSize - buffer->size;
+    if (n > size) n = size;
+    memcpy(buffer->data + buffer->size, data, n);
+    buffer->size += n;
+    data += n;
+    size -= n;
+    if (buffer->size == kBufferSize) Submit();
+  }
+  return !failed_;
+}
+
+bool AsyncWriter::Finish() {
+  if (!running_) return !failed_;
+  if (filling_ != nullptr && filling_->size > 0) Submit();
+  // 空 buffer 通知 worker 退出
+  Buffer *quit = AcquireBuffer();
+  quit->size = 0;
+  Submit();
+  pthread_join(worker_, nullptr);
+  sem_destroy(&free_);
+  sem_destroy(&filled_);
+  FreeBuffers();
+  running_ = false;
+  return !failed_;
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
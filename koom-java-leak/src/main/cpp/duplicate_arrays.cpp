@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <android-base/macros.h>
+#include <duplicate_arrays.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <vector>
+
+namespace kwai {
+namespace leak_monitor {
+
+static const char *ElementName(uint8_t type) {
+  switch (type) {
+    case hprof_basic_boolean:
+      return "boolean";
+    case hprof_basic_char:
+      return "char";
+    case hprof_basic_float:
+      return "float";
+    case hprof_basic_double:
+      return "double";
+    case hprof_basic_byte:
+      return "byte";
+    case hprof_basic_short:
+      return "short";
+    case hprof_basic_int:
+      return "int";
+    case hprof_basic_long:
+      return "long";
+    default:
+      return "unknown";
+  }
+}
+
+static uint32_t ElementSize(uint8_t type) {
+  switch (type) {
+    case hprof_basic_char:
+    case hprof_basic_short:
+      return 2;
+    case hprof_basic_float:
+    case hprof_basic_int:
+      return 4;
+    case hprof_basic_double:
+    case hprof_basic_long:
+      return 8;
+    default:
+      return 1;
+  }
+}
+
+void DuplicateArrayDetector::Reset(size_t min_bytes, uint32_t heap_mask) {
+  min_bytes_ = min_bytes;
+  heap_mask_ = heap_mask;
+  current_ = {};
+  entries_.clear();
+}
+
+void DuplicateArrayDetector::OnString(uint64_t id ATTRIBUTE_UNUSED,
+                                      const uint8_t *utf8 ATTRIBUTE_UNUSED,
+                                      size_t size ATTRIBUTE_UNUSED,
+                                      bool kept ATTRIBUTE_UNUSED,
+                                      uint64_t position ATTRIBUTE_UNUSED) {}
+
+void DuplicateArrayDetector::OnLoadClass(uint64_t class_id ATTRIBUTE_UNUSED,
+                                         uint64_t name_id ATTRIBUTE_UNUSED) {}
+
+bool DuplicateArrayDetector::OnObject(const HprofObject &object,
+                                      bool kept ATTRIBUTE_UNUSED,
+                                      uint64_t position ATTRIBUTE_UNUSED) {
+  if (object.tag != HPROF_PRIMITIVE_ARRAY_DUMP || object.size < min_bytes_ ||
+      (heap_mask_ & (1u << object.heap)) == 0) {
+    return false;
+  }
+  current_ = object;
+  hash_.Reset();
+  return true;
+}
+
+void DuplicateArrayDetector::OnObjectBody(const uint8_t *data, size_t size) {
+  hash_.Update(data, size);
+}
+
+void DuplicateArrayDetector::OnObjectEnd() {
+  // 长度已经参与了 hash，类型不同但字节相同的数组另外区分开
+  const uint64_t key = hash_.Final() ^ current_.element_type;
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    it->second.count++;
+  } else if (entries_.size() < kMaxEntries) {
+    const auto length =
+        (uint32_t)(current_.size / ElementSize(current_.element_type));
+    entries_[key] = {1, length, current_.element_type, current_.id};
+  }
+}
+
+std::string DuplicateArrayDetector::Summary(size_t top) const {
+  struct Row {
+    const Entry *entry;
+    uint64_t wasted;
+  };
+  std::vector<Row> rows;
+  uint64_t duplicates = 0;
+  uint64_t wasted = 0;
+  for (auto &it : entries_) {
+    const Entry &entry = it.second;
+    if (entry.count < 2) continue;
+    const uint64_t bytes = (uint64_t)entry.length *
+                           ElementSize(entry.element_type) * (entry.count - 1);
+    rows.push_back({&entry, bytes});
+    duplicates += entry.count;
+    wasted += bytes;
+  }
+
+  size_t count = std::min(top, rows.size());
+  std::partial_sort(rows.begin(), rows.begin() + count, rows.end(),
+                    [](const Row &a, const Row &b) {
+                      if (a.wasted != b.wasted) return a.wasted > b.wasted;
+                      return a.entry->first_id < b.entry->first_id;
+                    });
+
+  std::string summary = "# koom duplicate arrays 1\n";
+  char line[128];
+  snprintf(line, sizeof(line), "total\t%zu\t%" PRIu64 "\t%" PRIu64 "\n",
+           rows.size(), duplicates, wasted);
+  summary += line;
+  for (size_t i = 0; i < count; i++) {
+    const Entry &entry = *rows[i].entry;
+    snprintf(line, sizeof(line),
+             "%" PRIu32 "\t%" PRIu64 "\t%s[%" PRIu32 "]\t0x%" PRIx64 "\n",
+             entry.count, rows[i].wasted, ElementName(entry.element_type),
+             entry.length, entry.first_id);
+    summary += line;
+  }
+  return summary;
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
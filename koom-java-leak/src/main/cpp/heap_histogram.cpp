@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <android-base/macros.h>
+#include <heap_histogram.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+namespace kwai {
+namespace leak_monitor {
+
+static const char *PrimitiveArrayName(uint8_t type) {
+  switch (type) {
+    case hprof_basic_boolean:
+      return "boolean[]";
+    case hprof_basic_char:
+      return "char[]";
+    case hprof_basic_float:
+      return "float[]";
+    case hprof_basic_double:
+      return "double[]";
+    case hprof_basic_byte:
+      return "byte[]";
+    case hprof_basic_short:
+      return "short[]";
+    case hprof_basic_int:
+      return "int[]";
+    case hprof_basic_long:
+      return "long[]";
+    default:
+      return nullptr;
+  }
+}
+
+void HeapHistogram::Reset(uint32_t heap_mask) {
+  heap_mask_ = heap_mask;
+  string_data_.clear();
+  strings_.clear();
+  class_names_.clear();
+  classes_.clear();
+  for (auto &entry : primitive_arrays_) entry = {0, 0};
+  last_class_id_ = 0;
+  last_entry_ = nullptr;
+}
+
+void HeapHistogram::OnString(uint64_t id, const uint8_t *utf8, size_t size,
+                             bool kept ATTRIBUTE_UNUSED,
+                             uint64_t position ATTRIBUTE_UNUSED) {
+  strings_[id] = {(uint32_t)string_data_.size(), (uint32_t)size};
+  string_data_.insert(string_data_.end(), utf8, utf8 + size);
+}
+
+void HeapHistogram::OnLoadClass(uint64_t class_id, uint64_t name_id) {
+  class_names_[class_id] = name_id;
+}
+
+bool HeapHistogram::OnObject(const HprofObject &object,
+                             bool kept ATTRIBUTE_UNUSED,
+                             uint64_t position ATTRIBUTE_UNUSED) {
+  if ((heap_mask_ & (1u << object.heap)) == 0) return false;
+  Entry *entry;
+  switch (object.tag) {
+    case HPROF_INSTANCE_DUMP:
+    case HPROF_OBJECT_ARRAY_DUMP:
+      if (last_entry_ == nullptr || object.class_id != last_class_id_) {
+        last_class_id_ = object.class_id;
+        last_entry_ = &classes_[object.class_id];
+      }
+      entry = last_entry_;
+      break;
+    case HPROF_PRIMITIVE_ARRAY_DUMP:
+      entry = &primitive_arrays_[object.element_type];
+      break;
+    default:
+      return false;
+  }
+  entry->count++;
+  entry->bytes += object.size;
+  return false;
+}
+
+std::string HeapHistogram::ClassName(uint64_t class_id) const {
+  auto name = class_names_.find(class_id);
+  if (name != class_names_.end()) {
+    auto string = strings_.find(name->second);
+    if (string != strings_.end()) {
+      return std::string(string_data_.data() + string->second.offset,
+                         string->second.size);
+    }
+  }
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "0x%" PRIx64, class_id);
+  return buffer;
+}
+
+std::string HeapHistogram::Summary(size_t top) const {
+  struct Row {
+    const Entry *entry;
+    uint64_t class_id;
+    const char *primitive_name;
+  };
+  std::vector<Row> rows;
+  rows.reserve(classes_.size() + hprof_basic_long + 1);
+  Entry total = {0, 0};
+  for (auto &it : classes_) {
+    rows.push_back({&it.second, it.first, nullptr});
+  }
+  for (uint8_t type = 0; type <= hprof_basic_long; type++) {
+    const Entry &entry = primitive_arrays_[type];
+    if (entry.count > 0) {
+      rows.push_back({&entry, 0, PrimitiveArrayName(type)});
+    }
+  }
+  for (auto &row : rows) {
+    total.count += row.entry->count;
+    total.bytes += row.entry->bytes;
+  }
+
+  size_t count = std::min(top, rows.size());
+  std::partial_sort(rows.begin(), rows.begin() + count, rows.end(),
+                    [](const Row &a, const Row &b) {
+                      if (a.entry->bytes != b.entry->bytes) {
+                        return a.entry->bytes > b.entry->bytes;
+                      }
+                      return a.entry->count > b.entry->count;
+                    });
+
+  std::string summary = "# koom heap histogram 1\n";
+  char line[64];
+  snprintf(line, sizeof(line), "total\t%" PRIu64 "\t%" PRIu64 "\t%zu\n",
+           total.count, total.bytes, rows.size());
+  summary += line;
+  for (size_t i = 0; i < count; i++) {
+    const Row &row = rows[i];
+    snprintf(line, sizeof(line), "%" PRIu64 "\t%" PRIu64 "\t",
+             row.entry->count, row.entry->bytes);
+    summary += line;
+    summary += row.primitive_name != nullptr ? row.primitive_name
+                                             : ClassName(row.class_id);
+    summary += '\n';
+  }
+  return summary;
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
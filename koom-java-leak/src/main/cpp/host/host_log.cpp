@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <android/log.h>
+
+#include <cstdarg>
+#include <cstdio>
+
+static int min_priority = ANDROID_LOG_INFO;
+
+void koom_host_log_set_min_priority(int prio) { min_priority = prio; }
+
+int __android_log_print(int prio, const char *tag, const char *fmt, ...) {
+  if (prio < min_priority) return 0;
+  static const char kLevels[] = "??VDIWEFS";
+  fprintf(stderr, "%c/%s: ", prio < 9 ? kLevels[prio] : '?', tag);
+  va_list ap;
+  va_start(ap, fmt);
+  int ret = vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+  return ret;
+}
@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+// Writes small synthetic hprof files with every record and heap sub record
+// type the strip engine knows, for 4 and 8 byte ids. They exercise all
+// parser paths of hprof-strip and can be scaled up for benchmarks:
+//
+//   hprof-corpus <dir> [objects per heap] [variant]
+//
+// A variant other than 0 is a later dump of the same process, the base of a
+// delta is variant 0: the same ids, some objects gone, some with other
+// values and new ones at the end of the app heap.
+
+#include <hprof_writer.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using kwai::leak_monitor::HprofWriter;
+
+namespace {
+
+// Ids of the fixed strings and classes
+enum : uint64_t {
+  kStringObject = 0x100,
+  kStringString,
+  kStringBitmap,
+  kStringLeaky,
+  kStringObjectArray,
+  kStringField,
+  kStringMain,
+  kStringMethod,
+  kStringSignature,
+  kStringSource,
+  kStringHeapDefault,
+  kStringHeapApp,
+  kStringHeapZygote,
+  kStringHeapImage,
+  kClassObject = 0x1000,
+  kClassString,
+  kClassBitmap,
+  kClassLeaky,
+  kClassObjectArray,
+  kFirstObject = 0x100000,
+};
+
+// hprof basic types: object, boolean, char, float, double, byte, short,
+// int, long
+const uint8_t kBasicTypes[] = {2, 4, 5, 6, 7, 8, 9, 10, 11};
+
+void WriteRoots(HprofWriter &w) {
+  uint64_t object = kFirstObject;
+  // Roots with only an object id
+  for (uint8_t tag : {0xff, 0x05, 0x07, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x90}) {
+    w.U1(tag);
+    w.Id(object++);
+  }
+  w.U1(0x01);  // JNI global: object, global ref id
+  w.Id(object++);
+  w.Id(0x7f0001);
+  // Object, thread serial, frame number
+  for (uint8_t tag : {0x02, 0x03, 0x08, 0x8e}) {
+    w.U1(tag);
+    w.Id(object++);
+    w.U4(1);
+    w.U4(0xffffffffu);
+  }
+  // Object, thread serial
+  for (uint8_t tag : {0x04, 0x06}) {
+    w.U1(tag);
+    w.Id(object++);
+    w.U4(1);
+  }
+}
+
+void WriteClassDumps(HprofWriter &w) {
+  const uint64_t classes[] = {kClassObject, kClassString, kClassBitmap,
+                              kClassLeaky, kClassObjectArray};
+  for (uint64_t class_id : classes) {
+    w.U1(0x20);
+    w.Id(class_id);
+    w.U4(1);
+    // Six ids after the stack serial like ART writes them: the super class,
+    // then loader, signers, protection domain and 2 reserved. A seventh one
+    // still parses in the strip engine but shifts every field after it, see
+    // the scans of hprof-index-test and heap-histogram-test.
+    w.Id(class_id == kClassObject ? 0 : (uint64_t)kClassObject);
+    for (int i = 0; i < 5; i++) w.Id(0);
+    const bool leaky = class_id == kClassLeaky;
+    w.U4(leaky ? 64 : 16);
+    // Constant pool, static fields and instance fields with every type
+    const uint16_t count = leaky ? sizeof(kBasicTypes) : 0;
+    w.U2(count);
+    for (uint16_t i = 0; i < count; i++) {
+      w.U2(i);
+      w.U1(kBasicTypes[i]);
+      w.Value(kBasicTypes[i], i + 1);
+    }
+    w.U2(count);
+    for (uint16_t i = 0; i < count; i++) {
+      w.Id(kStringField);
+      w.U1(kBasicTypes[i]);
+      w.Value(kBasicTypes[i], kBasicTypes[i] == 2 ? (uint64_t)kFirstObject : i);
+    }
+    w.U2(count);
+    for (uint16_t i = 0; i < count; i++) {
+      w.Id(kStringField);
+      w.U1(kBasicTypes[i]);
+    }
+  }
+}
+
+// One heap worth of objects, split over HEAP_DUMP_SEGMENT records
+void WriteHeap(HprofWriter &w, uint32_t heap, uint64_t heap_name, size_t objects,
+               uint32_t variant, uint64_t &next_id) {
+  size_t leaky_size = 0;
+  for (uint8_t type : kBasicTypes) leaky_size += w.TypeSize(type);
+  for (size_t done = 0; done < objects;) {
+    w.Begin(0x1c);
+    w.U1(0xfe);
+    w.U4(heap);
+    w.Id(heap_name);
+    for (size_t n = 0; n < 16 && done < objects; n++, done++) {
+      // 变体里每 13 组对象被回收（id 照样占掉），每 5 组换了值
+      const size_t mark = w.Bytes().size();
+      const bool gone = variant != 0 && (done + variant) % 13 == 0;
+      const bool changed = variant != 0 && (done + variant) % 5 == 0;
+      const uint32_t seed = (uint32_t)done + (changed ? variant << 16u : 0);
+      // Instance with a value of every type
+      w.U1(0x21);
+      w.Id(next_id++);
+      w.U4(1);
+      w.Id(kClassLeaky);
+      w.U4((uint32_t)leaky_size);
+      for (uint8_t type : kBasicTypes) {
+        w.Value(type, type == 2 ? next_id - 2 : seed);
+      }
+      // String with its char[]
+      w.U1(0x21);
+      w.Id(next_id++);
+      w.U4(1);
+      w.Id(kClassString);
+      w.U4((uint32_t)w.TypeSize(2));
+      w.Id(next_id);
+      w.U1(0x23);
+      w.Id(next_id++);
+      w.U4(1);
+      w.U4(8 + done % 24);
+      w.U1(5);
+      w.Fill((8 + done % 24) * 2, seed);
+      // Object array
+      const uint32_t length = done % 5;
+      w.U1(0x22);
+      w.Id(next_id++);
+      w.U4(1);
+      w.U4(length);
+      w.Id(kClassObjectArray);
+      for (uint32_t i = 0; i < length; i++) w.Id(next_id - 1 - i);
+      // Primitive array of every type, some empty, byte[]s of 256 bytes
+      // repeat so the duplicate detector has something to find
+      const uint8_t type = kBasicTypes[1 + done % 8];
+      const uint32_t count = done % 9 == 0 ? 0 : 4 + (uint32_t)(done % 40);
+      w.U1(0x23);
+      w.Id(next_id++);
+      w.U4(1);
+      w.U4(count);
+      w.U1(type);
+      w.Fill(count * w.TypeSize(type), seed);
+      if (done % 4 == 0) {
+        w.U1(0x23);
+        w.Id(next_id++);
+        w.U4(1);
+        w.U4(256);
+        w.U1(8);
+        w.Fill(256, (uint32_t)(done % 3));
+      }
+      if (gone) w.Bytes().resize(mark);
+    }
+    w.End();
+  }
+}
+
+std::vector<uint8_t> Generate(uint32_t id_size, size_t objects,
+                              uint32_t variant) {
+  HprofWriter w(id_size);
+  w.Header(1600000000000ull + variant * 60000ull);
+
+  w.String(kStringObject, "java.lang.Object");
+  w.String(kStringString, "java.lang.String");
+  w.String(kStringBitmap, "android.graphics.Bitmap");
+  w.String(kStringLeaky, "com.example.Leaky");
+  w.String(kStringObjectArray, "java.lang.Object[]");
+  w.String(kStringField, "value");
+  w.String(kStringMain, "main");
+  w.String(kStringMethod, "run");
+  w.String(kStringSignature, "()V");
+  w.String(kStringSource, "Leaky.java");
+  w.String(kStringHeapDefault, "default");
+  w.String(kStringHeapApp, "app");
+  w.String(kStringHeapZygote, "zygote");
+  w.String(kStringHeapImage, "image");
+  w.LoadClass(1, kClassObject, kStringObject);
+  w.LoadClass(2, kClassString, kStringString);
+  w.LoadClass(3, kClassBitmap, kStringBitmap);
+  w.LoadClass(4, kClassLeaky, kStringLeaky);
+  w.LoadClass(5, kClassObjectArray, kStringObjectArray);
+
+  w.Begin(0x03);  // UNLOAD_CLASS: class serial
+  w.U4(3);
+  w.End();
+  w.Begin(0x04);  // STACK_FRAME: frame, method, signature, source, class, line
+  w.Id(0x2000);
+  w.Id(kStringMethod);
+  w.Id(kStringSignature);
+  w.Id(kStringSource);
+  w.U4(4);
+  w.U4(42);
+  w.End();
+  w.Begin(0x05);  // STACK_TRACE: serial, thread serial, frames
+  w.U4(1);
+  w.U4(1);
+  w.U4(1);
+  w.Id(0x2000);
+  w.End();
+  w.Begin(0x06);  // ALLOC_SITES with one site
+  w.U2(0);
+  w.U4(0);
+  w.U4(1024);
+  w.U4(16);
+  w.U8(4096);
+  w.U8(64);
+  w.U4(1);
+  w.U1(0);
+  for (int i = 0; i < 6; i++) w.U4(i + 1);
+  w.End();
+  w.Begin(0x07);  // HEAP_SUMMARY
+  w.U4(1024);
+  w.U4(16);
+  w.U8(4096);
+  w.U8(64);
+  w.End();
+  w.Begin(0x0a);  // START_THREAD
+  w.U4(1);
+  w.Id(kFirstObject);
+  w.U4(1);
+  w.Id(kStringMain);
+  w.Id(kStringMain);
+  w.Id(0);
+  w.End();
+  w.Begin(0x0d);  // CPU_SAMPLES with one trace
+  w.U4(10);
+  w.U4(1);
+  w.U4(10);
+  w.U4(1);
+  w.End();
+  w.Begin(0x0e);  // CONTROL_SETTINGS
+  w.U4(3);
+  w.U2(8);
+  w.End();
+
+  // ART writes roots and class dumps first, then the objects heap by heap
+  w.Begin(0x0c);
+  WriteRoots(w);
+  w.U1(0xfe);
+  w.U4(0);
+  w.Id(kStringHeapDefault);
+  WriteClassDumps(w);
+  w.U1(0xc3);  // PRIMITIVE_ARRAY_NODATA_DUMP
+  w.Id(kFirstObject + 0x80);
+  w.U4(1);
+  w.U4(16);
+  w.U1(10);
+  w.End();
+
+  uint64_t next_id = kFirstObject + 0x100;
+  WriteHeap(w, 'I', kStringHeapImage, objects / 4 + 1, variant, next_id);
+  WriteHeap(w, 'Z', kStringHeapZygote, objects / 2 + 1, variant, next_id);
+  // The app heap is last, objects allocated since the base get new ids
+  WriteHeap(w, 'A', kStringHeapApp, objects + variant * 8, variant, next_id);
+
+  w.Begin(0x2c);  // HEAP_DUMP_END
+  w.End();
+  w.Begin(0x0b);  // END_THREAD
+  w.U4(1);
+  w.End();
+  return w.Bytes();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 4) {
+    fprintf(stderr,
+            "usage: %s <dir> [objects per heap, default 64] [variant, "
+            "default 0]\n",
+            argv[0]);
+    return 2;
+  }
+  const std::string dir = argv[1];
+  const size_t objects = argc >= 3 ? strtoull(argv[2], nullptr, 0) : 64;
+  const auto variant = (uint32_t)(argc == 4 ? strtoul(argv[3], nullptr, 0) : 0);
+  if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "mkdir %s failed: %s\n", dir.c_str(), strerror(errno));
+    return 1;
+  }
+  for (uint32_t id_size : {4u, 8u}) {
+    std::vector<uint8_t> bytes = Generate(id_size, objects, variant);
+    std::string path = dir + "/corpus-id" + std::to_string(id_size) + ".hprof";
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr ||
+        fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) {
+      fprintf(stderr, "write %s failed\n", path.c_str());
+      return 1;
+    }
+    fclose(file);
+    printf("%s %zu bytes\n", path.c_str(), bytes.size());
+  }
+  return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+// Rebuilds a full stripped hprof from a full dump and a delta written against
+// it with --delta-base / ForkStripHeapDumper.setDeltaBase():
+//
+//   hprof-delta <base.hprof> <delta.hprof> <output.hprof>
+//
+// The fingerprints of the base are read from <base.hprof>.kfp. Compressed
+// files are decompressed first, the output is always raw.
+
+#include <android/log.h>
+#include <fcntl.h>
+#include <hprof_delta.h>
+#include <mapped_hprof.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using kwai::leak_monitor::ApplyHprofDelta;
+using kwai::leak_monitor::HprofFingerprints;
+using kwai::leak_monitor::MappedHprof;
+
+int main(int argc, char **argv) {
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s <base.hprof> <delta.hprof> <output.hprof>\n",
+            argv[0]);
+    return 2;
+  }
+  koom_host_log_set_min_priority(ANDROID_LOG_WARN);
+  const std::string fingerprint_path = std::string(argv[1]) + ".kfp";
+  HprofFingerprints fingerprints;
+  if (!fingerprints.Open(fingerprint_path.c_str())) {
+    fprintf(stderr, "cannot read %s\n", fingerprint_path.c_str());
+    return 1;
+  }
+  MappedHprof base, delta;
+  if (!base.Open(argv[1]) || !delta.Open(argv[2])) return 1;
+
+  int out_fd = open(argv[3], O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+  if (out_fd < 0) {
+    fprintf(stderr, "open %s failed: %s\n", argv[3], strerror(errno));
+    return 1;
+  }
+  std::string error;
+  bool success = ApplyHprofDelta(base.Data(), base.Size(), fingerprints,
+                                 delta.Data(), delta.Size(), out_fd, &error);
+  if (close(out_fd) != 0) success = false;
+  if (!success) {
+    fprintf(stderr, "%s\n", error.empty() ? "write failed" : error.c_str());
+    unlink(argv[3]);
+    return 1;
+  }
+  struct stat out = {};
+  stat(argv[3], &out);
+  printf("base %zu bytes, delta %zu bytes, output %lld bytes\n", base.Size(),
+         delta.Size(), (long long)out.st_size);
+  return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+// Turns a snapshot written with --snapshot / ForkStripHeapDumper
+// .setSnapshotMode() back into the stripped hprof it was made from:
+//
+//   hprof-snapshot <snapshot> <output.hprof>
+//
+// A compressed snapshot is decompressed first, the output is always raw.
+
+#include <android/log.h>
+#include <fcntl.h>
+#include <hprof_snapshot.h>
+#include <mapped_hprof.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using kwai::leak_monitor::DecodeHprofSnapshot;
+using kwai::leak_monitor::MappedHprof;
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <snapshot> <output.hprof>\n", argv[0]);
+    return 2;
+  }
+  koom_host_log_set_min_priority(ANDROID_LOG_WARN);
+  MappedHprof snapshot;
+  if (!snapshot.Open(argv[1])) return 1;
+
+  int out_fd = open(argv[2], O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+  if (out_fd < 0) {
+    fprintf(stderr, "open %s failed: %s\n", argv[2], strerror(errno));
+    return 1;
+  }
+  std::string error;
+  bool success =
+      DecodeHprofSnapshot(snapshot.Data(), snapshot.Size(), out_fd, &error);
+  if (close(out_fd) != 0) success = false;
+  if (!success) {
+    fprintf(stderr, "%s\n", error.empty() ? "write failed" : error.c_str());
+    unlink(argv[2]);
+    return 1;
+  }
+  struct stat out = {};
+  stat(argv[2], &out);
+  printf("snapshot %zu bytes, output %lld bytes\n", snapshot.Size(),
+         (long long)out.st_size);
+  return 0;
+}
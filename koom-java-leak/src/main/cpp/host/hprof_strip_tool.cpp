@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+// Runs an existing hprof through HprofStripEngine on the host, the way
+// HprofStrip does inside the dump process, see Usage().
+
+#include <android/log.h>
+#include <async_writer.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <hprof_compressor.h>
+#include <hprof_strip_engine.h>
+#include <hprof_stream.h>
+#include <signal.h>
+#include <strip_stream.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <string>
+#include <vector>
+
+using kwai::leak_monitor::AsyncWriter;
+using kwai::leak_monitor::CreateHprofPipe;
+using kwai::leak_monitor::HprofContainer;
+using kwai::leak_monitor::HprofStreamProcessor;
+using kwai::leak_monitor::HprofStreamStats;
+using kwai::leak_monitor::HprofStripEngine;
+using kwai::leak_monitor::PumpHprofStream;
+using kwai::leak_monitor::StripPolicy;
+using kwai::leak_monitor::StripStreamProcessor;
+using kwai::leak_monitor::TokenBucket;
+
+namespace {
+
+struct Options {
+  size_t chunk_size = 1u << 20u;
+  // Random chunk sizes in [1, chunk_size] when non zero
+  uint32_t random_seed = 0;
+  int rounds = 1;
+  bool async = false;
+  // Pipe capacity of --stream, -1 when not streaming
+  int stream_pipe_size = -1;
+  // Bytes after which the --stream child dies, 0 never
+  size_t stream_kill_at = 0;
+  // Pace of --stream in bytes per second, 0 unlimited
+  uint64_t stream_rate = 0;
+  int compression = HprofContainer::kCodecNone;
+  bool index = false;
+  size_t histogram_top = 0;
+  size_t duplicate_min_bytes = 0;
+  bool fingerprint = false;
+  std::string delta_base;
+  bool snapshot = false;
+  std::vector<std::string> leak_path_classes;
+  StripPolicy policy;
+};
+
+void Usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [options] <input.hprof> <output>\n"
+          "  --chunk <bytes>        bytes per write, default 1048576\n"
+          "  --random-chunks <seed> random write sizes up to --chunk\n"
+          "  --bench <rounds>       repeat, report the best round\n"
+          "  --async                strip on a writer thread like "
+          "setAsyncWrite\n"
+          "  --stream <pipe bytes>  a forked child writes the input into a "
+          "pipe like\n"
+          "                         ForkJvmHeapDumper.dumpToStream, 0 keeps "
+          "the pipe size\n"
+          "  --stream-kill <bytes>  the child dies after writing that much\n"
+          "  --stream-rate <bytes>  read the pipe at most that many bytes per "
+          "second\n"
+          "  --compression <codec>  none, lz4 or lzma\n"
+          "  --index                write <output>.kidx\n"
+          "  --histogram <top>      write a class histogram instead\n"
+          "  --duplicates <bytes>   write <output>.kdup\n"
+          "  --fingerprint          write <output>.kfp, the base of deltas, "
+          "not with\n"
+          "                         --stream\n"
+          "  --delta-base <hprof>   write a delta against that hprof and its "
+          ".kfp,\n"
+          "                         see hprof-delta, not with --stream\n"
+          "  --snapshot             write a compact snapshot, see "
+          "hprof-snapshot, not\n"
+          "                         with --stream\n"
+          "  --leak-paths <class>   write <output>.kpath, paths from GC roots "
+          "to\n"
+          "                         instances of the class, name#field only "
+          "those\n"
+          "                         whose boolean field is true, "
+          "repeatable,\n"
+          "                         not with --stream\n"
+          "  --keep-all             keep everything instead of the default "
+          "rules\n"
+          "  --allow-class <name>   keep instances of the class\n"
+          "  --deny-class <name>    drop instances of the class\n"
+          "  --verbose              log like the device does\n",
+          name);
+}
+
+uint64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+bool ConsumeAsync(void *arg, const uint8_t *data, size_t size) {
+  return static_cast<HprofStripEngine *>(arg)->Write(data, size);
+}
+
+// Stands in for ART's DumpHeap in the forked child: writes the input to fd
+// in the chunks given by the options, then exits
+[[noreturn]] void DumpToFd(const Options &options, int fd, const uint8_t *input,
+                           size_t size) {
+  std::mt19937 random(options.random_seed);
+  for (size_t pos = 0; pos < size;) {
+    size_t n = options.random_seed != 0
+                   ? 1 + random() % options.chunk_size
+                   : options.chunk_size;
+    n = std::min(n, size - pos);
+    if (options.stream_kill_at != 0 && pos + n > options.stream_kill_at) {
+      raise(SIGKILL);
+    }
+    ssize_t written = write(fd, input + pos, n);
+    if (written < 0 && errno == EINTR) continue;
+    if (written < 0) _exit(1);
+    pos += written;
+  }
+  _exit(0);
+}
+
+// Same steps as HprofDump::ForkDumpToStream
+bool StreamRound(const Options &options, const HprofStreamProcessor *processor,
+                 const uint8_t *input, size_t size, const char *output) {
+  if (!processor->begin(processor->arg, output)) return false;
+  int fds[2];
+  if (!CreateHprofPipe(fds, options.stream_pipe_size)) {
+    return processor->end(processor->arg, false);
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    DumpToFd(options, fds[1], input, size);
+  }
+  close(fds[1]);
+  if (pid < 0) {
+    close(fds[0]);
+    return processor->end(processor->arg, false);
+  }
+  HprofStreamStats stats = {};
+  TokenBucket limiter(options.stream_rate,
+                      std::max<uint64_t>(options.stream_rate / 10, 1 << 20));
+  bool pumped =
+      PumpHprofStream(fds[0], processor,
+                      options.stream_rate != 0 ? &limiter : nullptr, nullptr,
+                      &stats);
+  close(fds[0]);
+  int status = 0;
+  while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+  }
+  bool exited = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  if (!exited) fprintf(stderr, "dump child failed, status %d\n", status);
+  return processor->end(processor->arg, pumped && exited);
+}
+
+struct RoundResult {
+  bool success;
+  bool finished;
+  uint64_t ns;
+  uint64_t syscalls;
+  uint64_t stripped;
+  uint64_t omitted;
+};
+
+RoundResult RunRound(const Options &options, HprofStripEngine &engine,
+                     AsyncWriter &writer, const uint8_t *input, size_t size,
+                     const char *output) {
+  RoundResult result = {};
+  if (options.stream_pipe_size >= 0) {
+    StripStreamProcessor processor(engine);
+    uint64_t start = NowNs();
+    result.success = StreamRound(options, processor.Get(), input, size, output);
+    result.ns = NowNs() - start;
+    result.finished = engine.Finished();
+    result.syscalls = engine.SyscallCount();
+    result.stripped = engine.StrippedBytes();
+    result.omitted = engine.OmittedBytes();
+    return result;
+  }
+  int fd = open(output, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "open %s failed: %s\n", output, strerror(errno));
+    return result;
+  }
+  std::mt19937 random(options.random_seed);
+  uint64_t start = NowNs();
+  engine.Begin(output, fd);
+  bool async = options.async && writer.Start(ConsumeAsync, &engine);
+  bool success = true;
+  for (size_t pos = 0; pos < size && success;) {
+    size_t n = options.random_seed != 0
+                   ? 1 + random() % options.chunk_size
+                   : options.chunk_size;
+    n = std::min(n, size - pos);
+    success = async ? writer.Write(input + pos, n)
+                    : engine.Write(input + pos, n);
+    pos += n;
+  }
+  if (async) success = writer.Finish() && success;
+  result.ns = NowNs() - start;
+  close(fd);
+  result.success = success;
+  result.finished = engine.Finished();
+  result.syscalls = engine.SyscallCount();
+  result.stripped = engine.StrippedBytes();
+  result.omitted = engine.OmittedBytes();
+  return result;
+}
+
+int CodecOf(const char *name) {
+  if (strcmp(name, "none") == 0) return HprofContainer::kCodecNone;
+  if (strcmp(name, "lz4") == 0) return HprofContainer::kCodecLz4;
+  if (strcmp(name, "lzma") == 0) return HprofContainer::kCodecLzma;
+  return -1;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  enum {
+    kOptChunk = 256,
+    kOptRandomChunks,
+    kOptBench,
+    kOptAsync,
+    kOptStream,
+    kOptStreamKill,
+    kOptStreamRate,
+    kOptCompression,
+    kOptIndex,
+    kOptHistogram,
+    kOptDuplicates,
+    kOptFingerprint,
+    kOptDeltaBase,
+    kOptSnapshot,
+    kOptLeakPaths,
+    kOptKeepAll,
+    kOptAllowClass,
+    kOptDenyClass,
+    kOptVerbose,
+  };
+  static const struct option kLongOptions[] = {
+      {"chunk", required_argument, nullptr, kOptChunk},
+      {"random-chunks", required_argument, nullptr, kOptRandomChunks},
+      {"bench", required_argument, nullptr, kOptBench},
+      {"async", no_argument, nullptr, kOptAsync},
+      {"stream", required_argument, nullptr, kOptStream},
+      {"stream-kill", required_argument, nullptr, kOptStreamKill},
+      {"stream-rate", required_argument, nullptr, kOptStreamRate},
+      {"compression", required_argument, nullptr, kOptCompression},
+      {"index", no_argument, nullptr, kOptIndex},
+      {"histogram", required_argument, nullptr, kOptHistogram},
+      {"duplicates", required_argument, nullptr, kOptDuplicates},
+      {"fingerprint", no_argument, nullptr, kOptFingerprint},
+      {"delta-base", required_argument, nullptr, kOptDeltaBase},
+      {"snapshot", no_argument, nullptr, kOptSnapshot},
+      {"leak-paths", required_argument, nullptr, kOptLeakPaths},
+      {"keep-all", no_argument, nullptr, kOptKeepAll},
+      {"allow-class", required_argument, nullptr, kOptAllowClass},
+      {"deny-class", required_argument, nullptr, kOptDenyClass},
+      {"verbose", no_argument, nullptr, kOptVerbose},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  Options options;
+  bool verbose = false;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", kLongOptions, nullptr)) != -1) {
+    switch (opt) {
+      case kOptChunk:
+        options.chunk_size = strtoull(optarg, nullptr, 0);
+        break;
+      case kOptRandomChunks:
+        options.random_seed = (uint32_t)strtoul(optarg, nullptr, 0);
+        break;
+      case kOptBench:
+        options.rounds = atoi(optarg);
+        break;
+      case kOptAsync:
+        options.async = true;
+        break;
+      case kOptStream:
+        options.stream_pipe_size = atoi(optarg);
+        break;
+      case kOptStreamKill:
+        options.stream_kill_at = strtoull(optarg, nullptr, 0);
+        break;
+      case kOptStreamRate:
+        options.stream_rate = strtoull(optarg, nullptr, 0);
+        break;
+      case kOptCompression:
+        options.compression = CodecOf(optarg);
+        break;
+      case kOptIndex:
+        options.index = true;
+        break;
+      case kOptHistogram:
+        options.histogram_top = strtoull(optarg, nullptr, 0);
+        break;
+      case kOptDuplicates:
+        options.duplicate_min_bytes = strtoull(optarg, nullptr, 0);
+        break;
+      case kOptFingerprint:
+        options.fingerprint = true;
+        break;
+      case kOptDeltaBase:
+        options.delta_base = optarg;
+        break;
+      case kOptSnapshot:
+        options.snapshot = true;
+        break;
+      case kOptLeakPaths:
+        options.leak_path_classes.push_back(optarg);
+        break;
+      case kOptKeepAll:
+        options.policy.Clear();
+        break;
+      case kOptAllowClass:
+        options.policy.AddClass(optarg, StripPolicy::kClassAllow);
+        break;
+      case kOptDenyClass:
+        options.policy.AddClass(optarg, StripPolicy::kClassDeny);
+        break;
+      case kOptVerbose:
+        verbose = true;
+        break;
+      default:
+        Usage(argv[0]);
+        return 2;
+    }
+  }
+  if (argc - optind != 2 || options.chunk_size == 0 || options.rounds < 1 ||
+      options.compression < 0 ||
+      (options.async && options.stream_pipe_size >= 0)) {
+    Usage(argv[0]);
+    return 2;
+  }
+  const char *input_path = argv[optind];
+  const char *output_path = argv[optind + 1];
+  koom_host_log_set_min_priority(verbose ? ANDROID_LOG_VERBOSE
+                                         : ANDROID_LOG_WARN);
+
+  int input_fd = open(input_path, O_RDONLY | O_CLOEXEC);
+  struct stat st = {};
+  if (input_fd < 0 || fstat(input_fd, &st) != 0 || st.st_size == 0) {
+    fprintf(stderr, "cannot read %s\n", input_path);
+    return 1;
+  }
+  const auto size = (size_t)st.st_size;
+  void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, input_fd, 0);
+  close(input_fd);
+  if (mapped == MAP_FAILED) {
+    fprintf(stderr, "mmap %s failed: %s\n", input_path, strerror(errno));
+    return 1;
+  }
+  madvise(mapped, size, MADV_SEQUENTIAL);
+  const auto *input = static_cast<const uint8_t *>(mapped);
+
+  HprofStripEngine engine;
+  engine.SetCompression(options.compression);
+  engine.SetStripPolicy(options.policy);
+  engine.SetIndexEnabled(options.index);
+  engine.SetHistogramMode(options.histogram_top);
+  engine.SetDuplicateArrayThreshold(options.duplicate_min_bytes);
+  engine.SetFingerprintEnabled(options.fingerprint);
+  engine.SetDeltaBase(options.delta_base);
+  engine.SetSnapshotMode(options.snapshot);
+  engine.SetLeakPathClasses(options.leak_path_classes);
+  AsyncWriter writer;
+
+  RoundResult best = {};
+  for (int round = 0; round < options.rounds; round++) {
+    RoundResult result =
+        RunRound(options, engine, writer, input, size, output_path);
+    if (!result.success) {
+      fprintf(stderr, "writing %s failed\n", output_path);
+      return 1;
+    }
+    if (round == 0 || result.ns < best.ns) best = result;
+  }
+  munmap(mapped, size);
+  if (!best.finished) {
+    fprintf(stderr, "warning: no HEAP_DUMP_END, input truncated?\n");
+  }
+
+  struct stat out = {};
+  stat(output_path, &out);
+  struct rusage usage = {};
+  getrusage(RUSAGE_SELF, &usage);
+  printf("input %zu bytes, output %lld bytes, stripped %llu bytes\n", size,
+         (long long)out.st_size, (unsigned long long)best.stripped);
+  if (!options.delta_base.empty()) {
+    printf("delta omits %llu bytes\n", (unsigned long long)best.omitted);
+  }
+  // The mapped input counts towards the peak rss
+  printf("%s %.1f ms, %.0f MB/s, %llu write syscalls, peak rss %ld KB\n",
+         options.rounds > 1 ? "best" : "time", best.ns / 1e6,
+         size / 1e6 / (best.ns / 1e9), (unsigned long long)best.syscalls,
+         usage.ru_maxrss);
+  return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+// The part of the NDK liblog API used by the strip engine, for host builds.
+// Messages go to stderr, see host_log.cpp.
+
+#ifndef KOOM_HOST_ANDROID_LOG_H
+#define KOOM_HOST_ANDROID_LOG_H
+
+// The NDK header includes it too, callers rely on that for va_list
+#include <stdarg.h>
+
+typedef enum android_LogPriority {
+  ANDROID_LOG_UNKNOWN = 0,
+  ANDROID_LOG_DEFAULT,
+  ANDROID_LOG_VERBOSE,
+  ANDROID_LOG_DEBUG,
+  ANDROID_LOG_INFO,
+  ANDROID_LOG_WARN,
+  ANDROID_LOG_ERROR,
+  ANDROID_LOG_FATAL,
+  ANDROID_LOG_SILENT,
+} android_LogPriority;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int __android_log_print(int prio, const char *tag, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+// Messages below prio are dropped, ANDROID_LOG_INFO by default
+void koom_host_log_set_min_priority(int prio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // KOOM_HOST_ANDROID_LOG_H
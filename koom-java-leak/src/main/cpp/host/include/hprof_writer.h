@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+// Builds hprof files byte by byte for the host tools and tests. Values are
+// big endian like ART writes them, records get their length patched in.
+
+#ifndef KOOM_HOST_HPROF_WRITER_H
+#define KOOM_HOST_HPROF_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kwai {
+namespace leak_monitor {
+
+class HprofWriter {
+ public:
+  explicit HprofWriter(uint32_t id_size) : id_size_(id_size) {}
+
+  std::vector<uint8_t> &Bytes() { return bytes_; }
+
+  void U1(uint32_t v) { bytes_.push_back((uint8_t)v); }
+  void U2(uint32_t v) {
+    U1(v >> 8u);
+    U1(v);
+  }
+  void U4(uint32_t v) {
+    U2(v >> 16u);
+    U2(v);
+  }
+  void U8(uint64_t v) {
+    U4((uint32_t)(v >> 32u));
+    U4((uint32_t)v);
+  }
+  void Id(uint64_t v) {
+    if (id_size_ == 4) {
+      U4((uint32_t)v);
+    } else {
+      U8(v);
+    }
+  }
+  void Fill(size_t size, uint32_t seed) {
+    for (size_t i = 0; i < size; i++) U1((seed + i * 7) >> 2u);
+  }
+  size_t TypeSize(uint8_t type) const {
+    switch (type) {
+      case 2:
+        return id_size_;
+      case 4:
+      case 8:
+        return 1;
+      case 5:
+      case 9:
+        return 2;
+      case 6:
+      case 10:
+        return 4;
+      default:
+        return 8;
+    }
+  }
+  void Value(uint8_t type, uint64_t v) {
+    size_t size = TypeSize(type);
+    for (size_t i = size; i > 0; i--) U1((uint32_t)(v >> ((i - 1) * 8)));
+  }
+
+  // Record with the length patched in by End()
+  void Begin(uint8_t tag) {
+    U1(tag);
+    U4(0);
+    record_start_ = bytes_.size();
+    U4(0);
+  }
+  void End() {
+    auto length = (uint32_t)(bytes_.size() - record_start_ - 4);
+    for (int i = 0; i < 4; i++) {
+      bytes_[record_start_ + i] = (uint8_t)(length >> ((3 - i) * 8));
+    }
+  }
+
+  // File header up to the first record
+  void Header(uint64_t timestamp) {
+    const char kMagic[] = "JAVA PROFILE 1.0.3";
+    for (char c : kMagic) U1((uint8_t)c);  // includes the terminating 0
+    U4(id_size_);
+    U8(timestamp);
+  }
+  void String(uint64_t id, const char *value) {
+    Begin(0x01);
+    Id(id);
+    for (const char *p = value; *p; p++) U1((uint8_t)*p);
+    End();
+  }
+  void LoadClass(uint32_t serial, uint64_t class_id, uint64_t name_id) {
+    Begin(0x02);
+    U4(serial);
+    Id(class_id);
+    U4(1);
+    Id(name_id);
+    End();
+  }
+
+ private:
+  uint32_t id_size_;
+  size_t record_start_ = 0;
+  std::vector<uint8_t> bytes_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_HOST_HPROF_WRITER_H
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+// Maps an hprof for the host tools, containers are decompressed first.
+
+#ifndef KOOM_HOST_MAPPED_HPROF_H
+#define KOOM_HOST_MAPPED_HPROF_H
+
+#include <fcntl.h>
+#include <hprof_block_reader.h>
+#include <hprof_compressor.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace kwai {
+namespace leak_monitor {
+
+class MappedHprof {
+ public:
+  MappedHprof() = default;
+  MappedHprof(const MappedHprof &) = delete;
+  MappedHprof &operator=(const MappedHprof &) = delete;
+  ~MappedHprof() {
+    if (data_ != nullptr) munmap(data_, size_);
+  }
+
+  // Maps path, a container is decompressed into an unlinked temporary file
+  bool Open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      fprintf(stderr, "open %s failed: %s\n", path, strerror(errno));
+      return false;
+    }
+    uint32_t magic = 0;
+    if (pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) &&
+        magic == HprofContainer::kMagic) {
+      int raw_fd = Decompress(fd, path);
+      close(fd);
+      if (raw_fd < 0) return false;
+      fd = raw_fd;
+    }
+    struct stat st = {};
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      fprintf(stderr, "cannot read %s\n", path);
+      close(fd);
+      return false;
+    }
+    size_ = (size_t)st.st_size;
+    void *mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+      fprintf(stderr, "mmap %s failed: %s\n", path, strerror(errno));
+      return false;
+    }
+    data_ = static_cast<uint8_t *>(mapped);
+    return true;
+  }
+
+  const uint8_t *Data() const { return data_; }
+  size_t Size() const { return size_; }
+
+ private:
+  static int Decompress(int fd, const char *path) {
+    HprofBlockReader reader;
+    if (!reader.Open(fd)) {
+      fprintf(stderr, "bad container %s\n", path);
+      return -1;
+    }
+    char tmp_path[] = "/tmp/hprof-XXXXXX";
+    int raw_fd = mkstemp(tmp_path);
+    if (raw_fd < 0) {
+      fprintf(stderr, "mkstemp failed: %s\n", strerror(errno));
+      return -1;
+    }
+    unlink(tmp_path);
+    if (!reader.DecompressTo(raw_fd)) {
+      fprintf(stderr, "decompressing %s failed\n", path);
+      close(raw_fd);
+      return -1;
+    }
+    return raw_fd;
+  }
+
+  uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_HOST_MAPPED_HPROF_H
@@ -0,0 +1,71 @@
+# Strips BASE with fingerprints, INPUT, a later dump of the same process, as a
+# delta against it and as a full strip with the same options, rebuilds the
+# full strip from base and delta with hprof-delta and requires it to hold the
+# same records and objects as the full strip, for the default rules,
+# --keep-all, random write sizes and compressed files:
+#
+#   cmake -DSTRIP=<hprof-strip> -DDELTA=<hprof-delta>
+#         -DCOMPARE=<hprof-compare-test> -DBASE=<hprof> -DINPUT=<hprof>
+#         -DWORK_DIR=<dir> -P delta_round_trip.cmake
+
+foreach (VAR STRIP DELTA COMPARE BASE INPUT WORK_DIR)
+    if (NOT DEFINED ${VAR})
+        message(FATAL_ERROR "${VAR} is not set")
+    endif ()
+endforeach ()
+file(MAKE_DIRECTORY ${WORK_DIR})
+
+# DELTA_OPTIONS only apply to base and delta, ARGN to all three strips
+function(round_trip NAME DELTA_OPTIONS)
+    set(BASE_FILE ${WORK_DIR}/${NAME}-base.hprof)
+    set(DELTA_FILE ${WORK_DIR}/${NAME}.khpd)
+    set(STRIPPED ${WORK_DIR}/${NAME}.hprof)
+    set(REBUILT ${WORK_DIR}/${NAME}-rebuilt.hprof)
+    execute_process(COMMAND ${STRIP} --fingerprint ${DELTA_OPTIONS} ${ARGN}
+            ${BASE} ${BASE_FILE}
+            RESULT_VARIABLE RESULT OUTPUT_QUIET)
+    if (NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "${NAME}: stripping the base failed")
+    endif ()
+    execute_process(COMMAND ${STRIP} --delta-base ${BASE_FILE}
+            ${DELTA_OPTIONS} ${ARGN} ${INPUT} ${DELTA_FILE}
+            RESULT_VARIABLE RESULT OUTPUT_VARIABLE OUTPUT)
+    if (NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "${NAME}: writing the delta failed")
+    endif ()
+    # A full dump instead of the delta would pass all the rest
+    if (NOT OUTPUT MATCHES "delta omits [1-9][0-9]* bytes")
+        message(FATAL_ERROR "${NAME}: the delta left nothing out\n${OUTPUT}")
+    endif ()
+    execute_process(COMMAND ${STRIP} ${ARGN} ${INPUT} ${STRIPPED}
+            RESULT_VARIABLE RESULT OUTPUT_QUIET)
+    if (NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "${NAME}: stripping failed")
+    endif ()
+    execute_process(COMMAND ${DELTA} ${BASE_FILE} ${DELTA_FILE} ${REBUILT}
+            RESULT_VARIABLE RESULT OUTPUT_QUIET)
+    if (NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "${NAME}: hprof-delta failed")
+    endif ()
+    list(FIND ARGN --keep-all KEEP_ALL)
+    set(SCAN_OPTIONS --values-stripped)
+    if (NOT KEEP_ALL EQUAL -1)
+        set(SCAN_OPTIONS)
+    endif ()
+    execute_process(COMMAND ${COMPARE} ${SCAN_OPTIONS} ${STRIPPED} ${REBUILT}
+            RESULT_VARIABLE RESULT OUTPUT_QUIET)
+    if (NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "${NAME}: ${REBUILT} differs from ${STRIPPED}")
+    endif ()
+    file(SIZE ${STRIPPED} STRIPPED_SIZE)
+    file(SIZE ${DELTA_FILE} DELTA_SIZE)
+    message(STATUS "${NAME}: ${STRIPPED_SIZE} bytes, delta ${DELTA_SIZE} OK")
+    file(REMOVE ${BASE_FILE} ${BASE_FILE}.kfp ${DELTA_FILE} ${STRIPPED}
+            ${REBUILT})
+endfunction()
+
+round_trip(default "")
+round_trip(keep-all "" --keep-all)
+round_trip(random-chunks "" --chunk 4096 --random-chunks 7)
+round_trip(lz4 "--compression;lz4")
+round_trip(lz4-keep-all "--compression;lz4" --keep-all)
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+// Runs an hprof through histogram mode and checks the per-class instance
+// counts and shallow bytes against a full scan of the input, for the whole
+// histogram written at once and byte by byte, and that a short one keeps the
+// classes with the most bytes:
+//
+//   heap-histogram-test <hprof>...
+
+#include <android/log.h>
+#include <fcntl.h>
+#include <hprof_strip_engine.h>
+#include <mapped_hprof.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hprof_scan.h"
+
+using kwai::leak_monitor::HprofScan;
+using kwai::leak_monitor::HprofStripEngine;
+using kwai::leak_monitor::MappedHprof;
+using kwai::leak_monitor::ScanHprof;
+
+namespace {
+
+// count, shallow bytes
+using Histogram = std::map<std::string, std::pair<uint64_t, uint64_t>>;
+
+const char *PrimitiveArrayName(uint64_t type) {
+  static const char *const kNames[] = {
+      "boolean[]", "char[]", "float[]", "double[]",
+      "byte[]",    "short[]", "int[]",  "long[]",
+  };
+  return type >= 4 && type <= 11 ? kNames[type - 4] : "?";
+}
+
+// The default and app heaps, as HeapHistogram counts by default
+bool Counted(uint8_t heap_type) { return heap_type != 'Z' && heap_type != 'I'; }
+
+Histogram Reference(const MappedHprof &input, const HprofScan &scan) {
+  std::map<uint64_t, std::string> strings;
+  const size_t header = 9 + scan.id_size;
+  for (const auto &string : scan.strings) {
+    const uint8_t *record = input.Data() + string.offset;
+    const uint32_t length = (uint32_t)record[5] << 24u |
+                            (uint32_t)record[6] << 16u |
+                            (uint32_t)record[7] << 8u | record[8];
+    strings[string.id].assign(reinterpret_cast<const char *>(record + header),
+                              length - scan.id_size);
+  }
+  std::map<uint64_t, std::string> class_names;
+  for (const auto &loaded : scan.classes) {
+    class_names[loaded.class_id] = strings[loaded.name_id];
+  }
+  Histogram histogram;
+  for (const auto &object : scan.objects) {
+    if (object.tag == 0x20 || !Counted(object.heap_type)) continue;
+    auto &entry = histogram[object.tag == 0x23
+                                ? PrimitiveArrayName(object.class_id)
+                                : class_names[object.class_id]];
+    entry.first++;
+    entry.second += object.body;
+  }
+  return histogram;
+}
+
+bool Run(const MappedHprof &input, size_t top, bool byte_by_byte,
+         std::string *text) {
+  char path[] = "/tmp/heap-histogram-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) return false;
+  HprofStripEngine engine;
+  engine.SetHistogramMode(top);
+  engine.Begin(path, fd);
+  bool ok = true;
+  if (byte_by_byte) {
+    for (size_t i = 0; ok && i < input.Size(); i++) {
+      ok = engine.Write(input.Data() + i, 1);
+    }
+  } else {
+    ok = engine.Write(input.Data(), input.Size());
+  }
+  ok = ok && engine.Finished();
+  close(fd);
+  MappedHprof output;
+  if (ok && output.Open(path)) {
+    text->assign(reinterpret_cast<const char *>(output.Data()), output.Size());
+  } else {
+    ok = false;
+  }
+  unlink(path);
+  return ok;
+}
+
+// Parses the rows of a histogram in their order, the total goes to total
+bool Parse(const std::string &text,
+           std::vector<std::pair<std::string, std::pair<uint64_t, uint64_t>>>
+               *rows,
+           uint64_t total[3]) {
+  const char kHeader[] = "# koom heap histogram 1\n";
+  if (text.compare(0, sizeof(kHeader) - 1, kHeader) != 0) return false;
+  size_t start = sizeof(kHeader) - 1;
+  bool has_total = false;
+  while (start < text.size()) {
+    size_t end = text.find('\n', start);
+    if (end == std::string::npos) return false;
+    std::string line = text.substr(start, end - start);
+    start = end + 1;
+    uint64_t count, bytes;
+    int name = 0;
+    if (!has_total) {
+      uint64_t classes;
+      if (sscanf(line.c_str(), "total\t%" SCNu64 "\t%" SCNu64 "\t%" SCNu64 "%n",
+                 &count, &bytes, &classes, &name) != 3 ||
+          (size_t)name != line.size()) {
+        return false;
+      }
+      total[0] = count;
+      total[1] = bytes;
+      total[2] = classes;
+      has_total = true;
+      continue;
+    }
+    if (sscanf(line.c_str(), "%" SCNu64 "\t%" SCNu64 "\t%n", &count, &bytes,
+               &name) != 2 ||
+        name == 0) {
+      return false;
+    }
+    rows->emplace_back(line.substr(name), std::make_pair(count, bytes));
+  }
+  return has_total;
+}
+
+bool Test(const char *name) {
+  MappedHprof input;
+  HprofScan scan;
+  if (!input.Open(name) ||
+      !ScanHprof(input.Data(), input.Size(), false, &scan)) {
+    fprintf(stderr, "%s: does not scan\n", name);
+    return false;
+  }
+  const Histogram expected = Reference(input, scan);
+  uint64_t expected_total[3] = {0, 0, expected.size()};
+  for (const auto &entry : expected) {
+    expected_total[0] += entry.second.first;
+    expected_total[1] += entry.second.second;
+  }
+
+  bool ok = true;
+  for (bool byte_by_byte : {false, true}) {
+    std::string text;
+    std::vector<std::pair<std::string, std::pair<uint64_t, uint64_t>>> rows;
+    uint64_t total[3];
+    if (!Run(input, 1000, byte_by_byte, &text) ||
+        !Parse(text, &rows, total)) {
+      fprintf(stderr, "%s: no histogram\n", name);
+      return false;
+    }
+    Histogram actual(rows.begin(), rows.end());
+    if (actual.size() != rows.size() || actual != expected ||
+        memcmp(total, expected_total, sizeof(total)) != 0) {
+      fprintf(stderr, "%s: histogram differs from the scan\n%s", name,
+              text.c_str());
+      for (const auto &entry : expected) {
+        fprintf(stderr, "expected %" PRIu64 "\t%" PRIu64 "\t%s\n",
+                entry.second.first, entry.second.second, entry.first.c_str());
+      }
+      ok = false;
+    }
+    for (size_t i = 1; ok && i < rows.size(); i++) {
+      ok = rows[i - 1].second.second >= rows[i].second.second;
+    }
+    if (!ok) return false;
+  }
+
+  // 只要前 3 个类时，应该是字节数最多的 3 个，total 仍然覆盖全部
+  std::vector<std::pair<uint64_t, std::string>> by_bytes;
+  for (const auto &entry : expected) {
+    by_bytes.emplace_back(entry.second.second, entry.first);
+  }
+  std::sort(by_bytes.rbegin(), by_bytes.rend());
+  std::string text;
+  std::vector<std::pair<std::string, std::pair<uint64_t, uint64_t>>> rows;
+  uint64_t total[3];
+  ok = Run(input, 3, false, &text) && Parse(text, &rows, total) &&
+       rows.size() == std::min<size_t>(3, by_bytes.size()) &&
+       memcmp(total, expected_total, sizeof(total)) == 0;
+  for (size_t i = 0; ok && i < rows.size(); i++) {
+    ok = rows[i].second.second == by_bytes[i].first;
+  }
+  if (!ok) {
+    fprintf(stderr, "%s: top 3 differ\n%s", name, text.c_str());
+    return false;
+  }
+  printf("%s: %zu classes, %" PRIu64 " objects, %" PRIu64 " bytes OK\n", name,
+         expected.size(), expected_total[0], expected_total[1]);
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <hprof>...\n", argv[0]);
+    return 2;
+  }
+  koom_host_log_set_min_priority(ANDROID_LOG_WARN);
+  bool ok = true;
+  for (int i = 1; i < argc; i++) ok &= Test(argv[i]);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+// Checks that two hprofs hold the same dump where objects may be placed in
+// other segments, which is what hprof-delta rebuilds compared to a full
+// strip: the same header, strings and classes in the same order and the same
+// instances, arrays and class dumps, byte for byte and in the same heaps.
+// --values-stripped reads both as kStripBody leaves primitive arrays:
+//
+//   hprof-compare-test [--values-stripped] <expected.hprof> <actual.hprof>
+
+#include <mapped_hprof.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "hprof_scan.h"
+
+using kwai::leak_monitor::HprofScan;
+using kwai::leak_monitor::MappedHprof;
+using kwai::leak_monitor::ScanHprof;
+using kwai::leak_monitor::ScannedObject;
+
+namespace {
+
+struct Dump {
+  MappedHprof file;
+  HprofScan scan;
+};
+
+bool Load(const char *path, bool values_stripped, Dump *dump) {
+  if (!dump->file.Open(path) ||
+      !ScanHprof(dump->file.Data(), dump->file.Size(), values_stripped,
+                 &dump->scan)) {
+    fprintf(stderr, "%s: does not scan\n", path);
+    return false;
+  }
+  std::sort(dump->scan.objects.begin(), dump->scan.objects.end(),
+            [](const ScannedObject &a, const ScannedObject &b) {
+              return a.id < b.id;
+            });
+  return true;
+}
+
+// Bytes of the sub record in the file, without stripped values
+size_t Written(const ScannedObject &object, bool values_stripped) {
+  return object.size -
+         (values_stripped && object.tag == 0x23 ? object.body : 0);
+}
+
+// The file header and the string records, whose length is at offset 5
+bool SameRecords(const Dump &expected, const Dump &actual) {
+  const size_t header = strlen(reinterpret_cast<const char *>(
+                            expected.file.Data())) + 1 + 4 + 8;
+  if (actual.file.Size() < header ||
+      memcmp(expected.file.Data(), actual.file.Data(), header) != 0) {
+    fprintf(stderr, "headers differ\n");
+    return false;
+  }
+  const auto &strings = expected.scan.strings;
+  if (strings.size() != actual.scan.strings.size()) {
+    fprintf(stderr, "%zu strings, expected %zu\n", actual.scan.strings.size(),
+            strings.size());
+    return false;
+  }
+  for (size_t i = 0; i < strings.size(); i++) {
+    const uint8_t *a = expected.file.Data() + strings[i].offset;
+    const uint8_t *b = actual.file.Data() + actual.scan.strings[i].offset;
+    const size_t size = 9 + ((uint32_t)a[5] << 24u | (uint32_t)a[6] << 16u |
+                             (uint32_t)a[7] << 8u | a[8]);
+    if (strings[i].id != actual.scan.strings[i].id ||
+        actual.scan.strings[i].offset + size > actual.file.Size() ||
+        memcmp(a, b, size) != 0) {
+      fprintf(stderr, "string %" PRIx64 " differs\n", strings[i].id);
+      return false;
+    }
+  }
+  const auto &classes = expected.scan.classes;
+  if (classes.size() != actual.scan.classes.size()) {
+    fprintf(stderr, "%zu loaded classes, expected %zu\n",
+            actual.scan.classes.size(), classes.size());
+    return false;
+  }
+  for (size_t i = 0; i < classes.size(); i++) {
+    if (classes[i].class_id != actual.scan.classes[i].class_id ||
+        classes[i].name_id != actual.scan.classes[i].name_id) {
+      fprintf(stderr, "loaded class %" PRIx64 " differs\n",
+              classes[i].class_id);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SameObjects(const Dump &expected, const Dump &actual,
+                 bool values_stripped) {
+  const auto &objects = expected.scan.objects;
+  if (objects.size() != actual.scan.objects.size()) {
+    fprintf(stderr, "%zu objects, expected %zu\n", actual.scan.objects.size(),
+            objects.size());
+    return false;
+  }
+  for (size_t i = 0; i < objects.size(); i++) {
+    const ScannedObject &a = objects[i];
+    const ScannedObject &b = actual.scan.objects[i];
+    if (a.id != b.id || a.tag != b.tag || a.heap_type != b.heap_type ||
+        a.class_id != b.class_id || a.size != b.size || a.body != b.body ||
+        memcmp(expected.file.Data() + a.offset, actual.file.Data() + b.offset,
+               Written(a, values_stripped)) != 0) {
+      fprintf(stderr, "object %" PRIx64 " differs\n", a.id);
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  int arg = 1;
+  const bool values_stripped =
+      argc > 1 && strcmp(argv[1], "--values-stripped") == 0;
+  if (values_stripped) arg++;
+  if (argc - arg != 2) {
+    fprintf(stderr,
+            "usage: %s [--values-stripped] <expected.hprof> <actual.hprof>\n",
+            argv[0]);
+    return 2;
+  }
+  Dump expected, actual;
+  if (!Load(argv[arg], values_stripped, &expected) ||
+      !Load(argv[arg + 1], values_stripped, &actual) ||
+      !SameRecords(expected, actual) ||
+      !SameObjects(expected, actual, values_stripped)) {
+    fprintf(stderr, "%s differs from %s\n", argv[arg + 1], argv[arg]);
+    return 1;
+  }
+  printf("%zu objects OK\n", expected.scan.objects.size());
+  return 0;
+}
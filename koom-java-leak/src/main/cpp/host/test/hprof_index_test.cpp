@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+// Strips an hprof with an index and checks every section of the .kidx
+// against a full scan of the stripped hprof, with the default policy, with
+// --keep-all and compressed:
+//
+//   hprof-index-test <hprof>...
+
+#include <android/log.h>
+#include <fcntl.h>
+#include <hprof_compressor.h>
+#include <hprof_index.h>
+#include <hprof_strip_engine.h>
+#include <mapped_hprof.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hprof_scan.h"
+
+using kwai::leak_monitor::HprofContainer;
+using kwai::leak_monitor::HprofIndex;
+using kwai::leak_monitor::HprofIndexFormat;
+using kwai::leak_monitor::HprofScan;
+using kwai::leak_monitor::HprofStripEngine;
+using kwai::leak_monitor::MappedHprof;
+using kwai::leak_monitor::ScanHprof;
+using kwai::leak_monitor::StripPolicy;
+
+namespace {
+
+using Entries = std::vector<std::pair<uint64_t, uint64_t>>;
+
+const char *const kSectionNames[] = {
+    "",        "instances", "object arrays", "primitive arrays",
+    "class dumps", "strings", "class names",
+};
+
+bool Strip(const MappedHprof &input, const std::string &path, bool keep_all,
+           int codec) {
+  int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+  if (fd < 0) return false;
+  HprofStripEngine engine;
+  StripPolicy policy;
+  if (keep_all) policy.Clear();
+  engine.SetStripPolicy(policy);
+  engine.SetCompression(codec);
+  engine.SetIndexEnabled(true);
+  engine.Begin(path.c_str(), fd);
+  bool ok = engine.Write(input.Data(), input.Size()) && engine.Finished();
+  return close(fd) == 0 && ok;
+}
+
+bool CheckSection(const HprofIndex &index, HprofIndexFormat::Section section,
+                  Entries expected, const char *name) {
+  std::sort(expected.begin(), expected.end());
+  const size_t count = index.Count(section);
+  bool ok = count == expected.size();
+  for (size_t i = 0; ok && i < count; i++) {
+    ok = index.Keys(section)[i] == expected[i].first &&
+         index.Values(section)[i] == expected[i].second;
+  }
+  // 逐个查找，也查不存在的 id
+  for (size_t i = 0; ok && i < expected.size(); i++) {
+    uint64_t value = 0;
+    ok = index.Find(section, expected[i].first, &value) &&
+         value == expected[i].second;
+    if (ok && (i + 1 == expected.size() ||
+               expected[i + 1].first > expected[i].first + 1)) {
+      ok = !index.Find(section, expected[i].first + 1, &value);
+    }
+  }
+  if (!ok) {
+    fprintf(stderr, "%s: %s differ, %zu indexed, %zu scanned\n", name,
+            kSectionNames[section], count, expected.size());
+  }
+  return ok;
+}
+
+bool Test(const char *name, bool keep_all, int codec) {
+  MappedHprof input;
+  if (!input.Open(name)) return false;
+  char path[] = "/tmp/hprof-index-XXXXXX";
+  int tmp = mkstemp(path);
+  if (tmp < 0) return false;
+  close(tmp);
+  const std::string index_path = std::string(path) + ".kidx";
+
+  bool ok = Strip(input, path, keep_all, codec);
+  MappedHprof stripped;
+  HprofIndex index;
+  HprofScan scan;
+  ok = ok && stripped.Open(path) && index.Open(index_path.c_str());
+  if (!ok) {
+    fprintf(stderr, "%s: stripping failed\n", name);
+  } else if (!ScanHprof(stripped.Data(), stripped.Size(), !keep_all, &scan)) {
+    fprintf(stderr, "%s: stripped hprof does not scan\n", name);
+    ok = false;
+  }
+  unlink(path);
+  unlink(index_path.c_str());
+  if (!ok) return false;
+
+  if (index.IdSize() != scan.id_size ||
+      index.HprofSize() != stripped.Size()) {
+    fprintf(stderr, "%s: index header differs\n", name);
+    return false;
+  }
+  Entries sections[HprofIndexFormat::kSectionEnd];
+  for (const auto &object : scan.objects) {
+    HprofIndexFormat::Section section;
+    switch (object.tag) {
+      case 0x20:
+        section = HprofIndexFormat::kClassDumps;
+        break;
+      case 0x21:
+        section = HprofIndexFormat::kInstances;
+        break;
+      case 0x22:
+        section = HprofIndexFormat::kObjectArrays;
+        break;
+      default:
+        section = HprofIndexFormat::kPrimitiveArrays;
+        break;
+    }
+    sections[section].emplace_back(object.id, object.offset);
+  }
+  for (const auto &string : scan.strings) {
+    sections[HprofIndexFormat::kStrings].emplace_back(string.id,
+                                                      string.offset);
+  }
+  for (const auto &loaded : scan.classes) {
+    sections[HprofIndexFormat::kClassNames].emplace_back(loaded.class_id,
+                                                         loaded.name_id);
+  }
+  for (uint32_t section = 1; section < HprofIndexFormat::kSectionEnd;
+       section++) {
+    ok &= CheckSection(index, (HprofIndexFormat::Section)section,
+                       sections[section], name);
+  }
+  if (ok) {
+    printf("%s%s%s: %zu objects, %zu strings, %zu classes OK\n", name,
+           keep_all ? " keep-all" : "",
+           codec != HprofContainer::kCodecNone ? " compressed" : "",
+           scan.objects.size(), scan.strings.size(), scan.classes.size());
+  }
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <hprof>...\n", argv[0]);
+    return 2;
+  }
+  koom_host_log_set_min_priority(ANDROID_LOG_WARN);
+  bool ok = true;
+  for (int i = 1; i < argc; i++) {
+    ok &= Test(argv[i], false, HprofContainer::kCodecNone);
+    ok &= Test(argv[i], true, HprofContainer::kCodecNone);
+    ok &= Test(argv[i], false, HprofContainer::kCodecLz4);
+  }
+  return ok ? 0 : 1;
+}
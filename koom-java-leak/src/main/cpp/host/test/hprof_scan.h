@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+// A plain reference walk over an hprof for the host tests, written
+// independently of HprofStreamParser so that the two can be compared.
+
+#ifndef KOOM_HOST_TEST_HPROF_SCAN_H
+#define KOOM_HOST_TEST_HPROF_SCAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace kwai {
+namespace leak_monitor {
+
+struct ScannedObject {
+  uint8_t tag;        // sub record tag
+  uint8_t heap_type;  // of the last HEAP_DUMP_INFO, 0 before the first
+  uint64_t id;
+  uint64_t class_id;  // class of instances and object arrays, element type
+                      // of primitive arrays
+  uint64_t offset;    // of the sub record
+  uint64_t size;      // of the sub record as ART wrote it
+  uint64_t body;      // bytes of field values or elements
+};
+
+struct ScannedString {
+  uint64_t id;
+  uint64_t offset;  // of the record
+};
+
+struct ScannedClass {
+  uint64_t class_id;
+  uint64_t name_id;
+};
+
+struct HprofScan {
+  uint32_t id_size = 0;
+  std::vector<ScannedObject> objects;
+  std::vector<ScannedString> strings;
+  std::vector<ScannedClass> classes;
+};
+
+/**
+ * Walks every record and heap sub record of data. With values_stripped the
+ * values of primitive arrays are absent but still counted in the segment
+ * lengths, which is what kStripBody leaves behind. Returns false on
+ * malformed input.
+ */
+inline bool ScanHprof(const uint8_t *data, size_t size, bool values_stripped,
+                      HprofScan *scan) {
+  const uint8_t *end = data + size;
+  const uint8_t *p =
+      static_cast<const uint8_t *>(memchr(data, 0, size < 64 ? size : 64));
+  if (p == nullptr || end - p < 13) return false;
+  p++;
+  auto u1 = [&p]() { return *p++; };
+  auto u2 = [&p]() {
+    uint32_t v = (uint32_t)p[0] << 8u | p[1];
+    p += 2;
+    return v;
+  };
+  auto u4 = [&p]() {
+    uint32_t v = (uint32_t)p[0] << 24u | (uint32_t)p[1] << 16u |
+                 (uint32_t)p[2] << 8u | p[3];
+    p += 4;
+    return v;
+  };
+  const uint32_t id_size = u4();
+  if (id_size != 4 && id_size != 8) return false;
+  scan->id_size = id_size;
+  auto id = [&u4, id_size]() -> uint64_t {
+    if (id_size == 4) return u4();
+    uint64_t high = u4();
+    return high << 32u | u4();
+  };
+  auto type_size = [id_size](uint8_t type) -> size_t {
+    switch (type) {
+      case 2:
+        return id_size;
+      case 4:
+      case 8:
+        return 1;
+      case 5:
+      case 9:
+        return 2;
+      case 6:
+      case 10:
+        return 4;
+      case 7:
+      case 11:
+        return 8;
+      default:
+        return 0;
+    }
+  };
+  p += 8;  // timestamp
+
+  uint8_t heap_type = 0;
+  while (p < end) {
+    if (end - p < 9) return false;
+    const uint8_t tag = u1();
+    const uint8_t *record = p - 1;
+    p += 4;
+    const uint32_t length = u4();
+    if (tag != 0x0c && tag != 0x1c) {
+      if ((size_t)(end - p) < length) return false;
+      if (tag == 0x01) {
+        const uint8_t *body = p;
+        scan->strings.push_back({id(), (uint64_t)(record - data)});
+        p = body;
+      } else if (tag == 0x02) {
+        const uint8_t *body = p;
+        u4();
+        uint64_t class_id = id();
+        u4();
+        scan->classes.push_back({class_id, id()});
+        p = body;
+      }
+      p += length;
+      continue;
+    }
+    // Stripped values are absent but counted in length
+    uint64_t left = length;
+    while (left > 0) {
+      if (p >= end) return false;
+      const uint8_t *sub = p;
+      const uint8_t sub_tag = u1();
+      uint64_t missing = 0;
+      ScannedObject object = {sub_tag, heap_type, 0, 0,
+                              (uint64_t)(sub - data), 0, 0};
+      switch (sub_tag) {
+        case 0xff:
+        case 0x05:
+        case 0x07:
+        case 0x89:
+        case 0x8a:
+        case 0x8b:
+        case 0x8c:
+        case 0x8d:
+        case 0x90:
+          p += id_size;
+          break;
+        case 0x01:
+          p += 2 * id_size;
+          break;
+        case 0x02:
+        case 0x03:
+        case 0x08:
+        case 0x8e:
+          p += id_size + 8;
+          break;
+        case 0x04:
+        case 0x06:
+          p += id_size + 4;
+          break;
+        case 0xfe:
+          heap_type = (uint8_t)u4();
+          p += id_size;
+          break;
+        case 0x20: {
+          object.id = id();
+          p += 4 + 6 * id_size + 4;
+          const uint32_t constants = u2();
+          for (uint32_t i = 0; i < constants; i++) {
+            p += 2;
+            p += type_size(u1());
+          }
+          const uint32_t statics = u2();
+          for (uint32_t i = 0; i < statics; i++) {
+            p += id_size;
+            p += type_size(u1());
+          }
+          p += u2() * (id_size + 1);
+          break;
+        }
+        case 0x21: {
+          object.id = id();
+          p += 4;
+          object.class_id = id();
+          object.body = u4();
+          p += object.body;
+          break;
+        }
+        case 0x22: {
+          object.id = id();
+          p += 4;
+          const uint32_t count = u4();
+          object.class_id = id();
+          object.body = (uint64_t)count * id_size;
+          p += object.body;
+          break;
+        }
+        case 0x23: {
+          object.id = id();
+          p += 4;
+          const uint32_t count = u4();
+          object.class_id = u1();
+          const size_t bytes =
+              (size_t)count * type_size((uint8_t)object.class_id);
+          object.body = bytes;
+          if (values_stripped) {
+            missing = bytes;
+          } else {
+            p += bytes;
+          }
+          break;
+        }
+        case 0xc3:
+          object.id = id();
+          p += 4 + 4 + 1;
+          break;
+        default:
+          return false;
+      }
+      const uint64_t sub_size = (uint64_t)(p - sub) + missing;
+      if (p > end || sub_size > left) return false;
+      left -= sub_size;
+      if (sub_tag >= 0x20 && sub_tag <= 0x23) {
+        object.size = sub_size;
+        scan->objects.push_back(object);
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_HOST_TEST_HPROF_SCAN_H
@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+// Strips a small hprof with a known reference graph, 4 and 8 byte ids, in one
+// write and in single byte writes, and checks the .kpath written next to it:
+// shortest paths through fields, array elements and statics, subclasses of
+// the suspect, the name#field condition, Reference.referent not followed,
+// garbage and suspects outside the default and app heaps left out.
+//
+//   leak-path-test
+
+#include <fcntl.h>
+#include <hprof_strip_engine.h>
+#include <hprof_writer.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using kwai::leak_monitor::HprofStripEngine;
+using kwai::leak_monitor::HprofWriter;
+
+namespace {
+
+enum : uint64_t {
+  kStringObject = 0x100,
+  kStringReference,
+  kStringWeakReference,
+  kStringHolder,
+  kStringLeaky,
+  kStringSubLeaky,
+  kStringObjectArray,
+  kStringReferent,
+  kStringNext,
+  kStringLeak,
+  kStringInstance,
+  kStringDestroyed,
+  kStringOther,
+  kStringExtra,
+  kClassObject = 0x1000,
+  kClassReference,
+  kClassWeakReference,
+  kClassHolder,
+  kClassLeaky,
+  kClassSubLeaky,
+  kClassObjectArray,
+  // Holders chain to a destroyed Leaky, an array holds a SubLeaky, a
+  // WeakReference refers to one more, the Holder class holds an alive Leaky
+  // that references a destroyed one
+  kHolder1 = 0x20000,
+  kHolder2,
+  kArray,
+  kWeak,
+  kLeakyByField,
+  kSubLeakyByElement,
+  kLeakyByReferent,
+  kLeakyAlive,
+  kLeakyByStatic,
+  kLeakyGarbage,
+  kLeakyZygote,
+};
+
+const uint8_t kObject = 2;
+const uint8_t kBoolean = 4;
+const uint8_t kInt = 10;
+
+struct Field {
+  uint64_t name;
+  uint8_t type;
+};
+
+void ClassDump(HprofWriter &w, uint64_t class_id, uint64_t super_id,
+               uint32_t instance_size, const std::vector<Field> &fields,
+               uint64_t static_name = 0, uint64_t static_value = 0) {
+  w.U1(0x20);
+  w.Id(class_id);
+  w.U4(1);
+  w.Id(super_id);
+  for (int i = 0; i < 5; i++) w.Id(0);
+  w.U4(instance_size);
+  w.U2(0);
+  w.U2(static_name != 0 ? 1 : 0);
+  if (static_name != 0) {
+    w.Id(static_name);
+    w.U1(kObject);
+    w.Id(static_value);
+  }
+  w.U2((uint32_t)fields.size());
+  for (const Field &field : fields) {
+    w.Id(field.name);
+    w.U1(field.type);
+  }
+}
+
+void InstanceHeader(HprofWriter &w, uint64_t id, uint64_t class_id,
+                    uint32_t size) {
+  w.U1(0x21);
+  w.Id(id);
+  w.U4(1);
+  w.Id(class_id);
+  w.U4(size);
+}
+
+// Leaky: boolean mDestroyed, Object other
+void Leaky(HprofWriter &w, uint64_t id, bool destroyed, uint64_t other) {
+  InstanceHeader(w, id, kClassLeaky, 1 + (uint32_t)w.TypeSize(kObject));
+  w.U1(destroyed ? 1 : 0);
+  w.Id(other);
+}
+
+// Holder: Object next, Object leak
+void Holder(HprofWriter &w, uint64_t id, uint64_t next, uint64_t leak) {
+  InstanceHeader(w, id, kClassHolder, 2 * (uint32_t)w.TypeSize(kObject));
+  w.Id(next);
+  w.Id(leak);
+}
+
+void HeapInfo(HprofWriter &w, uint32_t heap, uint64_t name) {
+  w.U1(0xfe);
+  w.U4(heap);
+  w.Id(name);
+}
+
+std::vector<uint8_t> Generate(uint32_t id_size) {
+  HprofWriter w(id_size);
+  const uint32_t id = id_size;
+  w.Header(1600000000000ull);
+  w.String(kStringObject, "java.lang.Object");
+  w.String(kStringReference, "java.lang.ref.Reference");
+  w.String(kStringWeakReference, "java.lang.ref.WeakReference");
+  w.String(kStringHolder, "com.example.Holder");
+  w.String(kStringLeaky, "com.example.Leaky");
+  w.String(kStringSubLeaky, "com.example.SubLeaky");
+  w.String(kStringObjectArray, "java.lang.Object[]");
+  w.String(kStringReferent, "referent");
+  w.String(kStringNext, "next");
+  w.String(kStringLeak, "leak");
+  w.String(kStringInstance, "sInstance");
+  w.String(kStringDestroyed, "mDestroyed");
+  w.String(kStringOther, "other");
+  w.String(kStringExtra, "extra");
+  w.LoadClass(1, kClassObject, kStringObject);
+  w.LoadClass(2, kClassReference, kStringReference);
+  w.LoadClass(3, kClassWeakReference, kStringWeakReference);
+  w.LoadClass(4, kClassHolder, kStringHolder);
+  w.LoadClass(5, kClassLeaky, kStringLeaky);
+  w.LoadClass(6, kClassSubLeaky, kStringSubLeaky);
+  w.LoadClass(7, kClassObjectArray, kStringObjectArray);
+
+  w.Begin(0x0c);
+  w.U1(0x01);  // jni global
+  w.Id(kHolder1);
+  w.Id(0x7f0001);
+  w.U1(0x03);  // java frame
+  w.Id(kArray);
+  w.U4(1);
+  w.U4(0);
+  w.U1(0x05);  // sticky class
+  w.Id(kClassHolder);
+  w.U1(0x01);
+  w.Id(kWeak);
+  w.Id(0x7f0002);
+  w.U1(0xff);  // unknown
+  w.Id(kLeakyZygote);
+  HeapInfo(w, 0, kStringObject);
+  ClassDump(w, kClassObject, 0, 0, {});
+  ClassDump(w, kClassReference, kClassObject, id, {{kStringReferent, kObject}});
+  ClassDump(w, kClassWeakReference, kClassReference, id, {});
+  ClassDump(w, kClassHolder, kClassObject, 2 * id,
+            {{kStringNext, kObject}, {kStringLeak, kObject}}, kStringInstance,
+            kLeakyAlive);
+  ClassDump(w, kClassLeaky, kClassObject, 1 + id,
+            {{kStringDestroyed, kBoolean}, {kStringOther, kObject}});
+  ClassDump(w, kClassSubLeaky, kClassLeaky, 5 + id, {{kStringExtra, kInt}});
+  ClassDump(w, kClassObjectArray, kClassObject, 0, {});
+  w.End();
+
+  w.Begin(0x1c);
+  HeapInfo(w, 'A', kStringLeaky);
+  Holder(w, kHolder1, kHolder2, 0);
+  Holder(w, kHolder2, 0, kLeakyByField);
+  w.U1(0x22);
+  w.Id(kArray);
+  w.U4(1);
+  w.U4(2);
+  w.Id(kClassObjectArray);
+  w.Id(0);
+  w.Id(kSubLeakyByElement);
+  InstanceHeader(w, kWeak, kClassWeakReference, id);
+  w.Id(kLeakyByReferent);
+  Leaky(w, kLeakyByField, true, 0);
+  InstanceHeader(w, kSubLeakyByElement, kClassSubLeaky, 5 + id);
+  w.U4(42);
+  w.U1(1);
+  w.Id(0);
+  Leaky(w, kLeakyByReferent, true, 0);
+  Leaky(w, kLeakyAlive, false, kLeakyByStatic);
+  Leaky(w, kLeakyByStatic, true, 0);
+  Leaky(w, kLeakyGarbage, true, kHolder1);
+  HeapInfo(w, 'Z', kStringSubLeaky);
+  Leaky(w, kLeakyZygote, true, 0);
+  w.End();
+  w.Begin(0x2c);
+  w.End();
+  return w.Bytes();
+}
+
+const char kExpected[] =
+    "# koom leak paths 1\n"
+    "total\t5\t3\t18\t6\n"
+    "path\t1\tcom.example.SubLeaky\t0x20005\n"
+    "\troot\tjava frame\tjava.lang.Object[]\t0x20002\n"
+    "\telement\t1\tcom.example.SubLeaky\t0x20005\n"
+    "path\t2\tcom.example.Leaky\t0x20004\n"
+    "\troot\tjni global\tcom.example.Holder\t0x20000\n"
+    "\tfield\tnext\tcom.example.Holder\t0x20001\n"
+    "\tfield\tleak\tcom.example.Leaky\t0x20004\n"
+    "path\t2\tcom.example.Leaky\t0x20008\n"
+    "\troot\tsticky class\tclass com.example.Holder\t0x1003\n"
+    "\tstatic\tsInstance\tcom.example.Leaky\t0x20007\n"
+    "\tfield\tother\tcom.example.Leaky\t0x20008\n";
+
+bool ReadFile(const std::string &path, std::string *data) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == nullptr) return false;
+  char buf[4096];
+  size_t n;
+  data->clear();
+  while ((n = fread(buf, 1, sizeof(buf), file)) > 0) data->append(buf, n);
+  fclose(file);
+  return true;
+}
+
+bool Check(const std::vector<uint8_t> &hprof, size_t chunk,
+           const std::string &path, const char *name) {
+  int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    perror(path.c_str());
+    return false;
+  }
+  HprofStripEngine engine;
+  engine.SetLeakPathClasses({"com.example.Leaky#mDestroyed"});
+  engine.Begin(path.c_str(), fd);
+  bool ok = true;
+  for (size_t pos = 0; pos < hprof.size() && ok; pos += chunk) {
+    ok = engine.Write(hprof.data() + pos, std::min(chunk, hprof.size() - pos));
+  }
+  close(fd);
+  std::string report;
+  if (!ok || !engine.Finished() || !ReadFile(path + ".kpath", &report)) {
+    fprintf(stderr, "%s: no report\n", name);
+    return false;
+  }
+  unlink(path.c_str());
+  unlink((path + ".kpath").c_str());
+  if (report != kExpected) {
+    fprintf(stderr, "%s: got\n%s", name, report.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  char dir[] = "/tmp/leak-path-XXXXXX";
+  if (mkdtemp(dir) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+  bool ok = true;
+  for (uint32_t id_size : {4u, 8u}) {
+    std::vector<uint8_t> hprof = Generate(id_size);
+    std::string path = std::string(dir) + "/leak.hprof";
+    std::string name = "id" + std::to_string(id_size);
+    ok &= Check(hprof, hprof.size(), path, name.c_str());
+    ok &= Check(hprof, 1, path, (name + " byte by byte").c_str());
+  }
+  rmdir(dir);
+  printf("%s\n", ok ? "ALL OK" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+# Strips INPUT into an hprof and into a snapshot with the same options, turns
+# the snapshot back with hprof-snapshot and requires the two hprofs to be
+# identical, for the default rules, --keep-all, random write sizes and a
+# compressed snapshot:
+#
+#   cmake -DSTRIP=<hprof-strip> -DSNAPSHOT=<hprof-snapshot> -DINPUT=<hprof>
+#         -DWORK_DIR=<dir> -P snapshot_round_trip.cmake
+
+foreach (VAR STRIP SNAPSHOT INPUT WORK_DIR)
+    if (NOT DEFINED ${VAR})
+        message(FATAL_ERROR "${VAR} is not set")
+    endif ()
+endforeach ()
+file(MAKE_DIRECTORY ${WORK_DIR})
+
+# SNAPSHOT_OPTIONS only apply to the snapshot, ARGN to both
+function(round_trip NAME SNAPSHOT_OPTIONS)
+    set(STRIPPED ${WORK_DIR}/${NAME}.hprof)
+    set(SNAPSHOT_FILE ${WORK_DIR}/${NAME}.ksnap)
+    set(DECODED ${WORK_DIR}/${NAME}-decoded.hprof)
+    execute_process(COMMAND ${STRIP} ${ARGN} ${INPUT} ${STRIPPED}
+            RESULT_VARIABLE RESULT OUTPUT_QUIET)
+    if (NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "${NAME}: stripping failed")
+    endif ()
+    execute_process(COMMAND ${STRIP} --snapshot ${SNAPSHOT_OPTIONS} ${ARGN}
+            ${INPUT} ${SNAPSHOT_FILE}
+            RESULT_VARIABLE RESULT OUTPUT_QUIET)
+    if (NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "${NAME}: writing the snapshot failed")
+    endif ()
+    execute_process(COMMAND ${SNAPSHOT} ${SNAPSHOT_FILE} ${DECODED}
+            RESULT_VARIABLE RESULT OUTPUT_QUIET)
+    if (NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "${NAME}: hprof-snapshot failed")
+    endif ()
+    execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files
+            ${STRIPPED} ${DECODED} RESULT_VARIABLE RESULT)
+    if (NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "${NAME}: ${DECODED} differs from ${STRIPPED}")
+    endif ()
+    file(SIZE ${STRIPPED} STRIPPED_SIZE)
+    file(SIZE ${SNAPSHOT_FILE} SNAPSHOT_SIZE)
+    message(STATUS "${NAME}: ${STRIPPED_SIZE} bytes, snapshot ${SNAPSHOT_SIZE} OK")
+    file(REMOVE ${STRIPPED} ${SNAPSHOT_FILE} ${DECODED})
+endfunction()
+
+round_trip(default "")
+round_trip(keep-all "" --keep-all)
+round_trip(random-chunks "" --chunk 4096 --random-chunks 7)
+round_trip(lz4 "--compression;lz4")
+round_trip(lzma "--compression;lzma" --keep-all)
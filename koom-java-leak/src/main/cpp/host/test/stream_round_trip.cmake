@@ -0,0 +1,65 @@
+# Strips INPUT directly and through --stream, where a forked child writes it
+# into a pipe like ForkJvmHeapDumper.dumpToStream, and requires the hprofs
+# and their .kidx and .kdup to be identical, for the default pipe size and a
+# small pipe fed in random write sizes, with the default rules, --keep-all
+# and lz4. A child killed halfway and an output that cannot be written must
+# fail the dump:
+#
+#   cmake -DSTRIP=<hprof-strip> -DINPUT=<hprof> -DWORK_DIR=<dir>
+#         -P stream_round_trip.cmake
+
+foreach (VAR STRIP INPUT WORK_DIR)
+    if (NOT DEFINED ${VAR})
+        message(FATAL_ERROR "${VAR} is not set")
+    endif ()
+endforeach ()
+file(MAKE_DIRECTORY ${WORK_DIR})
+
+# STREAM_OPTIONS only apply to the stream, ARGN to both
+function(round_trip NAME STREAM_OPTIONS)
+    set(DIRECT ${WORK_DIR}/${NAME}-direct.hprof)
+    set(STREAMED ${WORK_DIR}/${NAME}-stream.hprof)
+    execute_process(COMMAND ${STRIP} --index --duplicates 256 ${ARGN}
+            ${INPUT} ${DIRECT}
+            RESULT_VARIABLE RESULT OUTPUT_QUIET)
+    if (NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "${NAME}: stripping failed")
+    endif ()
+    execute_process(COMMAND ${STRIP} ${STREAM_OPTIONS} --index
+            --duplicates 256 ${ARGN} ${INPUT} ${STREAMED}
+            RESULT_VARIABLE RESULT OUTPUT_QUIET)
+    if (NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "${NAME}: stripping the stream failed")
+    endif ()
+    foreach (SUFFIX "" .kidx .kdup)
+        execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files
+                ${DIRECT}${SUFFIX} ${STREAMED}${SUFFIX} RESULT_VARIABLE RESULT)
+        if (NOT RESULT EQUAL 0)
+            message(FATAL_ERROR
+                    "${NAME}: ${STREAMED}${SUFFIX} differs from ${DIRECT}${SUFFIX}")
+        endif ()
+        file(REMOVE ${DIRECT}${SUFFIX} ${STREAMED}${SUFFIX})
+    endforeach ()
+    message(STATUS "${NAME} OK")
+endfunction()
+
+# The dump must fail, not leave a truncated hprof behind as a success
+function(must_fail NAME OUTPUT)
+    execute_process(COMMAND ${STRIP} ${ARGN} ${INPUT} ${OUTPUT}
+            RESULT_VARIABLE RESULT OUTPUT_QUIET ERROR_QUIET)
+    if (RESULT EQUAL 0)
+        message(FATAL_ERROR "${NAME}: the dump succeeded")
+    endif ()
+    message(STATUS "${NAME} failed OK")
+endfunction()
+
+round_trip(default "--stream;0")
+round_trip(random-chunks "--stream;4096;--chunk;8192;--random-chunks;7")
+round_trip(keep-all "--stream;4096;--chunk;8192;--random-chunks;7" --keep-all)
+round_trip(lz4 "--stream;0" --compression lz4)
+
+file(SIZE ${INPUT} INPUT_SIZE)
+math(EXPR HALF "${INPUT_SIZE} / 2")
+must_fail(killed ${WORK_DIR}/killed.hprof --stream 4096 --stream-kill ${HALF})
+file(REMOVE ${WORK_DIR}/killed.hprof)
+must_fail(unwritable /dev/full --stream 0)
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+// Feeds hprof files to HprofStripEngine split in every possible way a writer
+// could split them and checks that the stripped output is always the one of
+// a single write:
+//
+//   strip-split-test [--keep-all] <hprof>...
+//
+// Each file is written in two parts at every byte boundary, byte by byte and
+// in random chunks. Inputs should be small, the two part splits are
+// quadratic.
+
+#include <android/log.h>
+#include <fcntl.h>
+#include <hprof_strip_engine.h>
+#include <mapped_hprof.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using kwai::leak_monitor::HprofStripEngine;
+using kwai::leak_monitor::MappedHprof;
+using kwai::leak_monitor::StripPolicy;
+
+namespace {
+
+class Stripper {
+ public:
+  Stripper(const std::string &path, bool keep_all) : path_(path) {
+    if (keep_all) policy_.Clear();
+    fd_ = open(path_.c_str(), O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0644);
+  }
+  ~Stripper() {
+    if (fd_ >= 0) close(fd_);
+    unlink(path_.c_str());
+  }
+
+  bool Valid() const { return fd_ >= 0; }
+
+  // Strips data written in the given chunk sizes, the last one repeats
+  bool Run(const uint8_t *data, size_t size, const std::vector<size_t> &chunks,
+           std::string *output) {
+    if (ftruncate(fd_, 0) != 0 || lseek(fd_, 0, SEEK_SET) != 0) return false;
+    HprofStripEngine engine;
+    engine.SetStripPolicy(policy_);
+    engine.Begin(path_.c_str(), fd_);
+    size_t i = 0;
+    for (size_t pos = 0; pos < size;) {
+      size_t n = std::min(chunks[std::min(i++, chunks.size() - 1)], size - pos);
+      if (!engine.Write(data + pos, n)) return false;
+      pos += n;
+    }
+    if (!engine.Finished()) return false;
+    off_t length = lseek(fd_, 0, SEEK_END);
+    output->resize((size_t)length);
+    return pread(fd_, &(*output)[0], output->size(), 0) == length;
+  }
+
+ private:
+  std::string path_;
+  StripPolicy policy_;
+  int fd_;
+};
+
+bool Test(const char *name, bool keep_all) {
+  MappedHprof hprof;
+  if (!hprof.Open(name)) return false;
+  const uint8_t *data = hprof.Data();
+  const size_t size = hprof.Size();
+
+  char path[] = "/tmp/strip-split-XXXXXX";
+  int tmp = mkstemp(path);
+  if (tmp < 0) {
+    perror("mkstemp");
+    return false;
+  }
+  close(tmp);
+  Stripper stripper(path, keep_all);
+  std::string expected;
+  if (!stripper.Valid() || !stripper.Run(data, size, {size}, &expected)) {
+    fprintf(stderr, "%s: stripping failed\n", name);
+    return false;
+  }
+
+  std::string output;
+  for (size_t split = 1; split < size; split++) {
+    if (!stripper.Run(data, size, {split, size}, &output) ||
+        output != expected) {
+      fprintf(stderr, "%s: differs when split at %zu\n", name, split);
+      return false;
+    }
+  }
+  if (!stripper.Run(data, size, {1}, &output) || output != expected) {
+    fprintf(stderr, "%s: differs when written byte by byte\n", name);
+    return false;
+  }
+  std::mt19937 random(7);
+  for (size_t max : {16u, 1000u, 70000u}) {
+    std::vector<size_t> chunks;
+    for (size_t pos = 0; pos < size;) {
+      chunks.push_back(1 + random() % max);
+      pos += chunks.back();
+    }
+    if (!stripper.Run(data, size, chunks, &output) || output != expected) {
+      fprintf(stderr, "%s: differs in random chunks up to %zu\n", name, max);
+      return false;
+    }
+  }
+  printf("%s%s: %zu bytes in, %zu out, %zu splits OK\n", name,
+         keep_all ? " keep-all" : "", size, expected.size(), size + 3);
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  bool keep_all = false;
+  int first = 1;
+  if (argc > 1 && strcmp(argv[1], "--keep-all") == 0) {
+    keep_all = true;
+    first++;
+  }
+  if (first >= argc) {
+    fprintf(stderr, "usage: %s [--keep-all] <hprof>...\n", argv[0]);
+    return 2;
+  }
+  koom_host_log_set_min_priority(ANDROID_LOG_WARN);
+  bool ok = true;
+  for (int i = first; i < argc; i++) ok &= Test(argv[i], keep_all);
+  return ok ? 0 : 1;
+}
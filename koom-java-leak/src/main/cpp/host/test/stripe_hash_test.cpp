@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+// Checks that a change of a single bit anywhere in a payload changes both 32
+// bit halves of its StripeHash, that the hash does not depend on how the
+// payload is split into Update() calls and that the SIMD stripe loop matches
+// the scalar one. --bench reports the speed of both over that many MB:
+//
+//   stripe-hash-test [--bench <MB>]
+
+#include <stripe_hash.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using kwai::leak_monitor::StripeHash;
+
+namespace {
+
+// Compiled with the flags of stripe_hash.cpp, see CMakeLists.txt
+#if defined(__ARM_NEON)
+const char kStripesVariant[] = "neon";
+#elif defined(__SSE4_1__)
+const char kStripesVariant[] = "sse4.1";
+#else
+const char kStripesVariant[] = "scalar";
+#endif
+
+uint64_t Hash(const std::vector<uint8_t> &data) {
+  StripeHash hash;
+  hash.Update(data.data(), data.size());
+  return hash.Final();
+}
+
+bool TestSingleBitChanges(std::mt19937 &random) {
+  size_t checked = 0;
+  for (size_t size : {1, 31, 32, 33, 64, 100, 257, 1024}) {
+    std::vector<uint8_t> data(size);
+    for (auto &byte : data) byte = (uint8_t)random();
+    const uint64_t original = Hash(data);
+    for (size_t i = 0; i < size; i++) {
+      data[i] ^= (uint8_t)(1u << (i % 8));
+      const uint64_t changed = Hash(data);
+      data[i] ^= (uint8_t)(1u << (i % 8));
+      // 高低 32 位都要变，否则这条记录只有 32 位的保护
+      if ((uint32_t)changed == (uint32_t)original ||
+          (changed >> 32u) == (original >> 32u)) {
+        fprintf(stderr,
+                "%zu bytes, bit %zu of byte %zu: %016" PRIx64 " and %016" PRIx64
+                "\n",
+                size, i % 8, i, original, changed);
+        return false;
+      }
+      checked++;
+    }
+  }
+  printf("single bit changes: %zu OK\n", checked);
+  return true;
+}
+
+bool TestSplits(std::mt19937 &random) {
+  std::vector<uint8_t> data(1000);
+  for (auto &byte : data) byte = (uint8_t)random();
+  for (size_t size : {0, 5, 32, 95, 1000}) {
+    std::vector<uint8_t> prefix(data.begin(), data.begin() + size);
+    const uint64_t expected = Hash(prefix);
+    for (size_t round = 0; round < 20; round++) {
+      StripeHash hash;
+      for (size_t done = 0; done < size;) {
+        size_t piece = std::min<size_t>(size - done, random() % 70);
+        hash.Update(data.data() + done, piece);
+        done += piece;
+      }
+      if (hash.Final() != expected) {
+        fprintf(stderr, "%zu bytes: split hash differs\n", size);
+        return false;
+      }
+    }
+  }
+  printf("splits OK\n");
+  return true;
+}
+
+bool TestStripes(std::mt19937 &random) {
+  std::vector<uint8_t> data(300 * StripeHash::kStripeSize + 16);
+  for (auto &byte : data) byte = (uint8_t)random();
+  for (int round = 0; round < 500; round++) {
+    // 长度和起始地址都随机，SIMD 版本读的是非对齐数据
+    const size_t stripes = random() % 301;
+    const size_t offset = random() % 16;
+    alignas(16) uint32_t simd[8];
+    alignas(16) uint32_t scalar[8];
+    for (size_t i = 0; i < 8; i++) simd[i] = scalar[i] = (uint32_t)random();
+    StripeHash::Stripes(simd, data.data() + offset, stripes);
+    StripeHash::ScalarStripes(scalar, data.data() + offset, stripes);
+    if (memcmp(simd, scalar, sizeof(simd)) != 0) {
+      fprintf(stderr, "%s stripes differ from scalar: %zu stripes at %zu\n",
+              kStripesVariant, stripes, offset);
+      return false;
+    }
+  }
+  printf("%s stripes match scalar OK\n", kStripesVariant);
+  return true;
+}
+
+// Keeps the benchmarked loops from being optimized away
+volatile uint32_t lane_sink;
+
+// Best of 5 rounds over data, in GB/s
+double Speed(void (*stripes)(uint32_t *, const uint8_t *, size_t),
+             const std::vector<uint8_t> &data) {
+  double best = 0;
+  for (int round = 0; round < 5; round++) {
+    alignas(16) uint32_t lanes[8] = {};
+    auto start = std::chrono::steady_clock::now();
+    stripes(lanes, data.data(), data.size() / StripeHash::kStripeSize);
+    std::chrono::duration<double> seconds =
+        std::chrono::steady_clock::now() - start;
+    best = std::max(best, data.size() / 1e9 / seconds.count());
+    lane_sink = lanes[0];
+  }
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+    std::vector<uint8_t> data(strtoull(argv[2], nullptr, 0) << 20u);
+    std::mt19937 random(2021);
+    for (auto &byte : data) byte = (uint8_t)random();
+    const double simd = Speed(StripeHash::Stripes, data);
+    const double scalar = Speed(StripeHash::ScalarStripes, data);
+    printf("%zu MB: %s stripes %.2f GB/s, scalar %.2f GB/s\n",
+           data.size() >> 20u, kStripesVariant, simd, scalar);
+    return 0;
+  }
+  std::mt19937 random(2021);
+  bool ok = TestSingleBitChanges(random);
+  ok &= TestSplits(random);
+  ok &= TestStripes(random);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <LzmaLib.h>
+#include <android/log.h>
+#include <hprof_block_reader.h>
+#include <lz4_block.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+
+#define LOG_TAG "HprofBlockReader"
+
+namespace kwai {
+namespace leak_monitor {
+
+static uint32_t GetLe32(const uint8_t *p) {
+  return p[0] | (p[1] << 8u) | (p[2] << 16u) | ((uint32_t)p[3] << 24u);
+}
+
+static uint64_t GetLe64(const uint8_t *p) {
+  return GetLe32(p) | ((uint64_t)GetLe32(p + 4) << 32u);
+}
+
+bool HprofBlockReader::Open(int fd) {
+  fd_ = fd;
+  raw_size_ = 0;
+  blocks_.clear();
+
+  struct stat st {};
+  if (fstat(fd, &st) != 0) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "fstat failed, errno: %d",
+                        errno);
+    return false;
+  }
+  auto file_size = (uint64_t)st.st_size;
+
+  uint8_t header[HprofContainer::kHeaderSize];
+  if (!ReadAt(0, header, sizeof(header)) ||
+      GetLe32(header) != HprofContainer::kMagic ||
+      (header[4] | (header[5] << 8u)) != HprofContainer::kVersion) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "not a compressed hprof");
+    return false;
+  }
+
+  if (LoadIndex(file_size)) return true;
+  // 没有写完 trailer 的文件，按块头顺序恢复出完整的块
+  __android_log_print(ANDROID_LOG_INFO, LOG_TAG, "no index, scan blocks");
+  return ScanBlocks(file_size);
+}
+
+size_t HprofBlockReader::FindBlock(uint64_t raw_offset) const {
+  if (raw_offset >= raw_size_) return blocks_.size();
+  auto it = std::upper_bound(
+      blocks_.begin(), blocks_.end(), raw_offset,
+      [](uint64_t offset, const Block &block) {
+        return offset < block.raw_offset;
+      });
+  return it - blocks_.begin() - 1;
+}
+
+bool HprofBlockReader::ReadBlock(size_t index,
+                                 std::vector<uint8_t> &out) const {
+  if (index >= blocks_.size()) return false;
+  const Block &block = blocks_[index];
+  std::vector<uint8_t> packed(block.packed_size);
+  if (!ReadAt(block.file_offset + HprofContainer::kBlockHeaderSize,
+              packed.data(), packed.size())) {
+    return false;
+  }
+
+  out.resize(block.raw_size);
+  bool ok = false;
+  switch (block.codec) {
+    case HprofContainer::kCodecNone:
+      ok = block.packed_size == block.raw_size;
+      if (ok) out.swap(packed);
+      break;
+    case HprofContainer::kCodecLz4:
+      ok = Lz4Block::Decompress(packed.data(), packed.size(), out.data(),
+                                out.size());
+      break;
+    case HprofContainer::kCodecLzma: {
+      if (packed.size() < HprofContainer::kLzmaPropsSize) break;
+      size_t dest_size = out.size();
+      size_t src_size = packed.size() - HprofContainer::kLzmaPropsSize;
+      ok = LzmaUncompress(out.data(), &dest_size,
+                          packed.data() + HprofContainer::kLzmaPropsSize,
+                          &src_size, packed.data(),
+                          HprofContainer::kLzmaPropsSize) == SZ_OK &&
+           dest_size == out.size();
+      break;
+    }
+  }
+
+  if (!ok || HprofContainer::Crc(out.data(), out.size()) != block.crc) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "block %zu is corrupted",
+                        index);
+    return false;
+  }
+  return true;
+}
+
+bool HprofBlockReader::DecompressTo(int out_fd) const {
+  std::vector<uint8_t> raw;
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    if (!ReadBlock(i, raw)) return false;
+    size_t written = 0;
+    while (written < raw.size()) {
+      ssize_t n = write(out_fd, raw.data() + written, raw.size() - written);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        __android_log_print(ANDROID_LOG_ERROR, LOG_TAG,
+                            "write failed, errno: %d", errno);
+        return false;
+      }
+      written += n;
+    }
+  }
+  return true;
+}
+
+bool HprofBlockReader::ReadAt(uint64_t offset, void *buf, size_t size) const {
+  auto *p = static_cast<uint8_t *>(buf);
+  while (size > 0) {
+    ssize_t n = pread(fd_, p, size, (off_t)offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    offset += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool HprofBlockReader::ReadBlockHeader(uint64_t file_offset,
+                                       Block &block) const {
+  uint8_t header[HprofContainer::kBlockHeaderSize];
+  if (!ReadAt(file_offset, header, sizeof(header))) return false;
+  if (header[0] > HprofContainer::kCodecLzma) return false;
+  block.file_offset = file_offset;
+  block.codec = static_cast<HprofContainer::Codec>(header[0]);
+  block.raw_size = GetLe32(header + 4);
+  block.packed_size = GetLe32(header + 8);
+  block.crc = GetLe32(header + 12);
+  return true;
+}
+
+bool HprofBlockReader::LoadIndex(uint64_t file_size) {
+  if (file_size < HprofContainer::kHeaderSize + HprofContainer::kTrailerSize) {
+    return false;
+  }
+  uint8_t trailer[HprofContainer::kTrailerSize];
+  if (!ReadAt(file_size - sizeof(trailer), trailer, sizeof(trailer)) ||
+      GetLe32(trailer + 20) != HprofContainer::kMagic) {
+    return false;
+  }
+  uint64_t index_offset = GetLe64(trailer);
+  uint64_t raw_size = GetLe64(trailer + 8);
+  uint32_t count = GetLe32(trailer + 16);
+  if (index_offset + (uint64_t)count * HprofContainer::kIndexEntrySize +
+          HprofContainer::kTrailerSize !=
+      file_size) {
+    return false;
+  }
+
+  std::vector<uint8_t> index((size_t)count * HprofContainer::kIndexEntrySize);
+  if (!ReadAt(index_offset, index.data(), index.size())) return false;
+  blocks_.resize(count);
+  for (uint32_t i = 0; i < count; i++) {
+    const uint8_t *entry = index.data() + i * HprofContainer::kIndexEntrySize;
+    Block &block = blocks_[i];
+    if (!ReadBlockHeader(GetLe64(entry + 8), block)) {
+      blocks_.clear();
+      return false;
+    }
+    block.raw_offset = GetLe64(entry);
+  }
+  raw_size_ = raw_size;
+  return true;
+}
+
+bool HprofBlockReader::ScanBlocks(uint64_t file_size) {
+  uint64_t file_offset = HprofContainer::kHeaderSize;
+  uint64_t raw_offset = 0;
+  Block block{};
+  while (ReadBlockHeader(file_offset, block)) {
+    uint64_t end =
+        file_offset + HprofContainer::kBlockHeaderSize + block.packed_size;
+    if (block.raw_size == 0 || end > file_size) break;
+    block.raw_offset = raw_offset;
+    blocks_.push_back(block);
+    raw_offset += block.raw_size;
+    file_offset = end;
+  }
+  raw_size_ = raw_offset;
+  return !blocks_.empty();
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <7zCrc.h>
+#include <LzmaLib.h>
+#include <hprof_compressor.h>
+#include <lz4_block.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace kwai {
+namespace leak_monitor {
+
+// LZMA level 1 (fast mode) with a dictionary as large as a block
+static constexpr int kLzmaLevel = 1;
+
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static uint64_t NowNs() {
+  struct timespec ts {};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint32_t HprofContainer::Crc(const uint8_t *data, size_t size) {
+  pthread_once(&crc_table_once, CrcGenerateTable);
+  return CrcCalc(data, size);
+}
+
+HprofCompressor::HprofCompressor() { Reset(HprofContainer::kCodecNone); }
+
+void HprofCompressor::Reset(HprofContainer::Codec codec, size_t block_size) {
+  codec_ = codec;
+  block_size_ = block_size;
+  finished_ = false;
+  block_.clear();
+  pending_.clear();
+  index_.clear();
+  raw_offset_ = 0;
+  file_offset_ = 0;
+  max_block_ns_ = 0;
+  if (!Enabled()) return;
+
+  block_.reserve(block_size_);
+  PutLe32(HprofContainer::kMagic);
+  pending_.push_back((uint8_t)HprofContainer::kVersion);
+  pending_.push_back((uint8_t)(HprofContainer::kVersion >> 8u));
+  pending_.push_back(codec_);
+  pending_.push_back(0);
+  PutLe32((uint32_t)block_size_);
+  PutLe32(0);
+}
+
+void HprofCompressor::Append(const struct iovec *iov, size_t count) {
+  if (!Enabled() || finished_) return;
+  for (size_t i = 0; i < count; i++) {
+    auto *data = static_cast<const uint8_t *>(iov[i].iov_base);
+    size_t size = iov[i].iov_len;
+    while (size > 0) {
+      size_t take = std::min(size, block_size_ - block_.size());
+      block_.insert(block_.end(), data, data + take);
+      data += take;
+      size -= take;
+      if (block_.size() == block_size_) CompressBlock();
+    }
+  }
+}
+
+void HprofCompressor::Finish() {
+  if (!Enabled() || finished_) return;
+  if (!block_.empty()) CompressBlock();
+  uint64_t index_offset = PackedBytes();
+  for (uint64_t value : index_) PutLe64(value);
+  PutLe64(index_offset);
+  PutLe64(raw_offset_);
+  PutLe32((uint32_t)(index_.size() / 2));
+  PutLe32(HprofContainer::kMagic);
+  finished_ = true;
+}
+
+size_t HprofCompressor::Encode(const uint8_t *src, size_t size, uint8_t *dst,
+                               size_t capacity) {
+  switch (codec_) {
+    case HprofContainer::kCodecLz4:
+      return Lz4Block::Compress(src, size, dst, capacity);
+    case HprofContainer::kCodecLzma: {
+      if (capacity <= HprofContainer::kLzmaPropsSize) return 0;
+      size_t props_size = HprofContainer::kLzmaPropsSize;
+      size_t packed = capacity - HprofContainer::kLzmaPropsSize;
+      int result = LzmaCompress(dst + HprofContainer::kLzmaPropsSize, &packed,
+                                src, size, dst, &props_size, kLzmaLevel,
+                                (unsigned)block_size_, -1, -1, -1, -1, 1);
+      if (result != SZ_OK) return 0;
+      return HprofContainer::kLzmaPropsSize + packed;
+    }
+    default:
+      return 0;
+  }
+}
+
+void HprofCompressor::CompressBlock() {
+  uint64_t start = NowNs();
+  const size_t raw_size = block_.size();
+  index_.push_back(raw_offset_);
+  index_.push_back(PackedBytes());
+
+  size_t header = pending_.size();
+  // 压缩后不能比原始数据小时直接存原始数据
+  pending_.resize(header + HprofContainer::kBlockHeaderSize + raw_size);
+  uint8_t *payload =
+      pending_.data() + header + HprofContainer::kBlockHeaderSize;
+  size_t packed = Encode(block_.data(), raw_size, payload, raw_size - 1);
+  HprofContainer::Codec codec = codec_;
+  if (packed == 0) {
+    codec = HprofContainer::kCodecNone;
+    memcpy(payload, block_.data(), raw_size);
+    packed = raw_size;
+  }
+  pending_.resize(header + HprofContainer::kBlockHeaderSize + packed);
+
+  uint32_t crc = HprofContainer::Crc(block_.data(), raw_size);
+  uint8_t *p = pending_.data() + header;
+  uint32_t fields[] = {(uint32_t)raw_size, (uint32_t)packed, crc};
+  p[0] = codec;
+  p[1] = p[2] = p[3] = 0;
+  for (size_t i = 0; i < 3; i++) {
+    for (size_t j = 0; j < 4; j++) {
+      p[4 + i * 4 + j] = (uint8_t)(fields[i] >> (8 * j));
+    }
+  }
+
+  raw_offset_ += raw_size;
+  block_.clear();
+  uint64_t cost = NowNs() - start;
+  if (cost > max_block_ns_) max_block_ns_ = cost;
+}
+
+void HprofCompressor::PutLe32(uint32_t value) {
+  for (size_t i = 0; i < 4; i++) {
+    pending_.push_back((uint8_t)(value >> (8 * i)));
+  }
+}
+
+void HprofCompressor::PutLe64(uint64_t value) {
+  for (size_t i = 0; i < 8; i++) {
+    pending_.push_back((uint8_t)(value >> (8 * i)));
+  }
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
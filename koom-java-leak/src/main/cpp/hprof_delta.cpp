@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <android/log.h>
+#include <fcntl.h>
+#include <hprof_delta.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#define LOG_TAG "HprofDelta"
+
+namespace kwai {
+namespace leak_monitor {
+
+// 指纹和 trailer 都按本机字节序存（Android 都是小端），直接 mmap 使用
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "fingerprints are stored in host order");
+
+static constexpr size_t kRecordHeaderSize = 9;  // u1 tag, u4 time, u4 length
+// Length of the segments HprofSegmentWriter writes, a larger object gets one
+// of its own
+static constexpr size_t kMaxSegmentLength = 1u << 20u;
+static constexpr size_t kMaxFileHeaderSize = 64;
+
+static bool FullyWrite(int fd, const void *data, size_t size) {
+  auto *p = static_cast<const uint8_t *>(data);
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "write failed %d",
+                          errno);
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+template <typename T>
+static void Append(std::vector<uint8_t> &out, T value) {
+  auto *p = reinterpret_cast<const uint8_t *>(&value);
+  out.insert(out.end(), p, p + sizeof(value));
+}
+
+template <typename T>
+static T Load(const uint8_t *p) {
+  T value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+// hprof 本身是大端
+static void AppendU4BE(std::vector<uint8_t> &out, uint32_t value) {
+  Append(out, __builtin_bswap32(value));
+}
+
+static void AppendIdBE(std::vector<uint8_t> &out, uint64_t id,
+                       uint32_t id_size) {
+  if (id_size == 4) {
+    AppendU4BE(out, (uint32_t)id);
+  } else {
+    Append(out, __builtin_bswap64(id));
+  }
+}
+
+static size_t Align8(size_t size) { return (size + 7u) & ~(size_t)7u; }
+
+HprofFingerprints::~HprofFingerprints() { Close(); }
+
+bool HprofFingerprints::Open(const char *path) {
+  Close();
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "open %s failed %d", path,
+                        errno);
+    return false;
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0 ||
+      (size_t)st.st_size < HprofDeltaFormat::kFingerprintHeaderSize) {
+    close(fd);
+    return false;
+  }
+  map_size_ = st.st_size;
+  map_ = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map_ == MAP_FAILED) {
+    map_ = nullptr;
+    return false;
+  }
+
+  auto *header = static_cast<const uint8_t *>(map_);
+  const auto count = Load<uint64_t>(header + 24);
+  const uint64_t limit =
+      (map_size_ - HprofDeltaFormat::kFingerprintHeaderSize) /
+      HprofDeltaFormat::kFingerprintBytes;
+  if (Load<uint32_t>(header) != HprofDeltaFormat::kFingerprintMagic ||
+      Load<uint32_t>(header + 4) != HprofDeltaFormat::kVersion ||
+      count > limit) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "bad fingerprints %s",
+                        path);
+    Close();
+    return false;
+  }
+  id_size_ = Load<uint32_t>(header + 8);
+  timestamp_ = Load<uint64_t>(header + 16);
+  count_ = (size_t)count;
+  const uint8_t *p = header + HprofDeltaFormat::kFingerprintHeaderSize;
+  ids_ = reinterpret_cast<const uint64_t *>(p);
+  hashes_ = ids_ + count_;
+  offsets_ = hashes_ + count_;
+  sizes_ = reinterpret_cast<const uint32_t *>(offsets_ + count_);
+  lengths_ = sizes_ + count_;
+  heaps_ = reinterpret_cast<const uint8_t *>(lengths_ + count_);
+  return true;
+}
+
+void HprofFingerprints::Close() {
+  if (map_ != nullptr) munmap(map_, map_size_);
+  map_ = nullptr;
+  map_size_ = 0;
+  count_ = 0;
+}
+
+size_t HprofFingerprints::Find(uint64_t id, size_t hint) const {
+  if (hint < count_ && ids_[hint] == id) return hint;
+  const uint64_t *it = std::lower_bound(ids_, ids_ + count_, id);
+  return it != ids_ + count_ && *it == id ? (size_t)(it - ids_) : count_;
+}
+
+void HprofDeltaFilter::Reset(const HprofFingerprints *base) {
+  base_ = base;
+  base_states_.assign(base != nullptr ? base->Count() : 0, kBaseMissing);
+  base_hint_ = 0;
+  current_ = {};
+  fingerprints_.clear();
+  memset(heaps_, 0, sizeof(heaps_));
+  current_heap_ = kNoHeap;
+  omitted_objects_ = 0;
+}
+
+bool HprofDeltaFilter::OnHeapInfo(uint8_t heap, uint32_t heap_type,
+                                  uint64_t name_id) {
+  heaps_[heap] = {heap_type, 1, name_id};
+  current_heap_ = heap;
+  return true;
+}
+
+void HprofDeltaFilter::OnObjectBegin(const HprofObject &object,
+                                     uint64_t position, uint64_t size,
+                                     uint64_t length) {
+  // 被丢掉的 HEAP_DUMP_INFO 后面的对象（比如 image heap 的 class dump）
+  // 在裁剪后的 hprof 里跟着前一个 heap，按读出来的 heap 记
+  current_ = {object.id, 0, position, (uint32_t)size, (uint32_t)length,
+              current_heap_};
+  hash_.Reset();
+}
+
+void HprofDeltaFilter::OnObjectBytes(const uint8_t *data, size_t size) {
+  hash_.Update(data, size);
+}
+
+bool HprofDeltaFilter::OnObjectEnd() {
+  current_.hash = hash_.Final();
+  if (base_ == nullptr) {
+    fingerprints_.push_back(current_);
+    return true;
+  }
+  if (current_.heap == kNoHeap) return true;
+  const size_t index = base_->Find(current_.id, base_hint_);
+  if (index == base_->Count()) return true;
+  base_hint_ = index + 1;
+  if (base_->Hashes()[index] == current_.hash &&
+      base_->Heaps()[index] == current_.heap) {
+    base_states_[index] = kBaseSame;
+    omitted_objects_++;
+    return false;
+  }
+  base_states_[index] = kBaseChanged;
+  return true;
+}
+
+bool HprofDeltaFilter::WriteFingerprints(int fd, uint32_t id_size,
+                                         uint64_t timestamp) {
+  // ART 按地址顺序写对象，通常已经有序
+  auto by_id = [](const Fingerprint &a, const Fingerprint &b) {
+    return a.id < b.id;
+  };
+  if (!std::is_sorted(fingerprints_.begin(), fingerprints_.end(), by_id)) {
+    std::sort(fingerprints_.begin(), fingerprints_.end(), by_id);
+  }
+  const size_t count = fingerprints_.size();
+  std::vector<uint8_t> out;
+  out.reserve(HprofDeltaFormat::kFingerprintHeaderSize +
+              Align8(count * HprofDeltaFormat::kFingerprintBytes));
+  Append(out, HprofDeltaFormat::kFingerprintMagic);
+  Append(out, HprofDeltaFormat::kVersion);
+  Append(out, id_size);
+  Append(out, (uint32_t)0);
+  Append(out, timestamp);
+  Append(out, (uint64_t)count);
+  // 按列写，一列一次 resize 再逐个填
+  auto column = [&out, count](size_t width) {
+    size_t offset = out.size();
+    out.resize(offset + count * width);
+    return out.data() + offset;
+  };
+  uint8_t *p = column(8);
+  for (auto &fingerprint : fingerprints_) {
+    memcpy(p, &fingerprint.id, 8);
+    p += 8;
+  }
+  p = column(8);
+  for (auto &fingerprint : fingerprints_) {
+    memcpy(p, &fingerprint.hash, 8);
+    p += 8;
+  }
+  p = column(8);
+  for (auto &fingerprint : fingerprints_) {
+    memcpy(p, &fingerprint.offset, 8);
+    p += 8;
+  }
+  p = column(4);
+  for (auto &fingerprint : fingerprints_) {
+    memcpy(p, &fingerprint.size, 4);
+    p += 4;
+  }
+  p = column(4);
+  for (auto &fingerprint : fingerprints_) {
+    memcpy(p, &fingerprint.length, 4);
+    p += 4;
+  }
+  p = column(1);
+  for (auto &fingerprint : fingerprints_) *p++ = fingerprint.heap;
+  out.resize(Align8(out.size()));
+  return FullyWrite(fd, out.data(), out.size());
+}
+
+void HprofDeltaFilter::AppendTrailer(StripOutput &out, uint64_t end_position) {
+  std::vector<uint8_t> trailer;
+  uint64_t counts[kBaseChanged + 1] = {};
+  const uint64_t *ids = base_->Ids();
+  // 先 replaced 后 removed，两遍扫描省得另外存一份 id
+  for (uint8_t state : {kBaseChanged, kBaseMissing}) {
+    for (size_t i = 0; i < base_states_.size(); i++) {
+      if (base_states_[i] != state) continue;
+      Append(trailer, ids[i]);
+      counts[state]++;
+    }
+  }
+  for (auto &heap : heaps_) {
+    Append(trailer, heap.heap_type);
+    Append(trailer, heap.seen);
+    Append(trailer, heap.name_id);
+  }
+  Append(trailer, end_position);
+  Append(trailer, base_->Timestamp());
+  Append(trailer, counts[kBaseChanged]);
+  Append(trailer, counts[kBaseMissing]);
+  Append(trailer, HprofDeltaFormat::kVersion);
+  Append(trailer, HprofDeltaFormat::kDeltaMagic);
+  out.Copy(trailer.data(), trailer.size());
+  __android_log_print(ANDROID_LOG_INFO, LOG_TAG,
+                      "%llu base objects replaced, %llu removed",
+                      (unsigned long long)counts[kBaseChanged],
+                      (unsigned long long)counts[kBaseMissing]);
+}
+
+// "JAVA PROFILE 1.0.3\0", u4 id size, u8 timestamp, both big endian
+static bool ReadFileHeader(const uint8_t *data, size_t size,
+                           uint32_t *id_size, uint64_t *timestamp) {
+  auto *nul = static_cast<const uint8_t *>(
+      memchr(data, 0, std::min(size, kMaxFileHeaderSize)));
+  if (nul == nullptr || (size_t)(nul - data) + 1 + 4 + 8 > size) return false;
+  *id_size = __builtin_bswap32(Load<uint32_t>(nul + 1));
+  *timestamp = __builtin_bswap64(Load<uint64_t>(nul + 1 + 4));
+  return true;
+}
+
+HprofSegmentWriter::HprofSegmentWriter(int fd, uint32_t id_size)
+    : fd_(fd), id_size_(id_size), length_(0) {}
+
+bool HprofSegmentWriter::HeapInfo(uint32_t heap_type, uint64_t name_id) {
+  std::vector<uint8_t> info;
+  info.push_back(HPROF_HEAP_DUMP_INFO);
+  AppendU4BE(info, heap_type);
+  AppendIdBE(info, name_id, id_size_);
+  return Add(info.data(), info.size(), info.size());
+}
+
+bool HprofSegmentWriter::Add(const uint8_t *data, size_t size,
+                             uint32_t length) {
+  if (!segment_.empty() && length_ + length > kMaxSegmentLength && !Flush()) {
+    return false;
+  }
+  if (segment_.empty()) {
+    segment_.push_back(HPROF_TAG_HEAP_DUMP_SEGMENT);
+    AppendU4BE(segment_, 0);
+    AppendU4BE(segment_, 0);
+  }
+  segment_.insert(segment_.end(), data, data + size);
+  length_ += length;
+  return true;
+}
+
+bool HprofSegmentWriter::Flush() {
+  if (segment_.empty()) return true;
+  const uint32_t length = __builtin_bswap32((uint32_t)length_);
+  memcpy(segment_.data() + 5, &length, sizeof(length));
+  bool success = FullyWrite(fd_, segment_.data(), segment_.size());
+  segment_.clear();
+  length_ = 0;
+  return success;
+}
+
+bool ApplyHprofDelta(const uint8_t *base, size_t base_size,
+                     const HprofFingerprints &fingerprints,
+                     const uint8_t *delta, size_t delta_size, int out_fd,
+                     std::string *error) {
+  constexpr size_t kTrailerSize = HprofDeltaFormat::kTrailerSize;
+  if (delta_size < kTrailerSize ||
+      Load<uint32_t>(delta + delta_size - 4) != HprofDeltaFormat::kDeltaMagic ||
+      Load<uint32_t>(delta + delta_size - 8) != HprofDeltaFormat::kVersion) {
+    *error = "not a delta";
+    return false;
+  }
+  const uint8_t *tail = delta + delta_size - kTrailerSize;
+  const uint8_t *heaps = tail;
+  const uint8_t *fields = heaps + StripPolicy::kHeapCount *
+                                      HprofDeltaFormat::kHeapEntrySize;
+  const auto end_position = Load<uint64_t>(fields);
+  const auto base_timestamp = Load<uint64_t>(fields + 8);
+  const auto replaced_count = Load<uint64_t>(fields + 16);
+  const auto removed_count = Load<uint64_t>(fields + 24);
+  const uint64_t id_count = replaced_count + removed_count;
+  if (id_count > (delta_size - kTrailerSize) / 8) {
+    *error = "bad delta trailer";
+    return false;
+  }
+  const size_t trailer_start = delta_size - kTrailerSize - id_count * 8;
+  if (end_position + kRecordHeaderSize > trailer_start ||
+      delta[end_position] != HPROF_TAG_HEAP_DUMP_END) {
+    *error = "bad delta trailer";
+    return false;
+  }
+
+  uint32_t delta_id_size, base_id_size;
+  uint64_t delta_timestamp, timestamp;
+  if (!ReadFileHeader(delta, delta_size, &delta_id_size, &delta_timestamp) ||
+      !ReadFileHeader(base, base_size, &base_id_size, &timestamp)) {
+    *error = "not an hprof";
+    return false;
+  }
+  if (base_timestamp != fingerprints.Timestamp() ||
+      timestamp != fingerprints.Timestamp()) {
+    *error = "the delta, base and fingerprints are of different dumps";
+    return false;
+  }
+  const uint32_t id_size = fingerprints.IdSize();
+  if (delta_id_size != id_size || base_id_size != id_size) {
+    *error = "id sizes differ";
+    return false;
+  }
+
+  // replaced 和 removed 的对象都不从 base 拷贝，两边都按 id 排序后归并
+  std::vector<uint64_t> dropped(id_count);
+  memcpy(dropped.data(), delta + trailer_start, id_count * 8);
+  std::sort(dropped.begin(), dropped.end());
+  const size_t count = fingerprints.Count();
+  const uint64_t *ids = fingerprints.Ids();
+  std::vector<bool> carried(count);
+  for (size_t i = 0, j = 0; i < count; i++) {
+    while (j < dropped.size() && dropped[j] < ids[i]) j++;
+    carried[i] = j == dropped.size() || dropped[j] != ids[i];
+  }
+
+  if (!FullyWrite(out_fd, delta, end_position)) {
+    *error = "write failed";
+    return false;
+  }
+
+  const uint64_t *offsets = fingerprints.Offsets();
+  const uint32_t *sizes = fingerprints.Sizes();
+  const uint32_t *lengths = fingerprints.Lengths();
+  const uint8_t *heap_of = fingerprints.Heaps();
+  HprofSegmentWriter writer(out_fd, id_size);
+  // 留下的对象都在某个 HEAP_DUMP_INFO 之后，每个 heap 一段，前面补上 info
+  for (uint8_t heap = 0; heap < StripPolicy::kHeapCount; heap++) {
+    const uint8_t *info = heaps + heap * HprofDeltaFormat::kHeapEntrySize;
+    bool started = false;
+    for (size_t i = 0; i < count; i++) {
+      if (heap_of[i] != heap || !carried[i]) continue;
+      if (offsets[i] > base_size || sizes[i] > base_size - offsets[i]) {
+        *error = "fingerprints do not match the base hprof";
+        return false;
+      }
+      if (!started && Load<uint32_t>(info + 4) != 0 &&
+          !writer.HeapInfo(Load<uint32_t>(info), Load<uint64_t>(info + 8))) {
+        *error = "write failed";
+        return false;
+      }
+      started = true;
+      if (!writer.Add(base + offsets[i], sizes[i], lengths[i])) {
+        *error = "write failed";
+        return false;
+      }
+    }
+  }
+  if (!writer.Flush() ||
+      !FullyWrite(out_fd, delta + end_position, trailer_start - end_position)) {
+    *error = "write failed";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
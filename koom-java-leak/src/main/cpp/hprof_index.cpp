@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <android-base/macros.h>
+#include <android/log.h>
+#include <fcntl.h>
+#include <hprof_index.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#define LOG_TAG "HprofIndex"
+
+namespace kwai {
+namespace leak_monitor {
+
+// 索引给 mmap 直接用，只支持小端机器（Android 都是小端）
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "index is stored in host order");
+
+static bool FullyWrite(int fd, const void *data, size_t size) {
+  auto *p = static_cast<const uint8_t *>(data);
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "write failed %d",
+                          errno);
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+void HprofIndexBuilder::Reset() {
+  for (auto &entries : entries_) {
+    entries.clear();
+  }
+}
+
+void HprofIndexBuilder::OnString(uint64_t id,
+                                 const uint8_t *utf8 ATTRIBUTE_UNUSED,
+                                 size_t size ATTRIBUTE_UNUSED, bool kept,
+                                 uint64_t position) {
+  if (kept) entries_[HprofIndexFormat::kStrings].push_back({id, position});
+}
+
+void HprofIndexBuilder::OnLoadClass(uint64_t class_id, uint64_t name_id) {
+  entries_[HprofIndexFormat::kClassNames].push_back({class_id, name_id});
+}
+
+bool HprofIndexBuilder::OnObject(const HprofObject &object, bool kept,
+                                 uint64_t position) {
+  if (!kept) return false;
+  HprofIndexFormat::Section section;
+  switch (object.tag) {
+    case HPROF_INSTANCE_DUMP:
+      section = HprofIndexFormat::kInstances;
+      break;
+    case HPROF_OBJECT_ARRAY_DUMP:
+      section = HprofIndexFormat::kObjectArrays;
+      break;
+    case HPROF_PRIMITIVE_ARRAY_DUMP:
+      section = HprofIndexFormat::kPrimitiveArrays;
+      break;
+    default:
+      section = HprofIndexFormat::kClassDumps;
+      break;
+  }
+  entries_[section].push_back({object.id, position});
+  return false;
+}
+
+bool HprofIndexBuilder::Write(int fd, uint32_t id_size, uint64_t hprof_size) {
+  const uint32_t count = HprofIndexFormat::kSectionCount;
+  uint64_t offset = HprofIndexFormat::kHeaderSize +
+                    count * HprofIndexFormat::kSectionEntrySize;
+
+  std::vector<uint64_t> head;
+  head.push_back(HprofIndexFormat::kMagic |
+                 ((uint64_t)HprofIndexFormat::kVersion << 32u));
+  head.push_back(id_size | ((uint64_t)count << 32u));
+  head.push_back(hprof_size);
+  for (uint32_t section = 1; section <= count; section++) {
+    auto &entries = entries_[section];
+    // ART 大致按地址顺序写对象，基本有序时排序很快
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry &a, const Entry &b) { return a.key < b.key; });
+    head.push_back(section);
+    head.push_back(offset);
+    head.push_back(entries.size());
+    offset += entries.size() * 2 * sizeof(uint64_t);
+  }
+  if (!FullyWrite(fd, head.data(), head.size() * sizeof(uint64_t))) {
+    return false;
+  }
+
+  std::vector<uint64_t> column;
+  for (uint32_t section = 1; section <= count; section++) {
+    auto &entries = entries_[section];
+    column.resize(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) column[i] = entries[i].key;
+    if (!FullyWrite(fd, column.data(), column.size() * sizeof(uint64_t))) {
+      return false;
+    }
+    for (size_t i = 0; i < entries.size(); i++) column[i] = entries[i].value;
+    if (!FullyWrite(fd, column.data(), column.size() * sizeof(uint64_t))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+HprofIndex::~HprofIndex() { Close(); }
+
+bool HprofIndex::Open(const char *path) {
+  Close();
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "open %s failed %d", path,
+                        errno);
+    return false;
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0 ||
+      (size_t)st.st_size < HprofIndexFormat::kHeaderSize) {
+    close(fd);
+    return false;
+  }
+  map_size_ = st.st_size;
+  map_ = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map_ == MAP_FAILED) {
+    map_ = nullptr;
+    return false;
+  }
+
+  auto *words = static_cast<const uint64_t *>(map_);
+  const uint32_t count = (uint32_t)(words[1] >> 32u);
+  if ((uint32_t)words[0] != HprofIndexFormat::kMagic ||
+      (uint32_t)(words[0] >> 32u) != HprofIndexFormat::kVersion ||
+      HprofIndexFormat::kHeaderSize +
+              (uint64_t)count * HprofIndexFormat::kSectionEntrySize >
+          map_size_) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "bad index %s", path);
+    Close();
+    return false;
+  }
+  id_size_ = (uint32_t)words[1];
+  hprof_size_ = words[2];
+
+  const uint64_t *entry = words + 3;
+  for (uint32_t i = 0; i < count; i++, entry += 3) {
+    uint64_t type = entry[0], offset = entry[1], size = entry[2];
+    if (offset % sizeof(uint64_t) != 0 ||
+        offset + size * 2 * sizeof(uint64_t) > map_size_) {
+      __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "bad section %llu",
+                          (unsigned long long)type);
+      Close();
+      return false;
+    }
+    // 不认识的 section 跳过，方便以后加新的
+    if (type == 0 || type >= HprofIndexFormat::kSectionEnd) continue;
+    auto *keys = reinterpret_cast<const uint64_t *>(
+        static_cast<const uint8_t *>(map_) + offset);
+    sections_[type] = {keys, keys + size, (size_t)size};
+  }
+  return true;
+}
+
+void HprofIndex::Close() {
+  if (map_ != nullptr) munmap(map_, map_size_);
+  map_ = nullptr;
+  map_size_ = 0;
+  memset(sections_, 0, sizeof(sections_));
+}
+
+bool HprofIndex::Find(HprofIndexFormat::Section section, uint64_t key,
+                      uint64_t *value) const {
+  const View &view = sections_[section];
+  const uint64_t *end = view.keys + view.count;
+  const uint64_t *it = std::lower_bound(view.keys, end, key);
+  if (it == end || *it != key) return false;
+  *value = view.values[it - view.keys];
+  return true;
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
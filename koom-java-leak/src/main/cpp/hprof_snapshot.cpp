@@ -0,0 +1,1478 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <android/log.h>
+#include <fcntl.h>
+#include <hprof_snapshot.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unordered_map>
+
+#define LOG_TAG "HprofSnapshot"
+
+namespace kwai {
+namespace leak_monitor {
+
+// trailer 按本机字节序存（Android 都是小端）
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "the trailer is stored in host order");
+static_assert(StripPolicy::kHeapCount <= 4, "a heap takes 2 bits of a kind");
+
+using Format = HprofSnapshotFormat;
+
+static constexpr size_t kRecordHeaderSize = 9;  // u1 tag, u4 time, u4 length
+// The spool is written in chunks of this size
+static constexpr size_t kSpoolChunkSize = 1u << 20u;
+// So is the decoded hprof
+static constexpr size_t kOutputChunkSize = 1u << 20u;
+// Longer super class chains are taken as cycles
+static constexpr size_t kMaxClassDepth = 256;
+static constexpr uint8_t kKindMask = 3;
+static constexpr uint8_t kHeapShift = 2;
+
+static bool FullyWrite(int fd, const void *data, size_t size) {
+  auto *p = static_cast<const uint8_t *>(data);
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "write failed %d",
+                          errno);
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+template <typename T>
+static void Append(std::vector<uint8_t> &out, T value) {
+  auto *p = reinterpret_cast<const uint8_t *>(&value);
+  out.insert(out.end(), p, p + sizeof(value));
+}
+
+template <typename T>
+static T Load(const uint8_t *p) {
+  T value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+// hprof 本身是大端
+static inline uint32_t ReadU2(const uint8_t *p) {
+  return __builtin_bswap16(Load<uint16_t>(p));
+}
+
+static inline uint32_t ReadU4(const uint8_t *p) {
+  return __builtin_bswap32(Load<uint32_t>(p));
+}
+
+static inline uint64_t ReadU8(const uint8_t *p) {
+  return __builtin_bswap64(Load<uint64_t>(p));
+}
+
+static inline uint64_t ReadId(const uint8_t *p, uint32_t id_size) {
+  return id_size == 4 ? ReadU4(p) : ReadU8(p);
+}
+
+static void AppendU2BE(std::vector<uint8_t> &out, uint32_t value) {
+  Append(out, __builtin_bswap16((uint16_t)value));
+}
+
+static void AppendU4BE(std::vector<uint8_t> &out, uint32_t value) {
+  Append(out, __builtin_bswap32(value));
+}
+
+static void AppendIdBE(std::vector<uint8_t> &out, uint64_t id,
+                       uint32_t id_size) {
+  if (id_size == 4) {
+    AppendU4BE(out, (uint32_t)id);
+  } else {
+    Append(out, __builtin_bswap64(id));
+  }
+}
+
+static void PutVarint(std::vector<uint8_t> &out, uint64_t value) {
+  while (value >= 0x80u) {
+    out.push_back((uint8_t)(value | 0x80u));
+    value >>= 7u;
+  }
+  out.push_back((uint8_t)value);
+}
+
+static inline uint64_t ZigZag(int64_t value) {
+  return ((uint64_t)value << 1u) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t UnZigZag(uint64_t value) {
+  return (int64_t)(value >> 1u) ^ -(int64_t)(value & 1u);
+}
+
+static size_t TypeSize(uint8_t type, uint32_t id_size) {
+  switch (type) {
+    case hprof_basic_object:
+      return id_size;
+    case hprof_basic_boolean:
+    case hprof_basic_byte:
+      return 1;
+    case hprof_basic_char:
+    case hprof_basic_short:
+      return 2;
+    case hprof_basic_float:
+    case hprof_basic_int:
+      return 4;
+    case hprof_basic_long:
+    case hprof_basic_double:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+static bool IsVarintType(uint8_t type) {
+  return type == hprof_basic_char || type == hprof_basic_short ||
+         type == hprof_basic_int || type == hprof_basic_long;
+}
+
+// Integer values are mostly small, char, short, int and long become varints
+static void PutPrimitive(std::vector<uint8_t> &out, const uint8_t *value,
+                         uint8_t type) {
+  switch (type) {
+    case hprof_basic_char:
+      PutVarint(out, ReadU2(value));
+      break;
+    case hprof_basic_short:
+      PutVarint(out, ZigZag((int16_t)ReadU2(value)));
+      break;
+    case hprof_basic_int:
+      PutVarint(out, ZigZag((int32_t)ReadU4(value)));
+      break;
+    case hprof_basic_long:
+      PutVarint(out, ZigZag((int64_t)ReadU8(value)));
+      break;
+    default:
+      out.insert(out.end(), value, value + TypeSize(type, 0));
+      break;
+  }
+}
+
+// Alignment shared by ids, ART object ids are 8 byte aligned addresses
+static uint32_t IdShift(uint64_t id_bits) {
+  return id_bits == 0 ? 0 : (uint32_t)__builtin_ctzll(id_bits);
+}
+
+// Order of the objects of a heap, heaps without HEAP_DUMP_INFO come first
+// like they do in the stripped hprof
+static inline uint32_t HeapRank(uint8_t heap, bool seen) {
+  return seen ? StripPolicy::kHeapCount + heap : heap;
+}
+
+namespace {
+
+// What the encoder and the decoder both know of a class dump
+struct ClassLayout {
+  uint32_t super;             // class index + 1, 0 if not dumped
+  std::vector<uint8_t> own;   // types of the instance fields it declares
+  std::vector<uint8_t> types; // of the instance values, own fields first
+  uint64_t size;              // bytes of the instance values
+  bool resolved;
+};
+
+void ResolveLayouts(std::vector<ClassLayout> &classes, uint32_t id_size) {
+  std::vector<uint32_t> chain;
+  for (uint32_t i = 0; i < classes.size(); i++) {
+    // 沿 super 链找到已解析的类为止，环或者过长的链截断
+    chain.clear();
+    uint32_t index = i;
+    while (!classes[index].resolved && chain.size() < kMaxClassDepth) {
+      chain.push_back(index);
+      if (classes[index].super == 0) break;
+      index = classes[index].super - 1;
+    }
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+      ClassLayout &layout = classes[*it];
+      layout.types = layout.own;
+      if (layout.super != 0 && classes[layout.super - 1].resolved) {
+        const ClassLayout &super = classes[layout.super - 1];
+        layout.types.insert(layout.types.end(), super.types.begin(),
+                            super.types.end());
+      }
+      layout.size = 0;
+      for (uint8_t type : layout.types) layout.size += TypeSize(type, id_size);
+      layout.resolved = true;
+    }
+  }
+}
+
+struct Field {
+  uint64_t name_id;
+  uint8_t type;
+
+  bool operator<(const Field &other) const {
+    return name_id != other.name_id ? name_id < other.name_id
+                                    : type < other.type;
+  }
+  bool operator==(const Field &other) const {
+    return name_id == other.name_id && type == other.type;
+  }
+};
+
+}  // namespace
+
+/**
+ * One encoding of the spooled objects, sorted by heap and id.
+ */
+class HprofSnapshotEncoder::Columns {
+ public:
+  Columns(const std::vector<Object> &objects, const HeapInfo *heaps,
+          const uint8_t *spool, uint32_t id_size)
+      : objects_(objects),
+        heaps_(heaps),
+        spool_(spool),
+        id_size_(id_size) {}
+
+  void Prepare();
+  void Encode();
+  // Takes over the kPlacement column
+  void SetPlacement(std::vector<uint8_t> &placement) {
+    columns_[Format::kPlacement].swap(placement);
+  }
+  void Serialize(std::vector<uint8_t> &out, uint64_t end_position);
+
+ private:
+  uint32_t RankOf(const Object &object) const {
+    return HeapRank(object.heap, heaps_[object.heap].seen != 0);
+  }
+  // Index of the class dump of class_id, classes_.size() if absent
+  size_t FindClass(uint64_t class_id) const;
+  size_t FindField(uint64_t name_id, uint8_t type) const;
+  // Index of the object, objects_.size() if absent
+  size_t FindObject(uint64_t id);
+  void PutRef(uint64_t id, size_t own_index);
+  void PutValue(const uint8_t *value, uint8_t type, size_t own_index);
+  void PutClass(uint64_t class_id, size_t own_index);
+  void PutSerial(uint32_t serial);
+  void EndSerials();
+  void PutOrder(uint32_t order);
+  void EndOrder();
+  void EncodeClassDump(const uint8_t *p, size_t index);
+  uint8_t EncodeInstance(const uint8_t *p, const Object &object,
+                         size_t index);
+  void RemapForeign();
+
+  const std::vector<Object> &objects_;
+  const HeapInfo *heaps_;
+  const uint8_t *spool_;
+  const uint32_t id_size_;
+
+  std::vector<uint8_t> columns_[Format::kColumnCount];
+  // Objects of one heap rank are objects_[runs_[i].begin, runs_[i].end)
+  struct Run {
+    size_t begin;
+    size_t end;
+  };
+  std::vector<Run> runs_;
+  size_t run_hint_ = 0;
+  uint32_t id_shift_ = 0;
+
+  // class id and class index, by id
+  std::vector<std::pair<uint64_t, uint32_t>> class_ids_;
+  std::vector<ClassLayout> classes_;
+  std::vector<Field> fields_;
+
+  // Ids that are not dumped get numbers as they are met, RemapForeign()
+  // turns them into indexes of the sorted ids
+  std::unordered_map<uint64_t, uint64_t> foreign_numbers_;
+  std::vector<uint64_t> foreign_;
+
+  uint32_t serial_ = 0;
+  uint64_t serial_run_ = 0;
+  uint64_t order_ = 0;  // first of the run
+  uint64_t order_run_ = 0;
+  uint64_t order_end_ = 0;  // of the previous run
+};
+
+size_t HprofSnapshotEncoder::Columns::FindClass(uint64_t class_id) const {
+  auto it = std::lower_bound(
+      class_ids_.begin(), class_ids_.end(), class_id,
+      [](const std::pair<uint64_t, uint32_t> &entry, uint64_t id) {
+        return entry.first < id;
+      });
+  return it != class_ids_.end() && it->first == class_id ? it->second
+                                                         : classes_.size();
+}
+
+size_t HprofSnapshotEncoder::Columns::FindField(uint64_t name_id,
+                                                uint8_t type) const {
+  const Field field = {name_id, type};
+  return std::lower_bound(fields_.begin(), fields_.end(), field) -
+         fields_.begin();
+}
+
+size_t HprofSnapshotEncoder::Columns::FindObject(uint64_t id) {
+  auto by_id = [](const Object &object, uint64_t value) {
+    return object.id < value;
+  };
+  // 引用大多指向同一个 heap，先查上次命中的
+  for (size_t n = 0; n < runs_.size(); n++) {
+    const size_t r = (run_hint_ + n) % runs_.size();
+    const Run &run = runs_[r];
+    if (id < objects_[run.begin].id || id > objects_[run.end - 1].id) {
+      continue;
+    }
+    auto it = std::lower_bound(objects_.begin() + run.begin,
+                               objects_.begin() + run.end, id, by_id);
+    if (it->id == id) {
+      run_hint_ = r;
+      return it - objects_.begin();
+    }
+  }
+  return objects_.size();
+}
+
+void HprofSnapshotEncoder::Columns::PutRef(uint64_t id, size_t own_index) {
+  std::vector<uint8_t> &refs = columns_[Format::kRefs];
+  if (id == 0) {
+    refs.push_back(0);
+    return;
+  }
+  const size_t index = FindObject(id);
+  if (index != objects_.size()) {
+    PutVarint(refs,
+              1 + (ZigZag((int64_t)index - (int64_t)own_index) << 1u));
+    return;
+  }
+  auto it = foreign_numbers_.emplace(id, foreign_numbers_.size()).first;
+  PutVarint(refs, 1 + (it->second << 1u | 1u));
+}
+
+void HprofSnapshotEncoder::Columns::PutValue(const uint8_t *value,
+                                             uint8_t type, size_t own_index) {
+  if (type == hprof_basic_object) {
+    PutRef(ReadId(value, id_size_), own_index);
+  } else {
+    PutPrimitive(columns_[Format::kValues], value, type);
+  }
+}
+
+void HprofSnapshotEncoder::Columns::PutClass(uint64_t class_id,
+                                             size_t own_index) {
+  const size_t class_index = FindClass(class_id);
+  if (class_index != classes_.size()) {
+    PutVarint(columns_[Format::kClasses], class_index + 1);
+  } else {
+    columns_[Format::kClasses].push_back(0);
+    PutRef(class_id, own_index);
+  }
+}
+
+void HprofSnapshotEncoder::Columns::PutSerial(uint32_t serial) {
+  if (serial_run_ > 0 && serial == serial_) {
+    serial_run_++;
+    return;
+  }
+  EndSerials();
+  serial_ = serial;
+  serial_run_ = 1;
+}
+
+void HprofSnapshotEncoder::Columns::EndSerials() {
+  if (serial_run_ == 0) return;
+  PutVarint(columns_[Format::kSerials], serial_);
+  PutVarint(columns_[Format::kSerials], serial_run_);
+  serial_run_ = 0;
+}
+
+void HprofSnapshotEncoder::Columns::PutOrder(uint32_t order) {
+  if (order_run_ > 0 && order == order_ + order_run_) {
+    order_run_++;
+    return;
+  }
+  EndOrder();
+  order_ = order;
+  order_run_ = 1;
+}
+
+void HprofSnapshotEncoder::Columns::EndOrder() {
+  if (order_run_ == 0) return;
+  PutVarint(columns_[Format::kOrder],
+            ZigZag((int64_t)order_ - (int64_t)order_end_));
+  PutVarint(columns_[Format::kOrder], order_run_);
+  order_end_ = order_ + order_run_;
+  order_run_ = 0;
+}
+
+void HprofSnapshotEncoder::Columns::Prepare() {
+  const size_t id = id_size_;
+  uint64_t id_bits = 0;
+  for (size_t i = 0; i < objects_.size(); i++) {
+    id_bits |= objects_[i].id;
+    if (i == 0 || RankOf(objects_[i]) != RankOf(objects_[i - 1])) {
+      runs_.push_back({i, i + 1});
+    } else {
+      runs_.back().end = i + 1;
+    }
+    if (objects_[i].kind == Format::kClassDump) {
+      class_ids_.emplace_back(objects_[i].id, (uint32_t)class_ids_.size());
+    }
+  }
+  id_shift_ = IdShift(id_bits);
+  std::sort(class_ids_.begin(), class_ids_.end());
+
+  // class dump 整条都在 spool 里，parser 已经校验过长度
+  std::vector<uint64_t> supers;
+  classes_.reserve(class_ids_.size());
+  for (const Object &object : objects_) {
+    if (object.kind != Format::kClassDump) continue;
+    const uint8_t *p = spool_ + object.offset + 1 + id + 4;
+    supers.push_back(ReadId(p, id_size_));
+    p += id * 6 + 4;
+    uint32_t count = ReadU2(p);
+    p += 2;
+    for (uint32_t i = 0; i < count; i++) {
+      p += 3 + TypeSize(p[2], id_size_);
+    }
+    count = ReadU2(p);
+    p += 2;
+    for (uint32_t i = 0; i < count; i++) {
+      fields_.push_back({ReadId(p, id_size_), p[id]});
+      p += id + 1 + TypeSize(p[id], id_size_);
+    }
+    count = ReadU2(p);
+    p += 2;
+    ClassLayout layout = {};
+    for (uint32_t i = 0; i < count; i++) {
+      fields_.push_back({ReadId(p, id_size_), p[id]});
+      layout.own.push_back(p[id]);
+      p += id + 1;
+    }
+    classes_.push_back(std::move(layout));
+  }
+  for (size_t i = 0; i < classes_.size(); i++) {
+    const size_t super = FindClass(supers[i]);
+    classes_[i].super = super != classes_.size() ? (uint32_t)super + 1 : 0;
+  }
+  ResolveLayouts(classes_, id_size_);
+  std::sort(fields_.begin(), fields_.end());
+  fields_.erase(std::unique(fields_.begin(), fields_.end()), fields_.end());
+}
+
+void HprofSnapshotEncoder::Columns::EncodeClassDump(const uint8_t *p,
+                                                    size_t index) {
+  const size_t id = id_size_;
+  std::vector<uint8_t> &dumps = columns_[Format::kClassDumps];
+  p += 1 + id + 4;
+  const uint64_t super_id = ReadId(p, id_size_);
+  const size_t super = FindClass(super_id);
+  if (super != classes_.size()) {
+    PutVarint(dumps, super + 1);
+  } else {
+    dumps.push_back(0);
+    PutRef(super_id, index);
+  }
+  p += id;
+  // class loader, signers, protection domain, 2 reserved
+  for (int i = 0; i < 5; i++, p += id) PutRef(ReadId(p, id_size_), index);
+  PutVarint(dumps, ReadU4(p));
+  p += 4;
+
+  uint32_t count = ReadU2(p);
+  p += 2;
+  PutVarint(dumps, count);
+  for (uint32_t i = 0; i < count; i++) {
+    PutVarint(dumps, ReadU2(p));
+    dumps.push_back(p[2]);
+    PutValue(p + 3, p[2], index);
+    p += 3 + TypeSize(p[2], id_size_);
+  }
+  count = ReadU2(p);
+  p += 2;
+  PutVarint(dumps, count);
+  for (uint32_t i = 0; i < count; i++) {
+    PutVarint(dumps, FindField(ReadId(p, id_size_), p[id]));
+    PutValue(p + id + 1, p[id], index);
+    p += id + 1 + TypeSize(p[id], id_size_);
+  }
+  count = ReadU2(p);
+  p += 2;
+  PutVarint(dumps, count);
+  for (uint32_t i = 0; i < count; i++, p += id + 1) {
+    PutVarint(dumps, FindField(ReadId(p, id_size_), p[id]));
+  }
+}
+
+uint8_t HprofSnapshotEncoder::Columns::EncodeInstance(const uint8_t *p,
+                                                      const Object &object,
+                                                      size_t index) {
+  const size_t id = id_size_;
+  const uint64_t class_id = ReadId(p + 1 + id + 4, id_size_);
+  const uint32_t length = ReadU4(p + 1 + id + 4 + id);
+  const uint8_t *values = p + 1 + id + 4 + id + 4;
+  PutClass(class_id, index);
+  if (object.stripped) {
+    PutVarint(columns_[Format::kCounts], length);
+    return Format::kFlagStripped;
+  }
+  const size_t class_index = FindClass(class_id);
+  if (class_index == classes_.size() ||
+      classes_[class_index].size != length) {
+    // 找不到 class dump 或者字段对不上，原样保存
+    PutVarint(columns_[Format::kCounts], length);
+    std::vector<uint8_t> &raw = columns_[Format::kValues];
+    raw.insert(raw.end(), values, values + length);
+    return Format::kFlagRaw;
+  }
+  for (uint8_t type : classes_[class_index].types) {
+    PutValue(values, type, index);
+    values += TypeSize(type, id_size_);
+  }
+  return 0;
+}
+
+void HprofSnapshotEncoder::Columns::Encode() {
+  const size_t id = id_size_;
+  uint64_t previous_id = 0;
+  for (size_t i = 0; i < objects_.size(); i++) {
+    const Object &object = objects_[i];
+    const uint8_t *p = spool_ + object.offset;
+    if (i == 0 || RankOf(object) != RankOf(objects_[i - 1])) previous_id = 0;
+    PutVarint(columns_[Format::kIds], (object.id - previous_id) >> id_shift_);
+    previous_id = object.id;
+    PutSerial(ReadU4(p + 1 + id));
+    PutOrder(object.order);
+
+    uint8_t flags = object.stripped ? Format::kFlagStripped : 0;
+    switch (object.kind) {
+      case Format::kClassDump:
+        EncodeClassDump(p, i);
+        break;
+      case Format::kInstance:
+        flags = EncodeInstance(p, object, i);
+        break;
+      case Format::kObjectArray: {
+        const uint32_t count = ReadU4(p + 1 + id + 4);
+        PutClass(ReadId(p + 1 + id + 4 + 4, id_size_), i);
+        PutVarint(columns_[Format::kCounts], count);
+        if (object.stripped) break;
+        const uint8_t *element = p + 1 + id + 4 + 4 + id;
+        for (uint32_t e = 0; e < count; e++, element += id) {
+          PutRef(ReadId(element, id_size_), i);
+        }
+      } break;
+      case Format::kPrimitiveArray: {
+        const uint32_t count = ReadU4(p + 1 + id + 4);
+        const uint8_t type = p[1 + id + 4 + 4];
+        columns_[Format::kTypes].push_back(type);
+        PutVarint(columns_[Format::kCounts], count);
+        if (object.stripped) break;
+        const uint8_t *values = p + 1 + id + 4 + 4 + 1;
+        const size_t element_size = TypeSize(type, id_size_);
+        std::vector<uint8_t> &column = columns_[Format::kValues];
+        if (!IsVarintType(type)) {
+          column.insert(column.end(), values, values + count * element_size);
+          break;
+        }
+        for (uint32_t e = 0; e < count; e++, values += element_size) {
+          PutPrimitive(column, values, type);
+        }
+      } break;
+      default:
+        break;
+    }
+    columns_[Format::kKinds].push_back(
+        (uint8_t)(object.kind | object.heap << kHeapShift | flags));
+  }
+  EndSerials();
+  EndOrder();
+
+  std::vector<uint8_t> &fields = columns_[Format::kFields];
+  PutVarint(fields, fields_.size());
+  uint64_t previous_name = 0;
+  for (const Field &field : fields_) {
+    PutVarint(fields, field.name_id - previous_name);
+    fields.push_back(field.type);
+    previous_name = field.name_id;
+  }
+  RemapForeign();
+}
+
+void HprofSnapshotEncoder::Columns::RemapForeign() {
+  // 外部 id 排序后才能差分编码，按遇到的顺序编的号要换成排序后的下标
+  foreign_.resize(foreign_numbers_.size());
+  uint64_t id_bits = 0;
+  for (auto &entry : foreign_numbers_) {
+    foreign_[entry.second] = entry.first;
+    id_bits |= entry.first;
+  }
+  std::vector<uint64_t> sorted = foreign_;
+  std::sort(sorted.begin(), sorted.end());
+  std::vector<uint64_t> index_of(foreign_.size());
+  for (size_t n = 0; n < foreign_.size(); n++) {
+    index_of[n] =
+        std::lower_bound(sorted.begin(), sorted.end(), foreign_[n]) -
+        sorted.begin();
+  }
+  const uint32_t shift = IdShift(id_bits);
+  std::vector<uint8_t> &column = columns_[Format::kForeign];
+  PutVarint(column, shift);
+  uint64_t previous = 0;
+  for (uint64_t foreign_id : sorted) {
+    PutVarint(column, (foreign_id - previous) >> shift);
+    previous = foreign_id;
+  }
+  foreign_.swap(sorted);
+  if (foreign_.empty()) return;
+
+  std::vector<uint8_t> refs;
+  refs.reserve(columns_[Format::kRefs].size());
+  const std::vector<uint8_t> &numbered = columns_[Format::kRefs];
+  for (size_t pos = 0; pos < numbered.size();) {
+    const size_t start = pos;
+    uint64_t value = 0;
+    for (uint32_t shift_bits = 0;; shift_bits += 7) {
+      const uint8_t byte = numbered[pos++];
+      value |= (uint64_t)(byte & 0x7fu) << shift_bits;
+      if ((byte & 0x80u) == 0) break;
+    }
+    if (value != 0 && ((value - 1) & 1u) != 0) {
+      PutVarint(refs, 1 + (index_of[(value - 1) >> 1u] << 1u | 1u));
+    } else {
+      refs.insert(refs.end(), numbered.begin() + start,
+                  numbered.begin() + pos);
+    }
+  }
+  columns_[Format::kRefs].swap(refs);
+}
+
+void HprofSnapshotEncoder::Columns::Serialize(std::vector<uint8_t> &out,
+                                              uint64_t end_position) {
+  uint64_t sizes[Format::kColumnCount];
+  size_t total = Format::kTrailerSize;
+  for (uint32_t c = 0; c < Format::kColumnCount; c++) {
+    sizes[c] = columns_[c].size();
+    total += columns_[c].size();
+  }
+  out.clear();
+  out.reserve(total);
+  for (auto &column : columns_) {
+    out.insert(out.end(), column.begin(), column.end());
+    std::vector<uint8_t>().swap(column);
+  }
+  for (uint8_t heap = 0; heap < StripPolicy::kHeapCount; heap++) {
+    Append(out, heaps_[heap].heap_type);
+    Append(out, heaps_[heap].seen);
+    Append(out, heaps_[heap].name_id);
+  }
+  for (uint64_t size : sizes) Append(out, size);
+  Append(out, end_position);
+  Append(out, (uint64_t)objects_.size());
+  Append(out, (uint64_t)foreign_.size());
+  Append(out, id_size_);
+  Append(out, id_shift_);
+  Append(out, Format::kVersion);
+  Append(out, Format::kMagic);
+}
+
+static uint64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+HprofSnapshotEncoder::~HprofSnapshotEncoder() { Reset(std::string()); }
+
+void HprofSnapshotEncoder::Reset(const std::string &spool_path) {
+  if (spool_map_ != nullptr) munmap(spool_map_, spool_map_size_);
+  spool_map_ = nullptr;
+  spool_map_size_ = 0;
+  if (spool_fd_ >= 0) close(spool_fd_);
+  spool_fd_ = -1;
+  spooled_ = 0;
+  spool_failed_ = false;
+  std::vector<uint8_t>().swap(spool_);
+  std::vector<Object>().swap(objects_);
+  std::vector<uint8_t>().swap(encoded_);
+  memset(heaps_, 0, sizeof(heaps_));
+  current_heap_ = StripPolicy::kHeapDefault;
+  std::vector<uint8_t>().swap(placement_);
+  placement_position_ = 0;
+  placement_previous_ = 0;
+  placement_run_ = 0;
+  if (spool_path.empty()) return;
+  spool_fd_ = open(spool_path.c_str(),
+                   O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0600);
+  if (spool_fd_ < 0) {
+    __android_log_print(ANDROID_LOG_WARN, LOG_TAG,
+                        "open %s failed %d, spooling to memory",
+                        spool_path.c_str(), errno);
+    return;
+  }
+  // 只有本进程用，打开后马上删掉，dump 进程被杀也不会留下文件
+  unlink(spool_path.c_str());
+}
+
+bool HprofSnapshotEncoder::OnHeapInfo(uint8_t heap, uint32_t heap_type,
+                                      uint64_t name_id) {
+  // 留在原位置，解码时对象插回它后面
+  heaps_[heap] = {heap_type, 1, name_id};
+  current_heap_ = heap;
+  return true;
+}
+
+void HprofSnapshotEncoder::OnObjectBegin(const HprofObject &object,
+                                         uint64_t position, uint64_t size,
+                                         uint64_t length) {
+  uint8_t kind;
+  switch (object.tag) {
+    case HPROF_CLASS_DUMP:
+      kind = Format::kClassDump;
+      break;
+    case HPROF_INSTANCE_DUMP:
+      kind = Format::kInstance;
+      break;
+    case HPROF_OBJECT_ARRAY_DUMP:
+      kind = Format::kObjectArray;
+      break;
+    default:
+      kind = Format::kPrimitiveArray;
+      break;
+  }
+  // 前面的对象都被撤回了，position 就是它在 snapshot 里的插入点
+  if (placement_run_ > 0 && position != placement_position_) EndPlacement();
+  placement_position_ = position;
+  placement_run_++;
+  objects_.push_back({object.id, spooled_ + spool_.size(), (uint32_t)size,
+                      (uint32_t)objects_.size(), kind, current_heap_,
+                      length > size});
+}
+
+void HprofSnapshotEncoder::EndPlacement() {
+  if (placement_run_ == 0) return;
+  PutVarint(placement_, placement_position_ - placement_previous_);
+  PutVarint(placement_, placement_run_);
+  placement_previous_ = placement_position_;
+  placement_run_ = 0;
+}
+
+void HprofSnapshotEncoder::OnObjectBytes(const uint8_t *data, size_t size) {
+  Spool(data, size);
+}
+
+bool HprofSnapshotEncoder::OnObjectEnd() {
+  // 对象都进了列里，hprof 中只留下 string、class、root 这些
+  return false;
+}
+
+void HprofSnapshotEncoder::Spool(const uint8_t *data, size_t size) {
+  if (spool_failed_) return;
+  spool_.insert(spool_.end(), data, data + size);
+  if (spool_fd_ < 0 || spool_.size() < kSpoolChunkSize) return;
+  if (FullyWrite(spool_fd_, spool_.data(), spool_.size())) {
+    spooled_ += spool_.size();
+    spool_.clear();
+  } else {
+    SpoolToMemory();
+  }
+}
+
+bool HprofSnapshotEncoder::SpoolToMemory() {
+  // 比如磁盘满了，已经写出去的读回来，后面都放在内存里
+  std::vector<uint8_t> all(spooled_ + spool_.size());
+  const bool success =
+      spooled_ == 0 ||
+      pread(spool_fd_, all.data(), spooled_, 0) == (ssize_t)spooled_;
+  close(spool_fd_);
+  spool_fd_ = -1;
+  if (!success) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "spool lost %d", errno);
+    spool_failed_ = true;
+    std::vector<uint8_t>().swap(spool_);
+    return false;
+  }
+  if (!spool_.empty()) {
+    memcpy(all.data() + spooled_, spool_.data(), spool_.size());
+  }
+  spool_.swap(all);
+  spooled_ = 0;
+  return true;
+}
+
+const uint8_t *HprofSnapshotEncoder::MapSpool() {
+  if (spool_failed_) return nullptr;
+  if (spool_fd_ < 0 || spooled_ == 0) return spool_.data();
+  if (!spool_.empty()) {
+    if (!FullyWrite(spool_fd_, spool_.data(), spool_.size())) {
+      return SpoolToMemory() ? spool_.data() : nullptr;
+    }
+    spooled_ += spool_.size();
+    std::vector<uint8_t>().swap(spool_);
+  }
+  void *map = mmap(nullptr, spooled_, PROT_READ, MAP_PRIVATE, spool_fd_, 0);
+  if (map == MAP_FAILED) {
+    return SpoolToMemory() ? spool_.data() : nullptr;
+  }
+  spool_map_ = map;
+  spool_map_size_ = spooled_;
+  return static_cast<const uint8_t *>(map);
+}
+
+void HprofSnapshotEncoder::AppendColumns(StripOutput &out, uint32_t id_size,
+                                         uint64_t end_position) {
+  const uint64_t start = NowNs();
+  const uint8_t *spool = MapSpool();
+  if (spool == nullptr) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG,
+                        "%zu objects lost with the spool", objects_.size());
+    objects_.clear();
+    placement_run_ = 0;
+    placement_.clear();
+  }
+  // 同一 heap 内按 id 排序，ART 按地址写对象，通常已经有序
+  auto by_heap_and_id = [this](const Object &a, const Object &b) {
+    const uint32_t rank_a = HeapRank(a.heap, heaps_[a.heap].seen != 0);
+    const uint32_t rank_b = HeapRank(b.heap, heaps_[b.heap].seen != 0);
+    return rank_a != rank_b ? rank_a < rank_b : a.id < b.id;
+  };
+  if (!std::is_sorted(objects_.begin(), objects_.end(), by_heap_and_id)) {
+    std::sort(objects_.begin(), objects_.end(), by_heap_and_id);
+  }
+  EndPlacement();
+  Columns columns(objects_, heaps_, spool, id_size);
+  columns.Prepare();
+  columns.Encode();
+  columns.SetPlacement(placement_);
+  columns.Serialize(encoded_, end_position);
+  // encoded_ 在 Reset() 之前不会变，不用再拷贝一份
+  out.Ref(encoded_.data(), encoded_.size());
+  __android_log_print(ANDROID_LOG_INFO, LOG_TAG,
+                      "%zu objects in %zu bytes, %llu ms", objects_.size(),
+                      encoded_.size(),
+                      (unsigned long long)(NowNs() - start) / 1000000);
+}
+
+namespace {
+
+// Reads one column, any read past its end marks it as damaged
+class ColumnReader {
+ public:
+  void Init(const uint8_t *data, size_t size) {
+    data_ = data;
+    end_ = data + size;
+    failed_ = false;
+  }
+
+  bool Failed() const { return failed_; }
+  bool AtEnd() const { return data_ == end_; }
+
+  uint64_t Varint() {
+    uint64_t value = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+      if (data_ == end_) break;
+      const uint8_t byte = *data_++;
+      value |= (uint64_t)(byte & 0x7fu) << shift;
+      if ((byte & 0x80u) == 0) return value;
+    }
+    failed_ = true;
+    return 0;
+  }
+
+  uint8_t U1() {
+    if (data_ == end_) {
+      failed_ = true;
+      return 0;
+    }
+    return *data_++;
+  }
+
+  const uint8_t *Bytes(uint64_t size) {
+    if ((uint64_t)(end_ - data_) < size) {
+      failed_ = true;
+      data_ = end_;
+      return nullptr;
+    }
+    const uint8_t *bytes = data_;
+    data_ += size;
+    return bytes;
+  }
+
+ private:
+  const uint8_t *data_ = nullptr;
+  const uint8_t *end_ = nullptr;
+  bool failed_ = false;
+};
+
+class SnapshotDecoder {
+ public:
+  SnapshotDecoder(const uint8_t *snapshot, size_t size, std::string *error)
+      : snapshot_(snapshot), size_(size), error_(error) {}
+
+  bool Decode(int out_fd);
+
+ private:
+  struct Placement {
+    uint64_t position;  // in the snapshot
+    uint64_t count;
+  };
+
+  bool Fail(const char *message) {
+    *error_ = message;
+    return false;
+  }
+  bool ReadTrailer();
+  void InitColumns();
+  bool DecodeTables();
+  uint64_t Ref(size_t own_index);
+  uint64_t ClassId(size_t own_index, uint64_t *class_index);
+  void Value(uint8_t type, size_t own_index);
+  uint32_t Serial();
+  // Appends the sub record of object index to records_, returns the bytes
+  // stripped from it
+  uint64_t DecodeObject(size_t index, uint8_t kind_byte);
+  void DecodeClassDump(size_t index);
+  bool DecodePlacement();
+  // Writes the snapshot up to the columns with the objects put back
+  bool Splice();
+  bool Put(const uint8_t *data, size_t size);
+  bool FlushOutput();
+
+  const uint8_t *snapshot_;
+  const size_t size_;
+  std::string *error_;
+
+  const uint8_t *heaps_ = nullptr;
+  uint64_t column_sizes_[Format::kColumnCount] = {};
+  uint64_t columns_start_ = 0;
+  uint64_t end_position_ = 0;
+  uint64_t object_count_ = 0;
+  uint64_t foreign_count_ = 0;
+  uint32_t id_size_ = 0;
+  uint32_t id_shift_ = 0;
+
+  ColumnReader columns_[Format::kColumnCount];
+  std::vector<uint64_t> ids_;
+  std::vector<uint64_t> foreign_;
+  std::vector<Field> fields_;
+  // Object index of each class dump
+  std::vector<size_t> class_objects_;
+  std::vector<ClassLayout> classes_;
+  size_t next_class_ = 0;
+  uint32_t serial_ = 0;
+  uint64_t serial_run_ = 0;
+  bool damaged_ = false;
+  std::vector<uint8_t> records_;
+  // Start of each object in records_ and the end of the last
+  std::vector<uint64_t> offsets_;
+  // What each object adds to its segment length
+  std::vector<uint64_t> lengths_;
+  // Object indexes in dump order
+  std::vector<uint64_t> by_order_;
+  std::vector<Placement> placements_;
+  int out_fd_ = -1;
+  std::vector<uint8_t> out_;
+};
+
+bool SnapshotDecoder::ReadTrailer() {
+  constexpr size_t kTrailerSize = Format::kTrailerSize;
+  if (size_ < kTrailerSize ||
+      Load<uint32_t>(snapshot_ + size_ - 4) != Format::kMagic ||
+      Load<uint32_t>(snapshot_ + size_ - 8) != Format::kVersion) {
+    return Fail("not a snapshot");
+  }
+  const uint8_t *p = snapshot_ + size_ - kTrailerSize;
+  heaps_ = p;
+  p += StripPolicy::kHeapCount * Format::kHeapEntrySize;
+  uint64_t columns_size = 0;
+  for (uint64_t &column_size : column_sizes_) {
+    column_size = Load<uint64_t>(p);
+    p += 8;
+    columns_size += column_size;
+    if (column_size > size_ || columns_size > size_) {
+      return Fail("bad snapshot trailer");
+    }
+  }
+  end_position_ = Load<uint64_t>(p);
+  object_count_ = Load<uint64_t>(p + 8);
+  foreign_count_ = Load<uint64_t>(p + 16);
+  id_size_ = Load<uint32_t>(p + 24);
+  id_shift_ = Load<uint32_t>(p + 28);
+  if (columns_size > size_ - kTrailerSize) return Fail("bad snapshot trailer");
+  columns_start_ = size_ - kTrailerSize - columns_size;
+  if ((id_size_ != 4 && id_size_ != 8) || id_shift_ >= 64 ||
+      end_position_ + kRecordHeaderSize > columns_start_ ||
+      snapshot_[end_position_] != HPROF_TAG_HEAP_DUMP_END ||
+      object_count_ != column_sizes_[Format::kKinds]) {
+    return Fail("bad snapshot trailer");
+  }
+  return true;
+}
+
+void SnapshotDecoder::InitColumns() {
+  const uint8_t *p = snapshot_ + columns_start_;
+  for (uint32_t c = 0; c < Format::kColumnCount; c++) {
+    columns_[c].Init(p, column_sizes_[c]);
+    p += column_sizes_[c];
+  }
+  next_class_ = 0;
+  serial_run_ = 0;
+}
+
+bool SnapshotDecoder::DecodeTables() {
+  // 先解出所有 id，引用按下标指向它们
+  ids_.resize(object_count_);
+  const uint8_t *kinds = snapshot_ + columns_start_;
+  ColumnReader &ids = columns_[Format::kIds];
+  uint64_t previous_id = 0;
+  uint32_t previous_rank = 0;
+  for (size_t i = 0; i < object_count_; i++) {
+    const uint8_t heap = kinds[i] >> kHeapShift & 3u;
+    const uint32_t rank = HeapRank(
+        heap, Load<uint32_t>(heaps_ + heap * Format::kHeapEntrySize + 4) != 0);
+    if (i == 0 || rank != previous_rank) previous_id = 0;
+    previous_rank = rank;
+    ids_[i] = previous_id + (ids.Varint() << id_shift_);
+    previous_id = ids_[i];
+    if ((kinds[i] & kKindMask) == Format::kClassDump) {
+      class_objects_.push_back(i);
+    }
+  }
+
+  ColumnReader &foreign = columns_[Format::kForeign];
+  const uint64_t foreign_shift = foreign.Varint();
+  if (foreign_shift >= 64 ||
+      foreign_count_ > column_sizes_[Format::kForeign]) {
+    return Fail("bad foreign ids");
+  }
+  foreign_.resize(foreign_count_);
+  uint64_t previous = 0;
+  for (uint64_t &foreign_id : foreign_) {
+    foreign_id = previous + (foreign.Varint() << foreign_shift);
+    previous = foreign_id;
+  }
+
+  ColumnReader &fields = columns_[Format::kFields];
+  const uint64_t field_count = fields.Varint();
+  if (field_count > column_sizes_[Format::kFields]) {
+    return Fail("bad field table");
+  }
+  fields_.resize(field_count);
+  uint64_t previous_name = 0;
+  for (Field &field : fields_) {
+    field.name_id = previous_name + fields.Varint();
+    field.type = fields.U1();
+    previous_name = field.name_id;
+    if (TypeSize(field.type, id_size_) == 0) return Fail("bad field table");
+  }
+
+  // class dump 的布局要在读 instance 之前知道，这一列先单独过一遍
+  ColumnReader dumps = columns_[Format::kClassDumps];
+  classes_.resize(class_objects_.size());
+  for (ClassLayout &layout : classes_) {
+    const uint64_t super = dumps.Varint();
+    if (super > classes_.size()) return Fail("bad class dump");
+    layout.super = (uint32_t)super;
+    dumps.Varint();  // instance size
+    uint64_t count = dumps.Varint();
+    for (uint64_t i = 0; i < count && !dumps.Failed(); i++) {
+      dumps.Varint();
+      if (TypeSize(dumps.U1(), id_size_) == 0) return Fail("bad class dump");
+    }
+    count = dumps.Varint();
+    for (uint64_t i = 0; i < count && !dumps.Failed(); i++) {
+      if (dumps.Varint() >= fields_.size()) return Fail("bad class dump");
+    }
+    count = dumps.Varint();
+    for (uint64_t i = 0; i < count && !dumps.Failed(); i++) {
+      const uint64_t field = dumps.Varint();
+      if (field >= fields_.size()) return Fail("bad class dump");
+      layout.own.push_back(fields_[field].type);
+    }
+    if (dumps.Failed()) return Fail("bad class dump");
+  }
+  ResolveLayouts(classes_, id_size_);
+  if (ids.Failed() || foreign.Failed() || fields.Failed() || !ids.AtEnd() ||
+      !foreign.AtEnd() || !fields.AtEnd()) {
+    return Fail("bad id tables");
+  }
+  return true;
+}
+
+uint64_t SnapshotDecoder::Ref(size_t own_index) {
+  uint64_t value = columns_[Format::kRefs].Varint();
+  if (value == 0) return 0;
+  value--;
+  if ((value & 1u) != 0) {
+    if ((value >> 1u) < foreign_.size()) return foreign_[value >> 1u];
+  } else {
+    const uint64_t index = own_index + UnZigZag(value >> 1u);
+    if (index < ids_.size()) return ids_[index];
+  }
+  damaged_ = true;
+  return 0;
+}
+
+uint64_t SnapshotDecoder::ClassId(size_t own_index, uint64_t *class_index) {
+  *class_index = columns_[Format::kClasses].Varint();
+  if (*class_index == 0) return Ref(own_index);
+  if (*class_index > class_objects_.size()) {
+    damaged_ = true;
+    return 0;
+  }
+  return ids_[class_objects_[*class_index - 1]];
+}
+
+void SnapshotDecoder::Value(uint8_t type, size_t own_index) {
+  if (type == hprof_basic_object) {
+    AppendIdBE(records_, Ref(own_index), id_size_);
+    return;
+  }
+  ColumnReader &values = columns_[Format::kValues];
+  switch (type) {
+    case hprof_basic_char:
+      AppendU2BE(records_, (uint32_t)values.Varint());
+      break;
+    case hprof_basic_short:
+      AppendU2BE(records_, (uint32_t)UnZigZag(values.Varint()));
+      break;
+    case hprof_basic_int:
+      AppendU4BE(records_, (uint32_t)UnZigZag(values.Varint()));
+      break;
+    case hprof_basic_long:
+      Append(records_, __builtin_bswap64((uint64_t)UnZigZag(values.Varint())));
+      break;
+    default: {
+      const size_t size = TypeSize(type, id_size_);
+      const uint8_t *value = values.Bytes(size);
+      if (value != nullptr) records_.insert(records_.end(), value, value + size);
+    } break;
+  }
+}
+
+uint32_t SnapshotDecoder::Serial() {
+  if (serial_run_ == 0) {
+    serial_ = (uint32_t)columns_[Format::kSerials].Varint();
+    serial_run_ = columns_[Format::kSerials].Varint();
+    if (serial_run_ == 0) {
+      damaged_ = true;
+      return 0;
+    }
+  }
+  serial_run_--;
+  return serial_;
+}
+
+void SnapshotDecoder::DecodeClassDump(size_t index) {
+  ColumnReader &dumps = columns_[Format::kClassDumps];
+  const uint64_t super = dumps.Varint();
+  uint64_t super_id;
+  if (super == 0) {
+    super_id = Ref(index);
+  } else if (super <= class_objects_.size()) {
+    super_id = ids_[class_objects_[super - 1]];
+  } else {
+    damaged_ = true;
+    return;
+  }
+  AppendIdBE(records_, super_id, id_size_);
+  // class loader, signers, protection domain, 2 reserved
+  for (int i = 0; i < 5; i++) AppendIdBE(records_, Ref(index), id_size_);
+  AppendU4BE(records_, (uint32_t)dumps.Varint());
+
+  uint64_t count = dumps.Varint();
+  AppendU2BE(records_, (uint32_t)count);
+  for (uint64_t i = 0; i < count && !dumps.Failed(); i++) {
+    AppendU2BE(records_, (uint32_t)dumps.Varint());
+    const uint8_t type = dumps.U1();
+    records_.push_back(type);
+    Value(type, index);
+  }
+  count = dumps.Varint();
+  AppendU2BE(records_, (uint32_t)count);
+  for (uint64_t i = 0; i < count && !dumps.Failed(); i++) {
+    const Field &field = fields_[dumps.Varint()];
+    AppendIdBE(records_, field.name_id, id_size_);
+    records_.push_back(field.type);
+    Value(field.type, index);
+  }
+  count = dumps.Varint();
+  AppendU2BE(records_, (uint32_t)count);
+  for (uint64_t i = 0; i < count && !dumps.Failed(); i++) {
+    const Field &field = fields_[dumps.Varint()];
+    AppendIdBE(records_, field.name_id, id_size_);
+    records_.push_back(field.type);
+  }
+}
+
+uint64_t SnapshotDecoder::DecodeObject(size_t index, uint8_t kind_byte) {
+  static const uint8_t kTags[] = {HPROF_CLASS_DUMP, HPROF_INSTANCE_DUMP,
+                                  HPROF_OBJECT_ARRAY_DUMP,
+                                  HPROF_PRIMITIVE_ARRAY_DUMP};
+  const uint8_t kind = kind_byte & kKindMask;
+  const bool stripped = (kind_byte & Format::kFlagStripped) != 0;
+  records_.push_back(kTags[kind]);
+  AppendIdBE(records_, ids_[index], id_size_);
+  AppendU4BE(records_, Serial());
+  ColumnReader &counts = columns_[Format::kCounts];
+  ColumnReader &values = columns_[Format::kValues];
+
+  switch (kind) {
+    case Format::kClassDump:
+      DecodeClassDump(index);
+      return 0;
+
+    case Format::kInstance: {
+      uint64_t class_index;
+      AppendIdBE(records_, ClassId(index, &class_index), id_size_);
+      if (stripped || (kind_byte & Format::kFlagRaw) != 0) {
+        const uint64_t length = counts.Varint();
+        AppendU4BE(records_, (uint32_t)length);
+        if (stripped) return length;
+        const uint8_t *raw = values.Bytes(length);
+        if (raw != nullptr) records_.insert(records_.end(), raw, raw + length);
+        return 0;
+      }
+      if (class_index == 0 || class_index > classes_.size()) {
+        damaged_ = true;
+        return 0;
+      }
+      const ClassLayout &layout = classes_[class_index - 1];
+      AppendU4BE(records_, (uint32_t)layout.size);
+      for (uint8_t type : layout.types) Value(type, index);
+      return 0;
+    }
+
+    case Format::kObjectArray: {
+      uint64_t class_index;
+      const uint64_t class_id = ClassId(index, &class_index);
+      const uint64_t count = counts.Varint();
+      AppendU4BE(records_, (uint32_t)count);
+      AppendIdBE(records_, class_id, id_size_);
+      if (stripped) return count * id_size_;
+      // 每个元素至少一个字节，防止损坏的长度撑爆内存
+      if (count > column_sizes_[Format::kRefs]) {
+        damaged_ = true;
+        return 0;
+      }
+      for (uint64_t e = 0; e < count; e++) {
+        AppendIdBE(records_, Ref(index), id_size_);
+      }
+      return 0;
+    }
+
+    default: {
+      const uint8_t type = columns_[Format::kTypes].U1();
+      const uint64_t count = counts.Varint();
+      const size_t element_size = TypeSize(type, id_size_);
+      AppendU4BE(records_, (uint32_t)count);
+      records_.push_back(type);
+      if (element_size == 0 || type == hprof_basic_object) {
+        damaged_ = true;
+        return 0;
+      }
+      if (stripped) return count * element_size;
+      if (!IsVarintType(type)) {
+        const uint8_t *data = values.Bytes(count * element_size);
+        if (data != nullptr) {
+          records_.insert(records_.end(), data, data + count * element_size);
+        }
+        return 0;
+      }
+      // 每个元素至少一个字节，防止损坏的长度撑爆内存
+      if (count > column_sizes_[Format::kValues]) {
+        damaged_ = true;
+        return 0;
+      }
+      for (uint64_t e = 0; e < count && !values.Failed(); e++) {
+        Value(type, index);
+      }
+      return 0;
+    }
+  }
+}
+
+bool SnapshotDecoder::Decode(int out_fd) {
+  if (!ReadTrailer()) return false;
+  InitColumns();
+  if (!DecodeTables()) return false;
+
+  // 列是按 heap 和 id 排的，先全部解出来，写的时候再按 dump 的顺序插回去
+  const uint8_t *kinds = snapshot_ + columns_start_;
+  offsets_.resize(object_count_ + 1);
+  lengths_.resize(object_count_);
+  for (size_t i = 0; i < object_count_; i++) {
+    offsets_[i] = records_.size();
+    const uint64_t stripped = DecodeObject(i, kinds[i]);
+    if (damaged_) return Fail("bad object columns");
+    lengths_[i] = records_.size() - offsets_[i] + stripped;
+  }
+  offsets_[object_count_] = records_.size();
+  for (uint32_t c = 0; c < Format::kColumnCount; c++) {
+    if (c == Format::kKinds || c == Format::kIds || c == Format::kForeign ||
+        c == Format::kFields || c == Format::kOrder ||
+        c == Format::kPlacement) {
+      continue;
+    }
+    if (columns_[c].Failed() || !columns_[c].AtEnd()) {
+      return Fail("bad object columns");
+    }
+  }
+  if (!DecodePlacement()) return false;
+  out_fd_ = out_fd;
+  return Splice();
+}
+
+bool SnapshotDecoder::DecodePlacement() {
+  // 每个对象在 dump 中的序号，必须正好是一个排列
+  ColumnReader &order = columns_[Format::kOrder];
+  by_order_.assign(object_count_, object_count_);
+  uint64_t run_end = 0;
+  for (uint64_t i = 0; i < object_count_;) {
+    const uint64_t first = run_end + (uint64_t)UnZigZag(order.Varint());
+    const uint64_t run = order.Varint();
+    if (order.Failed() || run == 0 || run > object_count_ - i ||
+        first >= object_count_ || run > object_count_ - first) {
+      return Fail("bad object order");
+    }
+    for (uint64_t n = 0; n < run; n++, i++) {
+      if (by_order_[first + n] != object_count_) {
+        return Fail("bad object order");
+      }
+      by_order_[first + n] = i;
+    }
+    run_end = first + run;
+  }
+  if (!order.AtEnd()) return Fail("bad object order");
+
+  ColumnReader &placement = columns_[Format::kPlacement];
+  uint64_t position = 0;
+  uint64_t placed = 0;
+  while (!placement.AtEnd()) {
+    const uint64_t delta = placement.Varint();
+    const uint64_t count = placement.Varint();
+    if (placement.Failed() || delta > end_position_ - position ||
+        count == 0 || count > object_count_ - placed) {
+      return Fail("bad object placement");
+    }
+    position += delta;
+    placed += count;
+    placements_.push_back({position, count});
+  }
+  if (placed != object_count_) return Fail("bad object placement");
+  return true;
+}
+
+bool SnapshotDecoder::Splice() {
+  // 文件头是以 0 结尾的版本号、u4 id size 和 u8 时间
+  const auto *nul = static_cast<const uint8_t *>(
+      memchr(snapshot_, 0, std::min<uint64_t>(end_position_, 64)));
+  if (nul == nullptr ||
+      (uint64_t)(nul - snapshot_) + 1 + 4 + 8 > end_position_) {
+    return Fail("bad hprof header");
+  }
+  uint64_t position = (uint64_t)(nul - snapshot_) + 1 + 4 + 8;
+  if (!Put(snapshot_, position)) return Fail("write failed");
+
+  size_t placement = 0;
+  uint64_t order = 0;
+  while (position < end_position_) {
+    if (end_position_ - position < kRecordHeaderSize) {
+      return Fail("bad record");
+    }
+    const uint8_t *record = snapshot_ + position;
+    const uint64_t body = position + kRecordHeaderSize;
+    const uint64_t end = body + ReadU4(record + 5);
+    if (end > end_position_) return Fail("bad record");
+    const bool heap = record[0] == HPROF_TAG_HEAP_DUMP ||
+                      record[0] == HPROF_TAG_HEAP_DUMP_SEGMENT;
+    // 对象只能在 heap record 的 body 里
+    if (placement < placements_.size() &&
+        placements_[placement].position < (heap ? body : end)) {
+      return Fail("bad object placement");
+    }
+    if (!heap) {
+      if (!Put(record, end - position)) return Fail("write failed");
+      position = end;
+      continue;
+    }
+
+    // 段长度加回插进来的对象
+    uint64_t length = end - body;
+    size_t last = placement;
+    for (uint64_t o = order;
+         last < placements_.size() && placements_[last].position <= end;
+         last++) {
+      for (uint64_t n = 0; n < placements_[last].count; n++) {
+        length += lengths_[by_order_[o++]];
+      }
+    }
+    if (length > UINT32_MAX) return Fail("bad object columns");
+    if (!Put(record, kRecordHeaderSize - 4)) return Fail("write failed");
+    AppendU4BE(out_, (uint32_t)length);
+    uint64_t copied = body;
+    for (; placement < last; placement++) {
+      const Placement &run = placements_[placement];
+      bool success = Put(snapshot_ + copied, run.position - copied);
+      copied = run.position;
+      for (uint64_t n = 0; success && n < run.count; n++) {
+        const uint64_t index = by_order_[order++];
+        success = Put(records_.data() + offsets_[index],
+                      offsets_[index + 1] - offsets_[index]);
+      }
+      if (!success) return Fail("write failed");
+    }
+    if (!Put(snapshot_ + copied, end - copied)) return Fail("write failed");
+    position = end;
+  }
+  if (placement != placements_.size()) return Fail("bad object placement");
+  // HEAP_DUMP_END 和写在它之后的 record
+  if (!Put(snapshot_ + end_position_, columns_start_ - end_position_) ||
+      !FlushOutput()) {
+    return Fail("write failed");
+  }
+  return true;
+}
+
+bool SnapshotDecoder::Put(const uint8_t *data, size_t size) {
+  if (out_.size() + size > kOutputChunkSize && !FlushOutput()) return false;
+  if (size > kOutputChunkSize) return FullyWrite(out_fd_, data, size);
+  out_.insert(out_.end(), data, data + size);
+  return true;
+}
+
+bool SnapshotDecoder::FlushOutput() {
+  const bool success = FullyWrite(out_fd_, out_.data(), out_.size());
+  out_.clear();
+  return success;
+}
+
+}  // namespace
+
+bool DecodeHprofSnapshot(const uint8_t *snapshot, size_t size, int out_fd,
+                         std::string *error) {
+  SnapshotDecoder decoder(snapshot, size, error);
+  return decoder.Decode(out_fd);
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
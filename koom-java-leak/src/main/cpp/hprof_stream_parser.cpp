@@ -0,0 +1,835 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <hprof_stream_parser.h>
+#include <strip_output.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace kwai {
+namespace leak_monitor {
+
+// hprof 是大端，字段不对齐，memcpy 出来再 bswap，编译成一次 load 加 rev
+static inline uint32_t ReadU2(const uint8_t *p) {
+  uint16_t value;
+  memcpy(&value, p, sizeof(value));
+  return __builtin_bswap16(value);
+}
+
+static inline uint32_t ReadU4(const uint8_t *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return __builtin_bswap32(value);
+}
+
+static inline uint64_t ReadU8(const uint8_t *p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return __builtin_bswap64(value);
+}
+
+static inline void WriteU4(uint8_t *p, uint32_t value) {
+  value = __builtin_bswap32(value);
+  memcpy(p, &value, sizeof(value));
+}
+
+template <uint32_t kIdSize>
+static inline uint64_t ReadIdOf(const uint8_t *p) {
+  return kIdSize == 4 ? ReadU4(p) : ReadU8(p);
+}
+
+HprofStreamParser::HprofStreamParser() : filter_(nullptr) { Reset(); }
+
+void HprofStreamParser::Reset() {
+  state_ = kFileHeader;
+  SetIdSize(4);
+  heap_ = StripPolicy::kHeapDefault;
+  finished_ = false;
+  carry_.clear();
+  capture_.clear();
+  string_verdicts_.clear();
+  class_verdicts_.clear();
+  record_remaining_ = 0;
+  record_length_ = 0;
+  record_position_ = 0;
+  record_stripped_ = 0;
+  record_tag_ = 0;
+  record_dropped_ = false;
+  capture_size_ = 0;
+  body_remaining_ = 0;
+  body_keep_ = 0;
+  body_adjust_length_ = false;
+  body_listeners_.clear();
+  filtering_ = false;
+  filter_position_ = 0;
+  filter_length_ = 0;
+  stripped_bytes_ = 0;
+  omitted_bytes_ = 0;
+  timestamp_ = 0;
+  end_position_ = 0;
+}
+
+void HprofStreamParser::SetIdSize(uint32_t id_size) {
+  id_size_ = id_size;
+  // 只在读到文件头时选一次，热路径里不再判断 id size
+  feed_whole_sub_records_ =
+      id_size == 8 ? &HprofStreamParser::FeedWholeSubRecords<8>
+                   : &HprofStreamParser::FeedWholeSubRecords<4>;
+  memset(type_sizes_, 0, sizeof(type_sizes_));
+  type_sizes_[hprof_basic_object] = (uint8_t)id_size;
+  type_sizes_[hprof_basic_boolean] = 1;
+  type_sizes_[hprof_basic_byte] = 1;
+  type_sizes_[hprof_basic_char] = 2;
+  type_sizes_[hprof_basic_short] = 2;
+  type_sizes_[hprof_basic_float] = 4;
+  type_sizes_[hprof_basic_int] = 4;
+  type_sizes_[hprof_basic_long] = 8;
+  type_sizes_[hprof_basic_double] = 8;
+}
+
+bool HprofStreamParser::ParseSubRecord(const uint8_t *data, size_t size,
+                                       size_t *need, SubRecord *sub) const {
+  return id_size_ == 8 ? ParseSubRecord<8>(data, size, need, sub)
+                       : ParseSubRecord<4>(data, size, need, sub);
+}
+
+template <uint32_t kIdSize>
+bool HprofStreamParser::ParseSubRecord(const uint8_t *data, size_t size,
+                                       size_t *need, SubRecord *sub) const {
+  constexpr size_t id = kIdSize;
+  sub->body_size = 0;
+  switch (data[0]) {
+    /**
+     * __ AddU1(heap_tag);
+     * __ AddObjectId(obj);
+     */
+    case HPROF_ROOT_UNKNOWN:
+    case HPROF_ROOT_STICKY_CLASS:
+    case HPROF_ROOT_MONITOR_USED:
+    case HPROF_ROOT_INTERNED_STRING:
+    case HPROF_ROOT_DEBUGGER:
+    case HPROF_ROOT_VM_INTERNAL:
+    case HPROF_ROOT_FINALIZING:         // Obsolete.
+    case HPROF_ROOT_REFERENCE_CLEANUP:  // Obsolete.
+    case HPROF_UNREACHABLE:             // Obsolete.
+      *need = 1 + id;
+      break;
+
+    /**
+     * __ AddU1(heap_tag);
+     * __ AddObjectId(obj);
+     * __ AddJniGlobalRefId(jni_obj);
+     */
+    case HPROF_ROOT_JNI_GLOBAL:
+      *need = 1 + id + id;
+      break;
+
+    /**
+     * __ AddU1(heap_tag);
+     * __ AddObjectId(obj);
+     * __ AddU4(thread_serial);
+     * __ AddU4((uint32_t)-1);
+     */
+    case HPROF_ROOT_JNI_LOCAL:
+    case HPROF_ROOT_JAVA_FRAME:
+    case HPROF_ROOT_JNI_MONITOR:
+    case HPROF_ROOT_THREAD_OBJECT:
+      *need = 1 + id + 4 + 4;
+      break;
+
+    /**
+     * __ AddU1(heap_tag);
+     * __ AddObjectId(obj);
+     * __ AddU4(thread_serial);
+     */
+    case HPROF_ROOT_NATIVE_STACK:
+    case HPROF_ROOT_THREAD_BLOCK:
+      *need = 1 + id + 4;
+      break;
+
+    /**
+     * __ AddU1(HPROF_HEAP_DUMP_INFO);
+     * __ AddU4(heap_type);
+     * __ AddStringId(LookupStringId(heap_name));
+     */
+    case HPROF_HEAP_DUMP_INFO:
+      *need = 1 + 4 + id;
+      break;
+
+    /**
+     * class id, stack trace serial, super class id, class loader id, signers,
+     * protection domain, 2 reserved ids, u4 instance size, then three u2
+     * counted lists: constant pool (u2 index, u1 type, value), static fields
+     * (string id, u1 type, value) and instance fields (string id, u1 type).
+     *
+     * The whole class dump is treated as header. While it is incomplete *need
+     * is a lower bound that assumes the smallest entries, so carrying it over
+     * never reads past its end.
+     */
+    case HPROF_CLASS_DUMP: {
+      size_t pos = 1 + id + 4 + id * 6 + 4;
+      if (size < pos + 2) {
+        *need = pos + 2 + 2 + 2;
+        return true;
+      }
+      uint32_t count = ReadU2(data + pos);
+      pos += 2;
+      for (uint32_t i = 0; i < count; i++) {
+        if (size < pos + 3) {
+          *need = pos + (count - i) * 4 + 2 + 2;
+          return true;
+        }
+        size_t value_size = TypeSize(data[pos + 2]);
+        if (value_size == 0) return false;
+        pos += 3 + value_size;
+      }
+      if (size < pos + 2) {
+        *need = pos + 2 + 2;
+        return true;
+      }
+      count = ReadU2(data + pos);
+      pos += 2;
+      for (uint32_t i = 0; i < count; i++) {
+        if (size < pos + id + 1) {
+          *need = pos + (count - i) * (id + 2) + 2;
+          return true;
+        }
+        size_t value_size = TypeSize(data[pos + id]);
+        if (value_size == 0) return false;
+        pos += id + 1 + value_size;
+      }
+      if (size < pos + 2) {
+        *need = pos + 2;
+        return true;
+      }
+      count = ReadU2(data + pos);
+      pos += 2 + count * (id + 1);
+      *need = pos;
+    } break;
+
+    /**
+     * __ AddU1(HPROF_INSTANCE_DUMP);
+     * __ AddObjectId(obj);
+     * __ AddStackTraceSerialNumber(LookupStackTraceSerialNumber(obj));
+     * __ AddClassId(LookupClassId(klass));
+     * __ AddU4(length);
+     * field values
+     */
+    case HPROF_INSTANCE_DUMP:
+      *need = 1 + id + 4 + id + 4;
+      if (size >= *need) sub->body_size = ReadU4(data + 1 + id + 4 + id);
+      break;
+
+    /**
+     * __ AddU1(HPROF_OBJECT_ARRAY_DUMP);
+     * __ AddObjectId(obj);
+     * __ AddStackTraceSerialNumber(LookupStackTraceSerialNumber(obj));
+     * __ AddU4(length);
+     * __ AddClassId(LookupClassId(klass));
+     * element ids
+     */
+    case HPROF_OBJECT_ARRAY_DUMP:
+      *need = 1 + id + 4 + 4 + id;
+      if (size >= *need) {
+        sub->body_size = (uint64_t)ReadU4(data + 1 + id + 4) * id;
+      }
+      break;
+
+    /**
+     * __ AddU1(HPROF_PRIMITIVE_ARRAY_DUMP);
+     * __ AddObjectId(obj);
+     * __ AddStackTraceSerialNumber(LookupStackTraceSerialNumber(obj));
+     * __ AddU4(length);
+     * __ AddU1(t);
+     * packed element values
+     */
+    case HPROF_PRIMITIVE_ARRAY_DUMP:
+      *need = 1 + id + 4 + 4 + 1;
+      if (size >= *need) {
+        size_t value_size = TypeSize(data[*need - 1]);
+        if (value_size == 0) return false;
+        sub->body_size = (uint64_t)ReadU4(data + 1 + id + 4) * value_size;
+      }
+      break;
+
+    // Same as above without the values. Obsolete.
+    case HPROF_PRIMITIVE_ARRAY_NODATA_DUMP:
+      *need = 1 + id + 4 + 4 + 1;
+      break;
+
+    default:
+      return false;
+  }
+  sub->header_size = *need;
+  return true;
+}
+
+uint64_t HprofStreamParser::ReadId(const uint8_t *data) const {
+  return id_size_ == 4 ? ReadIdOf<4>(data) : ReadIdOf<8>(data);
+}
+
+void HprofStreamParser::Classify(const uint8_t *header, SubRecord *sub) {
+  sub->keep_header = true;
+  sub->body_keep = sub->body_size;
+  sub->adjust_length = false;
+  sub->truncate = false;
+
+  const size_t id = id_size_;
+  uint8_t slot = policy_.SlotOf(header[0]);
+  switch (slot) {
+    case StripPolicy::kSlotHeapInfo:
+      // heap type 是 u4，取最低字节；info 本身按新 heap 的规则处理
+      heap_ = StripPolicy::HeapOf(header[1 + 3]);
+      break;
+
+    case StripPolicy::kSlotInstance:
+    case StripPolicy::kSlotObjectArray:
+      if (!class_verdicts_.empty()) {
+        size_t offset = slot == StripPolicy::kSlotInstance ? 1 + id + 4
+                                                           : 1 + id + 4 + 4;
+        auto it = class_verdicts_.find(ReadId(header + offset));
+        if (it != class_verdicts_.end()) {
+          if (it->second == StripPolicy::kClassDeny) {
+            sub->keep_header = false;
+            sub->body_keep = 0;
+            sub->adjust_length = true;
+          }
+          return;
+        }
+      }
+      break;
+
+    case StripPolicy::kSlotPrimitiveArray:
+      slot += header[sub->header_size - 1];
+      break;
+
+    default:
+      break;
+  }
+  ApplyRule(header, slot, sub);
+}
+
+void HprofStreamParser::ApplyRule(const uint8_t *header, uint8_t slot,
+                                  SubRecord *sub) const {
+  const StripPolicy::Rule &rule = policy_.GetRule(heap_, slot);
+  if (rule.action == kStripKeep || sub->body_size < rule.min_size) return;
+
+  switch (rule.action) {
+    case kStripDrop:
+      sub->keep_header = false;
+      sub->body_keep = 0;
+      sub->adjust_length = true;
+      break;
+
+    // 保留数组元信息（类型、长度）方便回填，不修改长度因为回填数组时会补齐
+    case kStripBody:
+      sub->body_keep = 0;
+      break;
+
+    // 只有数组能按元素截断，instance 的字段截断后无法解析
+    case kStripTruncate: {
+      size_t element_size;
+      if (slot == StripPolicy::kSlotObjectArray) {
+        element_size = id_size_;
+      } else if (slot > StripPolicy::kSlotPrimitiveArray) {
+        element_size = TypeSize(slot - StripPolicy::kSlotPrimitiveArray);
+      } else {
+        break;
+      }
+      const uint32_t count = ReadU4(header + 1 + id_size_ + 4);
+      const uint32_t keep_count =
+          std::min<uint32_t>(count, rule.keep_bytes / element_size);
+      if (keep_count == count) break;
+      sub->body_keep = (uint64_t)keep_count * element_size;
+      sub->adjust_length = true;
+      sub->truncate = true;
+      sub->truncated_count = keep_count;
+    } break;
+
+    default:
+      break;
+  }
+}
+
+void HprofStreamParser::EmitHeader(const uint8_t *header, const SubRecord &sub,
+                                   bool borrowed, StripOutput &out) {
+  if (sub.truncate) {
+    uint8_t patched[kMaxArrayHeaderSize];
+    memcpy(patched, header, sub.header_size);
+    WriteU4(patched + 1 + id_size_ + 4, sub.truncated_count);
+    out.Copy(patched, sub.header_size);
+  } else if (borrowed) {
+    out.Ref(header, sub.header_size);
+  } else {
+    out.Copy(header, sub.header_size);
+  }
+}
+
+size_t HprofStreamParser::CaptureSize(uint8_t tag) const {
+  const size_t id = id_size_;
+  switch (tag) {
+    // ID, utf8 name
+    case HPROF_TAG_STRING:
+      if (record_length_ < id) return 0;
+      for (HprofListener *listener : listeners_) {
+        if (listener->WantsStringBodies()) return record_length_;
+      }
+      if (policy_.HasClasses() &&
+          record_length_ - id <= policy_.MaxClassNameLength()) {
+        return record_length_;
+      }
+      return !listeners_.empty() ? id : 0;
+    // u4 class serial, ID class, u4 stack serial, ID name
+    case HPROF_TAG_LOAD_CLASS:
+      if (record_length_ != 4 + id + 4 + id) return 0;
+      return !listeners_.empty() || !string_verdicts_.empty()
+                 ? record_length_
+                 : 0;
+    default:
+      return 0;
+  }
+}
+
+void HprofStreamParser::OnRecordCaptured() {
+  const size_t id = id_size_;
+  if (record_tag_ == HPROF_TAG_STRING) {
+    const uint64_t string_id = ReadId(capture_.data());
+    for (HprofListener *listener : listeners_) {
+      listener->OnString(string_id, capture_.data() + id,
+                         capture_.size() - id, !record_dropped_,
+                         record_position_);
+    }
+    if (capture_.size() > id && policy_.HasClasses()) {
+      std::string name(reinterpret_cast<const char *>(capture_.data() + id),
+                       capture_.size() - id);
+      StripPolicy::ClassVerdict verdict = policy_.FindClass(name);
+      if (verdict != StripPolicy::kClassNone) {
+        string_verdicts_[string_id] = verdict;
+      }
+    }
+  } else {
+    const uint64_t class_id = ReadId(capture_.data() + 4);
+    const uint64_t name_id = ReadId(capture_.data() + 4 + id + 4);
+    for (HprofListener *listener : listeners_) {
+      listener->OnLoadClass(class_id, name_id);
+    }
+    auto it = string_verdicts_.find(name_id);
+    if (it != string_verdicts_.end()) class_verdicts_[class_id] = it->second;
+  }
+  capture_.clear();
+}
+
+bool HprofStreamParser::MakeObject(const uint8_t *header, const SubRecord &sub,
+                                   HprofObject *object) const {
+  const size_t id = id_size_;
+  *object = {};
+  object->tag = header[0];
+  switch (object->tag) {
+    case HPROF_INSTANCE_DUMP:
+      object->class_id = ReadId(header + 1 + id + 4);
+      break;
+    case HPROF_OBJECT_ARRAY_DUMP:
+      object->class_id = ReadId(header + 1 + id + 4 + 4);
+      break;
+    case HPROF_PRIMITIVE_ARRAY_DUMP:
+      object->element_type = header[sub.header_size - 1];
+      break;
+    case HPROF_CLASS_DUMP:
+      break;
+    default:
+      return false;
+  }
+  object->heap = heap_;
+  object->id = ReadId(header + 1);
+  object->size = sub.body_size;
+  return true;
+}
+
+void HprofStreamParser::NotifyObject(const uint8_t *header,
+                                     const SubRecord &sub,
+                                     uint64_t position) {
+  if (policy_.SlotOf(header[0]) == StripPolicy::kSlotRoot) {
+    const uint64_t id = ReadId(header + 1);
+    for (HprofListener *listener : listeners_) listener->OnRoot(header[0], id);
+    return;
+  }
+  HprofObject object;
+  if (!MakeObject(header, sub, &object)) return;
+  body_listeners_.clear();
+  for (HprofListener *listener : listeners_) {
+    if (!listener->OnObject(object, sub.keep_header, position)) continue;
+    if (object.tag == HPROF_CLASS_DUMP) {
+      listener->OnClassDump(header, sub.header_size);
+    } else if (sub.body_size > 0) {
+      body_listeners_.push_back(listener);
+    }
+  }
+}
+
+void HprofStreamParser::NotifyObjectBody(const uint8_t *data, size_t size) {
+  for (HprofListener *listener : body_listeners_) {
+    listener->OnObjectBody(data, size);
+  }
+}
+
+void HprofStreamParser::NotifyObjectEnd() {
+  for (HprofListener *listener : body_listeners_) listener->OnObjectEnd();
+  body_listeners_.clear();
+}
+
+void HprofStreamParser::FilterBegin(const uint8_t *header,
+                                    const SubRecord &sub, uint64_t position,
+                                    StripOutput &out) {
+  if (header[0] == HPROF_HEAP_DUMP_INFO) {
+    if (!filter_->OnHeapInfo(heap_, ReadU4(header + 1),
+                             ReadId(header + 1 + 4))) {
+      FilterOut(position, sub.header_size, out);
+    }
+    return;
+  }
+  HprofObject object;
+  if (!MakeObject(header, sub, &object)) return;
+  // 段长度里算上了没写出的 body（kStripBody），去掉这条时要一起减掉
+  filter_length_ =
+      sub.header_size + (sub.adjust_length ? sub.body_keep : sub.body_size);
+  filter_position_ = position;
+  filtering_ = true;
+  filter_->OnObjectBegin(object, position, sub.header_size + sub.body_keep,
+                         filter_length_);
+  if (sub.truncate) {
+    uint8_t patched[kMaxArrayHeaderSize];
+    memcpy(patched, header, sub.header_size);
+    WriteU4(patched + 1 + id_size_ + 4, sub.truncated_count);
+    filter_->OnObjectBytes(patched, sub.header_size);
+  } else {
+    filter_->OnObjectBytes(header, sub.header_size);
+  }
+}
+
+void HprofStreamParser::FilterEnd(StripOutput &out) {
+  filtering_ = false;
+  if (filter_->OnObjectEnd()) return;
+  FilterOut(filter_position_, filter_length_, out);
+}
+
+void HprofStreamParser::FilterOut(uint64_t position, uint64_t length,
+                                  StripOutput &out) {
+  // heap record 在结束前一直 hold 在 StripOutput 里，可以整条撤回
+  omitted_bytes_ += out.Position() - position;
+  out.Truncate(position);
+  record_stripped_ += length;
+}
+
+void HprofStreamParser::Feed(const uint8_t *data, size_t size,
+                             StripOutput &out) {
+  const uint8_t *end = data + size;
+  while (data < end) {
+    switch (state_) {
+      case kFileHeader:
+        data = FeedFileHeader(data, end, out);
+        break;
+
+      case kRecordHeader:
+        data = FeedRecordHeader(data, end, out);
+        break;
+
+      case kRecordBody: {
+        auto n = (size_t)std::min<uint64_t>(end - data, record_remaining_);
+        if (record_dropped_) {
+          stripped_bytes_ += n;
+        } else {
+          out.Ref(data, n);
+        }
+        if (capture_size_ > capture_.size()) {
+          size_t take = std::min(n, capture_size_ - capture_.size());
+          capture_.insert(capture_.end(), data, data + take);
+        }
+        data += n;
+        record_remaining_ -= n;
+        if (record_remaining_ == 0) {
+          if (capture_size_ > 0) OnRecordCaptured();
+          state_ = kRecordHeader;
+        }
+      } break;
+
+      case kHeapRaw: {
+        auto n = (size_t)std::min<uint64_t>(end - data, record_remaining_);
+        out.Ref(data, n);
+        data += n;
+        record_remaining_ -= n;
+        EndHeapRecordIfDone(out);
+      } break;
+
+      case kSubRecordHeader:
+        data = FeedSubRecordHeader(data, end, out);
+        break;
+
+      case kSubRecordBody: {
+        auto n = (size_t)std::min<uint64_t>(end - data, body_remaining_);
+        auto keep = (size_t)std::min<uint64_t>(n, body_keep_);
+        if (keep > 0) out.Ref(data, keep);
+        if (n > keep) {
+          stripped_bytes_ += n - keep;
+          if (body_adjust_length_) record_stripped_ += n - keep;
+        }
+        body_keep_ -= keep;
+        if (!body_listeners_.empty()) NotifyObjectBody(data, n);
+        if (filtering_ && keep > 0) filter_->OnObjectBytes(data, keep);
+        data += n;
+        body_remaining_ -= n;
+        record_remaining_ -= n;
+        if (body_remaining_ == 0) {
+          if (!body_listeners_.empty()) NotifyObjectEnd();
+          if (filtering_) FilterEnd(out);
+          state_ = kSubRecordHeader;
+          EndHeapRecordIfDone(out);
+        }
+      } break;
+
+      case kPassThrough:
+        out.Ref(data, end - data);
+        data = end;
+        break;
+    }
+  }
+}
+
+const uint8_t *HprofStreamParser::FeedFileHeader(const uint8_t *data,
+                                                 const uint8_t *end,
+                                                 StripOutput &out) {
+  // "JAVA PROFILE 1.0.3\0", u4 id size, u8 timestamp
+  while (data < end) {
+    carry_.push_back(*data++);
+    auto *nul = static_cast<const uint8_t *>(
+        memchr(carry_.data(), 0, carry_.size()));
+    if (nul == nullptr) {
+      if (carry_.size() < kMaxFileHeaderSize) continue;
+    } else {
+      size_t header_size = (nul - carry_.data()) + 1 + 4 + 8;
+      if (carry_.size() < header_size) continue;
+      uint32_t id_size = ReadU4(nul + 1);
+      if (id_size == 4 || id_size == 8) {
+        SetIdSize(id_size);
+        timestamp_ = ReadU8(nul + 1 + 4);
+        out.Copy(carry_.data(), carry_.size());
+        carry_.clear();
+        state_ = kRecordHeader;
+        return data;
+      }
+    }
+    // 不认识的格式，原样写出
+    out.Copy(carry_.data(), carry_.size());
+    carry_.clear();
+    state_ = kPassThrough;
+    return data;
+  }
+  return data;
+}
+
+const uint8_t *HprofStreamParser::FeedRecordHeader(const uint8_t *data,
+                                                   const uint8_t *end,
+                                                   StripOutput &out) {
+  const uint8_t *header;
+  const bool borrowed =
+      carry_.empty() && (size_t)(end - data) >= kRecordHeaderSize;
+  if (borrowed) {
+    header = data;
+    data += kRecordHeaderSize;
+  } else {
+    size_t take =
+        std::min(kRecordHeaderSize - carry_.size(), (size_t)(end - data));
+    carry_.insert(carry_.end(), data, data + take);
+    data += take;
+    if (carry_.size() < kRecordHeaderSize) return data;
+    header = carry_.data();
+  }
+
+  const uint8_t tag = header[0];
+  record_tag_ = tag;
+  record_length_ = ReadU4(header + 5);
+  record_remaining_ = record_length_;
+  if (tag == HPROF_TAG_HEAP_DUMP || tag == HPROF_TAG_HEAP_DUMP_SEGMENT) {
+    // 长度要等 record 结束才知道，先拷贝一份 header 留着回填
+    out.Hold();
+    record_position_ = out.Position();
+    out.Copy(header, kRecordHeaderSize);
+    record_stripped_ = 0;
+    carry_.clear();
+    state_ = kSubRecordHeader;
+    EndHeapRecordIfDone(out);
+  } else {
+    record_dropped_ = policy_.IsRecordDropped(tag);
+    capture_size_ = record_remaining_ > 0 ? CaptureSize(tag) : 0;
+    record_position_ = out.Position();
+    if (record_dropped_) {
+      stripped_bytes_ += kRecordHeaderSize;
+    } else if (borrowed) {
+      out.Ref(header, kRecordHeaderSize);
+    } else {
+      out.Copy(header, kRecordHeaderSize);
+    }
+    carry_.clear();
+    if (tag == HPROF_TAG_HEAP_DUMP_END) {
+      finished_ = true;
+      end_position_ = record_position_;
+    }
+    state_ = record_remaining_ > 0 ? kRecordBody : kRecordHeader;
+  }
+  return data;
+}
+
+const uint8_t *HprofStreamParser::FeedSubRecordHeader(const uint8_t *data,
+                                                      const uint8_t *end,
+                                                      StripOutput &out) {
+  if (carry_.empty()) {
+    data = (this->*feed_whole_sub_records_)(data, end, out);
+    if (state_ != kSubRecordHeader || data == end) return data;
+  }
+
+  const auto in_record =
+      (size_t)std::min<uint64_t>(end - data, record_remaining_);
+  const bool from_carry = !carry_.empty();
+  const uint8_t *header = from_carry ? carry_.data() : data;
+  const size_t available = from_carry ? carry_.size() : in_record;
+  const uint64_t record_available = carry_.size() + record_remaining_;
+
+  SubRecord sub{};
+  size_t need;
+  if (!ParseSubRecord(header, available, &need, &sub) ||
+      need > record_available) {
+    EnterHeapRaw(out);
+    return data;
+  }
+  if (need > available) {
+    // 被 write 截断了，先攒下来
+    size_t take = std::min(need - carry_.size(), in_record);
+    carry_.insert(carry_.end(), data, data + take);
+    record_remaining_ -= take;
+    return data + take;
+  }
+  if (sub.header_size + sub.body_size > record_available) {
+    EnterHeapRaw(out);
+    return data;
+  }
+
+  Classify(header, &sub);
+  if (!from_carry) {
+    data += sub.header_size;
+    record_remaining_ -= sub.header_size;
+  }
+  const uint64_t position = out.Position();
+  if (!listeners_.empty()) NotifyObject(header, sub, position);
+  if (!sub.keep_header) {
+    stripped_bytes_ += sub.header_size;
+    if (sub.adjust_length) record_stripped_ += sub.header_size;
+  } else {
+    EmitHeader(header, sub, !from_carry, out);
+    if (filter_ != nullptr) FilterBegin(header, sub, position, out);
+  }
+  carry_.clear();
+
+  body_remaining_ = sub.body_size;
+  body_keep_ = sub.body_keep;
+  body_adjust_length_ = sub.adjust_length;
+  if (body_remaining_ > 0) {
+    state_ = kSubRecordBody;
+  } else {
+    if (filtering_) FilterEnd(out);
+    EndHeapRecordIfDone(out);
+  }
+  return data;
+}
+
+template <uint32_t kIdSize>
+const uint8_t *HprofStreamParser::FeedWholeSubRecords(const uint8_t *data,
+                                                      const uint8_t *end,
+                                                      StripOutput &out) {
+  // 常见情况下 sub record 整个都在这次 write 里，直接处理不经过状态机
+  const uint8_t *limit =
+      data + (size_t)std::min<uint64_t>(end - data, record_remaining_);
+  while (data < limit) {
+    const auto available = (size_t)(limit - data);
+    SubRecord sub{};
+    size_t need;
+    if (!ParseSubRecord<kIdSize>(data, available, &need, &sub) ||
+        need > available || sub.body_size > available - sub.header_size) {
+      break;
+    }
+    Classify(data, &sub);
+    const size_t size = sub.header_size + (size_t)sub.body_size;
+    const uint64_t position = out.Position();
+    if (!listeners_.empty()) {
+      NotifyObject(data, sub, position);
+      if (!body_listeners_.empty()) {
+        NotifyObjectBody(data + sub.header_size, (size_t)sub.body_size);
+        NotifyObjectEnd();
+      }
+    }
+    if (sub.keep_header && sub.body_keep == sub.body_size) {
+      out.Ref(data, size);
+    } else {
+      size_t stripped = 0;
+      if (sub.keep_header) {
+        EmitHeader(data, sub, true, out);
+      } else {
+        stripped += sub.header_size;
+      }
+      if (sub.body_keep > 0) {
+        out.Ref(data + sub.header_size, (size_t)sub.body_keep);
+      }
+      stripped += (size_t)(sub.body_size - sub.body_keep);
+      stripped_bytes_ += stripped;
+      if (sub.adjust_length) record_stripped_ += stripped;
+    }
+    if (filter_ != nullptr && sub.keep_header) {
+      FilterBegin(data, sub, position, out);
+      if (filtering_) {
+        if (sub.body_keep > 0) {
+          filter_->OnObjectBytes(data + sub.header_size,
+                                 (size_t)sub.body_keep);
+        }
+        FilterEnd(out);
+      }
+    }
+    data += size;
+    record_remaining_ -= size;
+  }
+  EndHeapRecordIfDone(out);
+  return data;
+}
+
+void HprofStreamParser::EnterHeapRaw(StripOutput &out) {
+  out.Copy(carry_.data(), carry_.size());
+  carry_.clear();
+  state_ = kHeapRaw;
+  EndHeapRecordIfDone(out);
+}
+
+void HprofStreamParser::EndHeapRecordIfDone(StripOutput &out) {
+  if (record_remaining_ != 0 || !carry_.empty()) return;
+  // 根据裁剪掉的zygote space和image space更新length
+  out.PatchU4(record_position_ + 5,
+              record_length_ - (uint32_t)record_stripped_);
+  out.Release();
+  state_ = kRecordHeader;
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <android/log.h>
+#include <fcntl.h>
+#include <hprof_strip_engine.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#define LOG_TAG "HprofCrop"
+
+namespace kwai {
+namespace leak_monitor {
+
+static constexpr int kWritePollTimeoutMs = 100;
+// 读端这么久都不收数据就放弃，不让 dump 一直挂着
+static constexpr uint64_t kWriteStallNs = 10ull * 1000000000ull;
+static constexpr const char *kIndexSuffix = ".kidx";
+static constexpr const char *kDuplicatesSuffix = ".kdup";
+static constexpr const char *kFingerprintSuffix = ".kfp";
+static constexpr const char *kSpoolSuffix = ".spool";
+static constexpr const char *kLeakPathsSuffix = ".kpath";
+static constexpr const char *kGraphSuffix = ".graph";
+static constexpr size_t kDuplicateRows = 200;
+
+static uint64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static StripPolicy HistogramPolicy() {
+  StripPolicy policy;
+  policy.Clear();
+  StripPolicy::Rule drop = {kStripDrop, 0, 0};
+  for (uint8_t slot = 0; slot < StripPolicy::kSlotCount; slot++) {
+    policy.SetRule(~0u, slot, drop);
+  }
+  for (uint32_t tag = 0; tag < 256; tag++) {
+    policy.SetRecordDropped((uint8_t)tag, true);
+  }
+  return policy;
+}
+
+HprofStripEngine::HprofStripEngine()
+    : fd_(-1),
+      write_syscall_count_(0),
+      compression_(HprofContainer::kCodecNone),
+      index_enabled_(false),
+      histogram_top_(0),
+      histogram_written_(false),
+      duplicate_min_bytes_(0),
+      fingerprint_enabled_(false),
+      snapshot_enabled_(false),
+      snapshot_active_(false) {}
+
+void HprofStripEngine::SetIndexEnabled(bool enabled) {
+  index_enabled_ = enabled;
+}
+
+void HprofStripEngine::SetStripPolicy(const StripPolicy &policy) {
+  strip_policy_ = policy;
+}
+
+void HprofStripEngine::SetHistogramMode(size_t top_classes) {
+  histogram_top_ = top_classes;
+}
+
+void HprofStripEngine::SetDuplicateArrayThreshold(size_t min_bytes) {
+  duplicate_min_bytes_ = min_bytes;
+}
+
+void HprofStripEngine::SetFingerprintEnabled(bool enabled) {
+  fingerprint_enabled_ = enabled;
+}
+
+void HprofStripEngine::SetDeltaBase(const std::string &base_path) {
+  delta_base_path_ = base_path;
+}
+
+void HprofStripEngine::SetSnapshotMode(bool enabled) {
+  snapshot_enabled_ = enabled;
+}
+
+void HprofStripEngine::SetLeakPathClasses(
+    const std::vector<std::string> &class_names) {
+  leak_path_classes_ = class_names;
+}
+
+void HprofStripEngine::SetCompression(int codec) {
+  switch (codec) {
+    case HprofContainer::kCodecLz4:
+    case HprofContainer::kCodecLzma:
+      compression_ = static_cast<HprofContainer::Codec>(codec);
+      break;
+    default:
+      compression_ = HprofContainer::kCodecNone;
+      break;
+  }
+}
+
+void HprofStripEngine::Begin(const char *path, int fd) {
+  fd_ = fd;
+  parser_.Reset();
+  output_.Reset();
+  compressor_.Reset(compression_);
+  index_.Reset();
+  index_path_.clear();
+  duplicates_path_.clear();
+  fingerprint_path_.clear();
+  leak_paths_path_.clear();
+  delta_base_.Close();
+  snapshot_active_ = false;
+  histogram_written_ = false;
+  parser_.ClearListeners();
+  parser_.SetObjectFilter(nullptr);
+  if (histogram_top_ > 0) {
+    // 只统计不落盘，所有内容都丢掉
+    histogram_.Reset();
+    parser_.SetPolicy(HistogramPolicy());
+    parser_.AddListener(&histogram_);
+  } else {
+    parser_.SetPolicy(strip_policy_);
+    snapshot_active_ = snapshot_enabled_;
+    // base 打不开就退回完整 dump，不能因为增量失败丢掉这次 dump
+    const bool delta =
+        !snapshot_active_ && !delta_base_path_.empty() &&
+        delta_base_.Open((delta_base_path_ + kFingerprintSuffix).c_str());
+    if (snapshot_active_) {
+      snapshot_.Reset(std::string(path) + kSpoolSuffix);
+      parser_.SetObjectFilter(&snapshot_);
+    } else if (delta) {
+      delta_.Reset(&delta_base_);
+      parser_.SetObjectFilter(&delta_);
+    } else if (fingerprint_enabled_) {
+      fingerprint_path_ = std::string(path) + kFingerprintSuffix;
+      delta_.Reset(nullptr);
+      parser_.SetObjectFilter(&delta_);
+    }
+    // 增量和快照里的对象不全，索引留给还原后的 hprof
+    if (index_enabled_ && !delta && !snapshot_active_) {
+      index_path_ = std::string(path) + kIndexSuffix;
+      parser_.AddListener(&index_);
+    }
+  }
+  if (duplicate_min_bytes_ > 0) {
+    duplicates_path_ = std::string(path) + kDuplicatesSuffix;
+    duplicates_.Reset(duplicate_min_bytes_);
+    parser_.AddListener(&duplicates_);
+  }
+  if (!leak_path_classes_.empty()) {
+    leak_paths_.Reset(leak_path_classes_, std::string(path) + kGraphSuffix);
+    if (leak_paths_.Enabled()) {
+      leak_paths_path_ = std::string(path) + kLeakPathsSuffix;
+      parser_.AddListener(&leak_paths_);
+    }
+  }
+  write_syscall_count_ = 0;
+}
+
+bool HprofStripEngine::Write(const uint8_t *data, size_t size) {
+  // record 可能被 ART 的 buffer 截断在任意位置，由 parser 跨 write 维护状态
+  parser_.Feed(data, size, output_);
+  if (parser_.Finished() && delta_base_.IsOpen()) AppendDeltaTrailer();
+  if (parser_.Finished() && snapshot_active_) AppendSnapshot();
+
+  bool write_success =
+      histogram_top_ > 0 ? WriteHistogram(fd_) : WriteOutput(fd_);
+  if (parser_.Finished()) {
+    WriteSidecars();
+  }
+  return write_success;
+}
+
+bool HprofStripEngine::FullyWritev(int fd, struct iovec *iov, size_t count) {
+  uint64_t stalled_since = 0;
+  while (count > 0) {
+    int batch = (int)std::min<size_t>(count, IOV_MAX);
+    ssize_t written = writev(fd, iov, batch);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) {
+        // 非阻塞 fd（比如 pipe）写满了，等到可写再继续，太久没进展就失败
+        uint64_t now = NowNs();
+        if (stalled_since == 0) stalled_since = now;
+        if (now - stalled_since >= kWriteStallNs) {
+          __android_log_print(ANDROID_LOG_ERROR, LOG_TAG,
+                              "writev stalled for %llu ms",
+                              (unsigned long long)(kWriteStallNs / 1000000));
+          errno = ETIMEDOUT;
+          return false;
+        }
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        poll(&pfd, 1, kWritePollTimeoutMs);
+        continue;
+      }
+      __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "writev failed %d",
+                          errno);
+      return false;
+    }
+    write_syscall_count_++;
+    stalled_since = 0;
+    if (written == 0) {
+      errno = EIO;
+      return false;
+    }
+    // 跳过已写完的部分，处理 partial write
+    while (count > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0 && written > 0) {
+      iov->iov_base = (uint8_t *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return true;
+}
+
+bool HprofStripEngine::WriteOutput(int fd) {
+  bool write_success = true;
+  if (!compressor_.Enabled()) {
+    // 保留的区间合并成 iovec 一次 writev 写出
+    output_.Drain([this, fd, &write_success](struct iovec *iov, size_t size) {
+      write_success = FullyWritev(fd, iov, size);
+    });
+    return write_success;
+  }
+
+  // 压缩在 fork 出的子进程里做，只拖慢 dump 本身，不影响主进程
+  output_.Drain([this](struct iovec *iov, size_t size) {
+    compressor_.Append(iov, size);
+  });
+  if (parser_.Finished()) {
+    compressor_.Finish();
+    __android_log_print(ANDROID_LOG_INFO, LOG_TAG,
+                        "compressed %llu -> %llu, max block %llu us",
+                        (unsigned long long)compressor_.RawBytes(),
+                        (unsigned long long)compressor_.PackedBytes(),
+                        (unsigned long long)compressor_.MaxBlockNs() / 1000);
+  }
+  compressor_.Drain([this, fd, &write_success](struct iovec *iov, size_t size) {
+    write_success = FullyWritev(fd, iov, size);
+  });
+  return write_success;
+}
+
+// Writes through a temporary file so that a sidecar either is complete or
+// does not exist
+template <typename Writer>
+static void WriteSidecar(const std::string &path, Writer writer) {
+  std::string tmp_path = path + ".tmp";
+  int fd = open(tmp_path.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC,
+                0644);
+  if (fd < 0) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "open %s failed %d",
+                        tmp_path.c_str(), errno);
+    return;
+  }
+  // sidecar 只是辅助分析，写失败不影响 hprof 本身
+  bool success = writer(fd);
+  close(fd);
+  if (!success || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+  }
+}
+
+void HprofStripEngine::AppendDeltaTrailer() {
+  // 写在 HEAP_DUMP_END 之后，和 hprof 一起压缩
+  delta_.AppendTrailer(output_, parser_.EndPosition());
+  __android_log_print(ANDROID_LOG_INFO, LOG_TAG,
+                      "delta omits %llu objects, %llu bytes",
+                      (unsigned long long)delta_.OmittedObjects(),
+                      (unsigned long long)parser_.OmittedBytes());
+  delta_base_.Close();
+  delta_.Reset(nullptr);
+}
+
+void HprofStripEngine::AppendSnapshot() {
+  // 同 delta trailer，列写在 HEAP_DUMP_END 之后
+  snapshot_.AppendColumns(output_, parser_.IdSize(), parser_.EndPosition());
+  snapshot_active_ = false;
+}
+
+void HprofStripEngine::WriteSidecars() {
+  if (!index_path_.empty()) {
+    WriteSidecar(index_path_, [this](int fd) {
+      return index_.Write(fd, parser_.IdSize(), output_.Position());
+    });
+    index_path_.clear();
+    index_.Reset();
+  }
+  if (!duplicates_path_.empty()) {
+    std::string summary = duplicates_.Summary(kDuplicateRows);
+    WriteSidecar(duplicates_path_, [this, &summary](int fd) {
+      struct iovec iov = {&summary[0], summary.size()};
+      return FullyWritev(fd, &iov, 1);
+    });
+    duplicates_path_.clear();
+    duplicates_.Reset(0);
+  }
+  if (!fingerprint_path_.empty()) {
+    WriteSidecar(fingerprint_path_, [this](int fd) {
+      return delta_.WriteFingerprints(fd, parser_.IdSize(),
+                                      parser_.Timestamp());
+    });
+    fingerprint_path_.clear();
+    delta_.Reset(nullptr);
+  }
+  if (!leak_paths_path_.empty()) {
+    // hprof 已经写完，在这之后建图找路径
+    std::string summary = leak_paths_.Summary(parser_.IdSize());
+    if (!summary.empty()) {
+      WriteSidecar(leak_paths_path_, [this, &summary](int fd) {
+        struct iovec iov = {&summary[0], summary.size()};
+        return FullyWritev(fd, &iov, 1);
+      });
+    }
+    leak_paths_path_.clear();
+    leak_paths_.Reset({}, std::string());
+  }
+  // 列已经写出去了，spool 和编码结果都可以释放
+  snapshot_.Reset(std::string());
+  parser_.ClearListeners();
+  parser_.SetObjectFilter(nullptr);
+}
+
+bool HprofStripEngine::WriteHistogram(int fd) {
+  output_.Drain([](struct iovec *, size_t) {});
+  if (histogram_written_ || !parser_.Finished()) return true;
+  histogram_written_ = true;
+  std::string summary = histogram_.Summary(histogram_top_);
+  histogram_.Reset();
+  struct iovec iov = {&summary[0], summary.size()};
+  return FullyWritev(fd, &iov, 1);
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#ifndef KOOM_ASYNC_WRITER_H
+#define KOOM_ASYNC_WRITER_H
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * Moves the work of a write() off the calling thread. Write() copies the bytes
+ * into a ring of large page aligned buffers and returns, a worker thread
+ * hands every full buffer to the consumer. Small writes are coalesced, so the
+ * consumer sees at most kBufferSize bytes at a time and mostly exactly that.
+ *
+ * Buffers are copied rather than borrowed because ART reuses its buffer as
+ * soon as write() returns. Once the consumer failed, the remaining data is
+ * dropped and Write() returns false.
+ */
+class AsyncWriter {
+ public:
+  static constexpr size_t kBufferSize = 1u << 20u;
+  static constexpr size_t kBufferCount = 4;
+
+  // Called on the worker thread, returns false on failure
+  typedef bool (*Consumer)(void *arg, const uint8_t *data, size_t size);
+
+  AsyncWriter();
+  ~AsyncWriter();
+
+  // Returns false if the buffers or the thread could not be created, the
+  // caller should then do the work synchronously
+  bool Start(Consumer consumer, void *arg);
+  bool Running() const { return running_; }
+  bool Write(const uint8_t *data, size_t size);
+  // Hands over the partly filled buffer and waits for the worker to finish.
+  // Returns false if any consumer call failed.
+  bool Finish();
+
+  // errno of the failed consumer call, EIO if it left none
+  int Error() const { return error_; }
+
+  // Longest time Write() waited for a free buffer
+  uint64_t MaxStallNs() const { return max_stall_ns_; }
+  size_t BufferBytes() const { return kBufferSize * kBufferCount; }
+
+ private:
+  struct Buffer {
+    uint8_t *data;
+    // 0 tells the worker to quit
+    size_t size;
+  };
+
+  static void *Trampoline(void *arg);
+  void Loop();
+  Buffer *AcquireBuffer();
+  void Submit();
+  void FreeBuffers();
+
+  Buffer buffers_[kBufferCount];
+  sem_t free_;
+  sem_t filled_;
+  // Only touched by the writing thread
+  size_t fill_index_;
+  Buffer *filling_;
+  // Only touched by the worker
+  size_t drain_index_;
+
+  pthread_t worker_;
+  bool running_;
+  std::atomic<bool> failed_;
+  std::atomic<int> error_;
+  Consumer consumer_;
+  void *arg_;
+  uint64_t max_stall_ns_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_ASYNC_WRITER_H
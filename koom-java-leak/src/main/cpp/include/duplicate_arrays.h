@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#ifndef KOOM_DUPLICATE_ARRAYS_H
+#define KOOM_DUPLICATE_ARRAYS_H
+
+#include <hprof_stream_parser.h>
+#include <stripe_hash.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * Finds primitive arrays with identical contents, typically the same bitmap,
+ * string or buffer loaded more than once. Payloads of at least min_bytes are
+ * hashed while they stream through the parser, stripped or not, and grouped
+ * by (hash, element type, length), only one entry per distinct payload is
+ * kept. Groups are told apart by a 64 bit hash and never compared byte by
+ * byte, so a collision would merge two groups, which is harmless for a
+ * report.
+ */
+class DuplicateArrayDetector : public HprofListener {
+ public:
+  static constexpr uint32_t kDefaultHeapMask =
+      (1u << StripPolicy::kHeapDefault) | (1u << StripPolicy::kHeapApp);
+  // Bounds the memory of the forked dump process, arrays with new contents
+  // past the limit are not tracked
+  static constexpr size_t kMaxEntries = 1u << 20u;
+
+  void Reset(size_t min_bytes, uint32_t heap_mask = kDefaultHeapMask);
+
+  bool WantsStringBodies() const override { return false; }
+  void OnString(uint64_t id, const uint8_t *utf8, size_t size, bool kept,
+                uint64_t position) override;
+  void OnLoadClass(uint64_t class_id, uint64_t name_id) override;
+  bool OnObject(const HprofObject &object, bool kept,
+                uint64_t position) override;
+  void OnObjectBody(const uint8_t *data, size_t size) override;
+  void OnObjectEnd() override;
+
+  /**
+   * Text summary of the groups wasting the most bytes, tab separated:
+   *
+   *   # koom duplicate arrays 1
+   *   total <groups> <duplicate arrays> <wasted bytes>
+   *   <arrays> <wasted bytes> <type>[<length>] <id of the first array>
+   *   ...
+   *
+   * A group of n arrays of s bytes wastes (n - 1) * s bytes.
+   */
+  std::string Summary(size_t top) const;
+
+ private:
+  struct Entry {
+    uint32_t count;
+    uint32_t length;
+    uint8_t element_type;
+    uint64_t first_id;
+  };
+
+  size_t min_bytes_ = 0;
+  uint32_t heap_mask_ = kDefaultHeapMask;
+
+  StripeHash hash_;
+  HprofObject current_ = {};
+
+  std::unordered_map<uint64_t, Entry> entries_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_DUPLICATE_ARRAYS_H
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#ifndef KOOM_HEAP_HISTOGRAM_H
+#define KOOM_HEAP_HISTOGRAM_H
+
+#include <hprof_stream_parser.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * Per class instance count and shallow size collected from the dump stream,
+ * for sampling heap composition without writing the hprof.
+ *
+ * Shallow size is what the hprof carries: field values of instances and
+ * elements of arrays, object headers are not included. Only the heaps in
+ * heap_mask are counted, by default the app heap, zygote and image objects
+ * are shared with other processes.
+ */
+class HeapHistogram : public HprofListener {
+ public:
+  static constexpr uint32_t kDefaultHeapMask =
+      (1u << StripPolicy::kHeapDefault) | (1u << StripPolicy::kHeapApp);
+
+  void Reset(uint32_t heap_mask = kDefaultHeapMask);
+
+  bool WantsStringBodies() const override { return true; }
+  void OnString(uint64_t id, const uint8_t *utf8, size_t size, bool kept,
+                uint64_t position) override;
+  void OnLoadClass(uint64_t class_id, uint64_t name_id) override;
+  bool OnObject(const HprofObject &object, bool kept,
+                uint64_t position) override;
+
+  /**
+   * Text summary of the top classes by shallow size, tab separated:
+   *
+   *   # koom heap histogram 1
+   *   total <instances> <shallow bytes> <classes>
+   *   <instances> <shallow bytes> <class name>
+   *   ...
+   */
+  std::string Summary(size_t top) const;
+
+ private:
+  struct Entry {
+    uint64_t count;
+    uint64_t bytes;
+  };
+  struct StringRef {
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  std::string ClassName(uint64_t class_id) const;
+
+  uint32_t heap_mask_ = kDefaultHeapMask;
+
+  // 类名要等 LOAD_CLASS 才知道是哪些 string，先全部存下来
+  std::vector<char> string_data_;
+  std::unordered_map<uint64_t, StringRef> strings_;
+  std::unordered_map<uint64_t, uint64_t> class_names_;
+
+  std::unordered_map<uint64_t, Entry> classes_;
+  Entry primitive_arrays_[hprof_basic_long + 1] = {};
+  // Objects of one class often come in a row
+  uint64_t last_class_id_ = 0;
+  Entry *last_entry_ = nullptr;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_HEAP_HISTOGRAM_H
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#ifndef KOOM_HPROF_BLOCK_READER_H
+#define KOOM_HPROF_BLOCK_READER_H
+
+#include <hprof_compressor.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * Random access reader of an HprofContainer file. The index is taken from the
+ * trailer, a file without trailer is indexed by walking the block headers.
+ */
+class HprofBlockReader {
+ public:
+  struct Block {
+    uint64_t raw_offset;
+    uint64_t file_offset;
+    uint32_t raw_size;
+    uint32_t packed_size;
+    uint32_t crc;
+    HprofContainer::Codec codec;
+  };
+
+  bool Open(int fd);
+
+  size_t BlockCount() const { return blocks_.size(); }
+  uint64_t RawSize() const { return raw_size_; }
+  const Block &GetBlock(size_t index) const { return blocks_[index]; }
+  // Index of the block holding raw_offset, BlockCount() if out of range
+  size_t FindBlock(uint64_t raw_offset) const;
+
+  // Decompresses one block into out and checks its crc
+  bool ReadBlock(size_t index, std::vector<uint8_t> &out) const;
+  // Writes the whole raw hprof to out_fd
+  bool DecompressTo(int out_fd) const;
+
+ private:
+  bool ReadAt(uint64_t offset, void *buf, size_t size) const;
+  bool ReadBlockHeader(uint64_t file_offset, Block &block) const;
+  bool LoadIndex(uint64_t file_size);
+  bool ScanBlocks(uint64_t file_size);
+
+  int fd_ = -1;
+  uint64_t raw_size_ = 0;
+  std::vector<Block> blocks_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_HPROF_BLOCK_READER_H
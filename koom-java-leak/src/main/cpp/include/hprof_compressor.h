@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#ifndef KOOM_HPROF_COMPRESSOR_H
+#define KOOM_HPROF_COMPRESSOR_H
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * Block container for compressed hprof, every block is compressed on its own
+ * so readers can seek to any raw offset. All integers are little endian.
+ *
+ *   header:  u32 magic "KHPZ", u16 version, u8 codec, u8 0, u32 block size,
+ *            u32 0
+ *   block:   u8 codec, u8[3] 0, u32 raw size, u32 packed size, u32 crc32 of
+ *            the raw bytes, packed bytes
+ *   index:   per block u64 raw offset, u64 file offset of the block
+ *   trailer: u64 index offset, u64 raw size, u32 block count, u32 magic
+ *
+ * A block whose data does not shrink is stored with kCodecNone. A file cut
+ * before the trailer can still be read by walking the blocks.
+ */
+struct HprofContainer {
+  enum Codec : uint8_t {
+    kCodecNone = 0,
+    kCodecLz4 = 1,
+    kCodecLzma = 2,
+  };
+
+  static constexpr uint32_t kMagic = 0x5a50484b;  // "KHPZ"
+  static constexpr uint16_t kVersion = 1;
+  static constexpr size_t kHeaderSize = 16;
+  static constexpr size_t kBlockHeaderSize = 16;
+  static constexpr size_t kIndexEntrySize = 16;
+  static constexpr size_t kTrailerSize = 24;
+  static constexpr size_t kLzmaPropsSize = 5;
+  static constexpr size_t kDefaultBlockSize = 1 << 20;
+
+  static uint32_t Crc(const uint8_t *data, size_t size);
+};
+
+/**
+ * Compresses the stripped hprof into an HprofContainer while it is written.
+ */
+class HprofCompressor {
+ public:
+  HprofCompressor();
+
+  // kCodecNone disables compression, the hprof is written as is
+  void Reset(HprofContainer::Codec codec,
+             size_t block_size = HprofContainer::kDefaultBlockSize);
+  bool Enabled() const { return codec_ != HprofContainer::kCodecNone; }
+
+  void Append(const struct iovec *iov, size_t count);
+  // Compresses the last block and appends the index and the trailer
+  void Finish();
+
+  // Passes the container bytes produced so far to fn(iovec *iov, size_t
+  // count) and drops them.
+  template <typename Fn>
+  void Drain(Fn fn) {
+    if (pending_.empty()) return;
+    struct iovec iov = {pending_.data(), pending_.size()};
+    fn(&iov, 1);
+    file_offset_ += pending_.size();
+    pending_.clear();
+  }
+
+  uint64_t RawBytes() const { return raw_offset_ + block_.size(); }
+  uint64_t PackedBytes() const { return file_offset_ + pending_.size(); }
+  // Longest time one block took, the writer is blocked for that long
+  uint64_t MaxBlockNs() const { return max_block_ns_; }
+
+ private:
+  void CompressBlock();
+  size_t Encode(const uint8_t *src, size_t size, uint8_t *dst,
+                size_t capacity);
+  void PutLe32(uint32_t value);
+  void PutLe64(uint64_t value);
+
+  HprofContainer::Codec codec_;
+  size_t block_size_;
+  bool finished_;
+
+  std::vector<uint8_t> block_;
+  std::vector<uint8_t> pending_;
+  // raw offset and file offset of every block
+  std::vector<uint64_t> index_;
+
+  uint64_t raw_offset_;   // raw bytes before block_
+  uint64_t file_offset_;  // container bytes before pending_
+  uint64_t max_block_ns_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_HPROF_COMPRESSOR_H
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#ifndef KOOM_HPROF_DELTA_H
+#define KOOM_HPROF_DELTA_H
+
+#include <android-base/macros.h>
+#include <hprof_stream_parser.h>
+#include <stripe_hash.h>
+#include <strip_output.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * Incremental dumps. A full dump writes "<hprof>.kfp", the fingerprints of
+ * its objects, later dumps of the same process are written as deltas against
+ * it: object sub records whose bytes did not change are left out. A delta
+ * is always taken against a full dump, never against another delta. Both
+ * are written by the forked dump process or the host tool only, stream mode
+ * strips in the app and leaves them out.
+ *
+ * Fingerprint file, little endian, arrays 8 byte aligned, mmap-ed as is:
+ *
+ *   header: u32 magic "KHPF", u32 version, u32 id size, u32 0,
+ *           u64 timestamp of the hprof, u64 count
+ *   u64 ids[count] ascending
+ *   u64 hashes[count]   of the bytes written for the sub record
+ *   u64 offsets[count]  of the sub record in the hprof
+ *   u32 sizes[count]    bytes written for the sub record
+ *   u32 lengths[count]  bytes it adds to the segment length, more than size
+ *                       when its values were stripped
+ *   u8 heaps[count]     StripPolicy::Heap of the last kept HEAP_DUMP_INFO
+ *                       before it, kHeapCount if none, padded to 8 bytes
+ *
+ * Delta: the stripped hprof of the new dump without the instances, arrays
+ * and class dumps that are identical in the base, segment lengths adjusted,
+ * followed by a trailer after HEAP_DUMP_END. Objects ahead of the first
+ * kept HEAP_DUMP_INFO are never left out, they could not be put back in
+ * front of it.
+ *
+ *
+ *   u64 replaced[replaced count]  base objects that are rewritten in the delta
+ *   u64 removed[removed count]    base objects that are gone, tombstones
+ *   per StripPolicy::Heap: u32 heap type, u32 1 if seen, u64 name string id
+ *                          of the last HEAP_DUMP_INFO of the heap
+ *   u64 offset of the HEAP_DUMP_END record
+ *   u64 timestamp of the base hprof
+ *   u64 replaced count, u64 removed count
+ *   u32 version, u32 magic "KHPD"
+ *
+ * Everything else of the base is found in the delta again, see
+ * ApplyHprofDelta(). With compression both files are containers and offsets
+ * are raw offsets.
+ */
+struct HprofDeltaFormat {
+  static constexpr uint32_t kFingerprintMagic = 0x4650484b;  // "KHPF"
+  static constexpr uint32_t kDeltaMagic = 0x4450484b;        // "KHPD"
+  // 2: StripeHash merges all 8 lanes into every bit of the hash
+  static constexpr uint32_t kVersion = 2;
+  static constexpr size_t kFingerprintHeaderSize = 32;
+  // u64 id, hash and offset, u32 size and length, u8 heap
+  static constexpr size_t kFingerprintBytes = 8 * 3 + 4 * 2 + 1;
+  static constexpr size_t kHeapEntrySize = 16;
+  static constexpr size_t kTrailerSize =
+      StripPolicy::kHeapCount * kHeapEntrySize + 8 + 8 + 8 + 8 + 4 + 4;
+};
+
+/**
+ * Read only view of a fingerprint file.
+ */
+class HprofFingerprints {
+ public:
+  HprofFingerprints() = default;
+  ~HprofFingerprints();
+
+  bool Open(const char *path);
+  void Close();
+  bool IsOpen() const { return map_ != nullptr; }
+
+  uint32_t IdSize() const { return id_size_; }
+  uint64_t Timestamp() const { return timestamp_; }
+  size_t Count() const { return count_; }
+  const uint64_t *Ids() const { return ids_; }
+  const uint64_t *Hashes() const { return hashes_; }
+  const uint64_t *Offsets() const { return offsets_; }
+  const uint32_t *Sizes() const { return sizes_; }
+  const uint32_t *Lengths() const { return lengths_; }
+  const uint8_t *Heaps() const { return heaps_; }
+  // Index of id, Count() if absent. hint is where to look first, ART writes
+  // objects by address so the next one is usually right after the last.
+  size_t Find(uint64_t id, size_t hint = 0) const;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(HprofFingerprints);
+
+  void *map_ = nullptr;
+  size_t map_size_ = 0;
+  uint32_t id_size_ = 0;
+  uint64_t timestamp_ = 0;
+  size_t count_ = 0;
+  const uint64_t *ids_ = nullptr;
+  const uint64_t *hashes_ = nullptr;
+  const uint64_t *offsets_ = nullptr;
+  const uint32_t *sizes_ = nullptr;
+  const uint32_t *lengths_ = nullptr;
+  const uint8_t *heaps_ = nullptr;
+};
+
+/**
+ * Hashes the object sub records HprofStreamParser keeps. Collects the
+ * fingerprints of a full dump, or, given the fingerprints of the base, leaves
+ * out the records that did not change and remembers which base objects were
+ * replaced or removed.
+ */
+class HprofDeltaFilter : public HprofObjectFilter {
+ public:
+  HprofDeltaFilter() = default;
+
+  // With base the dump becomes a delta, otherwise fingerprints are collected
+  void Reset(const HprofFingerprints *base);
+
+  bool OnHeapInfo(uint8_t heap, uint32_t heap_type, uint64_t name_id) override;
+  void OnObjectBegin(const HprofObject &object, uint64_t position,
+                     uint64_t size, uint64_t length) override;
+  void OnObjectBytes(const uint8_t *data, size_t size) override;
+  bool OnObjectEnd() override;
+
+  // Sorts the fingerprints and writes them, false on I/O errors
+  bool WriteFingerprints(int fd, uint32_t id_size, uint64_t timestamp);
+  // Appends the delta trailer once HEAP_DUMP_END went through
+  void AppendTrailer(StripOutput &out, uint64_t end_position);
+
+  uint64_t OmittedObjects() const { return omitted_objects_; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(HprofDeltaFilter);
+
+  static constexpr uint8_t kNoHeap = StripPolicy::kHeapCount;
+
+  enum BaseState : uint8_t {
+    kBaseMissing = 0,
+    kBaseSame,
+    kBaseChanged,
+  };
+
+  struct Fingerprint {
+    uint64_t id;
+    uint64_t hash;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t length;
+    uint8_t heap;
+  };
+
+  struct HeapInfo {
+    uint32_t heap_type;
+    uint32_t seen;
+    uint64_t name_id;
+  };
+
+  const HprofFingerprints *base_ = nullptr;
+  std::vector<uint8_t> base_states_;
+  size_t base_hint_ = 0;
+
+  StripeHash hash_;
+  Fingerprint current_ = {};
+  std::vector<Fingerprint> fingerprints_;
+  HeapInfo heaps_[StripPolicy::kHeapCount] = {};
+  // heap of the last kept HEAP_DUMP_INFO, which is what readers of the
+  // stripped hprof see, kNoHeap before the first one
+  uint8_t current_heap_ = kNoHeap;
+  uint64_t omitted_objects_ = 0;
+};
+
+/**
+ * Writes heap sub records to fd as HEAP_DUMP_SEGMENT records of about 1 MB,
+ * for tools that put objects back into an hprof.
+ */
+class HprofSegmentWriter {
+ public:
+  HprofSegmentWriter(int fd, uint32_t id_size);
+
+  bool HeapInfo(uint32_t heap_type, uint64_t name_id);
+  // size bytes of data add length bytes to the segment length, more than size
+  // when the values of the record were stripped
+  bool Add(const uint8_t *data, size_t size, uint32_t length);
+  // Writes the pending segment, false on I/O errors
+  bool Flush();
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(HprofSegmentWriter);
+
+  int fd_;
+  uint32_t id_size_;
+  std::vector<uint8_t> segment_;
+  uint64_t length_;
+};
+
+/**
+ * Rebuilds the full stripped hprof from the base hprof, its fingerprints and
+ * a delta against it, all raw, and writes it to out_fd. The objects carried
+ * over from the base are appended in extra segments before HEAP_DUMP_END,
+ * grouped by heap. Returns false with a message in error if the files do not
+ * belong together or writing fails.
+ */
+bool ApplyHprofDelta(const uint8_t *base, size_t base_size,
+                     const HprofFingerprints &fingerprints,
+                     const uint8_t *delta, size_t delta_size, int out_fd,
+                     std::string *error);
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_HPROF_DELTA_H
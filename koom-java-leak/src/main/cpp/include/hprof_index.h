@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#ifndef KOOM_HPROF_INDEX_H
+#define KOOM_HPROF_INDEX_H
+
+#include <hprof_stream_parser.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * Sidecar index of a stripped hprof, written next to it as "<hprof>.kidx" so
+ * the analyzer can look objects up without a full pass over the hprof.
+ *
+ * All integers are little endian and every array is 8 byte aligned, the file
+ * is meant to be mmap-ed as is:
+ *
+ *   header:   u32 magic "KHPI", u32 version, u32 id size, u32 section count,
+ *             u64 hprof size
+ *   sections: per section u32 type, u32 0, u64 file offset, u64 count
+ *   data:     per section u64 keys[count] sorted ascending, then
+ *             u64 values[count]
+ *
+ * Values are offsets in the stripped hprof of the sub record (objects and
+ * class dumps) or of the STRING record, except kClassNames whose values are
+ * the string ids of the class names. With compression the offsets are raw
+ * offsets, see HprofBlockReader::FindBlock().
+ */
+struct HprofIndexFormat {
+  enum Section : uint32_t {
+    kInstances = 1,
+    kObjectArrays,
+    kPrimitiveArrays,
+    kClassDumps,
+    kStrings,
+    kClassNames,
+    kSectionEnd,
+  };
+
+  static constexpr uint32_t kMagic = 0x4950484b;  // "KHPI"
+  static constexpr uint32_t kVersion = 1;
+  static constexpr size_t kHeaderSize = 24;
+  static constexpr size_t kSectionEntrySize = 24;
+  static constexpr uint32_t kSectionCount = kSectionEnd - 1;
+};
+
+/**
+ * Collects index entries from HprofStreamParser while the hprof is written.
+ */
+class HprofIndexBuilder : public HprofListener {
+ public:
+  void Reset();
+
+  bool WantsStringBodies() const override { return false; }
+  void OnString(uint64_t id, const uint8_t *utf8, size_t size, bool kept,
+                uint64_t position) override;
+  void OnLoadClass(uint64_t class_id, uint64_t name_id) override;
+  bool OnObject(const HprofObject &object, bool kept,
+                uint64_t position) override;
+
+  // Sorts the entries and writes the index, false on I/O errors
+  bool Write(int fd, uint32_t id_size, uint64_t hprof_size);
+
+ private:
+  struct Entry {
+    uint64_t key;
+    uint64_t value;
+  };
+
+  std::vector<Entry> entries_[HprofIndexFormat::kSectionEnd];
+};
+
+/**
+ * Read only view of an index file.
+ */
+class HprofIndex {
+ public:
+  HprofIndex() = default;
+  ~HprofIndex();
+
+  bool Open(const char *path);
+  void Close();
+
+  uint32_t IdSize() const { return id_size_; }
+  uint64_t HprofSize() const { return hprof_size_; }
+  size_t Count(HprofIndexFormat::Section section) const {
+    return sections_[section].count;
+  }
+  const uint64_t *Keys(HprofIndexFormat::Section section) const {
+    return sections_[section].keys;
+  }
+  const uint64_t *Values(HprofIndexFormat::Section section) const {
+    return sections_[section].values;
+  }
+  bool Find(HprofIndexFormat::Section section, uint64_t key,
+            uint64_t *value) const;
+
+ private:
+  struct View {
+    const uint64_t *keys;
+    const uint64_t *values;
+    size_t count;
+  };
+
+  void *map_ = nullptr;
+  size_t map_size_ = 0;
+  uint32_t id_size_ = 0;
+  uint64_t hprof_size_ = 0;
+  View sections_[HprofIndexFormat::kSectionEnd] = {};
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_HPROF_INDEX_H
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#ifndef KOOM_HPROF_STREAM_PARSER_H
+#define KOOM_HPROF_STREAM_PARSER_H
+
+#include <strip_policy.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace kwai {
+namespace leak_monitor {
+
+class StripOutput;
+
+enum HprofTag {
+  HPROF_TAG_STRING = 0x01,
+  HPROF_TAG_LOAD_CLASS = 0x02,
+  HPROF_TAG_UNLOAD_CLASS = 0x03,
+  HPROF_TAG_STACK_FRAME = 0x04,
+  HPROF_TAG_STACK_TRACE = 0x05,
+  HPROF_TAG_ALLOC_SITES = 0x06,
+  HPROF_TAG_HEAP_SUMMARY = 0x07,
+  HPROF_TAG_START_THREAD = 0x0A,
+  HPROF_TAG_END_THREAD = 0x0B,
+  HPROF_TAG_HEAP_DUMP = 0x0C,
+  HPROF_TAG_HEAP_DUMP_SEGMENT = 0x1C,
+  HPROF_TAG_HEAP_DUMP_END = 0x2C,
+  HPROF_TAG_CPU_SAMPLES = 0x0D,
+  HPROF_TAG_CONTROL_SETTINGS = 0x0E,
+};
+
+enum HprofHeapTag {
+  // Traditional.
+  HPROF_ROOT_UNKNOWN = 0xFF,
+  HPROF_ROOT_JNI_GLOBAL = 0x01,
+  HPROF_ROOT_JNI_LOCAL = 0x02,
+  HPROF_ROOT_JAVA_FRAME = 0x03,
+  HPROF_ROOT_NATIVE_STACK = 0x04,
+  HPROF_ROOT_STICKY_CLASS = 0x05,
+  HPROF_ROOT_THREAD_BLOCK = 0x06,
+  HPROF_ROOT_MONITOR_USED = 0x07,
+  HPROF_ROOT_THREAD_OBJECT = 0x08,
+  HPROF_CLASS_DUMP = 0x20,
+  HPROF_INSTANCE_DUMP = 0x21,
+  HPROF_OBJECT_ARRAY_DUMP = 0x22,
+  HPROF_PRIMITIVE_ARRAY_DUMP = 0x23,
+
+  // Android.
+  HPROF_HEAP_DUMP_INFO = 0xfe,
+  HPROF_ROOT_INTERNED_STRING = 0x89,
+  HPROF_ROOT_FINALIZING = 0x8a,  // Obsolete.
+  HPROF_ROOT_DEBUGGER = 0x8b,
+  HPROF_ROOT_REFERENCE_CLEANUP = 0x8c,  // Obsolete.
+  HPROF_ROOT_VM_INTERNAL = 0x8d,
+  HPROF_ROOT_JNI_MONITOR = 0x8e,
+  HPROF_UNREACHABLE = 0x90,                  // Obsolete.
+  HPROF_PRIMITIVE_ARRAY_NODATA_DUMP = 0xc3,  // Obsolete.
+};
+
+enum HprofBasicType {
+  hprof_basic_object = 2,
+  hprof_basic_boolean = 4,
+  hprof_basic_char = 5,
+  hprof_basic_float = 6,
+  hprof_basic_double = 7,
+  hprof_basic_byte = 8,
+  hprof_basic_short = 9,
+  hprof_basic_int = 10,
+  hprof_basic_long = 11,
+};
+
+enum HprofHeapId {
+  HPROF_HEAP_DEFAULT = 0,
+  HPROF_HEAP_ZYGOTE = 'Z',
+  HPROF_HEAP_APP = 'A',
+  HPROF_HEAP_IMAGE = 'I',
+};
+
+struct HprofObject {
+  uint8_t tag;           // instance, object/primitive array or class dump
+  uint8_t heap;          // StripPolicy::Heap
+  uint8_t element_type;  // HprofBasicType of primitive arrays
+  uint64_t id;
+  uint64_t class_id;     // instances and object arrays
+  uint64_t size;         // bytes of field values or elements
+};
+
+/**
+ * Observes the records going through HprofStreamParser, whether they are kept
+ * or stripped. position is the output offset of the record, meaningful only
+ * when kept.
+ *
+ * A listener returning true from OnObject() gets the body of that object
+ * through OnObjectBody(), in as many pieces as the writes cut it into,
+ * followed by OnObjectEnd(). Class dumps have no body, the whole sub record
+ * goes to OnClassDump() instead.
+ */
+class HprofListener {
+ public:
+  virtual ~HprofListener() = default;
+
+  // OnString() gets the utf8 bytes only when true
+  virtual bool WantsStringBodies() const = 0;
+  virtual void OnString(uint64_t id, const uint8_t *utf8, size_t size,
+                        bool kept, uint64_t position) = 0;
+  virtual void OnLoadClass(uint64_t class_id, uint64_t name_id) = 0;
+  virtual bool OnObject(const HprofObject &object, bool kept,
+                        uint64_t position) = 0;
+  virtual void OnObjectBody(const uint8_t * /* data */, size_t /* size */) {}
+  virtual void OnObjectEnd() {}
+  virtual void OnClassDump(const uint8_t * /* data */, size_t /* size */) {}
+  // GC roots, id is the object the root sub record of tag points to
+  virtual void OnRoot(uint8_t /* tag */, uint64_t /* id */) {}
+};
+
+/**
+ * Sees the object sub records that survive the strip rules and may still
+ * leave them out of the output, after their last byte went through. Heap
+ * records are held in StripOutput until they are complete, so the bytes can
+ * be taken back and the segment length is reduced accordingly.
+ *
+ * OnObjectBytes() gets exactly the bytes written for the record, header
+ * included, in as many pieces as the writes cut it into.
+ */
+class HprofObjectFilter {
+ public:
+  virtual ~HprofObjectFilter() = default;
+
+  // A HEAP_DUMP_INFO that is kept, heap is its StripPolicy::Heap. Returns
+  // false to leave it out as well
+  virtual bool OnHeapInfo(uint8_t heap, uint32_t heap_type,
+                          uint64_t name_id) = 0;
+  // size bytes are written for the record at position, it adds length bytes
+  // to the segment length, more than size when its values were stripped
+  virtual void OnObjectBegin(const HprofObject &object, uint64_t position,
+                             uint64_t size, uint64_t length) = 0;
+  virtual void OnObjectBytes(const uint8_t *data, size_t size) = 0;
+  // Returns false to leave the record out
+  virtual bool OnObjectEnd() = 0;
+};
+
+/**
+ * Strips an hprof stream while it is being written.
+ *
+ * ART flushes its buffer whenever it is full, so a record or heap sub record
+ * may be cut at any byte. The parser is a state machine driven by Feed(), a
+ * sub record prefix cut by a write is carried over in carry_, payloads are
+ * only counted down and never buffered. Nothing recurses, the cost per write
+ * is linear in its size.
+ *
+ * What is removed is decided by a StripPolicy, see strip_policy.h for the
+ * default rules. Class allow/deny lists are resolved to class ids from the
+ * STRING and LOAD_CLASS records, which ART writes before the heap dump.
+ */
+class HprofStreamParser {
+ public:
+  HprofStreamParser();
+
+  void Reset();
+  // Must be set before the dump starts
+  void SetPolicy(const StripPolicy &policy) { policy_ = policy; }
+  // Listeners are called in the order they were added
+  void AddListener(HprofListener *listener) { listeners_.push_back(listener); }
+  void ClearListeners() { listeners_.clear(); }
+  // At most one, nullptr keeps every object the policy keeps
+  void SetObjectFilter(HprofObjectFilter *filter) { filter_ = filter; }
+  void Feed(const uint8_t *data, size_t size, StripOutput &out);
+
+  // True once the HEAP_DUMP_END record went through, nothing follows it
+  bool Finished() const { return finished_; }
+  uint32_t IdSize() const { return id_size_; }
+  uint64_t StrippedBytes() const { return stripped_bytes_; }
+  // Bytes of the records the object filter left out
+  uint64_t OmittedBytes() const { return omitted_bytes_; }
+  // Milliseconds since the epoch from the file header, tells dumps apart
+  uint64_t Timestamp() const { return timestamp_; }
+  // Output position of the HEAP_DUMP_END record, valid once Finished()
+  uint64_t EndPosition() const { return end_position_; }
+
+ private:
+  enum State : uint8_t {
+    kFileHeader,
+    kRecordHeader,
+    kRecordBody,
+    kSubRecordHeader,
+    kSubRecordBody,
+    // Unknown sub record, the rest of the heap record is kept untouched
+    kHeapRaw,
+    // Not an hprof, everything is kept
+    kPassThrough,
+  };
+
+  struct SubRecord {
+    size_t header_size;
+    uint64_t body_size;
+    bool keep_header;
+    // Length of the kept prefix of the body
+    uint64_t body_keep;
+    // Whether stripped bytes are deducted from the segment length
+    bool adjust_length;
+    // The array count in the header is rewritten to truncated_count
+    bool truncate;
+    uint32_t truncated_count;
+  };
+
+  static constexpr size_t kRecordHeaderSize = 9;  // u1 tag, u4 time, u4 length
+  static constexpr size_t kMaxFileHeaderSize = 64;
+  // u1 tag, id, u4 stack serial, u4 count, id class
+  static constexpr size_t kMaxArrayHeaderSize = 1 + 8 + 4 + 4 + 8;
+
+  void SetIdSize(uint32_t id_size);
+  // Size of a value of the basic type, 0 if invalid. Class dumps with
+  // thousands of static fields make this the hottest lookup.
+  size_t TypeSize(uint8_t basic_type) const {
+    return basic_type < sizeof(type_sizes_) ? type_sizes_[basic_type] : 0;
+  }
+  // Returns false for unknown sub tags. Otherwise *need is the number of
+  // header bytes required, sub is filled once size >= *need.
+  bool ParseSubRecord(const uint8_t *data, size_t size, size_t *need,
+                      SubRecord *sub) const;
+  template <uint32_t kIdSize>
+  bool ParseSubRecord(const uint8_t *data, size_t size, size_t *need,
+                      SubRecord *sub) const;
+  uint64_t ReadId(const uint8_t *data) const;
+  // Fills object for the object sub records, false for the others
+  bool MakeObject(const uint8_t *header, const SubRecord &sub,
+                  HprofObject *object) const;
+  void Classify(const uint8_t *header, SubRecord *sub);
+  void ApplyRule(const uint8_t *header, uint8_t slot, SubRecord *sub) const;
+  void EmitHeader(const uint8_t *header, const SubRecord &sub, bool borrowed,
+                  StripOutput &out);
+  // Leading body bytes of the current record needed by the index or the
+  // class lists
+  size_t CaptureSize(uint8_t tag) const;
+  void OnRecordCaptured();
+  void NotifyObject(const uint8_t *header, const SubRecord &sub,
+                    uint64_t position);
+  void NotifyObjectBody(const uint8_t *data, size_t size);
+  void NotifyObjectEnd();
+  // Passes a kept sub record written at position to the object filter
+  void FilterBegin(const uint8_t *header, const SubRecord &sub,
+                   uint64_t position, StripOutput &out);
+  void FilterEnd(StripOutput &out);
+  // Takes back a written sub record that adds length to the segment length
+  void FilterOut(uint64_t position, uint64_t length, StripOutput &out);
+  const uint8_t *FeedFileHeader(const uint8_t *data, const uint8_t *end,
+                                StripOutput &out);
+  const uint8_t *FeedRecordHeader(const uint8_t *data, const uint8_t *end,
+                                  StripOutput &out);
+  const uint8_t *FeedSubRecordHeader(const uint8_t *data, const uint8_t *end,
+                                     StripOutput &out);
+  // Instantiated per id size, the fast path of FeedSubRecordHeader()
+  template <uint32_t kIdSize>
+  const uint8_t *FeedWholeSubRecords(const uint8_t *data, const uint8_t *end,
+                                     StripOutput &out);
+  void EnterHeapRaw(StripOutput &out);
+  void EndHeapRecordIfDone(StripOutput &out);
+
+  typedef const uint8_t *(HprofStreamParser::*FeedFunction)(
+      const uint8_t *data, const uint8_t *end, StripOutput &out);
+
+  State state_;
+  uint32_t id_size_;
+  FeedFunction feed_whole_sub_records_;
+  uint8_t type_sizes_[hprof_basic_long + 1];
+  StripPolicy policy_;
+  std::vector<HprofListener *> listeners_;
+  // Listeners that asked for the body of the current sub record
+  std::vector<HprofListener *> body_listeners_;
+  HprofObjectFilter *filter_;
+  // The current sub record goes to filter_, it starts at filter_position_
+  bool filtering_;
+  uint64_t filter_position_;
+  uint64_t filter_length_;
+  uint8_t heap_;  // StripPolicy::Heap of the following sub records
+  bool finished_;
+
+  // Partial file header, record header or sub record header
+  std::vector<uint8_t> carry_;
+
+  uint64_t record_remaining_;  // input bytes of the current record
+  uint32_t record_length_;
+  uint64_t record_position_;   // output position of the record header
+  uint64_t record_stripped_;   // bytes to deduct from record_length_
+  uint8_t record_tag_;
+  bool record_dropped_;
+  size_t capture_size_;        // body bytes collected into capture_
+
+  // STRING and LOAD_CLASS bodies for the index and the class lists
+  std::vector<uint8_t> capture_;
+  std::unordered_map<uint64_t, StripPolicy::ClassVerdict> string_verdicts_;
+  std::unordered_map<uint64_t, StripPolicy::ClassVerdict> class_verdicts_;
+
+  uint64_t body_remaining_;
+  uint64_t body_keep_;  // bytes of body_remaining_ still to keep
+  bool body_adjust_length_;
+
+  uint64_t stripped_bytes_;
+  uint64_t omitted_bytes_;
+  uint64_t timestamp_;
+  uint64_t end_position_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_HPROF_STREAM_PARSER_H
@@ -21,9 +21,13 @@
 #define KOOM_HPROF_STRIP_H
 
 #include <android-base/macros.h>
+#include <async_writer.h>
+#include <hprof_strip_engine.h>
+#include <strip_stream.h>
 
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace kwai {
 namespace leak_monitor {
@@ -34,37 +38,61 @@ class HprofStrip {
   static void HookInit();
   int HookOpenInternal(const char *path_name, int flags, ...);
   ssize_t HookWriteInternal(int fd, const void *buf, ssize_t count);
+  int HookCloseInternal(int fd);
   bool IsHookSuccess() const;
   void SetHprofName(const char *hprof_name);
+  // Dump settings, see HprofStripEngine
+  void SetCompression(int codec) { engine_.SetCompression(codec); }
+  void SetStripPolicy(const StripPolicy &policy) {
+    engine_.SetStripPolicy(policy);
+  }
+  void SetIndexEnabled(bool enabled) { engine_.SetIndexEnabled(enabled); }
+  void SetHistogramMode(size_t top_classes) {
+    engine_.SetHistogramMode(top_classes);
+  }
+  void SetDuplicateArrayThreshold(size_t min_bytes) {
+    engine_.SetDuplicateArrayThreshold(min_bytes);
+  }
+  void SetFingerprintEnabled(bool enabled) {
+    engine_.SetFingerprintEnabled(enabled);
+  }
+  void SetDeltaBase(const std::string &base_path) {
+    engine_.SetDeltaBase(base_path);
+  }
+  void SetSnapshotMode(bool enabled) { engine_.SetSnapshotMode(enabled); }
+  void SetLeakPathClasses(const std::vector<std::string> &class_names) {
+    engine_.SetLeakPathClasses(class_names);
+  }
+  // Strips and writes on a worker thread so that ART's writes only cost a
+  // copy, falls back to synchronous writes if the thread cannot be created.
+  // See async_writer.h.
+  void SetAsyncWrite(bool enabled);
+  // For ForkJvmHeapDumper.dumpToStream, strips with the settings above in
+  // this process, the hooks stay idle while the hprof name is empty
+  const HprofStreamProcessor *StreamProcessor() const {
+    return stream_processor_.Get();
+  }
 
  private:
   HprofStrip();
   ~HprofStrip() = default;
   DISALLOW_COPY_AND_ASSIGN(HprofStrip);
 
-  static int GetShortFromBytes(const unsigned char *buf, int index);
-  static int GetIntFromBytes(const unsigned char *buf, int index);
-  static int GetByteSizeFromType(unsigned char basic_type);
-
-  int ProcessHeap(const void *buf, int first_index, int max_len,
-                  int heap_serial_no, int array_serial_no);
-
-  static size_t FullyWrite(int fd, const void *buf, ssize_t count);
-  void reset();
+  static bool ConsumeAsync(void *arg, const uint8_t *data, size_t size);
+  bool ProcessWrite(const uint8_t *data, size_t size);
 
   int hprof_fd_;
-  int strip_bytes_sum_;
-  int heap_serial_num_;
   int hook_write_serial_num_;
-  int strip_index_;
 
   bool is_hook_success_;
-  bool is_current_system_heap_;
 
   std::string hprof_name_;
+  bool async_enabled_;
+  uint64_t dump_start_ns_;
 
-  static constexpr int kStripListLength = 65536 * 2 * 2 + 2;
-  int strip_index_list_pair_[kStripListLength];
+  HprofStripEngine engine_;
+  AsyncWriter async_writer_;
+  StripStreamProcessor stream_processor_;
 };
 
 }  // namespace leak_monitor
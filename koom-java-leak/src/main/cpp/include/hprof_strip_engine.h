@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#ifndef KOOM_HPROF_STRIP_ENGINE_H
+#define KOOM_HPROF_STRIP_ENGINE_H
+
+#include <android-base/macros.h>
+#include <duplicate_arrays.h>
+#include <heap_histogram.h>
+#include <hprof_delta.h>
+#include <hprof_compressor.h>
+#include <hprof_index.h>
+#include <hprof_snapshot.h>
+#include <hprof_stream_parser.h>
+#include <leak_path_finder.h>
+#include <strip_output.h>
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * Everything HprofStrip does with the bytes of a dump, without the hooks, so
+ * that it also runs on the host, see host/. The hprof is fed in order through
+ * Write() in chunks of any size, the stripped and optionally compressed
+ * result goes to the fd given to Begin(), sidecars are written next to path
+ * once the dump is complete. All work happens on the calling thread.
+ */
+class HprofStripEngine {
+ public:
+  HprofStripEngine();
+
+  // HprofContainer::Codec of the stripped hprof, kCodecNone by default
+  void SetCompression(int codec);
+  void SetStripPolicy(const StripPolicy &policy);
+  // Writes "<hprof>.kidx" next to the hprof, see hprof_index.h
+  void SetIndexEnabled(bool enabled);
+  // With top_classes > 0 nothing of the dump is written, the file gets a
+  // text histogram of the top classes instead, see heap_histogram.h
+  void SetHistogramMode(size_t top_classes);
+  // With min_bytes > 0 primitive arrays of at least min_bytes with identical
+  // contents are reported in "<hprof>.kdup", see duplicate_arrays.h
+  void SetDuplicateArrayThreshold(size_t min_bytes);
+  // Writes "<hprof>.kfp" next to full dumps, the base of later deltas
+  void SetFingerprintEnabled(bool enabled);
+  // With a non empty base_path dumps are written as deltas against that full
+  // dump, whose fingerprints must exist. Deltas get no index. See
+  // hprof_delta.h.
+  void SetDeltaBase(const std::string &base_path);
+  // Writes a compact snapshot instead of the stripped hprof, see
+  // hprof_snapshot.h. Takes precedence over deltas and fingerprints, gets no
+  // index.
+  void SetSnapshotMode(bool enabled);
+  // With class names the shortest paths from GC roots to their instances are
+  // written to "<hprof>.kpath" once the dump is complete, see
+  // leak_path_finder.h
+  void SetLeakPathClasses(const std::vector<std::string> &class_names);
+
+  // Starts a dump, the settings above apply from here on
+  void Begin(const char *path, int fd);
+  // Returns false if writing the output failed
+  bool Write(const uint8_t *data, size_t size);
+
+  bool Finished() const { return parser_.Finished(); }
+  uint64_t SyscallCount() const { return write_syscall_count_; }
+  uint64_t StrippedBytes() const { return parser_.StrippedBytes(); }
+  // Bytes a delta saved
+  uint64_t OmittedBytes() const { return parser_.OmittedBytes(); }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(HprofStripEngine);
+
+  bool FullyWritev(int fd, struct iovec *iov, size_t count);
+  bool WriteOutput(int fd);
+  void WriteSidecars();
+  void AppendDeltaTrailer();
+  void AppendSnapshot();
+  bool WriteHistogram(int fd);
+
+  int fd_;
+  uint64_t write_syscall_count_;
+
+  HprofContainer::Codec compression_;
+  bool index_enabled_;
+  std::string index_path_;
+  size_t histogram_top_;
+  bool histogram_written_;
+  size_t duplicate_min_bytes_;
+  std::string duplicates_path_;
+  bool fingerprint_enabled_;
+  std::string fingerprint_path_;
+  std::string delta_base_path_;
+  bool snapshot_enabled_;
+  bool snapshot_active_;
+  std::vector<std::string> leak_path_classes_;
+  std::string leak_paths_path_;
+  StripPolicy strip_policy_;
+
+  HprofStreamParser parser_;
+  StripOutput output_;
+  HprofCompressor compressor_;
+  HprofIndexBuilder index_;
+  HeapHistogram histogram_;
+  DuplicateArrayDetector duplicates_;
+  HprofFingerprints delta_base_;
+  HprofDeltaFilter delta_;
+  HprofSnapshotEncoder snapshot_;
+  LeakPathFinder leak_paths_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_HPROF_STRIP_ENGINE_H
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#ifndef KOOM_LEAK_PATH_FINDER_H
+#define KOOM_LEAK_PATH_FINDER_H
+
+#include <android-base/macros.h>
+#include <hprof_stream_parser.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * Shortest reference paths from GC roots to instances of leak suspect
+ * classes, found where the dump is stripped so that they are known without
+ * loading the hprof into shark. That is the forked dump process or the host
+ * tool, never the app: stream mode strips in the app and leaves this out.
+ *
+ * While the dump streams through the parser the class dumps and the bodies
+ * of instances and object arrays of all heaps, stripped or not, are spooled
+ * to an unlinked graph file, only strings and roots are kept in memory. Once
+ * the dump is complete the reference graph is built in the same file as CSR
+ * arrays with 32 bit node indices, mmap-ed, so it lives in page cache the
+ * kernel can write back. Like shark's PathFinder a breadth first search runs
+ * from all roots at once, the first path reaching an object is one of the
+ * shortest, Reference.referent is not followed and classes only reference
+ * their static field values.
+ *
+ * Suspects are instances of the configured classes and their subclasses in
+ * the heaps of heap_mask. "name#field" only takes instances whose boolean
+ * field declared by that class is true, e.g. "android.app.Activity#mDestroyed".
+ */
+class LeakPathFinder : public HprofListener {
+ public:
+  static constexpr uint32_t kDefaultHeapMask =
+      (1u << StripPolicy::kHeapDefault) | (1u << StripPolicy::kHeapApp);
+  // Suspects past this are counted but get no path
+  static constexpr size_t kMaxPaths = 100;
+
+  LeakPathFinder() = default;
+  ~LeakPathFinder() override;
+
+  // Collects nothing without suspects or if graph_path cannot be created,
+  // an empty list releases everything
+  void Reset(const std::vector<std::string> &suspects,
+             const std::string &graph_path,
+             uint32_t heap_mask = kDefaultHeapMask);
+  bool Enabled() const { return graph_fd_ >= 0; }
+
+  bool WantsStringBodies() const override { return true; }
+  void OnString(uint64_t id, const uint8_t *utf8, size_t size, bool kept,
+                uint64_t position) override;
+  void OnLoadClass(uint64_t class_id, uint64_t name_id) override;
+  bool OnObject(const HprofObject &object, bool kept,
+                uint64_t position) override;
+  void OnObjectBody(const uint8_t *data, size_t size) override;
+  void OnClassDump(const uint8_t *data, size_t size) override;
+  void OnRoot(uint8_t tag, uint64_t id) override;
+
+  /**
+   * Builds the graph, searches it and returns the paths as text, tab
+   * separated, or an empty string if the graph file failed:
+   *
+   *   # koom leak paths 1
+   *   total <suspects> <reachable> <objects> <references>
+   *   path <references> <class name> <id>
+   *   <tab> root <root type> <class name> <id>
+   *   <tab> field|static|element <name or index> <class name> <id>
+   *   ...
+   *
+   * Each path runs from the root to the suspect, one line per object, the
+   * class name of a class object is "class <name>". Unreachable suspects are
+   * garbage and not reported.
+   */
+  std::string Summary(uint32_t id_size);
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(LeakPathFinder);
+
+  struct Suspect {
+    std::string class_name;
+    std::string field_name;
+  };
+  struct Root {
+    uint64_t id;
+    uint8_t tag;
+  };
+  struct StringRef {
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  class Graph;
+
+  void Spool(const void *data, size_t size);
+  bool FlushSpool();
+  std::string String(uint64_t id) const;
+  std::string ClassName(uint64_t class_id) const;
+
+  std::vector<Suspect> suspects_;
+  uint32_t heap_mask_ = kDefaultHeapMask;
+
+  int graph_fd_ = -1;
+  bool failed_ = false;
+  uint64_t spooled_ = 0;  // bytes written to graph_fd_
+  std::vector<uint8_t> spool_;
+  uint64_t node_count_ = 0;
+  HprofObject current_ = {};  // the class dump OnClassDump() gets
+
+  // 类名和字段名要等 class dump 解析时才知道用到哪些，先全部存下来
+  std::vector<char> string_data_;
+  std::unordered_map<uint64_t, StringRef> strings_;
+  std::unordered_map<uint64_t, uint64_t> class_names_;
+  std::vector<Root> roots_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_LEAK_PATH_FINDER_H
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#ifndef KOOM_LZ4_BLOCK_H
+#define KOOM_LZ4_BLOCK_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * Minimal single pass compressor producing the LZ4 block format, so blocks
+ * can also be inspected with stock lz4 tools. Greedy matching with one hash
+ * probe per position, it trades ratio for speed since it runs inside the
+ * dump writer.
+ */
+class Lz4Block {
+ public:
+  static size_t CompressBound(size_t size) { return size + size / 255 + 16; }
+
+  // Returns the compressed size, 0 if it does not fit in capacity.
+  static size_t Compress(const uint8_t *src, size_t size, uint8_t *dst,
+                         size_t capacity);
+
+  // dst_size must be the exact decompressed size, returns false on malformed
+  // input.
+  static bool Decompress(const uint8_t *src, size_t size, uint8_t *dst,
+                         size_t dst_size);
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_LZ4_BLOCK_H
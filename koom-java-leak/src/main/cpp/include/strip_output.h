@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#ifndef KOOM_STRIP_OUTPUT_H
+#define KOOM_STRIP_OUTPUT_H
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * Ordered list of the byte spans that survive stripping. Spans either borrow
+ * the buffer passed to the current HookWrite (no copy) or live in an owned
+ * buffer.
+ *
+ * While a heap dump record is open its length is unknown, so the spans from
+ * Hold() on are kept back by Drain() until Release(). Borrowed spans that are
+ * still held at the end of a write are copied, the caller's buffer may be
+ * reused afterwards.
+ */
+class StripOutput {
+ public:
+  StripOutput();
+
+  void Reset();
+
+  // Borrows data, only valid until the next Drain(). Called for nearly every
+  // heap sub record, so it is kept inline.
+  void Ref(const uint8_t *data, size_t size) {
+    if (size == 0) return;
+    position_ += size;
+    // hold_index_ is 0 when not held, spans before it must stay separate
+    if (spans_.size() > hold_index_) {
+      Span &last = spans_.back();
+      if (last.data != nullptr && last.data + last.size == data) {
+        last.size += size;
+        return;
+      }
+    }
+    spans_.push_back({data, 0, size});
+  }
+
+  void Copy(const uint8_t *data, size_t size);
+
+  // Logical offset of the next byte in the output stream
+  uint64_t Position() const { return position_; }
+
+  void Hold();
+  void Release();
+  bool IsHeld() const { return held_; }
+
+  // Big-endian store into held bytes added by Copy()
+  void PatchU4(uint64_t position, uint32_t value);
+  // Drops the held bytes from position on
+  void Truncate(uint64_t position);
+
+  // Bytes of the spans Drain() would hand out now
+  size_t DrainableSize() const;
+
+  /**
+   * Passes the spans that may be written now to fn(iovec *iov, size_t count)
+   * as one batch, fn may modify the iovecs. The spans are dropped afterwards,
+   * held spans stay and are copied if borrowed.
+   */
+  template <typename Fn>
+  void Drain(Fn fn) {
+    size_t limit = held_ ? hold_index_ : spans_.size();
+    batch_.clear();
+    for (size_t i = 0; i < limit; i++) {
+      batch_.push_back(
+          {const_cast<uint8_t *>(Data(spans_[i])), spans_[i].size});
+    }
+    if (!batch_.empty()) fn(batch_.data(), batch_.size());
+    Consume(limit);
+  }
+
+ private:
+  struct Span {
+    const uint8_t *data;  // nullptr for owned spans
+    size_t offset;        // into owned_
+    size_t size;
+  };
+
+  const uint8_t *Data(const Span &span) const {
+    return span.data != nullptr ? span.data : owned_.data() + span.offset;
+  }
+  void Consume(size_t count);
+
+  std::vector<Span> spans_;
+  std::vector<uint8_t> owned_;
+  std::vector<iovec> batch_;
+  uint64_t position_;
+  size_t hold_index_;
+  // Logical position of spans_[hold_index_]
+  uint64_t hold_position_;
+  bool held_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_STRIP_OUTPUT_H
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#ifndef KOOM_STRIP_POLICY_H
+#define KOOM_STRIP_POLICY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace kwai {
+namespace leak_monitor {
+
+enum StripAction : uint8_t {
+  // Keep the sub record
+  kStripKeep = 0,
+  // Remove the sub record, the segment length is reduced
+  kStripDrop = 1,
+  // Keep the header and remove the values, the segment length is left as is
+  // so the values can be refilled with zeros later
+  kStripBody = 2,
+  // Keep the first keep_bytes of the values, count and length are updated
+  kStripTruncate = 3,
+};
+
+/**
+ * Which heap dump sub records the stripper removes. Rules are compiled into a
+ * table indexed by heap and sub record slot, so classifying a sub record is
+ * two loads and a compare.
+ *
+ * The default policy is the historical behaviour: zygote and image heaps are
+ * dropped except roots and class dumps, primitive array values are removed
+ * from the other heaps.
+ */
+class StripPolicy {
+ public:
+  enum Heap : uint8_t {
+    kHeapDefault = 0,  // before any HEAP_DUMP_INFO and unknown heaps
+    kHeapApp,
+    kHeapZygote,
+    kHeapImage,
+    kHeapCount,
+  };
+
+  enum Slot : uint8_t {
+    kSlotOther = 0,  // unknown and obsolete tags, always kept
+    kSlotHeapInfo,
+    kSlotRoot,
+    kSlotClass,
+    kSlotInstance,
+    kSlotObjectArray,
+    // + HprofBasicType of the elements
+    kSlotPrimitiveArray,
+    kSlotCount = kSlotPrimitiveArray + 12,
+  };
+
+  enum ClassVerdict : uint8_t {
+    kClassNone = 0,
+    kClassAllow,  // instances and arrays of the class are always kept
+    kClassDeny,   // instances and arrays of the class are always dropped
+  };
+
+  struct Rule {
+    StripAction action;
+    uint32_t keep_bytes;  // kStripTruncate only
+    uint64_t min_size;    // the action applies to values of at least this size
+  };
+
+  StripPolicy();
+
+  // Every sub record and record is kept
+  void Clear();
+  void SetRule(uint32_t heap_mask, uint8_t slot, const Rule &rule);
+  void SetRecordDropped(uint8_t tag, bool dropped);
+  void AddClass(const std::string &name, ClassVerdict verdict);
+
+  static Heap HeapOf(uint8_t heap_type);
+  uint8_t SlotOf(uint8_t sub_tag) const { return slot_of_tag_[sub_tag]; }
+
+  const Rule &GetRule(uint8_t heap, uint8_t slot) const {
+    return rules_[heap][slot];
+  }
+  bool IsRecordDropped(uint8_t tag) const { return dropped_records_[tag]; }
+
+  bool HasClasses() const { return !classes_.empty(); }
+  size_t MaxClassNameLength() const { return max_class_name_length_; }
+  ClassVerdict FindClass(const std::string &name) const;
+
+ private:
+  void InitSlots();
+
+  uint8_t slot_of_tag_[256];
+  Rule rules_[kHeapCount][kSlotCount];
+  bool dropped_records_[256];
+  std::unordered_map<std::string, ClassVerdict> classes_;
+  size_t max_class_name_length_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_STRIP_POLICY_H
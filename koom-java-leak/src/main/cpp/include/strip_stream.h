@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#ifndef KOOM_STRIP_STREAM_H
+#define KOOM_STRIP_STREAM_H
+
+#include <android-base/macros.h>
+#include <hprof_strip_engine.h>
+#include <hprof_stream.h>
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * Feeds a dump streamed from the forked child (koom-fast-dump's
+ * HprofDump::ForkDumpToStream) through an HprofStripEngine, so the stripped
+ * hprof is written by the parent in the same pass and no hook is involved.
+ * The dump is only successful if the stream reached HEAP_DUMP_END. This runs
+ * in the app, leak path classes, fingerprints, the delta base and snapshot
+ * mode are cleared for every dump, stream dumps are always written as the
+ * full stripped hprof.
+ */
+class StripStreamProcessor {
+ public:
+  explicit StripStreamProcessor(HprofStripEngine &engine);
+
+  const HprofStreamProcessor *Get() const { return &processor_; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(StripStreamProcessor);
+
+  static bool Begin(void *arg, const char *path);
+  static bool Write(void *arg, const uint8_t *data, size_t size);
+  static bool End(void *arg, bool complete);
+
+  HprofStripEngine &engine_;
+  int fd_;
+  HprofStreamProcessor processor_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_STRIP_STREAM_H
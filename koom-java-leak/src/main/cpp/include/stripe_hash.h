@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#ifndef KOOM_STRIPE_HASH_H
+#define KOOM_STRIPE_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kwai {
+namespace leak_monitor {
+
+/**
+ * Streaming 64 bit hash of array payloads. Input is consumed in 32 byte
+ * stripes by 8 independent 32 bit lanes (xxHash32 rounds), which map onto two
+ * NEON/SSE4.1 registers. At the end all 8 lanes are merged into every bit of
+ * the result like xxHash64 does, so a change anywhere is covered by all 64
+ * bits. Not a cryptographic hash, only meant to find identical payloads.
+ */
+class StripeHash {
+ public:
+  static constexpr size_t kStripeSize = 32;
+
+  StripeHash() { Reset(); }
+
+  void Reset();
+  void Update(const uint8_t *data, size_t size);
+  uint64_t Final() const;
+
+  // Runs stripes stripes of data through the 16 byte aligned lanes, with
+  // NEON or SSE4.1 where compiled in. Exposed for testing.
+  static void Stripes(uint32_t *lanes, const uint8_t *data, size_t stripes);
+  // Portable version of the stripe loop, used when SIMD is unavailable
+  static void ScalarStripes(uint32_t *lanes, const uint8_t *data,
+                            size_t stripes);
+
+ private:
+
+  alignas(16) uint32_t lanes_[8];
+  uint8_t tail_[kStripeSize];
+  size_t tail_size_;
+  uint64_t total_size_;
+};
+
+}  // namespace leak_monitor
+}  // namespace kwai
+
+#endif  // KOOM_STRIPE_HASH_H
@@ -0,0 +1,790 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <android-base/macros.h>
+#include <android/log.h>
+#include <fcntl.h>
+#include <leak_path_finder.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#define LOG_TAG "LeakPathFinder"
+
+namespace kwai {
+namespace leak_monitor {
+
+// The spool is written in chunks of this size
+static constexpr size_t kSpoolChunkSize = 1u << 20u;
+// Longer super class chains are taken as cycles
+static constexpr size_t kMaxClassDepth = 256;
+// 节点下标是 32 位，最大的两个值留作标记
+static constexpr uint32_t kNoNode = UINT32_MAX;
+static constexpr uint32_t kRootParent = UINT32_MAX - 1;
+static constexpr uint64_t kMaxNodes = UINT32_MAX - 1;
+
+enum NodeKind : uint8_t {
+  kNodeInstance,
+  kNodeObjectArray,
+  kNodeClass,
+};
+
+enum ReferenceKind : uint8_t {
+  kReferenceField,
+  kReferenceStatic,
+  kReferenceElement,
+};
+
+// Spooled in host order in front of the body of every node
+struct SpoolHeader {
+  uint64_t id;
+  uint64_t class_id;  // of instances and object arrays
+  uint32_t size;      // bytes that follow
+  uint8_t kind;       // NodeKind
+  uint8_t heap;
+  uint16_t reserved;
+};
+static_assert(sizeof(SpoolHeader) == 24, "spooled as is");
+
+struct Node {
+  uint64_t id;
+  uint64_t offset;  // of its SpoolHeader in the graph file
+};
+
+static bool FullyWrite(int fd, const void *data, size_t size) {
+  auto *p = static_cast<const uint8_t *>(data);
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "write failed %d",
+                          errno);
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static uint64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static size_t Align(size_t size, size_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+// hprof 里的 id 是大端
+static inline uint64_t ReadId(const uint8_t *data, uint32_t id_size) {
+  uint64_t id = 0;
+  for (uint32_t i = 0; i < id_size; i++) id = id << 8u | data[i];
+  return id;
+}
+
+static inline uint16_t ReadU2(const uint8_t *data) {
+  return (uint16_t)(data[0] << 8u | data[1]);
+}
+
+static size_t TypeSize(uint8_t type, uint32_t id_size) {
+  switch (type) {
+    case hprof_basic_object:
+      return id_size;
+    case hprof_basic_boolean:
+    case hprof_basic_byte:
+      return 1;
+    case hprof_basic_char:
+    case hprof_basic_short:
+      return 2;
+    case hprof_basic_float:
+    case hprof_basic_int:
+      return 4;
+    case hprof_basic_double:
+    case hprof_basic_long:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+static const char *RootName(uint8_t tag) {
+  switch (tag) {
+    case HPROF_ROOT_JNI_GLOBAL:
+      return "jni global";
+    case HPROF_ROOT_JNI_LOCAL:
+      return "jni local";
+    case HPROF_ROOT_JAVA_FRAME:
+      return "java frame";
+    case HPROF_ROOT_NATIVE_STACK:
+      return "native stack";
+    case HPROF_ROOT_STICKY_CLASS:
+      return "sticky class";
+    case HPROF_ROOT_THREAD_BLOCK:
+      return "thread block";
+    case HPROF_ROOT_MONITOR_USED:
+      return "monitor used";
+    case HPROF_ROOT_THREAD_OBJECT:
+      return "thread object";
+    case HPROF_ROOT_INTERNED_STRING:
+      return "interned string";
+    case HPROF_ROOT_DEBUGGER:
+      return "debugger";
+    case HPROF_ROOT_VM_INTERNAL:
+      return "vm internal";
+    case HPROF_ROOT_JNI_MONITOR:
+      return "jni monitor";
+    default:
+      return "unknown";
+  }
+}
+
+/**
+ * The reference graph of one dump, built in the graph file after the spooled
+ * nodes:
+ *
+ *   Node nodes[count]        sorted by id, the index is the node
+ *   u32 starts[count + 1]    CSR offsets into edges
+ *   u32 parents[count]       of the search, kRootParent for roots
+ *   u32 queue[count]         of the search
+ *   u32 edges[]              page aligned, mapped once their count is known
+ */
+class LeakPathFinder::Graph {
+ public:
+  Graph(const LeakPathFinder &finder, uint32_t id_size)
+      : finder_(finder), id_size_(id_size) {}
+  ~Graph();
+
+  bool Build();
+  void Search();
+  std::string Report() const;
+
+  size_t NodeCount() const { return count_; }
+  size_t EdgeCount() const { return edge_count_; }
+  size_t SuspectCount() const { return suspect_count_; }
+  size_t ReachedCount() const { return reached_count_; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(Graph);
+
+  struct Field {
+    uint64_t name_id;
+    uint8_t type;
+  };
+  struct Reference {
+    uint32_t offset;  // in the instance body
+    uint64_t name_id;
+  };
+  struct Static {
+    uint64_t name_id;
+    uint64_t value;
+  };
+  struct ClassInfo {
+    uint64_t super_id = 0;
+    std::vector<Field> fields;    // declared instance fields
+    std::vector<Static> statics;  // object static fields
+    // Resolved over the super class chain
+    bool valid = false;
+    uint32_t instance_size = 0;
+    std::vector<Reference> references;
+    int32_t suspect = -1;
+    int64_t condition = -1;  // offset of the boolean field
+  };
+
+  bool ParseClass(const SpoolHeader &header, const uint8_t *data);
+  void ResolveClasses();
+  void ResolveClass(uint64_t class_id, ClassInfo *info) const;
+  uint32_t Find(uint64_t id) const;
+  SpoolHeader HeaderOf(uint32_t node) const;
+  const uint8_t *BodyOf(uint32_t node) const;
+  bool IsSuspect(uint32_t node);
+  std::string Describe(uint32_t node) const;
+  // Calls visit(id, ReferenceKind, name id or index) for every non null
+  // reference of node, in body order
+  template <typename Visit>
+  void ForEachReference(uint32_t node, Visit visit) const;
+
+  const LeakPathFinder &finder_;
+  const uint32_t id_size_;
+
+  uint8_t *map_ = nullptr;
+  size_t map_size_ = 0;
+  uint32_t *edges_ = nullptr;
+  size_t edges_size_ = 0;
+
+  size_t count_ = 0;
+  size_t edge_count_ = 0;
+  Node *nodes_ = nullptr;
+  uint32_t *starts_ = nullptr;
+  uint32_t *parents_ = nullptr;
+  uint32_t *queue_ = nullptr;
+
+  std::unordered_map<uint64_t, ClassInfo> classes_;
+  std::unordered_map<uint64_t, int32_t> suspect_classes_;
+  uint64_t reference_class_id_ = 0;
+  uint64_t size_mismatches_ = 0;
+
+  std::vector<bool> suspect_nodes_;
+  size_t suspect_count_ = 0;
+  size_t reached_count_ = 0;
+  std::vector<uint32_t> found_;
+};
+
+LeakPathFinder::Graph::~Graph() {
+  if (edges_ != nullptr) munmap(edges_, edges_size_);
+  if (map_ != nullptr) munmap(map_, map_size_);
+}
+
+bool LeakPathFinder::Graph::Build() {
+  const int fd = finder_.graph_fd_;
+  const uint64_t spooled = finder_.spooled_;
+  count_ = finder_.node_count_;
+  if (count_ > kMaxNodes) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "%zu nodes, too many",
+                        count_);
+    return false;
+  }
+  const size_t nodes_offset = Align(spooled, 8);
+  map_size_ = nodes_offset + count_ * sizeof(Node) + (count_ + 1) * 4 +
+              count_ * 4 * 2;
+  if (ftruncate(fd, map_size_) != 0) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "ftruncate failed %d",
+                        errno);
+    return false;
+  }
+  void *map = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+  if (map == MAP_FAILED) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "mmap failed %d", errno);
+    return false;
+  }
+  map_ = static_cast<uint8_t *>(map);
+  nodes_ = reinterpret_cast<Node *>(map_ + nodes_offset);
+  starts_ = reinterpret_cast<uint32_t *>(nodes_ + count_);
+  parents_ = starts_ + count_ + 1;
+  queue_ = parents_ + count_;
+
+  // 顺序读一遍 spool 建节点表，顺便解析 class dump
+  size_t index = 0;
+  for (uint64_t offset = 0; offset < spooled;) {
+    SpoolHeader header;
+    if (spooled - offset < sizeof(header)) return false;
+    memcpy(&header, map_ + offset, sizeof(header));
+    if (spooled - offset - sizeof(header) < header.size || index == count_) {
+      return false;
+    }
+    nodes_[index++] = {header.id, offset};
+    if (header.kind == kNodeClass &&
+        !ParseClass(header, map_ + offset + sizeof(header))) {
+      __android_log_print(ANDROID_LOG_WARN, LOG_TAG,
+                          "bad class dump 0x%" PRIx64, header.id);
+    }
+    offset += sizeof(header) + header.size;
+  }
+  if (index != count_) return false;
+  // ART 按地址顺序写对象，通常已经有序
+  auto by_id = [](const Node &a, const Node &b) { return a.id < b.id; };
+  if (!std::is_sorted(nodes_, nodes_ + count_, by_id)) {
+    std::sort(nodes_, nodes_ + count_, by_id);
+  }
+  ResolveClasses();
+
+  // 先数引用的上限，映射好 edges 再填，找不到的 id（比如基本类型数组）不算边
+  uint64_t candidates = 0;
+  for (uint32_t node = 0; node < count_; node++) {
+    ForEachReference(node, [&candidates](uint64_t, uint8_t, uint64_t) {
+      candidates++;
+    });
+  }
+  if (candidates > UINT32_MAX) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG,
+                        "%" PRIu64 " references, too many", candidates);
+    return false;
+  }
+  if (candidates > 0) {
+    const size_t edges_offset = Align(map_size_, sysconf(_SC_PAGESIZE));
+    edges_size_ = candidates * 4;
+    if (ftruncate(fd, edges_offset + edges_size_) != 0) {
+      __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "ftruncate failed %d",
+                          errno);
+      return false;
+    }
+    map = mmap(nullptr, edges_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+               edges_offset);
+    if (map == MAP_FAILED) {
+      __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "mmap failed %d",
+                          errno);
+      return false;
+    }
+    edges_ = static_cast<uint32_t *>(map);
+  }
+
+  suspect_nodes_.assign(count_, false);
+  uint32_t cursor = 0;
+  for (uint32_t node = 0; node < count_; node++) {
+    starts_[node] = cursor;
+    ForEachReference(node, [this, &cursor](uint64_t id, uint8_t, uint64_t) {
+      const uint32_t target = Find(id);
+      if (target != kNoNode) edges_[cursor++] = target;
+    });
+    if (IsSuspect(node)) {
+      suspect_nodes_[node] = true;
+      suspect_count_++;
+    }
+  }
+  starts_[count_] = cursor;
+  edge_count_ = cursor;
+  if (size_mismatches_ > 0) {
+    __android_log_print(ANDROID_LOG_WARN, LOG_TAG,
+                        "%" PRIu64 " instances do not match their class",
+                        size_mismatches_);
+  }
+  return true;
+}
+
+bool LeakPathFinder::Graph::ParseClass(const SpoolHeader &header,
+                                       const uint8_t *data) {
+  const size_t id = id_size_;
+  const size_t size = header.size;
+  ClassInfo &info = classes_[header.id];
+  size_t p = 1 + id + 4;
+  if (size < p + id * 6 + 4 + 2) return false;
+  info.super_id = ReadId(data + p, id_size_);
+  p += id * 6 + 4;
+  uint16_t count = ReadU2(data + p);
+  p += 2;
+  for (uint16_t i = 0; i < count; i++) {
+    if (size < p + 3) return false;
+    p += 3 + TypeSize(data[p + 2], id_size_);
+  }
+  if (size < p + 2) return false;
+  count = ReadU2(data + p);
+  p += 2;
+  for (uint16_t i = 0; i < count; i++) {
+    if (size < p + id + 1) return false;
+    const uint8_t type = data[p + id];
+    const size_t value_size = TypeSize(type, id_size_);
+    if (value_size == 0 || size < p + id + 1 + value_size) return false;
+    if (type == hprof_basic_object) {
+      const uint64_t value = ReadId(data + p + id + 1, id_size_);
+      if (value != 0) {
+        info.statics.push_back({ReadId(data + p, id_size_), value});
+      }
+    }
+    p += id + 1 + value_size;
+  }
+  if (size < p + 2) return false;
+  count = ReadU2(data + p);
+  p += 2;
+  if (size < p + count * (id + 1)) return false;
+  info.fields.reserve(count);
+  for (uint16_t i = 0; i < count; i++, p += id + 1) {
+    info.fields.push_back({ReadId(data + p, id_size_), data[p + id]});
+  }
+  return true;
+}
+
+void LeakPathFinder::Graph::ResolveClasses() {
+  for (auto &it : finder_.class_names_) {
+    const std::string name = finder_.String(it.second);
+    if (name == "java.lang.ref.Reference") reference_class_id_ = it.first;
+    for (size_t i = 0; i < finder_.suspects_.size(); i++) {
+      if (finder_.suspects_[i].class_name == name) {
+        suspect_classes_[it.first] = (int32_t)i;
+      }
+    }
+  }
+  for (auto &it : classes_) ResolveClass(it.first, &it.second);
+}
+
+void LeakPathFinder::Graph::ResolveClass(uint64_t class_id,
+                                         ClassInfo *info) const {
+  // 实例的字段值先是自己声明的，再是父类的
+  uint32_t offset = 0;
+  uint64_t current = class_id;
+  for (size_t depth = 0; current != 0; depth++) {
+    auto it = classes_.find(current);
+    if (depth == kMaxClassDepth || it == classes_.end()) return;
+    const ClassInfo &declaring = it->second;
+    const Suspect *suspect = nullptr;
+    if (info->suspect < 0) {
+      auto found = suspect_classes_.find(current);
+      if (found != suspect_classes_.end()) {
+        info->suspect = found->second;
+        suspect = &finder_.suspects_[found->second];
+      }
+    }
+    for (const Field &field : declaring.fields) {
+      const size_t size = TypeSize(field.type, id_size_);
+      if (size == 0) return;
+      if (field.type == hprof_basic_object &&
+          (current != reference_class_id_ ||
+           finder_.String(field.name_id) != "referent")) {
+        info->references.push_back({offset, field.name_id});
+      } else if (suspect != nullptr && field.type == hprof_basic_boolean &&
+                 finder_.String(field.name_id) == suspect->field_name) {
+        info->condition = offset;
+      }
+      offset += size;
+    }
+    // 配了字段却没找到，这个类的实例都不算
+    if (suspect != nullptr && !suspect->field_name.empty() &&
+        info->condition < 0) {
+      info->suspect = -1;
+    }
+    current = declaring.super_id;
+  }
+  info->instance_size = offset;
+  info->valid = true;
+}
+
+uint32_t LeakPathFinder::Graph::Find(uint64_t id) const {
+  const Node *it = std::lower_bound(
+      nodes_, nodes_ + count_, id,
+      [](const Node &node, uint64_t value) { return node.id < value; });
+  return it != nodes_ + count_ && it->id == id ? (uint32_t)(it - nodes_)
+                                               : kNoNode;
+}
+
+SpoolHeader LeakPathFinder::Graph::HeaderOf(uint32_t node) const {
+  SpoolHeader header;
+  memcpy(&header, map_ + nodes_[node].offset, sizeof(header));
+  return header;
+}
+
+const uint8_t *LeakPathFinder::Graph::BodyOf(uint32_t node) const {
+  return map_ + nodes_[node].offset + sizeof(SpoolHeader);
+}
+
+template <typename Visit>
+void LeakPathFinder::Graph::ForEachReference(uint32_t node,
+                                             Visit visit) const {
+  const SpoolHeader header = HeaderOf(node);
+  const uint8_t *body = BodyOf(node);
+  switch (header.kind) {
+    case kNodeInstance: {
+      auto it = classes_.find(header.class_id);
+      if (it == classes_.end() || !it->second.valid) return;
+      const ClassInfo &info = it->second;
+      if (info.instance_size != header.size) return;
+      for (const Reference &reference : info.references) {
+        const uint64_t id = ReadId(body + reference.offset, id_size_);
+        if (id != 0) visit(id, kReferenceField, reference.name_id);
+      }
+    } break;
+
+    case kNodeObjectArray: {
+      const uint32_t length = header.size / id_size_;
+      for (uint32_t i = 0; i < length; i++) {
+        const uint64_t id = ReadId(body + (size_t)i * id_size_, id_size_);
+        if (id != 0) visit(id, kReferenceElement, i);
+      }
+    } break;
+
+    case kNodeClass: {
+      auto it = classes_.find(header.id);
+      if (it == classes_.end()) return;
+      for (const Static &field : it->second.statics) {
+        visit(field.value, kReferenceStatic, field.name_id);
+      }
+    } break;
+
+    default:
+      break;
+  }
+}
+
+bool LeakPathFinder::Graph::IsSuspect(uint32_t node) {
+  const SpoolHeader header = HeaderOf(node);
+  if (header.kind != kNodeInstance ||
+      (finder_.heap_mask_ & (1u << header.heap)) == 0) {
+    return false;
+  }
+  auto it = classes_.find(header.class_id);
+  if (it == classes_.end() || it->second.suspect < 0) return false;
+  const ClassInfo &info = it->second;
+  if (info.instance_size != header.size) {
+    size_mismatches_++;
+    return false;
+  }
+  return info.condition < 0 || BodyOf(node)[info.condition] != 0;
+}
+
+void LeakPathFinder::Graph::Search() {
+  // 所有 root 同时出发做 BFS，第一次到达某个对象的路径就是最短的之一
+  memset(parents_, 0xff, count_ * sizeof(*parents_));
+  size_t head = 0;
+  size_t tail = 0;
+  for (const Root &root : finder_.roots_) {
+    const uint32_t node = Find(root.id);
+    if (node == kNoNode || parents_[node] != kNoNode) continue;
+    parents_[node] = kRootParent;
+    queue_[tail++] = node;
+  }
+  while (head < tail && reached_count_ < suspect_count_) {
+    const uint32_t node = queue_[head++];
+    if (suspect_nodes_[node]) {
+      reached_count_++;
+      if (found_.size() < kMaxPaths) found_.push_back(node);
+    }
+    for (uint32_t edge = starts_[node]; edge < starts_[node + 1]; edge++) {
+      const uint32_t target = edges_[edge];
+      if (parents_[target] != kNoNode) continue;
+      parents_[target] = node;
+      queue_[tail++] = target;
+    }
+  }
+}
+
+std::string LeakPathFinder::Graph::Describe(uint32_t node) const {
+  const SpoolHeader header = HeaderOf(node);
+  char id[32];
+  snprintf(id, sizeof(id), "\t0x%" PRIx64 "\n", header.id);
+  if (header.kind == kNodeClass) {
+    return "class " + finder_.ClassName(header.id) + id;
+  }
+  return finder_.ClassName(header.class_id) + id;
+}
+
+std::string LeakPathFinder::Graph::Report() const {
+  std::string report = "# koom leak paths 1\n";
+  char line[128];
+  snprintf(line, sizeof(line), "total\t%zu\t%zu\t%zu\t%zu\n", suspect_count_,
+           reached_count_, count_, edge_count_);
+  report += line;
+  std::vector<uint32_t> path;
+  for (uint32_t suspect : found_) {
+    path.clear();
+    for (uint32_t node = suspect; node != kRootParent && path.size() <= count_;
+         node = parents_[node]) {
+      path.push_back(node);
+    }
+    std::reverse(path.begin(), path.end());
+    snprintf(line, sizeof(line), "path\t%zu\t", path.size() - 1);
+    report += line;
+    report += Describe(suspect);
+
+    const uint64_t root_id = nodes_[path[0]].id;
+    uint8_t root_tag = HPROF_ROOT_UNKNOWN;
+    for (const Root &root : finder_.roots_) {
+      if (root.id == root_id) {
+        root_tag = root.tag;
+        break;
+      }
+    }
+    report += "\troot\t";
+    report += RootName(root_tag);
+    report += '\t';
+    report += Describe(path[0]);
+
+    for (size_t i = 1; i < path.size(); i++) {
+      // 引用的字段不存在图里，从父节点的 body 再找一遍
+      const uint64_t target = nodes_[path[i]].id;
+      std::string how;
+      ForEachReference(path[i - 1], [this, target, &how](
+                                        uint64_t id, uint8_t kind,
+                                        uint64_t name) {
+        if (id != target || !how.empty()) return;
+        switch (kind) {
+          case kReferenceField:
+            how = "field\t" + finder_.String(name);
+            break;
+          case kReferenceStatic:
+            how = "static\t" + finder_.String(name);
+            break;
+          default:
+            how = "element\t" + std::to_string(name);
+            break;
+        }
+      });
+      report += '\t';
+      report += how;
+      report += '\t';
+      report += Describe(path[i]);
+    }
+  }
+  return report;
+}
+
+LeakPathFinder::~LeakPathFinder() { Reset({}, std::string()); }
+
+void LeakPathFinder::Reset(const std::vector<std::string> &suspects,
+                           const std::string &graph_path,
+                           uint32_t heap_mask) {
+  if (graph_fd_ >= 0) close(graph_fd_);
+  graph_fd_ = -1;
+  failed_ = false;
+  spooled_ = 0;
+  std::vector<uint8_t>().swap(spool_);
+  node_count_ = 0;
+  current_ = {};
+  std::vector<char>().swap(string_data_);
+  strings_.clear();
+  class_names_.clear();
+  std::vector<Root>().swap(roots_);
+  heap_mask_ = heap_mask;
+  suspects_.clear();
+  for (const std::string &suspect : suspects) {
+    const size_t separator = suspect.find('#');
+    if (separator == 0 || suspect.empty()) continue;
+    if (separator == std::string::npos) {
+      suspects_.push_back({suspect, std::string()});
+    } else {
+      suspects_.push_back(
+          {suspect.substr(0, separator), suspect.substr(separator + 1)});
+    }
+  }
+  if (suspects_.empty() || graph_path.empty()) return;
+  graph_fd_ = open(graph_path.c_str(), O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC,
+                   0600);
+  if (graph_fd_ < 0) {
+    __android_log_print(ANDROID_LOG_WARN, LOG_TAG, "open %s failed %d",
+                        graph_path.c_str(), errno);
+    return;
+  }
+  // 图只有本进程用，打开后马上删掉，dump 进程被杀也不会留下文件
+  unlink(graph_path.c_str());
+}
+
+void LeakPathFinder::OnString(uint64_t id, const uint8_t *utf8, size_t size,
+                              bool kept ATTRIBUTE_UNUSED,
+                              uint64_t position ATTRIBUTE_UNUSED) {
+  if (graph_fd_ < 0) return;
+  strings_[id] = {(uint32_t)string_data_.size(), (uint32_t)size};
+  string_data_.insert(string_data_.end(), utf8, utf8 + size);
+}
+
+void LeakPathFinder::OnLoadClass(uint64_t class_id, uint64_t name_id) {
+  if (graph_fd_ < 0) return;
+  class_names_[class_id] = name_id;
+}
+
+void LeakPathFinder::OnRoot(uint8_t tag, uint64_t id) {
+  if (graph_fd_ < 0) return;
+  roots_.push_back({id, tag});
+}
+
+bool LeakPathFinder::OnObject(const HprofObject &object,
+                              bool kept ATTRIBUTE_UNUSED,
+                              uint64_t position ATTRIBUTE_UNUSED) {
+  if (graph_fd_ < 0 || failed_ || object.size > UINT32_MAX) return false;
+  uint8_t kind;
+  switch (object.tag) {
+    case HPROF_INSTANCE_DUMP:
+      kind = kNodeInstance;
+      break;
+    case HPROF_OBJECT_ARRAY_DUMP:
+      kind = kNodeObjectArray;
+      break;
+    case HPROF_CLASS_DUMP:
+      // 整条 class dump 在 OnClassDump() 里才拿到
+      current_ = object;
+      return true;
+    default:
+      // 基本类型数组不引用别的对象，不进图
+      return false;
+  }
+  SpoolHeader header = {object.id, object.class_id, (uint32_t)object.size,
+                        kind, object.heap, 0};
+  Spool(&header, sizeof(header));
+  node_count_++;
+  return true;
+}
+
+void LeakPathFinder::OnObjectBody(const uint8_t *data, size_t size) {
+  Spool(data, size);
+}
+
+void LeakPathFinder::OnClassDump(const uint8_t *data, size_t size) {
+  SpoolHeader header = {current_.id, 0, (uint32_t)size, kNodeClass,
+                        current_.heap, 0};
+  Spool(&header, sizeof(header));
+  Spool(data, size);
+  node_count_++;
+}
+
+void LeakPathFinder::Spool(const void *data, size_t size) {
+  if (failed_) return;
+  auto *bytes = static_cast<const uint8_t *>(data);
+  spool_.insert(spool_.end(), bytes, bytes + size);
+  if (spool_.size() >= kSpoolChunkSize) FlushSpool();
+}
+
+bool LeakPathFinder::FlushSpool() {
+  if (failed_) return false;
+  if (spool_.empty()) return true;
+  // 内存有上限，写不下去就放弃，不退回内存
+  if (!FullyWrite(graph_fd_, spool_.data(), spool_.size())) {
+    failed_ = true;
+    std::vector<uint8_t>().swap(spool_);
+    return false;
+  }
+  spooled_ += spool_.size();
+  spool_.clear();
+  return true;
+}
+
+std::string LeakPathFinder::String(uint64_t id) const {
+  auto it = strings_.find(id);
+  if (it == strings_.end()) return std::string();
+  return std::string(string_data_.data() + it->second.offset,
+                     it->second.size);
+}
+
+std::string LeakPathFinder::ClassName(uint64_t class_id) const {
+  auto name = class_names_.find(class_id);
+  if (name != class_names_.end() && strings_.count(name->second) > 0) {
+    return String(name->second);
+  }
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "0x%" PRIx64, class_id);
+  return buffer;
+}
+
+std::string LeakPathFinder::Summary(uint32_t id_size) {
+  if (graph_fd_ < 0 || !FlushSpool()) return std::string();
+  const uint64_t start = NowNs();
+  std::vector<uint8_t>().swap(spool_);
+  Graph graph(*this, id_size);
+  if (!graph.Build()) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "graph not built");
+    return std::string();
+  }
+  const uint64_t built = NowNs();
+  graph.Search();
+  std::string report = graph.Report();
+  __android_log_print(
+      ANDROID_LOG_INFO, LOG_TAG,
+      "%zu objects, %zu references, %zu of %zu suspects reachable, "
+      "build %" PRIu64 " ms, search %" PRIu64 " ms",
+      graph.NodeCount(), graph.EdgeCount(), graph.ReachedCount(),
+      graph.SuspectCount(), (built - start) / 1000000,
+      (NowNs() - built) / 1000000);
+  return report;
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <lz4_block.h>
+
+#include <cstring>
+
+namespace kwai {
+namespace leak_monitor {
+
+static constexpr int kHashLog = 14;
+static constexpr size_t kMinMatch = 4;
+// The last match must start at least 12 bytes before the end of the block
+// and the last 5 bytes are always literals.
+static constexpr size_t kMatchFindLimit = 12;
+static constexpr size_t kLastLiterals = 5;
+static constexpr size_t kMaxOffset = 65535;
+
+static inline uint32_t Read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t Read64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t Hash(uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - kHashLog);
+}
+
+static inline size_t MatchLength(const uint8_t *p, const uint8_t *ref,
+                                 const uint8_t *limit) {
+  const uint8_t *start = p;
+  while (p + 8 <= limit) {
+    uint64_t diff = Read64(p) ^ Read64(ref);
+    if (diff != 0) return p - start + (__builtin_ctzll(diff) >> 3);
+    p += 8;
+    ref += 8;
+  }
+  while (p < limit && *p == *ref) {
+    p++;
+    ref++;
+  }
+  return p - start;
+}
+
+static inline uint8_t *PutLength(uint8_t *op, size_t length) {
+  while (length >= 255) {
+    *op++ = 255;
+    length -= 255;
+  }
+  *op++ = (uint8_t)length;
+  return op;
+}
+
+size_t Lz4Block::Compress(const uint8_t *src, size_t size, uint8_t *dst,
+                          size_t capacity) {
+  uint32_t table[1u << kHashLog];
+  memset(table, 0, sizeof(table));
+
+  const uint8_t *ip = src;
+  const uint8_t *anchor = src;
+  const uint8_t *const end = src + size;
+  uint8_t *op = dst;
+  uint8_t *const op_end = dst + capacity;
+
+  if (size >= kMatchFindLimit + 1) {
+    const uint8_t *const match_start_limit = end - kMatchFindLimit;
+    const uint8_t *const match_end_limit = end - kLastLiterals;
+    while (ip < match_start_limit) {
+      uint32_t sequence = Read32(ip);
+      uint32_t h = Hash(sequence);
+      const uint8_t *ref = src + table[h];
+      table[h] = (uint32_t)(ip - src);
+      if (ref >= ip || (size_t)(ip - ref) > kMaxOffset ||
+          Read32(ref) != sequence) {
+        // 长时间找不到匹配时加大步长，不可压缩的数据能快速跳过
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+
+      // 向前延伸匹配，把命中前的字面量并进来
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+      size_t literals = ip - anchor;
+      size_t match =
+          kMinMatch + MatchLength(ip + kMinMatch, ref + kMinMatch,
+                                  match_end_limit);
+      // token, literal length, literals, offset, match length
+      if (op + 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1 >
+          op_end) {
+        return 0;
+      }
+      uint8_t *token = op++;
+      if (literals >= 15) {
+        *token = 15u << 4u;
+        op = PutLength(op, literals - 15);
+      } else {
+        *token = (uint8_t)(literals << 4u);
+      }
+      memcpy(op, anchor, literals);
+      op += literals;
+      uint16_t offset = (uint16_t)(ip - ref);
+      *op++ = (uint8_t)offset;
+      *op++ = (uint8_t)(offset >> 8u);
+      size_t match_code = match - kMinMatch;
+      if (match_code >= 15) {
+        *token |= 15u;
+        op = PutLength(op, match_code - 15);
+      } else {
+        *token |= (uint8_t)match_code;
+      }
+      ip += match;
+      anchor = ip;
+      if (ip < match_start_limit) {
+        table[Hash(Read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+      }
+    }
+  }
+
+  size_t literals = end - anchor;
+  if (op + 1 + literals + literals / 255 + 1 > op_end) return 0;
+  if (literals >= 15) {
+    *op++ = 15u << 4u;
+    op = PutLength(op, literals - 15);
+  } else {
+    *op++ = (uint8_t)(literals << 4u);
+  }
+  memcpy(op, anchor, literals);
+  op += literals;
+  return op - dst;
+}
+
+static inline bool GetLength(const uint8_t *&ip, const uint8_t *end,
+                             size_t *length) {
+  uint8_t b;
+  do {
+    if (ip >= end) return false;
+    b = *ip++;
+    *length += b;
+  } while (b == 255);
+  return true;
+}
+
+bool Lz4Block::Decompress(const uint8_t *src, size_t size, uint8_t *dst,
+                          size_t dst_size) {
+  const uint8_t *ip = src;
+  const uint8_t *const end = src + size;
+  uint8_t *op = dst;
+  uint8_t *const op_end = dst + dst_size;
+  while (ip < end) {
+    const uint8_t token = *ip++;
+    size_t literals = token >> 4u;
+    if (literals == 15 && !GetLength(ip, end, &literals)) return false;
+    if (literals > (size_t)(end - ip) || literals > (size_t)(op_end - op)) {
+      return false;
+    }
+    memcpy(op, ip, literals);
+    ip += literals;
+    op += literals;
+    if (ip == end) break;  // the last sequence has no match
+
+    if (end - ip < 2) return false;
+    size_t offset = ip[0] | ((size_t)ip[1] << 8u);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - dst)) return false;
+    size_t match = token & 15u;
+    if (match == 15 && !GetLength(ip, end, &match)) return false;
+    match += kMinMatch;
+    if (match > (size_t)(op_end - op)) return false;
+    const uint8_t *ref = op - offset;
+    if (offset >= match) {
+      memcpy(op, ref, match);
+    } else {
+      // 与自身重叠（比如连续的 0），逐字节拷贝
+      for (size_t i = 0; i < match; i++) op[i] = ref[i];
+    }
+    op += match;
+  }
+  return op == op_end;
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
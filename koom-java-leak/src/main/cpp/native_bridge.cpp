@@ -29,6 +29,7 @@
 #include <wait.h>
 
 #include <string>
+#include <vector>
 
 #undef LOG_TAG
 #define LOG_TAG "JNIBridge"
@@ -55,6 +56,136 @@ Java_com_kwai_koom_javaoom_hprof_ForkStripHeapDumper_hprofName(
   env->ReleaseStringUTFChars(name, hprofName);
 }
 
+JNIEXPORT void JNICALL
+Java_com_kwai_koom_javaoom_hprof_ForkStripHeapDumper_hprofCompression(
+    JNIEnv *env ATTRIBUTE_UNUSED, jobject jobject ATTRIBUTE_UNUSED,
+    jint codec) {
+  HprofStrip::GetInstance().SetCompression(codec);
+}
+
+JNIEXPORT void JNICALL
+Java_com_kwai_koom_javaoom_hprof_ForkStripHeapDumper_hprofIndex(
+    JNIEnv *env ATTRIBUTE_UNUSED, jobject jobject ATTRIBUTE_UNUSED,
+    jboolean enabled) {
+  HprofStrip::GetInstance().SetIndexEnabled(enabled);
+}
+
+JNIEXPORT void JNICALL
+Java_com_kwai_koom_javaoom_hprof_ForkStripHeapDumper_hprofHistogram(
+    JNIEnv *env ATTRIBUTE_UNUSED, jobject jobject ATTRIBUTE_UNUSED,
+    jint top_classes) {
+  HprofStrip::GetInstance().SetHistogramMode(
+      top_classes > 0 ? (size_t)top_classes : 0);
+}
+
+JNIEXPORT void JNICALL
+Java_com_kwai_koom_javaoom_hprof_ForkStripHeapDumper_hprofDuplicateArrays(
+    JNIEnv *env ATTRIBUTE_UNUSED, jobject jobject ATTRIBUTE_UNUSED,
+    jint min_bytes) {
+  HprofStrip::GetInstance().SetDuplicateArrayThreshold(
+      min_bytes > 0 ? (size_t)min_bytes : 0);
+}
+
+JNIEXPORT void JNICALL
+Java_com_kwai_koom_javaoom_hprof_ForkStripHeapDumper_hprofFingerprint(
+    JNIEnv *env ATTRIBUTE_UNUSED, jobject jobject ATTRIBUTE_UNUSED,
+    jboolean enabled) {
+  HprofStrip::GetInstance().SetFingerprintEnabled(enabled);
+}
+
+JNIEXPORT void JNICALL
+Java_com_kwai_koom_javaoom_hprof_ForkStripHeapDumper_hprofDeltaBase(
+    JNIEnv *env, jobject jobject ATTRIBUTE_UNUSED, jstring base_path) {
+  const char *path = env->GetStringUTFChars(base_path, nullptr);
+  HprofStrip::GetInstance().SetDeltaBase(path);
+  env->ReleaseStringUTFChars(base_path, path);
+}
+
+JNIEXPORT void JNICALL
+Java_com_kwai_koom_javaoom_hprof_ForkStripHeapDumper_hprofSnapshot(
+    JNIEnv *env ATTRIBUTE_UNUSED, jobject jobject ATTRIBUTE_UNUSED,
+    jboolean enabled) {
+  HprofStrip::GetInstance().SetSnapshotMode(enabled);
+}
+
+JNIEXPORT void JNICALL
+Java_com_kwai_koom_javaoom_hprof_ForkStripHeapDumper_hprofLeakPaths(
+    JNIEnv *env, jobject jobject ATTRIBUTE_UNUSED, jobjectArray class_names) {
+  std::vector<std::string> names;
+  jsize count = env->GetArrayLength(class_names);
+  for (jsize i = 0; i < count; i++) {
+    auto name = (jstring)env->GetObjectArrayElement(class_names, i);
+    const char *chars = env->GetStringUTFChars(name, nullptr);
+    names.emplace_back(chars);
+    env->ReleaseStringUTFChars(name, chars);
+    env->DeleteLocalRef(name);
+  }
+  HprofStrip::GetInstance().SetLeakPathClasses(names);
+}
+
+JNIEXPORT void JNICALL
+Java_com_kwai_koom_javaoom_hprof_ForkStripHeapDumper_hprofAsyncWrite(
+    JNIEnv *env ATTRIBUTE_UNUSED, jobject jobject ATTRIBUTE_UNUSED,
+    jboolean enabled) {
+  HprofStrip::GetInstance().SetAsyncWrite(enabled);
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_kwai_koom_javaoom_hprof_ForkStripHeapDumper_hprofStreamProcessor(
+    JNIEnv *env ATTRIBUTE_UNUSED, jobject jobject ATTRIBUTE_UNUSED) {
+  return reinterpret_cast<jlong>(HprofStrip::GetInstance().StreamProcessor());
+}
+
+static void AddClasses(JNIEnv *env, jobjectArray names,
+                       StripPolicy::ClassVerdict verdict, StripPolicy &policy) {
+  jsize count = env->GetArrayLength(names);
+  for (jsize i = 0; i < count; i++) {
+    auto name = (jstring)env->GetObjectArrayElement(names, i);
+    const char *chars = env->GetStringUTFChars(name, nullptr);
+    policy.AddClass(chars, verdict);
+    env->ReleaseStringUTFChars(name, chars);
+    env->DeleteLocalRef(name);
+  }
+}
+
+JNIEXPORT void JNICALL
+Java_com_kwai_koom_javaoom_hprof_ForkStripHeapDumper_hprofStripPolicy(
+    JNIEnv *env, jobject jobject ATTRIBUTE_UNUSED, jboolean keep_defaults,
+    jlongArray rules, jintArray dropped_records, jobjectArray allow_classes,
+    jobjectArray deny_classes) {
+  // heapMask, kind, elementType, action, minSize, keepBytes
+  constexpr jsize kRuleFields = 6;
+  StripPolicy policy;
+  if (!keep_defaults) policy.Clear();
+
+  jsize length = env->GetArrayLength(rules);
+  jlong *values = env->GetLongArrayElements(rules, nullptr);
+  for (jsize i = 0; i + kRuleFields <= length; i += kRuleFields) {
+    const jlong *rule = values + i;
+    auto slot = (uint8_t)rule[1];
+    if (slot == StripPolicy::kSlotPrimitiveArray) slot += (uint8_t)rule[2];
+    if (rule[3] < kStripKeep || rule[3] > kStripTruncate) {
+      ALOGE("invalid strip action %lld", (long long)rule[3]);
+      continue;
+    }
+    StripPolicy::Rule strip_rule = {(StripAction)rule[3], (uint32_t)rule[5],
+                                    (uint64_t)rule[4]};
+    policy.SetRule((uint32_t)rule[0], slot, strip_rule);
+  }
+  env->ReleaseLongArrayElements(rules, values, JNI_ABORT);
+
+  length = env->GetArrayLength(dropped_records);
+  jint *tags = env->GetIntArrayElements(dropped_records, nullptr);
+  for (jsize i = 0; i < length; i++) {
+    policy.SetRecordDropped((uint8_t)tags[i], true);
+  }
+  env->ReleaseIntArrayElements(dropped_records, tags, JNI_ABORT);
+
+  AddClasses(env, allow_classes, StripPolicy::kClassAllow, policy);
+  AddClasses(env, deny_classes, StripPolicy::kClassDeny, policy);
+  HprofStrip::GetInstance().SetStripPolicy(policy);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <strip_output.h>
+
+#include <cstring>
+
+namespace kwai {
+namespace leak_monitor {
+
+StripOutput::StripOutput()
+    : position_(0),
+      hold_index_(0),
+      hold_position_(0),
+      held_(false) {}
+
+void StripOutput::Reset() {
+  spans_.clear();
+  owned_.clear();
+  position_ = 0;
+  hold_index_ = 0;
+  hold_position_ = 0;
+  held_ = false;
+}
+
+void StripOutput::Copy(const uint8_t *data, size_t size) {
+  if (size == 0) return;
+  position_ += size;
+  size_t offset = owned_.size();
+  owned_.insert(owned_.end(), data, data + size);
+  if (spans_.size() > hold_index_) {
+    Span &last = spans_.back();
+    if (last.data == nullptr && last.offset + last.size == offset) {
+      last.size += size;
+      return;
+    }
+  }
+  spans_.push_back({nullptr, offset, size});
+}
+
+void StripOutput::Hold() {
+  held_ = true;
+  hold_index_ = spans_.size();
+  hold_position_ = position_;
+}
+
+void StripOutput::Release() {
+  held_ = false;
+  hold_index_ = 0;
+}
+
+void StripOutput::PatchU4(uint64_t position, uint32_t value) {
+  if (!held_) return;
+  uint64_t span_position = hold_position_;
+  for (size_t i = hold_index_; i < spans_.size(); i++) {
+    const Span &span = spans_[i];
+    if (position >= span_position &&
+        position + 4 <= span_position + span.size) {
+      if (span.data != nullptr) return;  // only owned bytes are writable
+      uint8_t *p = owned_.data() + span.offset + (position - span_position);
+      p[0] = (uint8_t)(value >> 24u);
+      p[1] = (uint8_t)(value >> 16u);
+      p[2] = (uint8_t)(value >> 8u);
+      p[3] = (uint8_t)value;
+      return;
+    }
+    span_position += span.size;
+  }
+}
+
+void StripOutput::Truncate(uint64_t position) {
+  if (!held_ || position < hold_position_ || position >= position_) return;
+  uint64_t span_position = hold_position_;
+  size_t keep = hold_index_;
+  while (keep < spans_.size() &&
+         span_position + spans_[keep].size <= position) {
+    span_position += spans_[keep].size;
+    keep++;
+  }
+  if (keep < spans_.size() && span_position < position) {
+    spans_[keep].size = position - span_position;
+    keep++;
+  }
+  spans_.resize(keep);
+  position_ = position;
+  // owned_ 按 span 的顺序追加，最后一个自有 span 之后的字节都不再用到
+  size_t owned_end = 0;
+  for (size_t i = spans_.size(); i > 0; i--) {
+    const Span &span = spans_[i - 1];
+    if (span.data == nullptr) {
+      owned_end = span.offset + span.size;
+      break;
+    }
+  }
+  owned_.resize(owned_end);
+}
+
+size_t StripOutput::DrainableSize() const {
+  size_t limit = held_ ? hold_index_ : spans_.size();
+  size_t size = 0;
+  for (size_t i = 0; i < limit; i++) size += spans_[i].size;
+  return size;
+}
+
+void StripOutput::Consume(size_t count) {
+  spans_.erase(spans_.begin(), spans_.begin() + count);
+  if (!held_) {
+    owned_.clear();
+    return;
+  }
+  hold_index_ = 0;
+  // 跨 write 的 record，借用的 ART buffer 马上会被复用，先拷贝下来
+  for (auto &span : spans_) {
+    if (span.data == nullptr) continue;
+    span.offset = owned_.size();
+    owned_.insert(owned_.end(), span.data, span.data + span.size);
+    span.data = nullptr;
+  }
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <hprof_stream_parser.h>
+#include <strip_policy.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace kwai {
+namespace leak_monitor {
+
+void StripPolicy::InitSlots() {
+  memset(slot_of_tag_, kSlotOther, sizeof(slot_of_tag_));
+  static const uint8_t roots[] = {
+      HPROF_ROOT_UNKNOWN,        HPROF_ROOT_JNI_GLOBAL,
+      HPROF_ROOT_JNI_LOCAL,      HPROF_ROOT_JAVA_FRAME,
+      HPROF_ROOT_NATIVE_STACK,   HPROF_ROOT_STICKY_CLASS,
+      HPROF_ROOT_THREAD_BLOCK,   HPROF_ROOT_MONITOR_USED,
+      HPROF_ROOT_THREAD_OBJECT,  HPROF_ROOT_INTERNED_STRING,
+      HPROF_ROOT_DEBUGGER,       HPROF_ROOT_VM_INTERNAL,
+      HPROF_ROOT_JNI_MONITOR,
+  };
+  for (uint8_t tag : roots) slot_of_tag_[tag] = kSlotRoot;
+  slot_of_tag_[HPROF_HEAP_DUMP_INFO] = kSlotHeapInfo;
+  slot_of_tag_[HPROF_CLASS_DUMP] = kSlotClass;
+  slot_of_tag_[HPROF_INSTANCE_DUMP] = kSlotInstance;
+  slot_of_tag_[HPROF_OBJECT_ARRAY_DUMP] = kSlotObjectArray;
+  // 元素类型在 header 里，由 parser 加到 slot 上
+  slot_of_tag_[HPROF_PRIMITIVE_ARRAY_DUMP] = kSlotPrimitiveArray;
+}
+
+StripPolicy::StripPolicy() {
+  InitSlots();
+  Clear();
+  const uint32_t system = (1u << kHeapZygote) | (1u << kHeapImage);
+  const uint32_t others = (1u << kHeapDefault) | (1u << kHeapApp);
+  Rule drop = {kStripDrop, 0, 0};
+  Rule strip_body = {kStripBody, 0, 0};
+  SetRule(system, kSlotHeapInfo, drop);
+  SetRule(system, kSlotInstance, drop);
+  SetRule(system, kSlotObjectArray, drop);
+  for (uint8_t type = hprof_basic_boolean; type <= hprof_basic_long; type++) {
+    SetRule(system, kSlotPrimitiveArray + type, drop);
+    SetRule(others, kSlotPrimitiveArray + type, strip_body);
+  }
+}
+
+void StripPolicy::Clear() {
+  for (auto &heap_rules : rules_) {
+    for (auto &rule : heap_rules) rule = {kStripKeep, 0, 0};
+  }
+  memset(dropped_records_, 0, sizeof(dropped_records_));
+  classes_.clear();
+  max_class_name_length_ = 0;
+}
+
+void StripPolicy::SetRule(uint32_t heap_mask, uint8_t slot, const Rule &rule) {
+  // kSlotOther 包括未知的 tag，不能裁剪
+  if (slot == kSlotOther || slot >= kSlotCount) return;
+  for (uint8_t heap = 0; heap < kHeapCount; heap++) {
+    if (heap_mask & (1u << heap)) rules_[heap][slot] = rule;
+  }
+}
+
+void StripPolicy::SetRecordDropped(uint8_t tag, bool dropped) {
+  // heap dump 按 sub record 裁剪，文件结构相关的 record 不能去掉
+  if (tag == HPROF_TAG_HEAP_DUMP || tag == HPROF_TAG_HEAP_DUMP_SEGMENT ||
+      tag == HPROF_TAG_HEAP_DUMP_END) {
+    return;
+  }
+  dropped_records_[tag] = dropped;
+}
+
+void StripPolicy::AddClass(const std::string &name, ClassVerdict verdict) {
+  if (name.empty() || verdict == kClassNone) return;
+  classes_[name] = verdict;
+  max_class_name_length_ = std::max(max_class_name_length_, name.size());
+}
+
+StripPolicy::Heap StripPolicy::HeapOf(uint8_t heap_type) {
+  switch (heap_type) {
+    case HPROF_HEAP_APP:
+      return kHeapApp;
+    case HPROF_HEAP_ZYGOTE:
+      return kHeapZygote;
+    case HPROF_HEAP_IMAGE:
+      return kHeapImage;
+    default:
+      return kHeapDefault;
+  }
+}
+
+StripPolicy::ClassVerdict StripPolicy::FindClass(
+    const std::string &name) const {
+  auto it = classes_.find(name);
+  return it == classes_.end() ? kClassNone : it->second;
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
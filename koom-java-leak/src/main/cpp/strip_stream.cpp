@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <android/log.h>
+#include <fcntl.h>
+#include <strip_stream.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#define LOG_TAG "HprofCrop"
+
+namespace kwai {
+namespace leak_monitor {
+
+StripStreamProcessor::StripStreamProcessor(HprofStripEngine &engine)
+    : engine_(engine), fd_(-1), processor_{this, Begin, Write, End} {}
+
+bool StripStreamProcessor::Begin(void *arg, const char *path) {
+  auto self = static_cast<StripStreamProcessor *>(arg);
+  if (self->fd_ != -1) close(self->fd_);
+  self->fd_ = open(path, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+  if (self->fd_ == -1) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "open %s failed: %s",
+                        path, strerror(errno));
+    return false;
+  }
+  // 这里是 app 进程，建图找泄漏路径只在 fork 的子进程或 host 上做；
+  // 指纹要给每个对象算哈希、增量要 mmap 整个基线指纹，快照要把所有对象
+  // 按列攒在内存里直到 HEAP_DUMP_END，也都留给子进程
+  self->engine_.SetLeakPathClasses({});
+  self->engine_.SetFingerprintEnabled(false);
+  self->engine_.SetDeltaBase("");
+  self->engine_.SetSnapshotMode(false);
+  self->engine_.Begin(path, self->fd_);
+  return true;
+}
+
+bool StripStreamProcessor::Write(void *arg, const uint8_t *data,
+                                 size_t size) {
+  return static_cast<StripStreamProcessor *>(arg)->engine_.Write(data, size);
+}
+
+bool StripStreamProcessor::End(void *arg, bool complete) {
+  auto self = static_cast<StripStreamProcessor *>(arg);
+  if (self->fd_ == -1) return false;
+  bool closed = close(self->fd_) == 0;
+  self->fd_ = -1;
+  if (complete && !self->engine_.Finished()) {
+    __android_log_print(ANDROID_LOG_ERROR, LOG_TAG,
+                        "stream ended without HEAP_DUMP_END");
+    complete = false;
+  }
+  return complete && closed;
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by Qiushi Xue <xueqiushi@kuaishou.com> on 2021.
+ *
+ */
+
+#include <stripe_hash.h>
+
+#include <cstring>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+namespace kwai {
+namespace leak_monitor {
+
+static constexpr uint32_t kPrime1 = 0x9E3779B1u;
+static constexpr uint32_t kPrime2 = 0x85EBCA77u;
+// xxh64 primes, for folding the lanes
+static constexpr uint64_t kPrime64_1 = 0x9E3779B185EBCA87ull;
+static constexpr uint64_t kPrime64_2 = 0xC2B2AE3D27D4EB4Full;
+static constexpr uint64_t kPrime64_3 = 0x165667B19E3779F9ull;
+static constexpr uint64_t kPrime64_4 = 0x85EBCA77C2B2AE63ull;
+static constexpr uint64_t kPrime64_5 = 0x27D4EB2F165667C5ull;
+
+static inline uint32_t Rotl(uint32_t x, int r) {
+  return (x << r) | (x >> (32 - r));
+}
+
+static inline uint64_t Rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+void StripeHash::Reset() {
+  for (uint32_t i = 0; i < 8; i++) {
+    lanes_[i] = kPrime1 * (i + 1) + kPrime2;
+  }
+  tail_size_ = 0;
+  total_size_ = 0;
+}
+
+void StripeHash::ScalarStripes(uint32_t *lanes, const uint8_t *data,
+                               size_t stripes) {
+  for (size_t s = 0; s < stripes; s++, data += kStripeSize) {
+    for (size_t i = 0; i < 8; i++) {
+      uint32_t word;
+      memcpy(&word, data + i * 4, sizeof(word));
+      lanes[i] = Rotl(lanes[i] + word * kPrime2, 13) * kPrime1;
+    }
+  }
+}
+
+void StripeHash::Stripes(uint32_t *lanes, const uint8_t *data,
+                         size_t stripes) {
+#if defined(__ARM_NEON)
+  uint32x4_t a = vld1q_u32(lanes);
+  uint32x4_t b = vld1q_u32(lanes + 4);
+  const uint32x4_t prime1 = vdupq_n_u32(kPrime1);
+  const uint32x4_t prime2 = vdupq_n_u32(kPrime2);
+  for (size_t s = 0; s < stripes; s++, data += kStripeSize) {
+    uint32x4_t x = vreinterpretq_u32_u8(vld1q_u8(data));
+    uint32x4_t y = vreinterpretq_u32_u8(vld1q_u8(data + 16));
+    a = vmlaq_u32(a, x, prime2);
+    b = vmlaq_u32(b, y, prime2);
+    a = vsriq_n_u32(vshlq_n_u32(a, 13), a, 19);
+    b = vsriq_n_u32(vshlq_n_u32(b, 13), b, 19);
+    a = vmulq_u32(a, prime1);
+    b = vmulq_u32(b, prime1);
+  }
+  vst1q_u32(lanes, a);
+  vst1q_u32(lanes + 4, b);
+#elif defined(__SSE4_1__)
+  __m128i a = _mm_load_si128(reinterpret_cast<const __m128i *>(lanes));
+  __m128i b = _mm_load_si128(reinterpret_cast<const __m128i *>(lanes + 4));
+  const __m128i prime1 = _mm_set1_epi32((int)kPrime1);
+  const __m128i prime2 = _mm_set1_epi32((int)kPrime2);
+  for (size_t s = 0; s < stripes; s++, data += kStripeSize) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16));
+    a = _mm_add_epi32(a, _mm_mullo_epi32(x, prime2));
+    b = _mm_add_epi32(b, _mm_mullo_epi32(y, prime2));
+    a = _mm_or_si128(_mm_slli_epi32(a, 13), _mm_srli_epi32(a, 19));
+    b = _mm_or_si128(_mm_slli_epi32(b, 13), _mm_srli_epi32(b, 19));
+    a = _mm_mullo_epi32(a, prime1);
+    b = _mm_mullo_epi32(b, prime1);
+  }
+  _mm_store_si128(reinterpret_cast<__m128i *>(lanes), a);
+  _mm_store_si128(reinterpret_cast<__m128i *>(lanes + 4), b);
+#else
+  ScalarStripes(lanes, data, stripes);
+#endif
+}
+
+void StripeHash::Update(const uint8_t *data, size_t size) {
+  total_size_ += size;
+  if (tail_size_ > 0) {
+    size_t take = kStripeSize - tail_size_;
+    if (take > size) take = size;
+    memcpy(tail_ + tail_size_, data, take);
+    tail_size_ += take;
+    data += take;
+    size -= take;
+    if (tail_size_ < kStripeSize) return;
+    Stripes(lanes_, tail_, 1);
+    tail_size_ = 0;
+  }
+  size_t stripes = size / kStripeSize;
+  if (stripes > 0) {
+    Stripes(lanes_, data, stripes);
+    data += stripes * kStripeSize;
+    size -= stripes * kStripeSize;
+  }
+  memcpy(tail_, data, size);
+  tail_size_ = size;
+}
+
+uint64_t StripeHash::Final() const {
+  // xxh64 的合并方式：lane i 和 i + 4 拼成一个 64 位值，8 个 lane 都进入结果的
+  // 每一位，只改一个 stripe 里的一个字节也会影响整个 64 位
+  uint64_t v[4];
+  for (uint32_t i = 0; i < 4; i++) {
+    v[i] = (uint64_t)lanes_[i] << 32u | lanes_[i + 4];
+  }
+  uint64_t acc = Rotl64(v[0], 1) + Rotl64(v[1], 7) + Rotl64(v[2], 12) +
+                 Rotl64(v[3], 18);
+  for (uint64_t value : v) {
+    acc ^= Rotl64(value * kPrime64_2, 31) * kPrime64_1;
+    acc = acc * kPrime64_1 + kPrime64_4;
+  }
+  acc += total_size_;
+  size_t i = 0;
+  for (; i + 4 <= tail_size_; i += 4) {
+    uint32_t word;
+    memcpy(&word, tail_ + i, sizeof(word));
+    acc ^= (uint64_t)word * kPrime64_1;
+    acc = Rotl64(acc, 23) * kPrime64_2 + kPrime64_3;
+  }
+  for (; i < tail_size_; i++) {
+    acc ^= tail_[i] * kPrime64_5;
+    acc = Rotl64(acc, 11) * kPrime64_1;
+  }
+  acc ^= acc >> 33u;
+  acc *= kPrime64_2;
+  acc ^= acc >> 29u;
+  acc *= kPrime64_3;
+  acc ^= acc >> 32u;
+  return acc;
+}
+
+}  // namespace leak_monitor
+}  // namespace kwai
@@ -29,7 +29,28 @@ import com.kwai.koom.fastdump.HeapDumper;
 
 public class ForkStripHeapDumper implements HeapDumper {
   private static final String TAG = "OOMMonitor_ForkStripHeapDumper";
+
+  /**
+   * Codecs of {@link #setCompression(int)}, a compressed hprof is written as a
+   * block container (magic "KHPZ") and must be decompressed before analysis.
+   */
+  public static final int COMPRESSION_NONE = 0;
+  public static final int COMPRESSION_LZ4 = 1;
+  public static final int COMPRESSION_LZMA = 2;
+
   private boolean mLoadSuccess;
+  private int mCompression = COMPRESSION_NONE;
+  private StripPolicy mStripPolicy;
+  private boolean mIndexEnabled;
+  private int mHistogramTopClasses;
+  private int mDuplicateArrayMinBytes;
+  private boolean mFingerprintEnabled;
+  private String mDeltaBase;
+  private boolean mSnapshotMode;
+  private String[] mLeakPathClasses;
+  private boolean mAsyncWrite;
+  private boolean mStreamMode;
+  private int mStreamPipeBufferSize;
 
   private static class Holder {
     private static final ForkStripHeapDumper INSTANCE = new ForkStripHeapDumper();
@@ -51,6 +72,111 @@ public class ForkStripHeapDumper implements HeapDumper {
     }
   }
 
+  /**
+   * Compresses the stripped hprof while it is written, LZ4 is fast and LZMA
+   * is smaller but slower, see hprof_compressor.h.
+   */
+  public synchronized void setCompression(int compression) {
+    mCompression = compression;
+  }
+
+  /**
+   * Replaces the default strip rules, null restores them.
+   */
+  public synchronized void setStripPolicy(StripPolicy policy) {
+    mStripPolicy = policy;
+  }
+
+  /**
+   * Writes an object index next to the hprof as "path.kidx" while stripping,
+   * so the analyzer can look objects up without a full pass, see hprof_index.h.
+   */
+  public synchronized void setIndexEnabled(boolean enabled) {
+    mIndexEnabled = enabled;
+  }
+
+  /**
+   * With topClasses > 0 no hprof is written: the file at the dump path gets a
+   * tab separated histogram of the topClasses classes with the most shallow
+   * bytes, a few KB, see heap_histogram.h. 0 restores normal dumps.
+   */
+  public synchronized void setHistogramMode(int topClasses) {
+    mHistogramTopClasses = topClasses;
+  }
+
+  /**
+   * With minBytes > 0 primitive arrays of at least minBytes are hashed while
+   * dumping, groups of arrays with identical contents and the bytes they waste
+   * are written next to the hprof as "path.kdup", see duplicate_arrays.h.
+   * Works in histogram mode too. 0 disables it.
+   */
+  public synchronized void setDuplicateArrayThreshold(int minBytes) {
+    mDuplicateArrayMinBytes = minBytes;
+  }
+
+  /**
+   * Writes the fingerprints of the dumped objects next to the hprof as "path.kfp", so that
+   * later dumps can be written as deltas against it, see {@link #setDeltaBase(String)}.
+   * Ignored in stream mode.
+   */
+  public synchronized void setFingerprintEnabled(boolean enabled) {
+    mFingerprintEnabled = enabled;
+  }
+
+  /**
+   * Writes the following dumps as deltas against basePath, a full dump taken with
+   * fingerprints enabled in this process: objects whose bytes did not change are left out
+   * and the removed ones are listed, see hprof_delta.h. The host tool hprof-delta rebuilds
+   * the full hprof from both files. Deltas get no index. If the fingerprints cannot be read
+   * the dump is written in full. null restores full dumps. Ignored in stream mode, which
+   * always writes full dumps.
+   */
+  public synchronized void setDeltaBase(String basePath) {
+    mDeltaBase = basePath;
+  }
+
+  /**
+   * Writes a compact snapshot instead of the stripped hprof: the objects are stored as
+   * columns with delta encoded ids and references, see hprof_snapshot.h. The host tool
+   * hprof-snapshot turns it back into the stripped hprof. Overrides delta dumps and
+   * fingerprints, snapshots get no index. Ignored in stream mode.
+   */
+  public synchronized void setSnapshotMode(boolean enabled) {
+    mSnapshotMode = enabled;
+  }
+
+  /**
+   * Finds the shortest reference paths from GC roots to the instances of these classes and
+   * their subclasses where the dump is stripped, once it is complete, and writes them next to
+   * the hprof as "path.kpath", see leak_path_finder.h. "name#field" only takes instances whose
+   * boolean field declared by that class is true, e.g. "android.app.Activity#mDestroyed". The
+   * graph is built in an unlinked file next to the hprof. null or empty disables it. Ignored in
+   * stream mode, which strips in this process.
+   */
+  public synchronized void setLeakPathClasses(String... classNames) {
+    mLeakPathClasses = classNames;
+  }
+
+  /**
+   * Strips and writes on a separate thread of the dump process, ART's writes
+   * then only cost a copy into a 4 MB ring. Falls back to synchronous writes
+   * if the thread cannot be created, see async_writer.h.
+   */
+  public synchronized void setAsyncWrite(boolean enabled) {
+    mAsyncWrite = enabled;
+  }
+
+  /**
+   * The forked process writes the hprof into a pipe and this process strips, compresses
+   * and writes it while it is dumped, so the unstripped hprof never reaches the disk and
+   * no write hook is needed. pipeBufferSize is how many bytes the forked process may run
+   * ahead before it blocks, 0 keeps the system default (64 KB). See hprof_stream.h.
+   */
+  public synchronized void setStreamMode(boolean enabled, int pipeBufferSize) {
+    mStreamMode = enabled;
+    mStreamPipeBufferSize = pipeBufferSize;
+  }
+
   @Override
   public synchronized boolean dump(String path) {
     MonitorLog.i(TAG, "dump " + path);
@@ -64,8 +190,27 @@ public class ForkStripHeapDumper implements HeapDumper {
     }
     boolean dumpRes = false;
     try {
-      hprofName(path);
-      dumpRes = ForkJvmHeapDumper.getInstance().dump(path);
+      // The hooks must not match any file in stream mode, the processor gets the data
+      hprofName(mStreamMode ? "" : path);
+      hprofCompression(mCompression);
+      hprofIndex(mIndexEnabled);
+      hprofHistogram(mHistogramTopClasses);
+      hprofDuplicateArrays(mDuplicateArrayMinBytes);
+      // Hashing every object, the analysis, the delta lookups and the snapshot columns belong
+      // in the forked process, stream mode strips in this one
+      hprofFingerprint(mFingerprintEnabled && !mStreamMode);
+      hprofDeltaBase(mDeltaBase != null && !mStreamMode ? mDeltaBase : "");
+      hprofSnapshot(mSnapshotMode && !mStreamMode);
+      hprofLeakPaths(mLeakPathClasses != null && !mStreamMode
+          ? mLeakPathClasses : new String[0]);
+      hprofAsyncWrite(mAsyncWrite);
+      StripPolicy policy = mStripPolicy != null ? mStripPolicy : new StripPolicy.Builder().build();
+      hprofStripPolicy(policy.keepDefaults, policy.rules, policy.droppedRecords,
+          policy.allowClasses, policy.denyClasses);
+      dumpRes = mStreamMode
+          ? ForkJvmHeapDumper.getInstance().dumpToStream(path, hprofStreamProcessor(),
+              mStreamPipeBufferSize)
+          : ForkJvmHeapDumper.getInstance().dump(path);
       MonitorLog.i(TAG, "dump result " + dumpRes);
     } catch (Exception e) {
       MonitorLog.e(TAG, "dump failed caused by " + e);
@@ -77,4 +222,27 @@ public class ForkStripHeapDumper implements HeapDumper {
   public native void initStripDump();
 
   public native void hprofName(String name);
+
+  public native void hprofCompression(int codec);
+
+  public native void hprofIndex(boolean enabled);
+
+  public native void hprofHistogram(int topClasses);
+
+  public native void hprofDuplicateArrays(int minBytes);
+
+  public native void hprofFingerprint(boolean enabled);
+
+  public native void hprofDeltaBase(String basePath);
+
+  public native void hprofSnapshot(boolean enabled);
+
+  public native void hprofLeakPaths(String[] classNames);
+
+  public native void hprofAsyncWrite(boolean enabled);
+
+  public native long hprofStreamProcessor();
+
+  public native void hprofStripPolicy(boolean keepDefaults, long[] rules, int[] droppedRecords,
+      String[] allowClasses, String[] denyClasses);
 }
\ No newline at end of file
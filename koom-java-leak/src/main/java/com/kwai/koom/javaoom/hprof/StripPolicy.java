@@ -0,0 +1,157 @@
+/**
+ * Copyright 2020 Kwai, Inc. All rights reserved.
+ * <p>
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * <p>
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * <p>
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.kwai.koom.javaoom.hprof;
+
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.List;
+
+/**
+ * What {@link ForkStripHeapDumper} removes from the hprof, see strip_policy.h.
+ *
+ * A new builder starts from the default rules: zygote and image heaps are
+ * dropped except roots and class dumps, and primitive array values are
+ * removed from the other heaps with their type and length kept.
+ */
+public final class StripPolicy {
+  public static final int HEAP_DEFAULT = 1;
+  public static final int HEAP_APP = 1 << 1;
+  public static final int HEAP_ZYGOTE = 1 << 2;
+  public static final int HEAP_IMAGE = 1 << 3;
+  public static final int HEAP_ALL = HEAP_DEFAULT | HEAP_APP | HEAP_ZYGOTE | HEAP_IMAGE;
+
+  public static final int KIND_HEAP_INFO = 1;
+  public static final int KIND_ROOT = 2;
+  public static final int KIND_CLASS = 3;
+  public static final int KIND_INSTANCE = 4;
+  public static final int KIND_OBJECT_ARRAY = 5;
+
+  // hprof basic types of primitive array elements
+  public static final int TYPE_BOOLEAN = 4;
+  public static final int TYPE_CHAR = 5;
+  public static final int TYPE_FLOAT = 6;
+  public static final int TYPE_DOUBLE = 7;
+  public static final int TYPE_BYTE = 8;
+  public static final int TYPE_SHORT = 9;
+  public static final int TYPE_INT = 10;
+  public static final int TYPE_LONG = 11;
+
+  public static final int ACTION_KEEP = 0;
+  // Remove the whole sub record
+  public static final int ACTION_DROP = 1;
+  // Keep type and length, remove the values, they can be refilled with zeros
+  public static final int ACTION_STRIP_BODY = 2;
+  // Keep the first keepBytes of array values
+  public static final int ACTION_TRUNCATE = 3;
+
+  private static final int KIND_PRIMITIVE_ARRAY = 6;
+
+  // Rules are flattened as heapMask, kind, elementType, action, minSize, keepBytes
+
+  final boolean keepDefaults;
+  final long[] rules;
+  final int[] droppedRecords;
+  final String[] allowClasses;
+  final String[] denyClasses;
+
+  private StripPolicy(Builder builder) {
+    keepDefaults = builder.keepDefaults;
+    rules = new long[builder.rules.size()];
+    for (int i = 0; i < rules.length; i++) {
+      rules[i] = builder.rules.get(i);
+    }
+    droppedRecords = new int[builder.droppedRecords.size()];
+    for (int i = 0; i < droppedRecords.length; i++) {
+      droppedRecords[i] = builder.droppedRecords.get(i);
+    }
+    allowClasses = builder.allowClasses.toArray(new String[0]);
+    denyClasses = builder.denyClasses.toArray(new String[0]);
+  }
+
+  public static final class Builder {
+    private boolean keepDefaults = true;
+    private final List<Long> rules = new ArrayList<>();
+    private final List<Integer> droppedRecords = new ArrayList<>();
+    private final List<String> allowClasses = new ArrayList<>();
+    private final List<String> denyClasses = new ArrayList<>();
+
+    /**
+     * Starts from a policy that keeps everything instead of the default rules.
+     */
+    public Builder keepAll() {
+      keepDefaults = false;
+      rules.clear();
+      return this;
+    }
+
+    /**
+     * Applies action to sub records of kind in the heaps of heapMask whose
+     * values are at least minSize bytes.
+     */
+    public Builder heapRule(int heapMask, int kind, int action, long minSize, int keepBytes) {
+      return addRule(heapMask, kind, 0, action, minSize, keepBytes);
+    }
+
+    public Builder heapRule(int heapMask, int kind, int action) {
+      return heapRule(heapMask, kind, action, 0, 0);
+    }
+
+    /**
+     * Applies action to primitive arrays of elementType whose values are at
+     * least minSize bytes, e.g. keep byte[] of the app heap for bitmap
+     * duplicate analysis.
+     */
+    public Builder primitiveArrayRule(int heapMask, int elementType, int action, long minSize,
+        int keepBytes) {
+      return addRule(heapMask, KIND_PRIMITIVE_ARRAY, elementType, action, minSize, keepBytes);
+    }
+
+    /**
+     * Removes every top level record of the tag, heap dump records excepted.
+     */
+    public Builder dropRecord(int tag) {
+      droppedRecords.add(tag);
+      return this;
+    }
+
+    /**
+     * Instances and arrays of the class are always kept, e.g. "android.graphics.Bitmap".
+     */
+    public Builder allowClass(String className) {
+      allowClasses.add(className);
+      return this;
+    }
+
+    /**
+     * Instances and arrays of the class are always removed.
+     */
+    public Builder denyClass(String className) {
+      denyClasses.add(className);
+      return this;
+    }
+
+    public StripPolicy build() {
+      return new StripPolicy(this);
+    }
+
+    private Builder addRule(int heapMask, int kind, int elementType, int action, long minSize,
+        int keepBytes) {
+      rules.addAll(Arrays.asList((long) heapMask, (long) kind, (long) elementType, (long) action,
+          minSize, (long) keepBytes));
+      return this;
+    }
+  }
+}
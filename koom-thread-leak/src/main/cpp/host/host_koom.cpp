@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by shenvsv on 2021.
+ *
+ */
+
+#include "koom.h"
+
+#include "common/log.h"
+#include "common/util.h"
+
+namespace koom {
+
+int Util::android_api;
+bool Log::log_enable = false;
+
+std::string host_last_report;
+std::string host_last_report_file;
+
+void JavaCallback(const char *value, bool) {
+  host_last_report = value;
+}
+
+void JavaFileCallback(const char *path, bool) {
+  host_last_report_file = path;
+}
+}  // namespace koom
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by shenvsv on 2021.
+ *
+ */
+
+// util.h includes jni.h without using it. It also calls
+// android_get_device_api_level(), which bionic declares everywhere.
+
+#ifndef KOOM_HOST_JNI_H
+#define KOOM_HOST_JNI_H
+
+int android_get_device_api_level();
+
+#endif  // KOOM_HOST_JNI_H
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by shenvsv on 2021.
+ *
+ */
+
+// The part of koom.h the report sinks use, for host builds. The real one
+// pulls in JNI and the hook looper. The callbacks keep the last report in
+// the host_ variables, see host_koom.cpp.
+
+#ifndef KOOM_HOST_KOOM_H
+#define KOOM_HOST_KOOM_H
+
+#include <string>
+
+namespace koom {
+
+extern std::string host_last_report;
+
+extern std::string host_last_report_file;
+
+void JavaCallback(const char *value, bool doAttach = true);
+
+void JavaFileCallback(const char *path, bool doAttach = true);
+}  // namespace koom
+
+#endif  // KOOM_HOST_KOOM_H
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by shenvsv on 2021.
+ *
+ */
+
+// Writes fixed reports through JsonReportSink and BinaryReportSink and
+// compares them with the fixtures ThreadReportDecoderTest decodes on the JVM,
+// so that both ends agree on the binary format:
+//
+//   thread-report-test <fixture dir> [--update]
+//
+// --update rewrites the fixtures after a deliberate format change.
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "koom.h"
+#include "thread/report_sink.h"
+
+namespace {
+
+struct Thread {
+  int tid;
+  uint64_t internal_id;
+  int64_t create_time;
+  int64_t start_time;
+  int64_t end_time;
+  int64_t cpu_time;
+  int idle_rounds;
+  char state;
+  std::string name;
+  std::string family;
+  std::string stack;
+};
+
+struct Report {
+  const char *fixture;
+  const char *leak_type;
+  uint64_t evicted;
+  int64_t census_cost;
+  std::vector<Thread> threads;
+};
+
+const Report kReports[] = {
+    {"thread_report_leak",
+     "leak",
+     3,
+     -1,
+     {{1201, 0x7a1b2c3d40ull, 1000, 1002, 5000, 1234567, 0, 0,
+       "pool-3-thread-12", "pool-3-thread-N",
+       "#00 pc 0000000000012345 /system/lib64/libc.so (pthread_create)\n"
+       "#java.lang.Thread.start(Thread.java:883)\n"},
+      {1202, 0x7a1b2c3e80ull, 2000, 2001, 9000, 0, 0, 0, "\xe4\xb8\x8b\xe8\xbd\xbd",
+       "\xe4\xb8\x8b\xe8\xbd\xbd", ""}}},
+    {"thread_report_idle",
+     "idle_thread",
+     0,
+     48213,
+     {{3301, 0x7a1b2c4000ull, 3000, 3004, 0, 88000000, 5, 'S', "Binder:1234_5",
+       "Binder:1234_N", "#00 pc 0000000000045678 /system/lib64/libbinder.so\n"},
+      {3302, 0x7a1b2c4100ull, 3100, 3101, 0, 17, 12, 'D', "OkHttp \"quoted\"",
+       "OkHttp \"quoted\"", "#com.example.Pool.spawn(Pool.java:42)\n"}}},
+};
+
+bool ReadFile(const std::string &path, std::string *data) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == nullptr) return false;
+  char buf[4096];
+  size_t n;
+  data->clear();
+  while ((n = fread(buf, 1, sizeof(buf), file)) > 0) data->append(buf, n);
+  fclose(file);
+  return true;
+}
+
+bool WriteFile(const std::string &path, const std::string &data) {
+  FILE *file = fopen(path.c_str(), "wb");
+  if (file == nullptr) return false;
+  bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+  return fclose(file) == 0 && ok;
+}
+
+void Emit(const Report &report, koom::ReportSink &sink) {
+  sink.Begin(report.leak_type, report.evicted, report.census_cost);
+  for (const auto &thread : report.threads) {
+    koom::ThreadRecord record{};
+    record.tid = thread.tid;
+    record.internal_id = thread.internal_id;
+    record.create_time = thread.create_time;
+    record.start_time = thread.start_time;
+    record.end_time = thread.end_time;
+    record.cpu_time = thread.cpu_time;
+    record.idle_rounds = thread.idle_rounds;
+    record.state = thread.state;
+    record.name = &thread.name;
+    record.family = &thread.family;
+    record.stack = &thread.stack;
+    sink.Thread(record);
+  }
+  sink.End();
+}
+
+size_t CountFiles(const std::string &dir) {
+  size_t count = 0;
+  DIR *d = opendir(dir.c_str());
+  if (d == nullptr) return 0;
+  while (struct dirent *entry = readdir(d)) {
+    if (entry->d_name[0] != '.') count++;
+  }
+  closedir(d);
+  return count;
+}
+
+// Compares or, with update, rewrites one fixture
+bool Check(const std::string &path, const std::string &data, bool update) {
+  if (update) {
+    if (WriteFile(path, data)) return true;
+    fprintf(stderr, "cannot write %s\n", path.c_str());
+    return false;
+  }
+  std::string expected;
+  if (!ReadFile(path, &expected)) {
+    fprintf(stderr, "cannot read %s\n", path.c_str());
+    return false;
+  }
+  if (expected == data) return true;
+  fprintf(stderr, "%s differs, %zu bytes written, %zu expected\n",
+          path.c_str(), data.size(), expected.size());
+  return false;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: thread-report-test <fixture dir> [--update]\n");
+    return 2;
+  }
+  std::string fixtures = argv[1];
+  bool update = argc > 2 && strcmp(argv[2], "--update") == 0;
+
+  char dir_template[] = "/tmp/thread-report-XXXXXX";
+  if (mkdtemp(dir_template) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+  std::string dir = dir_template;
+
+  bool ok = true;
+  for (const auto &report : kReports) {
+    koom::host_last_report.clear();
+    koom::JsonReportSink json;
+    Emit(report, json);
+    ok &= Check(fixtures + "/" + report.fixture + ".json",
+                koom::host_last_report, update);
+
+    koom::host_last_report_file.clear();
+    {
+      koom::BinaryReportSink binary(dir);
+      Emit(report, binary);
+    }
+    std::string data;
+    if (!ReadFile(koom::host_last_report_file, &data)) {
+      fprintf(stderr, "%s: no binary report\n", report.fixture);
+      ok = false;
+    } else {
+      ok &= Check(fixtures + "/" + report.fixture + ".bin", data, update);
+    }
+    unlink(koom::host_last_report_file.c_str());
+  }
+
+  // 没有线程的报告不应该建文件，也不回调 java
+  Report empty = {"", "leak", 0, -1, {}};
+  koom::host_last_report_file.clear();
+  {
+    koom::BinaryReportSink binary(dir);
+    Emit(empty, binary);
+  }
+  if (!koom::host_last_report_file.empty() || CountFiles(dir) != 0) {
+    fprintf(stderr, "empty report left a file behind\n");
+    ok = false;
+  }
+  koom::host_last_report.clear();
+  koom::JsonReportSink json;
+  Emit(empty, json);
+  if (!koom::host_last_report.empty()) {
+    fprintf(stderr, "empty json report was delivered\n");
+    ok = false;
+  }
+
+  rmdir(dir.c_str());
+  printf("%s\n", ok ? (update ? "fixtures updated" : "ALL OK") : "FAILED");
+  return ok ? 0 : 1;
+}
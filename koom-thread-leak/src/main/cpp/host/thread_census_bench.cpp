@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by shenvsv on 2021.
+ *
+ */
+
+// Times ThreadCensus::Sample() on a process with many idle threads:
+//
+//   thread-census-bench [threads] [samples] [budget us]
+//
+// Prints the median and worst sample. With a budget it fails if the median
+// exceeds it, which makes it usable as a test.
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "common/util.h"
+#include "thread/thread_census.h"
+
+namespace {
+
+pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+bool gate_open = false;
+
+void *Idle(void *) {
+  pthread_mutex_lock(&gate_lock);
+  while (!gate_open) pthread_cond_wait(&gate_cond, &gate_lock);
+  pthread_mutex_unlock(&gate_lock);
+  return nullptr;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  int thread_count = argc > 1 ? atoi(argv[1]) : 500;
+  int samples = argc > 2 ? atoi(argv[2]) : 200;
+  long budget_us = argc > 3 ? atol(argv[3]) : 0;
+
+  std::vector<pthread_t> threads;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64 * 1024);
+  for (int i = 0; i < thread_count; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, Idle, nullptr) != 0) {
+      fprintf(stderr, "only %d threads created\n", i);
+      break;
+    }
+    threads.push_back(thread);
+  }
+
+  koom::ThreadCensus census;
+  census.SetIdleRounds(3);
+  std::vector<koom::IdleThread> idle;
+  // 第一轮要打开所有 schedstat，不计入
+  census.Sample(idle);
+  std::vector<int64_t> costs;
+  for (int i = 0; i < samples; i++) {
+    idle.clear();
+    census.Sample(idle);
+    costs.push_back(census.LastCostNs());
+  }
+
+  pthread_mutex_lock(&gate_lock);
+  gate_open = true;
+  pthread_cond_broadcast(&gate_cond);
+  pthread_mutex_unlock(&gate_lock);
+  for (auto thread : threads) pthread_join(thread, nullptr);
+
+  std::sort(costs.begin(), costs.end());
+  int64_t median = costs[costs.size() / 2];
+  printf("%zu tasks, %d samples, median %.1f us, worst %.1f us\n",
+         census.TaskCount(), samples, median / 1e3, costs.back() / 1e3);
+  if (budget_us > 0 && median > budget_us * 1000) {
+    printf("over budget of %ld us\n", budget_us);
+    return 1;
+  }
+  return 0;
+}
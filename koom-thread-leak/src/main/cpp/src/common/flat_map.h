@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by shenvsv on 2021.
+ *
+ */
+
+#ifndef APM_FLAT_MAP_H
+#define APM_FLAT_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace koom {
+
+/**
+ * Open addressing hash map with linear probing for integral / pointer sized
+ * keys. Key 0 marks an empty slot, so 0 can not be stored. Erase uses
+ * backward shift deletion, no tombstones are left behind.
+ */
+template <typename K, typename V>
+class FlatMap {
+ public:
+  struct Slot {
+    K key;
+    V value;
+  };
+
+  FlatMap() : size_(0) {}
+
+  size_t Size() const { return size_; }
+
+  V *Find(K key) {
+    if (slots_.empty() || key == K()) return nullptr;
+    size_t mask = slots_.size() - 1;
+    for (size_t i = Hash(key) & mask;; i = (i + 1) & mask) {
+      if (slots_[i].key == key) return &slots_[i].value;
+      if (slots_[i].key == K()) return nullptr;
+    }
+  }
+
+  // Returns the value of key, a default value is inserted when absent.
+  V &operator[](K key) {
+    V *value = Find(key);
+    if (value != nullptr) return *value;
+    if ((size_ + 1) * 4 > slots_.size() * 3) Grow();
+    size_t mask = slots_.size() - 1;
+    size_t i = Hash(key) & mask;
+    while (slots_[i].key != K()) i = (i + 1) & mask;
+    slots_[i].key = key;
+    slots_[i].value = V();
+    size_++;
+    return slots_[i].value;
+  }
+
+  bool Erase(K key) {
+    if (slots_.empty() || key == K()) return false;
+    size_t mask = slots_.size() - 1;
+    size_t i = Hash(key) & mask;
+    for (;; i = (i + 1) & mask) {
+      if (slots_[i].key == K()) return false;
+      if (slots_[i].key == key) break;
+    }
+    // Shift following entries of the probe chain back into the hole.
+    size_t hole = i;
+    for (size_t j = (i + 1) & mask; slots_[j].key != K(); j = (j + 1) & mask) {
+      size_t home = Hash(slots_[j].key) & mask;
+      if (((j - home) & mask) >= ((j - hole) & mask)) {
+        slots_[hole] = slots_[j];
+        hole = j;
+      }
+    }
+    slots_[hole].key = K();
+    slots_[hole].value = V();
+    size_--;
+    return true;
+  }
+
+  void Clear() {
+    slots_.clear();
+    slots_.shrink_to_fit();
+    size_ = 0;
+  }
+
+  // fn(K key, V &value), the map must not be modified while iterating
+  template <typename Fn>
+  void ForEach(Fn fn) {
+    for (auto &slot : slots_) {
+      if (slot.key != K()) fn(slot.key, slot.value);
+    }
+  }
+
+ private:
+  static size_t Hash(K key) {
+    // fibonacci hashing, pthread_t values are aligned pointers
+    auto h = static_cast<uint64_t>((uintptr_t)key) *
+             0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(h ^ (h >> 32));
+  }
+
+  void Grow() {
+    std::vector<Slot> old;
+    old.swap(slots_);
+    slots_.resize(old.empty() ? 16 : old.size() * 2, Slot{K(), V()});
+    size_ = 0;
+    for (auto &slot : old) {
+      if (slot.key != K()) (*this)[slot.key] = slot.value;
+    }
+  }
+
+  std::vector<Slot> slots_;
+  size_t size_;
+};
+}  // namespace koom
+#endif  // APM_FLAT_MAP_H
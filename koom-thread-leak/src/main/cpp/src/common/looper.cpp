@@ -40,12 +40,6 @@
 #define TAG "koom-looper"
 #define LOGV(...) koom::Log::info(TAG, __VA_ARGS__);
 
-struct LooperMessage {
-  int what;
-  void *obj;
-  LooperMessage *next;
-  bool quit;
-};
 void *looper::trampoline(void *p) {
   prctl(PR_SET_NAME, "koom-looper");
   ((looper *)p)->loop();
@@ -73,15 +67,27 @@ void looper::post(int what, void *data, bool flush) {
   msg->obj = data;
   msg->next = nullptr;
   msg->quit = false;
+  msg->external = false;
   addMsg(msg, flush);
 }
+void looper::postMessage(LooperMessage *msg) {
+  msg->next = nullptr;
+  msg->quit = false;
+  msg->external = true;
+  addMsg(msg, false);
+}
 void looper::addMsg(LooperMessage *msg, bool flush) {
   sem_wait(&headWriteProtect);
   LooperMessage *h = head;
   if (flush) {
     while (h) {
       LooperMessage *next = h->next;
-      delete h;
+      // external 消息嵌在 obj 里，交还给发送方释放
+      if (h->external) {
+        discard(h->what, h->obj);
+      } else {
+        delete h;
+      }
       h = next;
     }
     h = nullptr;
@@ -116,8 +122,10 @@ void looper::loop() {
       return;
     }
     LOGV("processing msg %d", msg->what);
+    // handle() may free an external message together with its owner
+    bool external = msg->external;
     handle(msg->what, msg->obj);
-    delete msg;
+    if (!external) delete msg;
   }
 }
 void looper::quit() {
@@ -127,6 +135,7 @@ void looper::quit() {
   msg->obj = nullptr;
   msg->next = nullptr;
   msg->quit = true;
+  msg->external = false;
   addMsg(msg, false);
   void *val;
   pthread_join(worker, &val);
@@ -137,3 +146,6 @@ void looper::quit() {
 void looper::handle(int what, void *obj) {
   LOGV("dropping msg %d %p", what, obj);
 }
+void looper::discard(int what, void *obj) {
+  LOGV("discarding external msg %d %p", what, obj);
+}
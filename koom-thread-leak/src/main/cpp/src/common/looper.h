@@ -17,16 +17,30 @@
  *
  */
 
+#ifndef APM_LOOPER_H
+#define APM_LOOPER_H
+
 #include <pthread.h>
 #include <semaphore.h>
-struct LooperMessage;
+struct LooperMessage {
+  int what;
+  void *obj;
+  LooperMessage *next;
+  bool quit;
+  // Owned by the sender (embedded in obj), the looper must not delete it.
+  bool external;
+};
 class looper {
  public:
   looper();
   ~looper();
   virtual void post(int what, void *data, bool flush = false);
+  // Post a message preallocated by the caller, never allocates.
+  void postMessage(LooperMessage *msg);
   void quit();
   virtual void handle(int what, void *data);
+  // Called for external messages a flush drops, the owner must free them.
+  virtual void discard(int what, void *data);
 
  private:
   void addMsg(LooperMessage *msg, bool flush);
@@ -38,4 +52,6 @@ class looper {
   sem_t headWriteProtect;
   sem_t headDataAvailable;
   bool running;
-};
\ No newline at end of file
+};
+
+#endif  // APM_LOOPER_H
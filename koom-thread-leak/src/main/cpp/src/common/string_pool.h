@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by shenvsv on 2021.
+ *
+ */
+
+#ifndef APM_STRING_POOL_H
+#define APM_STRING_POOL_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace koom {
+
+/**
+ * Reference counted string interning, thread items keep a 32 bit id instead
+ * of their own copy of call stacks and names. Id 0 is the empty string.
+ */
+class StringPool {
+ public:
+  static constexpr uint32_t kEmpty = 0;
+
+  StringPool() : entries_(1), bytes_(0) {}
+
+  uint32_t Intern(const std::string &str) {
+    if (str.empty()) return kEmpty;
+    auto it = index_.find(str);
+    if (it != index_.end()) {
+      entries_[it->second].refs++;
+      return it->second;
+    }
+    uint32_t id;
+    if (!free_ids_.empty()) {
+      id = free_ids_.back();
+      free_ids_.pop_back();
+    } else {
+      id = static_cast<uint32_t>(entries_.size());
+      entries_.emplace_back();
+    }
+    it = index_.emplace(str, id).first;
+    entries_[id].str = &it->first;
+    entries_[id].refs = 1;
+    bytes_ += str.size();
+    return id;
+  }
+
+  void Release(uint32_t id) {
+    if (id == kEmpty || id >= entries_.size()) return;
+    auto &entry = entries_[id];
+    if (entry.refs == 0 || --entry.refs > 0) return;
+    bytes_ -= entry.str->size();
+    index_.erase(*entry.str);
+    entry.str = nullptr;
+    free_ids_.push_back(id);
+  }
+
+  // Adds a reference to an already interned id
+  uint32_t Retain(uint32_t id) {
+    if (id != kEmpty && id < entries_.size() && entries_[id].refs > 0) {
+      entries_[id].refs++;
+    }
+    return id;
+  }
+
+  const std::string &Get(uint32_t id) const {
+    static const std::string empty;
+    if (id >= entries_.size() || entries_[id].str == nullptr) return empty;
+    return *entries_[id].str;
+  }
+
+  size_t Size() const { return index_.size(); }
+  size_t Bytes() const { return bytes_; }
+
+ private:
+  struct Entry {
+    const std::string *str = nullptr;
+    uint32_t refs = 0;
+  };
+
+  std::unordered_map<std::string, uint32_t> index_;
+  std::vector<Entry> entries_;
+  std::vector<uint32_t> free_ids_;
+  size_t bytes_;
+};
+}  // namespace koom
+#endif  // APM_STRING_POOL_H
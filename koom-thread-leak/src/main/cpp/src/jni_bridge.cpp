@@ -71,6 +71,26 @@ Java_com_kwai_performance_overhead_thread_monitor_NativeHandler_setThreadLeakDel
   koom::threadLeakDelay = delay;
 }
 
+JNIEXPORT void JNICALL
+Java_com_kwai_performance_overhead_thread_monitor_NativeHandler_setIdleThreadRounds(
+    JNIEnv *env, jclass thiz, jint rounds) {
+  koom::idleThreadRounds = rounds;
+}
+
+JNIEXPORT void JNICALL
+Java_com_kwai_performance_overhead_thread_monitor_NativeHandler_setMaxThreadRecords(
+    JNIEnv *env, jclass thiz, jint max) {
+  koom::maxThreadRecords = max;
+}
+
+JNIEXPORT void JNICALL
+Java_com_kwai_performance_overhead_thread_monitor_NativeHandler_setReportDir(
+    JNIEnv *env, jclass thiz, jstring dir) {
+  auto c_dir = env->GetStringUTFChars(dir, nullptr);
+  koom::reportDir.assign(c_dir);
+  env->ReleaseStringUTFChars(dir, c_dir);
+}
+
 JNIEXPORT void JNICALL
 Java_com_kwai_performance_overhead_thread_monitor_NativeHandler_enableNativeLog(
     JNIEnv *env, jclass jObject) {
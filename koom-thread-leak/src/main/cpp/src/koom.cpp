@@ -34,9 +34,13 @@ bool Log::log_enable = false;
 JavaVM *java_vm_;
 jclass native_handler_class;
 jmethodID java_callback_method;
+jmethodID java_file_callback_method;
 std::atomic<bool> isRunning;
 HookLooper *sHookLooper;
 long threadLeakDelay;
+int idleThreadRounds;
+int maxThreadRecords;
+std::string reportDir;
 
 void Init(JavaVM *vm, _JNIEnv *env) {
   java_vm_ = vm;
@@ -45,6 +49,8 @@ void Init(JavaVM *vm, _JNIEnv *env) {
   native_handler_class = static_cast<jclass>(env->NewGlobalRef(clazz));
   java_callback_method = env->GetStaticMethodID(
       native_handler_class, "nativeReport", "(Ljava/lang/String;)V");
+  java_file_callback_method = env->GetStaticMethodID(
+      native_handler_class, "nativeReportFile", "(Ljava/lang/String;)V");
   Util::Init();
   Log::info("koom", "Init, android api:%d", Util::AndroidApi());
   CallStack::Init();
@@ -97,4 +103,17 @@ void JavaCallback(const char *value, bool doAttach) {
   }
 }
 
+void JavaFileCallback(const char *path, bool doAttach) {
+  JNIEnv *env = GetEnv(doAttach);
+  if (env != nullptr && path != nullptr) {
+    Log::info("koom", "JavaFileCallback %s", path);
+    jstring string_path = env->NewStringUTF(path);
+    env->CallStaticVoidMethod(native_handler_class, java_file_callback_method,
+                              string_path);
+    env->DeleteLocalRef(string_path);
+  } else {
+    Log::info("koom", "JavaFileCallback fail no JNIEnv");
+  }
+}
+
 }  // namespace koom
\ No newline at end of file
@@ -32,12 +32,20 @@ extern jclass native_handler_class;
 
 extern jmethodID java_callback_method;
 
+extern jmethodID java_file_callback_method;
+
 extern HookLooper *sHookLooper;
 
 extern std::atomic<bool> isRunning;
 
 extern int64_t threadLeakDelay;
 
+extern int idleThreadRounds;
+
+extern int maxThreadRecords;
+
+extern std::string reportDir;
+
 extern void Init(JavaVM *vm, JNIEnv *p_env);
 
 extern void Start();
@@ -51,6 +59,8 @@ extern void Refresh();
 JNIEnv *GetEnv(bool doAttach = true);
 
 void JavaCallback(const char *value, bool doAttach = true);
+
+void JavaFileCallback(const char *path, bool doAttach = true);
 }  // namespace koom
 
 #endif  // APM_KOOM_H
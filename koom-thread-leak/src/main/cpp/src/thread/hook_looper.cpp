@@ -53,7 +53,15 @@ void HookLooper::handle(int what, void *data) {
     case ACTION_EXIT_THREAD: {
       koom::Log::info(looper_tag, "ExitThread");
       auto info = static_cast<HookExitInfo *>(data);
-      holder->ExitThread(info->thread_id, info->threadName, info->time);
+      holder->ExitThread(info->thread_id, info->thread_name, info->time,
+                         info->cpu_time, info->is_thread_detached);
+      delete info;
+      break;
+    }
+    case ACTION_SET_NAME: {
+      koom::Log::info(looper_tag, "SetThreadName");
+      auto info = static_cast<HookSetNameInfo *>(data);
+      holder->SetThreadName(info->thread_id, info->thread_name);
       delete info;
       break;
     }
@@ -61,6 +69,7 @@ void HookLooper::handle(int what, void *data) {
       koom::Log::info(looper_tag, "Refresh");
       auto info = static_cast<SimpleHookInfo *>(data);
       holder->ReportThreadLeak(info->time);
+      holder->ReportIdleThread();
       delete info;
       break;
     }
@@ -68,5 +77,10 @@ void HookLooper::handle(int what, void *data) {
     }
   }
 }
+void HookLooper::discard(int what, void *data) {
+  looper::discard(what, data);
+  // 只有退出消息是预分配的，消息本身就在 HookExitInfo 里
+  if (what == ACTION_EXIT_THREAD) delete static_cast<HookExitInfo *>(data);
+}
 void HookLooper::post(int what, void *data) { looper::post(what, data); }
 }  // namespace koom
\ No newline at end of file
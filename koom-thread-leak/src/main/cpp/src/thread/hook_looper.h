@@ -33,6 +33,7 @@ class HookLooper : public looper {
   HookLooper();
   ~HookLooper();
   void handle(int what, void *data);
+  void discard(int what, void *data);
   void post(int what, void *data);
 };
 }  // namespace koom
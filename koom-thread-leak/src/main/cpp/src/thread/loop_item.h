@@ -19,6 +19,9 @@
 
 #ifndef KOOM_KOOM_THREAD_LEAK_SRC_MAIN_CPP_SRC_THREAD_LOOP_ITEM_H_
 #define KOOM_KOOM_THREAD_LEAK_SRC_MAIN_CPP_SRC_THREAD_LOOP_ITEM_H_
+
+#include "common/looper.h"
+
 namespace koom {
 enum HookAction {
   ACTION_ADD_THREAD,
@@ -57,12 +60,30 @@ struct HookExitInfo {
   pthread_t thread_id;
   long long time;
   int tid;
-  std::string threadName;
-  HookExitInfo(pthread_t threadId, int tid, char *threadName, long long time) {
+  char thread_name[16];
+  int64_t cpu_time;
+  bool is_thread_detached;
+  // Allocated together with the info at thread start, the exit path (pthread
+  // key destructor) only fills the fields and posts it.
+  LooperMessage message;
+  HookExitInfo(pthread_t threadId, int tid) {
     this->thread_id = threadId;
     this->tid = tid;
-    this->threadName.assign(threadName);
-    this->time = time;
+    this->time = 0;
+    this->thread_name[0] = '\0';
+    this->cpu_time = 0;
+    this->is_thread_detached = false;
+    this->message = {};
+  }
+};
+
+struct HookSetNameInfo {
+  pthread_t thread_id;
+  char thread_name[16];
+  HookSetNameInfo(pthread_t threadId, const char *name) {
+    this->thread_id = threadId;
+    strncpy(this->thread_name, name, sizeof(this->thread_name) - 1);
+    this->thread_name[sizeof(this->thread_name) - 1] = '\0';
   }
 };
 
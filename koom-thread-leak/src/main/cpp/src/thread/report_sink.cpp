@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by shenvsv on 2021.
+ *
+ */
+
+#include "report_sink.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "common/log.h"
+#include "common/util.h"
+#include "koom.h"
+
+namespace koom {
+
+const char *sink_tag = "koom-report";
+
+JsonReportSink::JsonReportSink() : writer_(buffer_), count_(0) {}
+
+void JsonReportSink::Begin(const char *leak_type, uint64_t evicted,
+                           int64_t census_cost) {
+  writer_.StartObject();
+
+  writer_.Key("leakType");
+  writer_.String(leak_type);
+
+  writer_.Key("evicted");
+  writer_.Uint64(evicted);
+
+  if (census_cost >= 0) {
+    writer_.Key("censusCost");
+    writer_.Int64(census_cost);
+  }
+
+  writer_.Key("threads");
+  writer_.StartArray();
+}
+
+void JsonReportSink::Thread(const ThreadRecord &record) {
+  //写入单个thread数据
+  writer_.StartObject();
+
+  writer_.Key("tid");
+  writer_.Uint(record.tid);
+
+  writer_.Key("interal_id");
+  writer_.Uint64(record.internal_id);
+
+  writer_.Key("createTime");
+  writer_.Int64(record.create_time);
+
+  writer_.Key("startTime");
+  writer_.Int64(record.start_time);
+
+  writer_.Key("endTime");
+  writer_.Int64(record.end_time);
+
+  writer_.Key("cpuTime");
+  writer_.Int64(record.cpu_time);
+
+  if (record.idle_rounds > 0) {
+    writer_.Key("idleRounds");
+    writer_.Int(record.idle_rounds);
+
+    writer_.Key("state");
+    writer_.String(&record.state, 1);
+  }
+
+  writer_.Key("name");
+  writer_.String(record.name->c_str());
+
+  writer_.Key("family");
+  writer_.String(record.family->c_str());
+
+  writer_.Key("createCallStack");
+  writer_.String(record.stack->c_str());
+
+  writer_.EndObject();
+  count_++;
+}
+
+void JsonReportSink::End() {
+  writer_.EndArray();
+  writer_.EndObject();
+  if (count_ > 0) {
+    JavaCallback(buffer_.GetString());
+  }
+}
+
+BinaryReportSink::BinaryReportSink(const std::string &dir)
+    : dir_(dir),
+      evicted_(0),
+      census_cost_(-1),
+      fd_(-1),
+      failed_(false),
+      count_(0),
+      used_(0) {}
+
+BinaryReportSink::~BinaryReportSink() {
+  if (fd_ >= 0) {
+    close(fd_);
+    unlink(path_.c_str());
+  }
+}
+
+void BinaryReportSink::Begin(const char *leak_type, uint64_t evicted,
+                             int64_t census_cost) {
+  // 大多数刷新没有可报的线程，等第一个线程来了再建文件
+  leak_type_ = leak_type;
+  evicted_ = evicted;
+  census_cost_ = census_cost;
+}
+
+void BinaryReportSink::Open() {
+  char name[64];
+  snprintf(name, sizeof(name), "/thread_report_%lld.tmp",
+           Util::CurrentTimeNs());
+  path_ = dir_ + name;
+  fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd_ < 0) {
+    Log::error(sink_tag, "open %s fail %d", path_.c_str(), errno);
+    failed_ = true;
+    return;
+  }
+
+  Put("KTRP", 4);
+  uint16_t version = kVersion, flags = 0;
+  Put(&version, sizeof(version));
+  Put(&flags, sizeof(flags));
+
+  RecordHeader(kRecordReport, kFieldHeaderSize * 3 + leak_type_.size() +
+                                  sizeof(uint64_t) * 2);
+  Field(kReportLeakType, leak_type_.data(), leak_type_.size());
+  FieldU64(kReportEvicted, evicted_);
+  FieldU64(kReportCensusCost, (uint64_t)census_cost_);
+}
+
+void BinaryReportSink::Thread(const ThreadRecord &record) {
+  if (fd_ < 0 && !failed_) Open();
+  if (failed_) return;
+  size_t length = kFieldHeaderSize * 9 + sizeof(uint32_t) +
+                  sizeof(uint64_t) * 5 + record.name->size() +
+                  record.family->size() + record.stack->size();
+  if (record.idle_rounds > 0) {
+    length += kFieldHeaderSize * 2 + sizeof(uint32_t) + 1;
+  }
+  RecordHeader(kRecordThread, length);
+  FieldU32(kThreadTid, (uint32_t)record.tid);
+  FieldU64(kThreadInternalId, record.internal_id);
+  FieldU64(kThreadCreateTime, (uint64_t)record.create_time);
+  FieldU64(kThreadStartTime, (uint64_t)record.start_time);
+  FieldU64(kThreadEndTime, (uint64_t)record.end_time);
+  FieldU64(kThreadCpuTime, (uint64_t)record.cpu_time);
+  if (record.idle_rounds > 0) {
+    FieldU32(kThreadIdleRounds, (uint32_t)record.idle_rounds);
+    Field(kThreadState, &record.state, 1);
+  }
+  Field(kThreadName, record.name->data(), record.name->size());
+  Field(kThreadFamily, record.family->data(), record.family->size());
+  Field(kThreadCreateCallStack, record.stack->data(), record.stack->size());
+  count_++;
+}
+
+void BinaryReportSink::End() {
+  if (fd_ < 0) return;
+  RecordHeader(kRecordEnd, kFieldHeaderSize + sizeof(uint32_t));
+  FieldU32(kEndCount, count_);
+  Flush();
+  bool ok = !failed_ && fsync(fd_) == 0;
+  close(fd_);
+  fd_ = -1;
+  if (!ok) {
+    unlink(path_.c_str());
+    return;
+  }
+  // 写完再改名，java 侧只会看到完整的文件
+  std::string final_path = path_.substr(0, path_.size() - 4) + ".bin";
+  if (rename(path_.c_str(), final_path.c_str()) != 0) {
+    Log::error(sink_tag, "rename %s fail %d", path_.c_str(), errno);
+    unlink(path_.c_str());
+    return;
+  }
+  JavaFileCallback(final_path.c_str());
+}
+
+void BinaryReportSink::RecordHeader(uint8_t type, size_t length) {
+  auto length32 = (uint32_t)length;
+  Put(&type, sizeof(type));
+  Put(&length32, sizeof(length32));
+}
+
+void BinaryReportSink::Field(uint8_t id, const void *value, size_t length) {
+  auto length32 = (uint32_t)length;
+  Put(&id, sizeof(id));
+  Put(&length32, sizeof(length32));
+  Put(value, length);
+}
+
+void BinaryReportSink::FieldU32(uint8_t id, uint32_t value) {
+  Field(id, &value, sizeof(value));
+}
+
+void BinaryReportSink::FieldU64(uint8_t id, uint64_t value) {
+  Field(id, &value, sizeof(value));
+}
+
+void BinaryReportSink::Put(const void *data, size_t length) {
+  auto *bytes = static_cast<const char *>(data);
+  while (length > 0 && !failed_) {
+    if (used_ == kBufferSize) Flush();
+    size_t n = std::min(length, kBufferSize - used_);
+    memcpy(buffer_ + used_, bytes, n);
+    used_ += n;
+    bytes += n;
+    length -= n;
+  }
+}
+
+void BinaryReportSink::Flush() {
+  size_t offset = 0;
+  while (offset < used_ && !failed_) {
+    ssize_t written = write(fd_, buffer_ + offset, used_ - offset);
+    if (written > 0) {
+      offset += written;
+    } else if (written < 0 && errno == EINTR) {
+      continue;
+    } else {
+      Log::error(sink_tag, "write %s fail %d", path_.c_str(), errno);
+      failed_ = true;
+    }
+  }
+  used_ = 0;
+}
+}  // namespace koom
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by shenvsv on 2021.
+ *
+ */
+
+#ifndef APM_REPORT_SINK_H
+#define APM_REPORT_SINK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+namespace koom {
+
+// One thread of a report, strings point into ThreadHolder's pools
+struct ThreadRecord {
+  int tid;
+  uint64_t internal_id;
+  int64_t create_time;
+  int64_t start_time;
+  int64_t end_time;
+  int64_t cpu_time;
+  // only set by the idle thread census
+  int idle_rounds;
+  char state;
+  const std::string *name;
+  const std::string *family;
+  const std::string *stack;
+};
+
+class ReportSink {
+ public:
+  virtual ~ReportSink() = default;
+  // census_cost < 0 means the report was not produced by the census
+  virtual void Begin(const char *leak_type, uint64_t evicted,
+                     int64_t census_cost) = 0;
+  virtual void Thread(const ThreadRecord &record) = 0;
+  // Finishes the report and hands it to java if any thread was written
+  virtual void End() = 0;
+};
+
+/**
+ * Builds the whole report as a json string and passes it to
+ * NativeHandler.nativeReport.
+ */
+class JsonReportSink : public ReportSink {
+ public:
+  JsonReportSink();
+  void Begin(const char *leak_type, uint64_t evicted,
+             int64_t census_cost) override;
+  void Thread(const ThreadRecord &record) override;
+  void End() override;
+
+ private:
+  rapidjson::StringBuffer buffer_;
+  rapidjson::Writer<rapidjson::StringBuffer> writer_;
+  int count_;
+};
+
+/**
+ * Streams the report to a file in dir, only the path is passed to
+ * NativeHandler.nativeReportFile. Memory use is bounded by the write buffer,
+ * no matter how many threads and how long the stacks are.
+ *
+ * Format (little endian), decoded by ThreadReportDecoder on java side:
+ *   header:  "KTRP" u16 version u16 flags
+ *   record:  u8 type, u32 payload length, payload
+ *   payload: fields of u8 id, u32 length, value
+ * Unknown records and fields are skipped by the decoder, new fields only need
+ * a new id, incompatible changes bump kVersion. The file is only created once
+ * the first thread is written, empty reports cost nothing.
+ */
+class BinaryReportSink : public ReportSink {
+ public:
+  static constexpr uint16_t kVersion = 1;
+
+  enum RecordType : uint8_t {
+    kRecordReport = 1,
+    kRecordThread = 2,
+    kRecordEnd = 3,
+  };
+
+  enum ReportField : uint8_t {
+    kReportLeakType = 1,
+    kReportEvicted = 2,
+    kReportCensusCost = 3,
+  };
+
+  enum ThreadField : uint8_t {
+    kThreadTid = 1,
+    kThreadInternalId = 2,
+    kThreadCreateTime = 3,
+    kThreadStartTime = 4,
+    kThreadEndTime = 5,
+    kThreadCpuTime = 6,
+    kThreadIdleRounds = 7,
+    kThreadState = 8,
+    kThreadName = 9,
+    kThreadCreateCallStack = 10,
+    kThreadFamily = 11,
+  };
+
+  enum EndField : uint8_t {
+    kEndCount = 1,
+  };
+
+  explicit BinaryReportSink(const std::string &dir);
+  ~BinaryReportSink() override;
+  void Begin(const char *leak_type, uint64_t evicted,
+             int64_t census_cost) override;
+  void Thread(const ThreadRecord &record) override;
+  void End() override;
+
+ private:
+  static constexpr size_t kFieldHeaderSize = 5;
+  static constexpr size_t kBufferSize = 16 * 1024;
+
+  void Open();
+  void RecordHeader(uint8_t type, size_t length);
+  void Field(uint8_t id, const void *value, size_t length);
+  void FieldU32(uint8_t id, uint32_t value);
+  void FieldU64(uint8_t id, uint64_t value);
+  void Put(const void *data, size_t length);
+  void Flush();
+
+  std::string dir_;
+  std::string path_;
+  std::string leak_type_;
+  uint64_t evicted_;
+  int64_t census_cost_;
+  int fd_;
+  bool failed_;
+  uint32_t count_;
+  size_t used_;
+  char buffer_[kBufferSize];
+};
+}  // namespace koom
+#endif  // APM_REPORT_SINK_H
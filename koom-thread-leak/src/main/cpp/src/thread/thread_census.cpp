@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by shenvsv on 2021.
+ *
+ */
+
+#include "thread_census.h"
+
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "common/log.h"
+#include "common/util.h"
+
+namespace koom {
+
+const char *census_tag = "koom-census";
+
+struct LinuxDirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+static bool ParseTid(const char *name, int *tid) {
+  int value = 0;
+  if (*name == '\0') return false;
+  for (; *name != '\0'; name++) {
+    if (*name < '0' || *name > '9') return false;
+    value = value * 10 + (*name - '0');
+  }
+  *tid = value;
+  return true;
+}
+
+ThreadCensus::ThreadCensus()
+    : task_dir_fd_(-1),
+      idle_rounds_(0),
+      generation_(0),
+      cached_fds_(0),
+      last_cost_ns_(0) {}
+
+ThreadCensus::~ThreadCensus() {
+  for (auto &task : tasks_) {
+    CloseTask(task.second);
+  }
+  if (task_dir_fd_ >= 0) close(task_dir_fd_);
+}
+
+bool ThreadCensus::OpenTaskDir() {
+  if (task_dir_fd_ >= 0) return true;
+  task_dir_fd_ =
+      open("/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (task_dir_fd_ < 0) {
+    Log::error(census_tag, "open task dir fail %d", errno);
+    return false;
+  }
+  return true;
+}
+
+int ThreadCensus::OpenTaskFile(int tid, const char *file) {
+  char path[32];
+  snprintf(path, sizeof(path), "%d/%s", tid, file);
+  return openat(task_dir_fd_, path, O_RDONLY | O_CLOEXEC);
+}
+
+void ThreadCensus::CloseTask(TaskStat &stat) {
+  if (stat.fd >= 0) {
+    close(stat.fd);
+    stat.fd = -1;
+    cached_fds_--;
+  }
+}
+
+// schedstat: "<sum_exec_runtime ns> <run_delay ns> <pcount>"
+bool ThreadCensus::ReadExecTime(int tid, TaskStat &stat) {
+  int fd = stat.fd;
+  if (fd < 0) {
+    fd = OpenTaskFile(tid, "schedstat");
+    if (fd < 0) return false;
+    if (cached_fds_ < kMaxCachedFds) {
+      stat.fd = fd;
+      cached_fds_++;
+    }
+  }
+  char buf[64];
+  ssize_t len = TEMP_FAILURE_RETRY(pread(fd, buf, sizeof(buf) - 1, 0));
+  if (stat.fd != fd) close(fd);
+  if (len <= 0) return false;
+  buf[len] = '\0';
+  stat.exec_time = strtoull(buf, nullptr, 10);
+  return true;
+}
+
+void ThreadCensus::Sample(std::vector<IdleThread> &idle_threads) {
+  if (!Enabled() || !OpenTaskDir()) return;
+  auto begin = Util::CurrentTimeNs();
+  generation_++;
+
+  if (lseek(task_dir_fd_, 0, SEEK_SET) != 0) return;
+  alignas(LinuxDirent64) char buf[4096];
+  for (;;) {
+    auto len = syscall(SYS_getdents64, task_dir_fd_, buf, sizeof(buf));
+    if (len <= 0) break;
+    for (long pos = 0; pos < len;) {
+      auto *entry = reinterpret_cast<LinuxDirent64 *>(buf + pos);
+      pos += entry->d_reclen;
+      int tid;
+      if (!ParseTid(entry->d_name, &tid)) continue;
+
+      auto it = tasks_.find(tid);
+      bool fresh = it == tasks_.end();
+      if (fresh) {
+        it = tasks_.emplace(tid, TaskStat{-1, 0, 0, 0, false}).first;
+      }
+      auto &stat = it->second;
+      uint64_t last_exec_time = stat.exec_time;
+      if (!ReadExecTime(tid, stat)) {
+        // exited between getdents and pread, dropped below
+        continue;
+      }
+      stat.generation = generation_;
+      if (fresh || stat.exec_time != last_exec_time) {
+        stat.idle_rounds = 0;
+        stat.reported = false;
+        continue;
+      }
+      stat.idle_rounds++;
+      if (stat.idle_rounds >= idle_rounds_ && !stat.reported) {
+        stat.reported = true;
+        idle_threads.push_back({tid, stat.idle_rounds, stat.exec_time});
+      }
+    }
+  }
+
+  for (auto it = tasks_.begin(); it != tasks_.end();) {
+    if (it->second.generation != generation_) {
+      CloseTask(it->second);
+      it = tasks_.erase(it);
+    } else {
+      it++;
+    }
+  }
+
+  last_cost_ns_ = Util::CurrentTimeNs() - begin;
+  Log::info(census_tag, "Sample tasks:%zu idle:%zu cost:%lldns", tasks_.size(),
+            idle_threads.size(), (long long)last_cost_ns_);
+}
+
+// stat: "<tid> (<comm>) <state> ..."，comm 中可能包含空格和括号
+bool ThreadCensus::ReadStat(int tid, char *state, char *name,
+                            size_t name_len) {
+  if (!OpenTaskDir()) return false;
+  int fd = OpenTaskFile(tid, "stat");
+  if (fd < 0) return false;
+  char buf[512];
+  ssize_t len = TEMP_FAILURE_RETRY(pread(fd, buf, sizeof(buf) - 1, 0));
+  close(fd);
+  if (len <= 0) return false;
+  buf[len] = '\0';
+  char *open_paren = strchr(buf, '(');
+  char *close_paren = strrchr(buf, ')');
+  if (open_paren == nullptr || close_paren == nullptr ||
+      close_paren < open_paren || close_paren + 2 >= buf + len) {
+    return false;
+  }
+  size_t comm_len = close_paren - open_paren - 1;
+  if (comm_len >= name_len) comm_len = name_len - 1;
+  memcpy(name, open_paren + 1, comm_len);
+  name[comm_len] = '\0';
+  *state = close_paren[2];
+  return true;
+}
+}  // namespace koom
@@ -1,5 +1,6 @@
 #include "thread_holder.h"
 
+#include <cctype>
 #include <filesystem>
 #include <regex>
 
@@ -10,21 +11,80 @@ namespace koom {
 
 const char *holder_tag = "koom-holder";
 
+ThreadItem &ThreadHolder::Insert(FlatMap<pthread_t, ThreadItem> &map,
+                                 pthread_t threadId) {
+  auto *item = map.Find(threadId);
+  if (item != nullptr) {
+    stackPool.Release(item->stack_id);
+    namePool.Release(item->name_id);
+    namePool.Release(item->family_id);
+  } else {
+    if (maxThreadRecords > 0 && map.Size() >= (size_t)maxThreadRecords) {
+      EvictOldest(map);
+    }
+    item = &map[threadId];
+  }
+  *item = ThreadItem();
+  item->seq = nextSeq++;
+  return *item;
+}
+
+void ThreadHolder::Erase(FlatMap<pthread_t, ThreadItem> &map,
+                         pthread_t threadId) {
+  auto *item = map.Find(threadId);
+  if (item == nullptr) return;
+  stackPool.Release(item->stack_id);
+  namePool.Release(item->name_id);
+  namePool.Release(item->family_id);
+  map.Erase(threadId);
+}
+
+void ThreadHolder::EvictOldest(FlatMap<pthread_t, ThreadItem> &map) {
+  pthread_t oldest{};
+  uint64_t oldest_seq = UINT64_MAX;
+  map.ForEach([&](pthread_t key, ThreadItem &item) {
+    if (item.seq < oldest_seq) {
+      oldest_seq = item.seq;
+      oldest = key;
+    }
+  });
+  if (oldest_seq == UINT64_MAX) return;
+  koom::Log::info(holder_tag, "EvictOldest tid:%p", oldest);
+  Erase(map, oldest);
+  evictedCount++;
+}
+
+// 线程池里的线程只有末尾的序号不同，把它折叠成 N 作为线程族，
+// 例如 pool-3-thread-12 -> pool-3-thread-N，Binder:1234_5 -> Binder:1234_N
+static std::string NameFamily(const char *name) {
+  std::string family(name);
+  size_t end = family.size();
+  size_t begin = end;
+  while (begin > 0 && isdigit(static_cast<unsigned char>(family[begin - 1]))) {
+    begin--;
+  }
+  if (begin == end || begin == 0) return family;
+  family.replace(begin, end - begin, "N");
+  return family;
+}
+
+void ThreadHolder::UpdateName(ThreadItem &item, const char *threadName) {
+  namePool.Release(item.name_id);
+  namePool.Release(item.family_id);
+  item.name_id = namePool.Intern(threadName);
+  item.family_id = namePool.Intern(NameFamily(threadName));
+}
+
 void ThreadHolder::AddThread(int tid, pthread_t threadId, bool isThreadDetached,
                              int64_t start_time, ThreadCreateArg *create_arg) {
-  bool valid = threadMap.count(threadId) > 0;
-  if (valid) return;
+  bool valid = threadMap.Find(threadId) != nullptr;
+  if (valid) {
+    delete create_arg;
+    return;
+  }
 
   koom::Log::info(holder_tag, "AddThread tid:%d pthread_t:%p", tid, threadId);
-  auto &item = threadMap[threadId];
-  item.Clear();
-  item.thread_internal_id = threadId;
-  item.thread_detached = isThreadDetached;
-  item.startTime = start_time;
-  item.create_time = create_arg->time;
-  item.id = tid;
-  std::string &stack = item.create_call_stack;
-  stack.assign("");
+  std::string stack;
   try {
     // native stack
     int ignoreLines = 0;
@@ -57,120 +117,162 @@ void ThreadHolder::AddThread(int tid, pthread_t threadId, bool isThreadDetached,
   } catch (const std::bad_alloc &) {
     stack.assign("error:bad_alloc");
   }
+
+  auto &item = Insert(threadMap, threadId);
+  item.thread_internal_id = threadId;
+  item.thread_detached = isThreadDetached;
+  item.startTime = start_time;
+  item.create_time = create_arg->time;
+  item.id = tid;
+  // 同一位置创建的线程共享一份堆栈
+  item.stack_id = stackPool.Intern(stack);
   delete create_arg;
-  koom::Log::info(holder_tag, "AddThread finish");
+  koom::Log::info(holder_tag, "AddThread finish, stacks:%zu bytes:%zu",
+                  stackPool.Size(), stackPool.Bytes());
 }
 
 void ThreadHolder::JoinThread(pthread_t threadId) {
-  bool valid = threadMap.count(threadId) > 0;
+  auto *item = threadMap.Find(threadId);
   koom::Log::info(holder_tag, "JoinThread tid:%p", threadId);
-  if (valid) {
-    threadMap[threadId].thread_detached = true;
+  if (item != nullptr) {
+    item->thread_detached = true;
   } else {
-    leakThreadMap.erase(threadId);
+    Erase(leakThreadMap, threadId);
   }
 }
 
-void ThreadHolder::ExitThread(pthread_t threadId, std::string &threadName,
-                              long long int time) {
-  bool valid = threadMap.count(threadId) > 0;
-  if (!valid) return;
-  auto &item = threadMap[threadId];
+void ThreadHolder::ExitThread(pthread_t threadId, const char *threadName,
+                              long long time, int64_t cpuTime,
+                              bool isThreadDetached) {
+  auto *found = threadMap.Find(threadId);
+  if (found == nullptr) return;
+  auto &item = *found;
   koom::Log::info(holder_tag, "ExitThread tid:%p name:%s", threadId,
-                  item.name.c_str());
+                  threadName);
 
   item.exitTime = time;
-  item.name.assign(threadName);
+  item.cpuTime = cpuTime;
+  UpdateName(item, threadName);
+  if (isThreadDetached) item.thread_detached = true;
   if (!item.thread_detached) {
     // 泄露了
     koom::Log::error(holder_tag,
                      "Exited thread Leak! Not joined or detached!\n tid:%p",
                      threadId);
-    leakThreadMap[threadId] = item;
+    // 字符串的引用随 item 一起转移到 leakThreadMap
+    ThreadItem leak = item;
+    threadMap.Erase(threadId);
+    auto &leak_item = Insert(leakThreadMap, threadId);
+    uint64_t seq = leak_item.seq;
+    leak_item = leak;
+    leak_item.seq = seq;
+  } else {
+    Erase(threadMap, threadId);
   }
-  threadMap.erase(threadId);
   koom::Log::info(holder_tag, "ExitThread finish");
 }
 
 void ThreadHolder::DetachThread(pthread_t threadId) {
-  bool valid = threadMap.count(threadId) > 0;
+  auto *item = threadMap.Find(threadId);
   koom::Log::info(holder_tag, "DetachThread tid:%p", threadId);
-  if (valid) {
-    threadMap[threadId].thread_detached = true;
+  if (item != nullptr) {
+    item->thread_detached = true;
   } else {
-    leakThreadMap.erase(threadId);
+    Erase(leakThreadMap, threadId);
   }
 }
 
-void ThreadHolder::WriteThreadJson(
-    rapidjson::Writer<rapidjson::StringBuffer> &writer,
-    ThreadItem &thread_item) {
-  //写入单个thread数据
-  writer.StartObject();
-
-  writer.Key("tid");
-  writer.Uint(thread_item.id);
-
-  writer.Key("interal_id");
-  writer.Uint(thread_item.thread_internal_id);
-
-  writer.Key("createTime");
-  writer.Int64(thread_item.create_time);
-
-  writer.Key("startTime");
-  writer.Int64(thread_item.startTime);
-
-  writer.Key("endTime");
-  writer.Int64(thread_item.exitTime);
-
-  writer.Key("name");
-  writer.String(thread_item.name.c_str());
+void ThreadHolder::SetThreadName(pthread_t threadId, const char *threadName) {
+  auto *item = threadMap.Find(threadId);
+  koom::Log::info(holder_tag, "SetThreadName tid:%p name:%s", threadId,
+                  threadName);
+  if (item != nullptr) UpdateName(*item, threadName);
+}
 
-  // 这里先注释掉，确认一下是不是这里的转换有问题，是的话，再处理
-  writer.Key("createCallStack");
-  auto stack = thread_item.create_call_stack.c_str();
-  writer.String(stack);
+std::unique_ptr<ReportSink> ThreadHolder::CreateSink() {
+  if (reportDir.empty()) {
+    return std::make_unique<JsonReportSink>();
+  }
+  return std::make_unique<BinaryReportSink>(reportDir);
+}
 
-  writer.EndObject();
+ThreadRecord ThreadHolder::MakeRecord(ThreadItem &thread_item) {
+  ThreadRecord record{};
+  record.tid = thread_item.id;
+  record.internal_id = (uint64_t)thread_item.thread_internal_id;
+  record.create_time = thread_item.create_time;
+  record.start_time = thread_item.startTime;
+  record.end_time = thread_item.exitTime;
+  record.cpu_time = thread_item.cpuTime;
+  record.name = &namePool.Get(thread_item.name_id);
+  record.family = &namePool.Get(thread_item.family_id);
+  record.stack = &stackPool.Get(thread_item.stack_id);
+  return record;
 }
 
 void ThreadHolder::ReportThreadLeak(long long time) {
   int needReport{};
   const char *type = "detach_leak";
   auto delay = threadLeakDelay * 1000000LL;  // ms -> ns
-  rapidjson::StringBuffer jsonBuf;
-  rapidjson::Writer<rapidjson::StringBuffer> writer(jsonBuf);
-  writer.StartObject();
-
-  writer.Key("leakType");
-  writer.String(type);
+  auto sink = CreateSink();
+  sink->Begin(type, evictedCount, -1);
 
-  writer.Key("threads");
-  writer.StartArray();
-
-  for (auto &item : leakThreadMap) {
-    if (item.second.exitTime + delay < time && !item.second.thread_reported) {
+  leakThreadMap.ForEach([&](pthread_t, ThreadItem &item) {
+    if (item.exitTime + delay < time && !item.thread_reported) {
       koom::Log::info(holder_tag, "ReportThreadLeak %ld, %ld, %ld",
-                      item.second.exitTime, time, delay);
+                      item.exitTime, time, delay);
       needReport++;
-      item.second.thread_reported = true;
-      WriteThreadJson(writer, item.second);
+      item.thread_reported = true;
+      sink->Thread(MakeRecord(item));
     }
-  }
-  writer.EndArray();
-  writer.EndObject();
+  });
+  sink->End();
   koom::Log::info(holder_tag, "ReportThreadLeak %d", needReport);
   if (needReport) {
-    JavaCallback(jsonBuf.GetString());
     // clean up
-    auto it = leakThreadMap.begin();
-    for (; it != leakThreadMap.end();) {
-      if (it->second.thread_reported) {
-        leakThreadMap.erase(it++);
-      } else {
-        it++;
-      }
+    std::vector<pthread_t> reported;
+    leakThreadMap.ForEach([&](pthread_t key, ThreadItem &item) {
+      if (item.thread_reported) reported.push_back(key);
+    });
+    for (auto key : reported) {
+      Erase(leakThreadMap, key);
+    }
+  }
+}
+
+void ThreadHolder::ReportIdleThread() {
+  census.SetIdleRounds(idleThreadRounds);
+  if (!census.Enabled()) return;
+  std::vector<IdleThread> idle_threads;
+  census.Sample(idle_threads);
+  if (idle_threads.empty()) return;
+
+  // 只上报由 hook 创建、有创建堆栈的线程，系统常驻线程本身就是空闲的
+  FlatMap<int, ThreadItem *> tid_items;
+  threadMap.ForEach([&](pthread_t, ThreadItem &item) {
+    if (item.id != 0) tid_items[item.id] = &item;
+  });
+
+  auto sink = CreateSink();
+  sink->Begin("idle_thread", evictedCount, census.LastCostNs());
+  int needReport{};
+  for (auto &idle : idle_threads) {
+    auto found = tid_items.Find(idle.tid);
+    if (found == nullptr) continue;
+    auto &item = **found;
+    char state = '?';
+    char name[64]{};
+    if (census.ReadStat(idle.tid, &state, name, sizeof(name))) {
+      UpdateName(item, name);
     }
+    needReport++;
+    auto record = MakeRecord(item);
+    record.cpu_time = (int64_t)idle.exec_time;
+    record.idle_rounds = idle.idle_rounds;
+    record.state = state;
+    sink->Thread(record);
   }
+  sink->End();
+  koom::Log::info(holder_tag, "ReportIdleThread %d", needReport);
 }
 }  // namespace koom
\ No newline at end of file
@@ -20,13 +20,16 @@
 #ifndef APM_RESOURCEDATA_H
 #define APM_RESOURCEDATA_H
 
-#include <map>
+#include <memory>
 
 #include "common/callstack.h"
+#include "common/flat_map.h"
 #include "common/log.h"
+#include "common/string_pool.h"
 #include "common/util.h"
 #include "loop_item.h"
-#include "rapidjson/writer.h"
+#include "report_sink.h"
+#include "thread_census.h"
 #include "thread_item.h"
 
 namespace koom {
@@ -36,19 +39,28 @@ class ThreadHolder {
   void AddThread(int tid, pthread_t pthread, bool isThreadDetached,
                  int64_t start_time, ThreadCreateArg* create_arg);
   void JoinThread(pthread_t threadId);
-  void ExitThread(pthread_t threadId, std::string& threadName, long long int i);
+  void ExitThread(pthread_t threadId, const char* threadName, long long time,
+                  int64_t cpuTime, bool isThreadDetached);
   void DetachThread(pthread_t threadId);
+  void SetThreadName(pthread_t threadId, const char* threadName);
   void ReportThreadLeak(long long time);
+  void ReportIdleThread();
 
  private:
-  std::map<pthread_t, ThreadItem> leakThreadMap;
-  std::map<pthread_t, ThreadItem> threadMap;
-  void WriteThreadJson(rapidjson::Writer<rapidjson::StringBuffer>& writer,
-                       ThreadItem& thread_item);
-  void Clear() {
-    leakThreadMap.clear();
-    threadMap.clear();
-  }
+  FlatMap<pthread_t, ThreadItem> leakThreadMap;
+  FlatMap<pthread_t, ThreadItem> threadMap;
+  StringPool stackPool;
+  StringPool namePool;
+  ThreadCensus census;
+  uint64_t nextSeq{};
+  uint64_t evictedCount{};
+
+  ThreadItem &Insert(FlatMap<pthread_t, ThreadItem> &map, pthread_t threadId);
+  void Erase(FlatMap<pthread_t, ThreadItem> &map, pthread_t threadId);
+  void EvictOldest(FlatMap<pthread_t, ThreadItem> &map);
+  void UpdateName(ThreadItem &item, const char *threadName);
+  std::unique_ptr<ReportSink> CreateSink();
+  ThreadRecord MakeRecord(ThreadItem& thread_item);
 };
 }  // namespace koom
 #endif  // APM_RESOURCEDATA_H
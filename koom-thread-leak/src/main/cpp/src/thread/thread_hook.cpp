@@ -30,6 +30,10 @@ namespace koom {
 
 const char *thread_tag = "thread-hook";
 
+pthread_key_t ThreadHooker::exit_key;
+bool ThreadHooker::exit_key_valid = false;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
 const char *ignore_libs[] = {"koom-thread", "liblog.so", "perfd", "memtrack"};
 
 static bool IsLibIgnored(const std::string &lib) {
@@ -90,8 +94,10 @@ bool ThreadHooker::RegisterSo(const std::string &lib, int source) {
                  reinterpret_cast<void *>(HookThreadDetach), nullptr);
   xhook_register(lib_ctr, "pthread_join",
                  reinterpret_cast<void *>(HookThreadJoin), nullptr);
-  xhook_register(lib_ctr, "pthread_exit",
-                 reinterpret_cast<void *>(HookThreadExit), nullptr);
+  xhook_register(lib_ctr, "pthread_setname_np",
+                 reinterpret_cast<void *>(HookThreadSetName), nullptr);
+  xhook_register(lib_ctr, "prctl", reinterpret_cast<void *>(HookPrctl),
+                 nullptr);
 
   return true;
 }
@@ -111,14 +117,18 @@ int ThreadHooker::HookThreadCreate(pthread_t *tidp, const pthread_attr_t *attr,
     koom::CallStack::FastUnwind(thread_create_arg->pc,
                                 koom::Constant::kMaxCallStackDepth);
     thread_create_arg->stack_time = Util::CurrentTimeNs() - time;
-    return pthread_create(tidp, attr,
-                          reinterpret_cast<void *(*)(void *)>(HookThreadStart),
+    return pthread_create(tidp, attr, HookThreadStart,
                           reinterpret_cast<void *>(hook_arg));
   }
   return pthread_create(tidp, attr, start_rtn, arg);
 }
 
-ALWAYS_INLINE void ThreadHooker::HookThreadStart(void *arg) {
+void ThreadHooker::InitExitKey() {
+  exit_key_valid = pthread_key_create(&exit_key, OnThreadExit) == 0;
+  koom::Log::info(thread_tag, "InitExitKey %d", exit_key_valid);
+}
+
+ALWAYS_INLINE void *ThreadHooker::HookThreadStart(void *arg) {
   koom::Log::info(thread_tag, "HookThreadStart");
   auto *hookArg = (StartRtnArg *)arg;
   pthread_attr_t attr;
@@ -126,6 +136,7 @@ ALWAYS_INLINE void ThreadHooker::HookThreadStart(void *arg) {
   int state = 0;
   if (pthread_getattr_np(self, &attr) == 0) {
     pthread_attr_getdetachstate(&attr, &state);
+    pthread_attr_destroy(&attr);
   }
   int tid = (int)syscall(SYS_gettid);
   koom::Log::info(thread_tag, "HookThreadStart %p, %d, %d", self, tid,
@@ -135,10 +146,20 @@ ALWAYS_INLINE void ThreadHooker::HookThreadStart(void *arg) {
                               hookArg->thread_create_arg);
 
   sHookLooper->post(ACTION_ADD_THREAD, info);
+
+  // 线程退出（return 或 pthread_exit）时由 key 的析构函数上报
+  pthread_once(&exit_key_once, InitExitKey);
+  if (exit_key_valid) {
+    auto exit_info = new HookExitInfo(self, tid);
+    if (pthread_setspecific(exit_key, exit_info) != 0) {
+      delete exit_info;
+    }
+  }
+
   void *(*start_rtn)(void *) = hookArg->start_rtn;
   void *routine_arg = hookArg->arg;
   delete hookArg;
-  start_rtn(routine_arg);
+  return start_rtn(routine_arg);
 }
 
 int ThreadHooker::HookThreadDetach(pthread_t t) {
@@ -163,17 +184,55 @@ int ThreadHooker::HookThreadJoin(pthread_t t, void **return_value) {
   return pthread_join(t, return_value);
 }
 
-void ThreadHooker::HookThreadExit(void *return_value) {
-  if (!hookEnabled()) pthread_exit(return_value);
+int ThreadHooker::HookThreadSetName(pthread_t t, const char *name) {
+  int result = pthread_setname_np(t, name);
+  if (result == 0 && hookEnabled() && name != nullptr) {
+    koom::Log::info(thread_tag, "HookThreadSetName %p %s", t, name);
+    sHookLooper->post(ACTION_SET_NAME, new HookSetNameInfo(t, name));
+  }
+  return result;
+}
 
-  koom::Log::info(thread_tag, "HookThreadExit");
-  int tid = (int)syscall(SYS_gettid);
-  char thread_name[16]{};
-  prctl(PR_GET_NAME, thread_name);
-  auto info =
-      new HookExitInfo(pthread_self(), tid, thread_name, Util::CurrentTimeNs());
-  sHookLooper->post(ACTION_EXIT_THREAD, info);
-  pthread_exit(return_value);
+// prctl 是变参函数，arm64 上变参与定长参数同样经寄存器传递，可原样转发
+int ThreadHooker::HookPrctl(int option, unsigned long arg2,
+                            unsigned long arg3, unsigned long arg4,
+                            unsigned long arg5) {
+  int result = prctl(option, arg2, arg3, arg4, arg5);
+  if (option == PR_SET_NAME && result == 0 && hookEnabled() && arg2 != 0) {
+    auto name = reinterpret_cast<const char *>(arg2);
+    koom::Log::info(thread_tag, "HookPrctl PR_SET_NAME %s", name);
+    sHookLooper->post(ACTION_SET_NAME,
+                      new HookSetNameInfo(pthread_self(), name));
+  }
+  return result;
+}
+
+void ThreadHooker::OnThreadExit(void *arg) {
+  auto *info = static_cast<HookExitInfo *>(arg);
+  if (!hookEnabled()) {
+    delete info;
+    return;
+  }
+
+  // Runs on every thread exit, keep it free of allocation and locks other than
+  // the looper queue.
+  info->time = Util::CurrentTimeNs();
+  struct timespec cpu_time {};
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_time) == 0) {
+    info->cpu_time = cpu_time.tv_sec * 1000000000LL + cpu_time.tv_nsec;
+  }
+  prctl(PR_GET_NAME, info->thread_name);
+  info->thread_name[sizeof(info->thread_name) - 1] = '\0';
+  pthread_attr_t attr;
+  int state = 0;
+  if (pthread_getattr_np(info->thread_id, &attr) == 0) {
+    pthread_attr_getdetachstate(&attr, &state);
+    pthread_attr_destroy(&attr);
+  }
+  info->is_thread_detached = state == PTHREAD_CREATE_DETACHED;
+  info->message.what = ACTION_EXIT_THREAD;
+  info->message.obj = info;
+  sHookLooper->postMessage(&info->message);
 }
 
 void ThreadHooker::Start() { ThreadHooker::InitHook(); }
@@ -37,18 +37,25 @@ class ThreadHooker {
   static void Start();
 
  private:
-  static void HookThreadStart(void *arg);
+  static void *HookThreadStart(void *arg);
   static int HookThreadCreate(pthread_t *tidp, const pthread_attr_t *attr,
                               void *(*start_rtn)(void *), void *arg);
   static int HookThreadJoin(pthread_t t, void **return_value);
   static int HookThreadDetach(pthread_t t);
-  static void HookThreadExit(void *return_value);
+  static int HookThreadSetName(pthread_t t, const char *name);
+  static int HookPrctl(int option, unsigned long arg2, unsigned long arg3,
+                       unsigned long arg4, unsigned long arg5);
+  static void OnThreadExit(void *arg);
+  static void InitExitKey();
   static bool RegisterSo(const std::string &lib, int source);
   static void InitHook();
   static void DlopenCallback(std::set<std::string> &libs, int source,
                              std::string &sourcelib);
   static void HookLibs(std::set<std::string> &libs, int source);
   static bool hookEnabled();
+
+  static pthread_key_t exit_key;
+  static bool exit_key_valid;
 };
 
 class StartRtnArg {
@@ -19,25 +19,28 @@
 
 #ifndef APM_THREAD_H
 #define APM_THREAD_H
-#include <string>
+#include <pthread.h>
+
+#include <cstdint>
 namespace koom {
 
+// Plain value type stored in FlatMap, strings live in ThreadHolder's pools
 class ThreadItem {
  public:
   int id{};
   int64_t create_time{};
-  std::string create_call_stack;
-  std::string collect_mode{};
+  uint32_t stack_id{};
+  uint32_t name_id{};
+  // name with the trailing index folded, e.g. "pool-3-thread-N"
+  uint32_t family_id{};
   bool thread_detached{};
   long long startTime{};
   long long exitTime{};
+  int64_t cpuTime{};
   bool thread_reported{};
   pthread_t thread_internal_id{};
-  std::string name{};
-
-  ThreadItem();
-  ThreadItem(const ThreadItem &threadItem);
-  void Clear();
+  // insertion order, the smallest one is evicted first
+  uint64_t seq{};
 };
 
 #endif  // APM_THREAD_H
@@ -35,6 +35,15 @@ object NativeHandler {
   @JvmStatic
   external fun setThreadLeakDelay(delay: Long)
 
+  @JvmStatic
+  external fun setIdleThreadRounds(rounds: Int)
+
+  @JvmStatic
+  external fun setMaxThreadRecords(max: Int)
+
+  @JvmStatic
+  external fun setReportDir(dir: String)
+
   @JvmStatic
   external fun disableJavaStack()
 
@@ -49,4 +58,9 @@ object NativeHandler {
     ThreadMonitor.nativeReport(resultJson)
   }
 
+  @JvmStatic
+  fun nativeReportFile(path: String) {
+    ThreadMonitor.nativeReportFile(path)
+  }
+
 }
\ No newline at end of file
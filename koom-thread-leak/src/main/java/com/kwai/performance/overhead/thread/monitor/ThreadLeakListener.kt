@@ -20,5 +20,11 @@ package com.kwai.performance.overhead.thread.monitor
 
 interface ThreadLeakListener {
   fun onReport(leaks: MutableList<ThreadLeakRecord>)
+
+  /**
+   * Live threads whose cpu time made no progress for idleRounds loops.
+   */
+  fun onIdleReport(idles: MutableList<ThreadLeakRecord>) {}
+
   fun onError(msg: String)
 }
\ No newline at end of file
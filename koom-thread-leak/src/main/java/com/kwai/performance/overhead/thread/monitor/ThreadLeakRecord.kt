@@ -20,6 +20,7 @@
 package com.kwai.performance.overhead.thread.monitor
 
 import androidx.annotation.Keep
+import com.google.gson.annotations.SerializedName
 
 @Keep
 data class ThreadLeakRecord(
@@ -27,7 +28,11 @@ data class ThreadLeakRecord(
     val createTime: Long,
     val startTime: Long,
     val endTime: Long,
+    val cpuTime: Long,
+    val idleRounds: Int,
     val name: String,
+    // 折叠了末尾序号的线程名，用于按线程池聚合，例如 pool-3-thread-N
+    val family: String?,
     val createCallStack: String) {
 
   override fun toString(): String = StringBuilder().apply {
@@ -35,7 +40,10 @@ data class ThreadLeakRecord(
     append("createTime: $createTime Byte\n")
     append("startTime: $startTime\n")
     append("endTime: $endTime\n")
+    append("cpuTime: $cpuTime\n")
+    if (idleRounds > 0) append("idleRounds: $idleRounds\n")
     append("name: $name\n")
+    family?.let { append("family: $it\n") }
     append("createCallStack:\n")
     append(createCallStack)
   }.toString()
@@ -43,5 +51,11 @@ data class ThreadLeakRecord(
 
 @Keep
 data class ThreadLeakContainer(
-    val type: String,
-    val threads: MutableList<ThreadLeakRecord>)
\ No newline at end of file
+    @SerializedName("leakType") val type: String,
+    // records dropped so far because the native cap was reached
+    val evicted: Long,
+    val threads: MutableList<ThreadLeakRecord>) {
+  companion object {
+    const val TYPE_IDLE_THREAD = "idle_thread"
+  }
+}
\ No newline at end of file
@@ -25,6 +25,7 @@ import com.kwai.koom.base.MonitorLog
 import com.kwai.koom.base.isArm64
 import com.kwai.koom.base.loadSoQuietly
 import com.kwai.koom.base.loop.LoopMonitor
+import java.io.File
 
 object ThreadMonitor : LoopMonitor<ThreadMonitorConfig>() {
   private const val TAG = "koom-thread-monitor"
@@ -90,14 +91,41 @@ object ThreadMonitor : LoopMonitor<ThreadMonitorConfig>() {
       NativeHandler.enableNativeLog()
     }
     NativeHandler.setThreadLeakDelay(monitorConfig.threadLeakDelay)
+    NativeHandler.setIdleThreadRounds(monitorConfig.idleThreadRounds)
+    NativeHandler.setMaxThreadRecords(monitorConfig.maxThreadRecords)
+    monitorConfig.reportDir?.let {
+      File(it).mkdirs()
+      NativeHandler.setReportDir(it)
+    }
     NativeHandler.start()
     MonitorLog.i(TAG, "init finish")
     return true
   }
 
   fun nativeReport(resultJson: String) {
-    mGon.fromJson(resultJson, ThreadLeakContainer::class.java).let {
-      monitorConfig.listener?.onReport(it.threads)
+    dispatchReport(mGon.fromJson(resultJson, ThreadLeakContainer::class.java))
+  }
+
+  fun nativeReportFile(path: String) {
+    val file = File(path)
+    val container = try {
+      ThreadReportDecoder.decode(file)
+    } catch (e: Exception) {
+      monitorConfig.listener?.onError("decode report fail: ${e.message}")
+      null
+    } finally {
+      file.delete()
+    }
+    container?.let { dispatchReport(it) }
+  }
+
+  private fun dispatchReport(container: ThreadLeakContainer) {
+    container.let {
+      if (it.type == ThreadLeakContainer.TYPE_IDLE_THREAD) {
+        monitorConfig.listener?.onIdleReport(it.threads)
+      } else {
+        monitorConfig.listener?.onReport(it.threads)
+      }
     }
   }
 
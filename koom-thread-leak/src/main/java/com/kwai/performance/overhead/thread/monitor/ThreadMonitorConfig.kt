@@ -24,6 +24,9 @@ class ThreadMonitorConfig(val loopInterval: Long,
     val startDelay: Long,
     val disableNativeStack: Boolean, val disableJavaStack: Boolean,
     val threadLeakDelay: Long,
+    val idleThreadRounds: Int,
+    val maxThreadRecords: Int,
+    val reportDir: String?,
     val enableNativeLog:Boolean,
     var listener: ThreadLeakListener?) :
     MonitorConfig<ThreadMonitor>() {
@@ -40,6 +43,15 @@ class ThreadMonitorConfig(val loopInterval: Long,
     // 线程泄露检测延迟时间
     private var mThreadLeakDelay = 1 * 60 * 1000L //1min
 
+    // 连续多少个检测周期 cpu 时间无变化判定为空闲线程，0 为关闭
+    private var mIdleThreadRounds = 0
+
+    // 存活/泄露线程记录各自的上限，超出时淘汰最早的记录，0 为不限制
+    private var mMaxThreadRecords = 4096
+
+    // 非空时 native 以二进制文件形式输出报告，避免在 native 侧拼接大 JSON
+    private var mReportDir: String? = null
+
     fun disableNativeStack() = apply {
       disableNativeStack = true
     }
@@ -61,6 +73,18 @@ class ThreadMonitorConfig(val loopInterval: Long,
       mThreadLeakDelay = leakDelay
     }
 
+    fun enableIdleThreadCheck(idleRounds: Int) = apply {
+      mIdleThreadRounds = idleRounds
+    }
+
+    fun setMaxThreadRecords(maxRecords: Int) = apply {
+      mMaxThreadRecords = maxRecords
+    }
+
+    fun enableFileReport(dir: String) = apply {
+      mReportDir = dir
+    }
+
     fun setListener(listener: ThreadLeakListener) = apply {
       mListener = listener
     }
@@ -71,6 +95,9 @@ class ThreadMonitorConfig(val loopInterval: Long,
         disableJavaStack = disableJavaStack,
         disableNativeStack = disableNativeStack,
         threadLeakDelay = mThreadLeakDelay,
+        idleThreadRounds = mIdleThreadRounds,
+        maxThreadRecords = mMaxThreadRecords,
+        reportDir = mReportDir,
         enableNativeLog = enableNativeLog,
         listener = mListener
     )
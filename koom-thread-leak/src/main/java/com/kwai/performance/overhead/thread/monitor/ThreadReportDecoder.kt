@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by shenvsv on 2021.
+ *
+ */
+
+package com.kwai.performance.overhead.thread.monitor
+
+import java.io.File
+import java.io.IOException
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/**
+ * 解析 native BinaryReportSink 输出的二进制报告，布局见 report_sink.h。
+ * 未知的 record / field 直接跳过，保证新版本 native 写出的文件旧版本仍可读。
+ */
+object ThreadReportDecoder {
+  private const val MAGIC = 0x5052544b // "KTRP"
+  private const val VERSION = 1
+
+  private const val RECORD_REPORT = 1
+  private const val RECORD_THREAD = 2
+  private const val RECORD_END = 3
+
+  private const val REPORT_LEAK_TYPE = 1
+  private const val REPORT_EVICTED = 2
+
+  private const val THREAD_TID = 1
+  private const val THREAD_CREATE_TIME = 3
+  private const val THREAD_START_TIME = 4
+  private const val THREAD_END_TIME = 5
+  private const val THREAD_CPU_TIME = 6
+  private const val THREAD_IDLE_ROUNDS = 7
+  private const val THREAD_NAME = 9
+  private const val THREAD_CREATE_CALL_STACK = 10
+  private const val THREAD_FAMILY = 11
+
+  private const val END_COUNT = 1
+
+  @Throws(IOException::class)
+  fun decode(file: File) = decode(file.readBytes())
+
+  @Throws(IOException::class)
+  fun decode(bytes: ByteArray): ThreadLeakContainer {
+    val buffer = ByteBuffer.wrap(bytes).order(ByteOrder.LITTLE_ENDIAN)
+    if (buffer.remaining() < 8 || buffer.int != MAGIC) throw IOException("bad magic")
+    val version = buffer.short.toInt()
+    if (version > VERSION) throw IOException("unsupported version $version")
+    buffer.short // flags
+
+    var type = ""
+    var evicted = 0L
+    var ended = false
+    val threads = mutableListOf<ThreadLeakRecord>()
+    while (buffer.remaining() >= 5 && !ended) {
+      val recordType = buffer.get().toInt()
+      val record = slice(buffer, buffer.int)
+      when (recordType) {
+        RECORD_REPORT -> forEachField(record) { id, value ->
+          when (id) {
+            REPORT_LEAK_TYPE -> type = value.string()
+            REPORT_EVICTED -> evicted = value.long
+          }
+        }
+        RECORD_THREAD -> threads.add(decodeThread(record))
+        RECORD_END -> forEachField(record) { id, value ->
+          if (id == END_COUNT && value.int != threads.size) throw IOException("truncated report")
+          ended = true
+        }
+      }
+    }
+    if (!ended) throw IOException("truncated report")
+    return ThreadLeakContainer(type, evicted, threads)
+  }
+
+  private fun decodeThread(record: ByteBuffer): ThreadLeakRecord {
+    var tid = 0
+    var createTime = 0L
+    var startTime = 0L
+    var endTime = 0L
+    var cpuTime = 0L
+    var idleRounds = 0
+    var name = ""
+    var family: String? = null
+    var createCallStack = ""
+    forEachField(record) { id, value ->
+      when (id) {
+        THREAD_TID -> tid = value.int
+        THREAD_CREATE_TIME -> createTime = value.long
+        THREAD_START_TIME -> startTime = value.long
+        THREAD_END_TIME -> endTime = value.long
+        THREAD_CPU_TIME -> cpuTime = value.long
+        THREAD_IDLE_ROUNDS -> idleRounds = value.int
+        THREAD_NAME -> name = value.string()
+        THREAD_FAMILY -> family = value.string()
+        THREAD_CREATE_CALL_STACK -> createCallStack = value.string()
+      }
+    }
+    return ThreadLeakRecord(tid, createTime, startTime, endTime, cpuTime, idleRounds, name,
+        family, createCallStack)
+  }
+
+  private inline fun forEachField(record: ByteBuffer, block: (Int, ByteBuffer) -> Unit) {
+    while (record.remaining() >= 5) {
+      val id = record.get().toInt()
+      block(id, slice(record, record.int))
+    }
+  }
+
+  private fun slice(buffer: ByteBuffer, length: Int): ByteBuffer {
+    if (length < 0 || length > buffer.remaining()) throw IOException("bad length $length")
+    val slice = buffer.slice().order(ByteOrder.LITTLE_ENDIAN)
+    slice.limit(length)
+    buffer.position(buffer.position() + length)
+    return slice
+  }
+
+  private fun ByteBuffer.string() = String(array(), arrayOffset() + position(), remaining())
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by shenvsv on 2021.
+ *
+ */
+
+package com.kwai.performance.overhead.thread.monitor
+
+import com.google.gson.Gson
+import java.io.IOException
+import org.junit.Assert.assertEquals
+import org.junit.Assert.fail
+import org.junit.Test
+
+/**
+ * The fixtures are written by the native JsonReportSink and BinaryReportSink
+ * for the same reports, see thread-report-test in src/main/cpp/host. Decoding
+ * the binary one must give what gson makes of the json one.
+ */
+class ThreadReportDecoderTest {
+  @Test
+  fun decodesLikeJson() {
+    for (name in listOf("thread_report_leak", "thread_report_idle")) {
+      val expected = Gson().fromJson(String(resource("$name.json")), ThreadLeakContainer::class.java)
+      assertEquals(name, expected, ThreadReportDecoder.decode(resource("$name.bin")))
+    }
+  }
+
+  @Test
+  fun rejectsTruncatedReport() {
+    val bytes = resource("thread_report_leak.bin")
+    try {
+      ThreadReportDecoder.decode(bytes.copyOf(bytes.size - 1))
+      fail("truncated report decoded")
+    } catch (e: IOException) {
+    }
+  }
+
+  private fun resource(name: String) = javaClass.classLoader!!.getResource(name)!!.readBytes()
+}